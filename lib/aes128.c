@@ -94,6 +94,48 @@ aes128_hw_enc_block(struct aes128_hw_ctx const *ctx, uint8_t const *pt, uint8_t
 	_mm_storeu_si128((__m128i *)ct, block);
 }
 
+static inline __attribute__((always_inline)) void
+aes128_hw_enc_lanes(struct aes128_hw_ctx const *ctx, uint8_t const *pt, uint8_t *ct, size_t const lanes)
+{
+	__m128i const *rk = ctx->rk;
+	__m128i block[AES128_MAX_LANES];
+	for (size_t i = 0; i < lanes; i++) {
+		block[i] = _mm_xor_si128(_mm_loadu_si128((__m128i *)(pt + i * AES128_BLOCK_BYTES)), rk[0]);
+	}
+	for (size_t r = 1; r < AES128_ROUNDS; r++) {
+		for (size_t i = 0; i < lanes; i++) {
+			block[i] = _mm_aesenc_si128(block[i], rk[r]);
+		}
+	}
+	for (size_t i = 0; i < lanes; i++) {
+		_mm_storeu_si128((__m128i *)(ct + i * AES128_BLOCK_BYTES),
+				 _mm_aesenclast_si128(block[i], rk[AES128_ROUNDS]));
+	}
+}
+
+static void
+aes128_hw_enc_blocks(struct aes128_hw_ctx const *ctx, uint8_t const *pt, uint8_t *ct, size_t n)
+{
+	// constant lane counts, so that each call is unrolled with the blocks
+	// kept in registers
+	for (; n >= AES128_MAX_LANES; n -= AES128_MAX_LANES) {
+		aes128_hw_enc_lanes(ctx, pt, ct, AES128_MAX_LANES);
+		pt += AES128_MAX_LANES * AES128_BLOCK_BYTES;
+		ct += AES128_MAX_LANES * AES128_BLOCK_BYTES;
+	}
+	if (n >= 4) {
+		aes128_hw_enc_lanes(ctx, pt, ct, 4);
+		pt += 4 * AES128_BLOCK_BYTES;
+		ct += 4 * AES128_BLOCK_BYTES;
+		n -= 4;
+	}
+	for (; n > 0; n--) {
+		aes128_hw_enc_block(ctx, pt, ct);
+		pt += AES128_BLOCK_BYTES;
+		ct += AES128_BLOCK_BYTES;
+	}
+}
+
 #if defined(__clang__)
 #pragma clang attribute pop
 #elif defined(__GNUC__)
@@ -233,6 +275,50 @@ aes128_hw_enc_block(struct aes128_hw_ctx const *ctx, uint8_t const *pt, uint8_t
 	vst1q_u8(ct, block);
 }
 
+static inline __attribute__((always_inline)) void
+aes128_hw_enc_lanes(struct aes128_hw_ctx const *ctx, uint8_t const *pt, uint8_t *ct, size_t const lanes)
+{
+	uint8x16_t block[AES128_MAX_LANES];
+	for (size_t i = 0; i < lanes; i++) {
+		block[i] = vld1q_u8(pt + i * AES128_BLOCK_BYTES);
+	}
+	for (size_t r = 0; r < AES128_ROUNDS - 1; r++) {
+		uint8x16_t rk = vld1q_u8(ctx->rk[r]);
+		for (size_t i = 0; i < lanes; i++) {
+			block[i] = vaesmcq_u8(vaeseq_u8(block[i], rk));
+		}
+	}
+	uint8x16_t rk9 = vld1q_u8(ctx->rk[AES128_ROUNDS - 1]);
+	uint8x16_t rk10 = vld1q_u8(ctx->rk[AES128_ROUNDS]);
+	for (size_t i = 0; i < lanes; i++) {
+		vst1q_u8(ct + i * AES128_BLOCK_BYTES,
+			 veorq_u8(vaeseq_u8(block[i], rk9), rk10));
+	}
+}
+
+static void
+aes128_hw_enc_blocks(struct aes128_hw_ctx const *ctx, uint8_t const *pt, uint8_t *ct, size_t n)
+{
+	// constant lane counts, so that each call is unrolled with the blocks
+	// kept in registers
+	for (; n >= AES128_MAX_LANES; n -= AES128_MAX_LANES) {
+		aes128_hw_enc_lanes(ctx, pt, ct, AES128_MAX_LANES);
+		pt += AES128_MAX_LANES * AES128_BLOCK_BYTES;
+		ct += AES128_MAX_LANES * AES128_BLOCK_BYTES;
+	}
+	if (n >= 4) {
+		aes128_hw_enc_lanes(ctx, pt, ct, 4);
+		pt += 4 * AES128_BLOCK_BYTES;
+		ct += 4 * AES128_BLOCK_BYTES;
+		n -= 4;
+	}
+	for (; n > 0; n--) {
+		aes128_hw_enc_block(ctx, pt, ct);
+		pt += AES128_BLOCK_BYTES;
+		ct += AES128_BLOCK_BYTES;
+	}
+}
+
 #if defined(__clang__)
 #pragma clang attribute pop
 #elif defined(__GNUC__)
@@ -309,6 +395,26 @@ void aes128_encrypt_block(aes128_ctx_t *ctx, uint8_t const *pt, uint8_t *ct)
 	rijndaelEncrypt(ctx->u.sw.rk, AES128_ROUNDS, pt, ct);
 }
 
+void aes128_encrypt_blocks(aes128_ctx_t *ctx, uint8_t const *pt, uint8_t *ct,
+			   size_t n)
+{
+#ifdef AES_HW
+	if (use_hw) {
+		aes128_hw_enc_blocks(&ctx->u.hw, pt, ct, n);
+		return;
+	}
+#endif
+
+	// the table-based software implementation is bound by its table
+	// lookups rather than by a latency chain, so there is nothing to gain
+	// from interleaving blocks
+	for (size_t i = 0; i < n; i++) {
+		rijndaelEncrypt(ctx->u.sw.rk, AES128_ROUNDS,
+				pt + i * AES128_BLOCK_BYTES,
+				ct + i * AES128_BLOCK_BYTES);
+	}
+}
+
 void aes128_fini(aes128_ctx_t *ctx)
 {
 	free(ctx);
@@ -326,9 +432,24 @@ void aes128_selftest(void)
 
 	aes128_ctx_t *ctx = aes128_init(key);
 	aes128_encrypt_block(ctx, pt, actual_ct);
-	aes128_fini(ctx);
 
 	if (memcmp(actual_ct, expected_ct, AES128_BLOCK_BYTES) != 0) {
 		log_fatal("aes128", "AES self-test with NIST test vector failed");
 	}
+
+	// enough blocks to go through every lane count of the batched path
+	uint8_t batch_pt[2 * AES128_MAX_LANES - 1][AES128_BLOCK_BYTES];
+	uint8_t batch_ct[2 * AES128_MAX_LANES - 1][AES128_BLOCK_BYTES];
+	size_t batch_len = sizeof(batch_pt) / sizeof(batch_pt[0]);
+	for (size_t i = 0; i < batch_len; i++) {
+		memcpy(batch_pt[i], pt, AES128_BLOCK_BYTES);
+	}
+	aes128_encrypt_blocks(ctx, &batch_pt[0][0], &batch_ct[0][0], batch_len);
+	aes128_fini(ctx);
+
+	for (size_t i = 0; i < batch_len; i++) {
+		if (memcmp(batch_ct[i], expected_ct, AES128_BLOCK_BYTES) != 0) {
+			log_fatal("aes128", "AES batch self-test with NIST test vector failed");
+		}
+	}
 }
@@ -9,15 +9,23 @@
 #ifndef ZMAP_AES_H
 #define ZMAP_AES_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define AES128_KEY_BYTES 16
 #define AES128_BLOCK_BYTES 16
+// number of blocks aes128_encrypt_blocks keeps in flight at once
+#define AES128_MAX_LANES 8
 
 typedef struct aes128_ctx aes128_ctx_t;
 
 aes128_ctx_t *aes128_init(uint8_t const *key);
 void aes128_encrypt_block(aes128_ctx_t *ctx, uint8_t const *pt, uint8_t *ct);
+// Encrypt n consecutive independent blocks (ECB). With hardware AES, up to
+// AES128_MAX_LANES blocks are interleaved round by round to hide the latency
+// of the AES instructions.
+void aes128_encrypt_blocks(aes128_ctx_t *ctx, uint8_t const *pt, uint8_t *ct,
+			   size_t n);
 void aes128_fini(aes128_ctx_t *ctx);
 
 void aes128_selftest(void);
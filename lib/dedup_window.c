@@ -0,0 +1,92 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "dedup_window.h"
+
+#include "xalloc.h"
+
+// Slot layout: the packed key in the low 48 bits, a bit marking the slot
+// as used (so that 0.0.0.0:0 is a valid key), and the CLOCK reference bit.
+#define SLOT_KEY_MASK ((1ULL << 48) - 1)
+#define SLOT_USED (1ULL << 48)
+#define SLOT_REFERENCED (1ULL << 63)
+
+dedup_window_t *dedup_window_init(size_t memory)
+{
+	dedup_window_t *w = xmalloc(sizeof(dedup_window_t));
+	w->num_buckets = memory / sizeof(dedup_window_bucket_t);
+	if (!w->num_buckets) {
+		w->num_buckets = 1;
+	} else if (w->num_buckets > UINT32_MAX) {
+		// the bucket index is computed from 32 bits of the hash
+		w->num_buckets = UINT32_MAX;
+	}
+	w->buckets = xmalloc_aligned(CACHE_LINE_SIZE,
+				     w->num_buckets *
+					 sizeof(dedup_window_bucket_t));
+	w->hand = 0;
+	return w;
+}
+
+void dedup_window_free(dedup_window_t *w)
+{
+	if (!w) {
+		return;
+	}
+	xfree(w->buckets);
+	xfree(w);
+}
+
+size_t dedup_window_capacity(dedup_window_t *w)
+{
+	return w->num_buckets * DEDUP_WINDOW_BUCKET_SLOTS;
+}
+
+static inline uint64_t mix(uint64_t key)
+{
+	// murmur3 finalizer
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return key;
+}
+
+int dedup_window_check(dedup_window_t *w, uint32_t ip, uint16_t port)
+{
+	uint64_t key = ((uint64_t)ip << 16) | port;
+	uint64_t h = mix(key);
+	// maps the hash onto [0, num_buckets) without a division
+	uint64_t idx = ((h >> 32) * w->num_buckets) >> 32;
+	uint64_t *slots = w->buckets[idx].slots;
+	uint64_t entry = key | SLOT_USED;
+	int empty = -1;
+	for (int i = 0; i < DEDUP_WINDOW_BUCKET_SLOTS; i++) {
+		uint64_t s = slots[i];
+		if ((s & ~SLOT_REFERENCED) == entry) {
+			slots[i] = s | SLOT_REFERENCED;
+			return 1;
+		}
+		if (!(s & SLOT_USED) && empty < 0) {
+			empty = i;
+		}
+	}
+	if (empty < 0) {
+		// at most one full lap clearing reference bits, after which
+		// the starting slot is a victim
+		uint32_t i = w->hand++ % DEDUP_WINDOW_BUCKET_SLOTS;
+		while (slots[i] & SLOT_REFERENCED) {
+			slots[i] &= ~SLOT_REFERENCED;
+			i = (i + 1) % DEDUP_WINDOW_BUCKET_SLOTS;
+		}
+		empty = (int)i;
+	}
+	slots[empty] = entry | SLOT_REFERENCED;
+	return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef ZMAP_DEDUP_WINDOW_H
+#define ZMAP_DEDUP_WINDOW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "includes.h"
+
+// Fixed-size set of recently seen (ip, port) pairs for windowed duplicate
+// suppression. Keys are packed into 48 bits and stored inline in buckets
+// of one cache line each, so there is no allocation after init. When a
+// bucket is full, an entry is evicted with CLOCK: every entry has a
+// reference bit that is set when it is inserted or seen again, and the
+// first entry found without one (clearing bits on the way) is replaced.
+// This approximates "the most recent responses" without keeping a global
+// order. Not thread safe.
+#define DEDUP_WINDOW_BUCKET_SLOTS 8
+
+typedef struct dedup_window_bucket {
+	uint64_t slots[DEDUP_WINDOW_BUCKET_SLOTS];
+} __attribute__((aligned(CACHE_LINE_SIZE))) dedup_window_bucket_t;
+
+typedef struct dedup_window {
+	dedup_window_bucket_t *buckets;
+	uint64_t num_buckets;
+	// where the eviction scan starts in the next full bucket
+	uint32_t hand;
+} dedup_window_t;
+
+// Uses at most memory bytes for entries, but at least one bucket.
+dedup_window_t *dedup_window_init(size_t memory);
+void dedup_window_free(dedup_window_t *w);
+
+// Number of entries the window holds when full.
+size_t dedup_window_capacity(dedup_window_t *w);
+
+// Returns 1 if (ip, port) is in the window. Otherwise inserts it, evicting
+// an older entry if needed, and returns 0.
+int dedup_window_check(dedup_window_t *w, uint32_t ip, uint16_t port);
+
+#endif /* ZMAP_DEDUP_WINDOW_H */
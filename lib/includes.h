@@ -43,3 +43,4 @@
 
 #define MAC_ADDR_LEN ETHER_ADDR_LEN
 #define UNUSED __attribute__((unused))
+#define CACHE_LINE_SIZE 64
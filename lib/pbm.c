@@ -15,17 +15,24 @@
  */
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
 
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include "logger.h"
+#include "pbm.h"
 #include "xalloc.h"
 
 #define NUM_VALUES 0xFFFFFFFF
@@ -78,34 +85,282 @@ void pbm_set(uint8_t **b, uint32_t v)
 	bm_set(b[top], bottom);
 }
 
-uint32_t pbm_load_from_file(uint8_t **b, char *file)
+uint8_t **pbm_map_file(const char *file)
 {
-	if (!b) {
-		log_fatal("pbm", "load_from_file called with NULL PBM");
+	const off_t size = (off_t)NUM_PAGES * PAGE_SIZE_IN_BYTES;
+	int fd = open(file, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		log_fatal("pbm", "unable to open %s: %s", file,
+			  strerror(errno));
 	}
-	if (!file) {
-		log_fatal("pbm", "load_from_file called with NULL filename");
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		log_fatal("pbm", "unable to stat %s: %s", file,
+			  strerror(errno));
 	}
-	FILE *fp = fopen(file, "r");
-	if (fp == NULL) {
-		log_fatal("pbm", "unable to open file: %s: %s", file,
+	if (st.st_size == 0) {
+		// a new file, none of its blocks are allocated until a bit
+		// in them is set
+		if (ftruncate(fd, size) < 0) {
+			log_fatal("pbm", "unable to size %s: %s", file,
+				  strerror(errno));
+		}
+	} else if (st.st_size != size) {
+		log_fatal("pbm",
+			  "%s is %lld bytes, not the %lld bytes of an address "
+			  "bitmap",
+			  file, (long long)st.st_size, (long long)size);
+	}
+	uint8_t *map =
+	    mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		log_fatal("pbm", "unable to mmap %s: %s", file,
 			  strerror(errno));
 	}
-	char line[1000];
-	uint32_t count = 0;
-	while (fgets(line, sizeof(line), fp)) {
-		char *comment = strchr(line, '#');
-		if (comment) {
-			*comment = '\0';
+	close(fd);
+	uint8_t **b = pbm_init();
+	for (uint32_t i = 0; i < NUM_PAGES; i++) {
+		b[i] = map + (size_t)i * PAGE_SIZE_IN_BYTES;
+	}
+	return b;
+}
+
+int pbm_test_and_set(uint8_t **b, uint32_t v)
+{
+	uint8_t *byte = &b[v >> 16][(v & PAGE_MASK) >> 3];
+	uint8_t bit = (uint8_t)(1 << (v & 0x07));
+	if (__atomic_load_n(byte, __ATOMIC_RELAXED) & bit) {
+		// most checks are for known addresses, which need no write
+		return 1;
+	}
+	return (__atomic_fetch_or(byte, bit, __ATOMIC_RELAXED) & bit) != 0;
+}
+
+#define PARSE_MAX_THREADS 16
+// text files smaller than this per thread aren't worth splitting up
+#define PARSE_MIN_BYTES_PER_THREAD (1 << 20)
+#define PARSE_MAX_LINE 1000
+
+struct parse_range {
+	const char *begin;
+	const char *end;
+	uint32_t *ips;
+	size_t len;
+	size_t cap;
+};
+
+// Fast path for plain dotted quads. Anything else, including octets with
+// leading zeros (which inet_aton reads as octal), is left to inet_aton.
+static int parse_dotted_quad(const char *s, const char *e, uint32_t *out)
+{
+	uint32_t addr = 0;
+	for (int octet = 0; octet < 4; octet++) {
+		if (octet) {
+			if (s == e || *s != '.') {
+				return 0;
+			}
+			s++;
+		}
+		const char *digits = s;
+		uint32_t v = 0;
+		while (s < e && s - digits < 3 && *s >= '0' && *s <= '9') {
+			v = v * 10 + (uint32_t)(*s - '0');
+			s++;
 		}
-		struct in_addr addr;
-		if (inet_aton(line, &addr) != 1) {
+		if (s == digits || v > 255 || (s - digits > 1 && *digits == '0')) {
+			return 0;
+		}
+		addr = (addr << 8) | v;
+	}
+	if (s != e) {
+		return 0;
+	}
+	*out = htonl(addr);
+	return 1;
+}
+
+static void parse_line(struct parse_range *r, const char *s, const char *e)
+{
+	const char *comment = memchr(s, '#', (size_t)(e - s));
+	if (comment) {
+		e = comment;
+	}
+	while (s < e && isspace((unsigned char)*s)) {
+		s++;
+	}
+	while (e > s && isspace((unsigned char)e[-1])) {
+		e--;
+	}
+	if (s == e) {
+		return;
+	}
+	uint32_t addr;
+	if (!parse_dotted_quad(s, e, &addr)) {
+		char line[PARSE_MAX_LINE];
+		size_t n = (size_t)(e - s);
+		if (n >= sizeof(line)) {
+			n = sizeof(line) - 1;
+		}
+		memcpy(line, s, n);
+		line[n] = '\0';
+		struct in_addr in;
+		if (inet_aton(line, &in) != 1) {
 			log_fatal("pbm", "unable to parse IP address: %s",
 				  line);
 		}
-		pbm_set(b, addr.s_addr);
-		++count;
+		addr = in.s_addr;
+	}
+	if (r->len == r->cap) {
+		r->cap = r->cap ? r->cap * 2 : 4096;
+		r->ips = xrealloc(r->ips, r->cap * sizeof(uint32_t));
+	}
+	r->ips[r->len++] = addr;
+}
+
+static void *parse_range_thread(void *arg)
+{
+	struct parse_range *r = arg;
+	const char *p = r->begin;
+	while (p < r->end) {
+		const char *nl = memchr(p, '\n', (size_t)(r->end - p));
+		const char *eol = nl ? nl : r->end;
+		parse_line(r, p, eol);
+		p = eol + 1;
+	}
+	return NULL;
+}
+
+static uint32_t *parse_text(const char *data, size_t size, uint32_t *count)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t num_threads = size / PARSE_MIN_BYTES_PER_THREAD;
+	if (num_threads > (size_t)cpus) {
+		num_threads = (size_t)cpus;
+	}
+	if (num_threads > PARSE_MAX_THREADS) {
+		num_threads = PARSE_MAX_THREADS;
+	}
+	if (num_threads < 1) {
+		num_threads = 1;
+	}
+	// Split the file into ranges that end on line boundaries
+	struct parse_range ranges[PARSE_MAX_THREADS];
+	memset(ranges, 0, sizeof(ranges));
+	const char *p = data;
+	const char *data_end = data + size;
+	for (size_t i = 0; i < num_threads; i++) {
+		const char *end = (i == num_threads - 1)
+				      ? data_end
+				      : data + size / num_threads * (i + 1);
+		if (end < p) {
+			end = p;
+		}
+		if (end < data_end && end > data && end[-1] != '\n') {
+			const char *nl =
+			    memchr(end, '\n', (size_t)(data_end - end));
+			end = nl ? nl + 1 : data_end;
+		}
+		ranges[i].begin = p;
+		ranges[i].end = end;
+		p = end;
+	}
+	pthread_t threads[PARSE_MAX_THREADS];
+	for (size_t i = 1; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, parse_range_thread,
+				   &ranges[i])) {
+			log_fatal("pbm", "unable to create parser thread");
+		}
+	}
+	parse_range_thread(&ranges[0]);
+	size_t total = ranges[0].len;
+	for (size_t i = 1; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+		total += ranges[i].len;
+	}
+	if (total > UINT32_MAX) {
+		log_fatal("pbm", "too many addresses in file");
+	}
+	// Stitch the per-thread results back together in file order
+	uint32_t *ips = ranges[0].ips;
+	ips = xrealloc(ips, (total ? total : 1) * sizeof(uint32_t));
+	size_t off = ranges[0].len;
+	for (size_t i = 1; i < num_threads; i++) {
+		memcpy(ips + off, ranges[i].ips, ranges[i].len * sizeof(uint32_t));
+		off += ranges[i].len;
+		free(ranges[i].ips);
+	}
+	*count = (uint32_t)total;
+	return ips;
+}
+
+static uint32_t *parse_binary(const char *file, const char *data, size_t size,
+			      uint32_t *count)
+{
+	if (size % sizeof(uint32_t)) {
+		log_fatal("pbm",
+			  "%s is not a whole number of big-endian uint32 "
+			  "addresses (%zu bytes)",
+			  file, size);
+	}
+	size_t total = size / sizeof(uint32_t);
+	if (total > UINT32_MAX) {
+		log_fatal("pbm", "too many addresses in file");
+	}
+	// big-endian is already network order
+	uint32_t *ips = xmalloc((total ? total : 1) * sizeof(uint32_t));
+	memcpy(ips, data, size);
+	*count = (uint32_t)total;
+	return ips;
+}
+
+uint32_t *pbm_parse_file(char *file, int format, uint32_t *count)
+{
+	if (!file) {
+		log_fatal("pbm", "parse_file called with NULL filename");
+	}
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		log_fatal("pbm", "unable to open file: %s: %s", file,
+			  strerror(errno));
+	}
+	struct stat st;
+	if (fstat(fd, &st)) {
+		log_fatal("pbm", "unable to stat file: %s: %s", file,
+			  strerror(errno));
+	}
+	size_t size = (size_t)st.st_size;
+	if (!size) {
+		close(fd);
+		*count = 0;
+		return xmalloc(sizeof(uint32_t));
+	}
+	char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		log_fatal("pbm", "unable to mmap file: %s: %s", file,
+			  strerror(errno));
+	}
+	close(fd);
+	madvise(data, size, MADV_WILLNEED);
+	uint32_t *ips;
+	if (format == PBM_FORMAT_BINARY) {
+		ips = parse_binary(file, data, size, count);
+	} else {
+		ips = parse_text(data, size, count);
+	}
+	munmap(data, size);
+	return ips;
+}
+
+uint32_t pbm_load_from_file(uint8_t **b, char *file)
+{
+	if (!b) {
+		log_fatal("pbm", "load_from_file called with NULL PBM");
+	}
+	uint32_t count;
+	uint32_t *ips = pbm_parse_file(file, PBM_FORMAT_TEXT, &count);
+	for (uint32_t i = 0; i < count; i++) {
+		pbm_set(b, ips[i]);
 	}
-	fclose(fp);
+	free(ips);
 	return count;
 }
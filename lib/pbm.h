@@ -26,6 +26,26 @@ void bm_set(uint8_t *bm, uint16_t v);
 uint8_t **pbm_init(void);
 int pbm_check(uint8_t **b, uint32_t v);
 void pbm_set(uint8_t **b, uint32_t v);
+
+// Maps file, creating it as a sparse file if needed, as a bitmap of every
+// IPv4 address with the same page layout as pbm_init. The mapping is
+// shared: bits set by any process that maps the file are visible to the
+// others right away, and stay in the file after the process exits.
+uint8_t **pbm_map_file(const char *file);
+// Sets v and returns whether it was already set, atomically with respect
+// to every thread and process sharing the bitmap. Only for bitmaps from
+// pbm_map_file.
+int pbm_test_and_set(uint8_t **b, uint32_t v);
+// Formats of a file of IPv4 addresses: one dotted-quad address per line
+// (with optional # comments), or packed big-endian uint32 values.
+#define PBM_FORMAT_TEXT 0
+#define PBM_FORMAT_BINARY 1
+
+// Returns every address in the file, in network order and file order. Large
+// text files are parsed by several threads.
+uint32_t *pbm_parse_file(char *file, int format, uint32_t *count);
+// Sets the bit of every address in a text file. Returns the number of
+// addresses read.
 uint32_t pbm_load_from_file(uint8_t **b, char *file);
 
 #endif /* ZMAP_PBM_H */
@@ -0,0 +1,229 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "rbm.h"
+
+#include <string.h>
+
+#include "xalloc.h"
+
+// An array container takes as much memory as a bitmap container once it
+// holds this many values.
+#define ARRAY_MAX 4096
+#define BITMAP_WORDS (65536 / 64)
+// values stored in the container itself, which is enough for most
+// networks in a sparse scan
+#define INLINE_VALUES 4
+#define INITIAL_SLOTS 1024
+
+typedef struct container {
+	uint32_t key;
+	// number of values, 0 for an unused slot
+	uint32_t card;
+	// capacity of the array, or 0 once the container is a bitmap
+	uint32_t capacity;
+	union {
+		uint16_t inline_values[INLINE_VALUES];
+		uint16_t *array;
+		uint64_t *bitmap;
+	};
+} container_t;
+
+// Containers live in an open addressing table keyed by
+// port << 16 | ip >> 16.
+struct rbm {
+	container_t *slots;
+	size_t num_slots;
+	size_t num_containers;
+	uint64_t count;
+	size_t memory;
+};
+
+rbm_t *rbm_init(void)
+{
+	rbm_t *b = xcalloc(1, sizeof(rbm_t));
+	b->num_slots = INITIAL_SLOTS;
+	b->slots = xcalloc(b->num_slots, sizeof(container_t));
+	b->memory = b->num_slots * sizeof(container_t);
+	return b;
+}
+
+static inline int is_inline(const container_t *c)
+{
+	return c->capacity == INLINE_VALUES;
+}
+
+static inline uint16_t *values(container_t *c)
+{
+	return is_inline(c) ? c->inline_values : c->array;
+}
+
+void rbm_free(rbm_t *b)
+{
+	if (!b) {
+		return;
+	}
+	for (size_t i = 0; i < b->num_slots; i++) {
+		container_t *c = &b->slots[i];
+		if (c->card && !is_inline(c)) {
+			// array and bitmap share the pointer
+			xfree(c->array);
+		}
+	}
+	xfree(b->slots);
+	xfree(b);
+}
+
+uint64_t rbm_count(rbm_t *b) { return b->count; }
+
+size_t rbm_memory(rbm_t *b) { return b->memory; }
+
+static inline size_t slot_for(rbm_t *b, uint32_t key)
+{
+	return (key * 2654435761u) & (b->num_slots - 1);
+}
+
+// Returns the container for key, or the unused slot where it belongs.
+static container_t *find_slot(rbm_t *b, uint32_t key)
+{
+	size_t i = slot_for(b, key);
+	while (b->slots[i].card && b->slots[i].key != key) {
+		i = (i + 1) & (b->num_slots - 1);
+	}
+	return &b->slots[i];
+}
+
+static void grow_table(rbm_t *b)
+{
+	container_t *slots = b->slots;
+	size_t num_slots = b->num_slots;
+	b->num_slots *= 2;
+	b->slots = xcalloc(b->num_slots, sizeof(container_t));
+	for (size_t i = 0; i < num_slots; i++) {
+		if (slots[i].card) {
+			*find_slot(b, slots[i].key) = slots[i];
+		}
+	}
+	b->memory += num_slots * sizeof(container_t);
+	xfree(slots);
+}
+
+// Index of the first value in the array that is >= v.
+static uint32_t array_lower_bound(const uint16_t *array, uint32_t card,
+				  uint16_t v)
+{
+	uint32_t lo = 0, hi = card;
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (array[mid] < v) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static int container_check(container_t *c, uint16_t v)
+{
+	if (!c->capacity) {
+		return (c->bitmap[v / 64] >> (v % 64)) & 1;
+	}
+	uint16_t *array = values(c);
+	uint32_t i = array_lower_bound(array, c->card, v);
+	return i < c->card && array[i] == v;
+}
+
+static void array_to_bitmap(rbm_t *b, container_t *c)
+{
+	uint64_t *bitmap = xcalloc(BITMAP_WORDS, sizeof(uint64_t));
+	for (uint32_t i = 0; i < c->card; i++) {
+		bitmap[c->array[i] / 64] |= 1ULL << (c->array[i] % 64);
+	}
+	b->memory += BITMAP_WORDS * sizeof(uint64_t);
+	b->memory -= c->capacity * sizeof(uint16_t);
+	xfree(c->array);
+	c->bitmap = bitmap;
+	c->capacity = 0;
+}
+
+static void grow_array(rbm_t *b, container_t *c)
+{
+	uint32_t capacity = 2 * c->capacity;
+	if (capacity > ARRAY_MAX) {
+		capacity = ARRAY_MAX;
+	}
+	if (is_inline(c)) {
+		uint16_t *array = xmalloc(capacity * sizeof(uint16_t));
+		memcpy(array, c->inline_values, sizeof(c->inline_values));
+		c->array = array;
+		b->memory += capacity * sizeof(uint16_t);
+	} else {
+		c->array = xrealloc(c->array, capacity * sizeof(uint16_t));
+		b->memory += (capacity - c->capacity) * sizeof(uint16_t);
+	}
+	c->capacity = capacity;
+}
+
+// Returns whether v was added.
+static int container_set(rbm_t *b, container_t *c, uint16_t v)
+{
+	if (!c->capacity) {
+		uint64_t bit = 1ULL << (v % 64);
+		if (c->bitmap[v / 64] & bit) {
+			return 0;
+		}
+		c->bitmap[v / 64] |= bit;
+		c->card++;
+		return 1;
+	}
+	uint16_t *array = values(c);
+	uint32_t i = array_lower_bound(array, c->card, v);
+	if (i < c->card && array[i] == v) {
+		return 0;
+	}
+	if (c->card == ARRAY_MAX) {
+		array_to_bitmap(b, c);
+		return container_set(b, c, v);
+	}
+	if (c->card == c->capacity) {
+		grow_array(b, c);
+		array = c->array;
+	}
+	memmove(&array[i + 1], &array[i], (c->card - i) * sizeof(uint16_t));
+	array[i] = v;
+	c->card++;
+	return 1;
+}
+
+int rbm_check(rbm_t *b, uint32_t ip, uint16_t port)
+{
+	container_t *c = find_slot(b, ((uint32_t)port << 16) | (ip >> 16));
+	return c->card && container_check(c, (uint16_t)ip);
+}
+
+void rbm_set(rbm_t *b, uint32_t ip, uint16_t port)
+{
+	uint32_t key = ((uint32_t)port << 16) | (ip >> 16);
+	container_t *c = find_slot(b, key);
+	if (!c->card) {
+		// keep the table at most 3/4 full so that probes stay short
+		if (4 * (b->num_containers + 1) > 3 * b->num_slots) {
+			grow_table(b);
+			c = find_slot(b, key);
+		}
+		b->num_containers++;
+		c->key = key;
+		c->capacity = INLINE_VALUES;
+		c->inline_values[0] = (uint16_t)ip;
+		c->card = 1;
+		b->count++;
+		return;
+	}
+	b->count += container_set(b, c, (uint16_t)ip);
+}
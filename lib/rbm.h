@@ -0,0 +1,33 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef ZMAP_RBM_H
+#define ZMAP_RBM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compressed set of (ip, port) pairs in the style of roaring bitmaps. The
+// pairs are split by port and /16 prefix into containers of 16-bit values,
+// each a sorted array while it holds few values and a 65536-bit bitmap
+// after that, so memory grows with the number of pairs stored rather than
+// with the size of the key space. Not thread safe.
+typedef struct rbm rbm_t;
+
+rbm_t *rbm_init(void);
+void rbm_free(rbm_t *b);
+
+// ip is in host order.
+int rbm_check(rbm_t *b, uint32_t ip, uint16_t port);
+void rbm_set(rbm_t *b, uint32_t ip, uint16_t port);
+
+// Number of pairs in the set, and bytes used to store them.
+uint64_t rbm_count(rbm_t *b);
+size_t rbm_memory(rbm_t *b);
+
+#endif /* ZMAP_RBM_H */
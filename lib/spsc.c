@@ -0,0 +1,69 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "spsc.h"
+
+#include "xalloc.h"
+
+spsc_ring_t *spsc_init(size_t capacity)
+{
+	size_t size = 1;
+	while (size < capacity) {
+		size <<= 1;
+	}
+	spsc_ring_t *r = xmalloc_aligned(CACHE_LINE_SIZE, sizeof(spsc_ring_t));
+	r->slots = xcalloc(size, sizeof(void *));
+	r->mask = size - 1;
+	return r;
+}
+
+void spsc_free(spsc_ring_t *r)
+{
+	if (!r) {
+		return;
+	}
+	xfree(r->slots);
+	xfree(r);
+}
+
+int spsc_push(spsc_ring_t *r, void *item)
+{
+	size_t tail = r->tail;
+	if (tail - r->head_cache > r->mask) {
+		r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		if (tail - r->head_cache > r->mask) {
+			return 0;
+		}
+	}
+	r->slots[tail & r->mask] = item;
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+void *spsc_pop(spsc_ring_t *r)
+{
+	size_t head = r->head;
+	if (head == r->tail_cache) {
+		r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		if (head == r->tail_cache) {
+			return NULL;
+		}
+	}
+	void *item = r->slots[head & r->mask];
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	return item;
+}
+
+size_t spsc_size(spsc_ring_t *r)
+{
+	size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	return tail - head;
+}
+
+size_t spsc_capacity(spsc_ring_t *r) { return r->mask + 1; }
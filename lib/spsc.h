@@ -0,0 +1,44 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef ZMAP_SPSC_H
+#define ZMAP_SPSC_H
+
+#include <stddef.h>
+
+#include "includes.h"
+
+// Bounded lock-free queue of pointers between exactly one producer thread
+// and exactly one consumer thread. Each side keeps a cached copy of the
+// other side's position so that it only touches the shared cache line when
+// the queue looks full (or empty).
+typedef struct spsc_ring {
+	void **slots;
+	size_t mask;
+	// written by the producer
+	size_t tail __attribute__((aligned(CACHE_LINE_SIZE)));
+	size_t head_cache;
+	// written by the consumer
+	size_t head __attribute__((aligned(CACHE_LINE_SIZE)));
+	size_t tail_cache;
+} spsc_ring_t;
+
+// capacity is rounded up to a power of two
+spsc_ring_t *spsc_init(size_t capacity);
+void spsc_free(spsc_ring_t *r);
+
+// Returns 0 if the ring is full. Producer only.
+int spsc_push(spsc_ring_t *r, void *item);
+// Returns NULL if the ring is empty. Consumer only.
+void *spsc_pop(spsc_ring_t *r);
+// Number of queued items. Safe to call from any thread, but only a
+// snapshot.
+size_t spsc_size(spsc_ring_t *r);
+size_t spsc_capacity(spsc_ring_t *r);
+
+#endif /* ZMAP_SPSC_H */
@@ -52,4 +52,14 @@ void *xrealloc(void *ptr, size_t size)
 	return res;
 }
 
+void *xmalloc_aligned(size_t alignment, size_t size)
+{
+	void *res = NULL;
+	if (posix_memalign(&res, alignment, size)) {
+		die();
+	}
+	memset(res, 0, size);
+	return res;
+}
+
 void die(void) { log_fatal("zmap", "Out of memory"); }
@@ -27,4 +27,8 @@ void *xmalloc(size_t size);
 
 void *xrealloc(void *ptr, size_t size);
 
+// Zeroed allocation aligned to alignment, a power of two multiple of
+// sizeof(void *). Released with xfree.
+void *xmalloc_aligned(size_t alignment, size_t size);
+
 #endif /* ZMAP_ALLOC_H */
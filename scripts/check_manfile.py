@@ -13,7 +13,7 @@ checks = [
     ("zopt.ggo.in", "zmap.1.ronn"),
     ("zbopt.ggo.in", "zblocklist.1.ronn"),
     ("zitopt.ggo.in", "ziterate.1.ronn"),
-    ("ztopt.ggo.in", "ztee.1.ronn")
+    ("topt.ggo.in", "ztee.1.ronn")
 ]
 
 failures = False
@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+#
+# Converts the output of zmap's columnar output module (-O columnar) to the
+# CSV that -O csv writes for the same results. The file format is
+# described at the top of src/output_modules/module_columnar.c.
+#
+# Usage: columnar_to_csv.py [--no-header-row] [FILE]
+#
+# Reads FILE, or stdin when it is missing or "-", and writes CSV to stdout.
+#
+
+import socket
+import struct
+import sys
+
+MAGIC = b"ZMAPCOL\0"
+VERSION = 1
+
+UINT64, BOOL, IPV4, STRING, BINARY = 1, 2, 3, 4, 5
+ENC_PLAIN, ENC_DICT = 0, 1
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def take(self, n):
+        if self.pos + n > len(self.data):
+            sys.exit("columnar_to_csv: file is truncated")
+        b = self.data[self.pos:self.pos + n]
+        self.pos += n
+        return b
+
+    def unpack(self, fmt):
+        return struct.unpack("<" + fmt, self.take(struct.calcsize("<" + fmt)))
+
+    def u8(self):
+        return self.unpack("B")[0]
+
+    def u16(self):
+        return self.unpack("H")[0]
+
+    def u32(self):
+        return self.unpack("I")[0]
+
+
+def bit(bitmap, i):
+    return bitmap[i // 8] >> (i % 8) & 1
+
+
+def read_column(r, col, rows):
+    # returns the column's values as the text csv output would contain
+    enc = r.u8()
+    valid = r.take((rows + 7) // 8)
+    t = col["type"]
+    if t == UINT64:
+        values = [str(v) for v in r.unpack("%dQ" % rows)]
+    elif t == BOOL:
+        bits = r.take((rows + 7) // 8)
+        values = [str(bit(bits, i)) for i in range(rows)]
+    elif t == IPV4:
+        raw = r.take(4 * rows)
+        values = [socket.inet_ntoa(raw[4 * i:4 * i + 4]) for i in range(rows)]
+    elif t in (STRING, BINARY):
+        if enc == ENC_DICT:
+            for _ in range(r.u32()):
+                col["dict"].append(r.take(r.u32()))
+            raw = [col["dict"][i] if bit(valid, n) else b""
+                   for n, i in enumerate(r.unpack("%dI" % rows))]
+        else:
+            offsets = r.unpack("%dI" % (rows + 1))
+            data = r.take(offsets[rows])
+            raw = [data[offsets[i]:offsets[i + 1]] for i in range(rows)]
+        if t == BINARY:
+            values = [v.hex() for v in raw]
+        else:
+            values = [v.decode("utf-8", "surrogateescape") for v in raw]
+            values = ['"%s"' % v if "," in v else v for v in values]
+    else:
+        sys.exit("columnar_to_csv: unknown column type %d" % t)
+    return [v if bit(valid, i) else "" for i, v in enumerate(values)]
+
+
+def main():
+    args = sys.argv[1:]
+    header = True
+    if args and args[0] == "--no-header-row":
+        header = False
+        args = args[1:]
+    if not args or args[0] == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        with open(args[0], "rb") as f:
+            data = f.read()
+
+    r = Reader(data)
+    if r.take(len(MAGIC)) != MAGIC:
+        sys.exit("columnar_to_csv: not a zmap columnar file")
+    version = r.u32()
+    if version != VERSION:
+        sys.exit("columnar_to_csv: unsupported version %d" % version)
+    columns = []
+    for _ in range(r.u32()):
+        t = r.u8()
+        r.u8()
+        name = r.take(r.u16()).decode()
+        columns.append({"name": name, "type": t, "dict": []})
+
+    out = sys.stdout.buffer
+    if header:
+        out.write((",".join(c["name"] for c in columns) + "\n").encode())
+    while True:
+        rows = r.u32()
+        if not rows:
+            break
+        values = [read_column(r, c, rows) for c in columns]
+        for i in range(rows):
+            line = ",".join(v[i] for v in values) + "\n"
+            out.write(line.encode("utf-8", "surrogateescape"))
+
+
+if __name__ == "__main__":
+    main()
@@ -57,6 +57,11 @@ static int eval_eq_node(node_t *node, fieldset_t *fields)
 		return (fs_get_uint64_by_index(fields, index) ==
 			literal->value.int_literal);
 		break;
+	case IPV4:
+		return (fields->fields[index].type == FS_IPV4 &&
+			fs_get_uint64_by_index(fields, index) ==
+			    literal->value.int_literal);
+		break;
 	default:
 		printf("wat\n");
 		break;
@@ -116,6 +121,7 @@ int evaluate_expression(node_t *root, fieldset_t *fields)
 	case FIELD:
 	case STRING:
 	case INT:
+	case IPV4:
 		return 1;
 	case OP:
 		break;
@@ -143,6 +149,76 @@ int evaluate_expression(node_t *root, fieldset_t *fields)
 	return 0;
 }
 
+static inline int eval_str_eq(const filter_insn_t *insn, fieldset_t *fields)
+{
+	const char *actual = fields->fields[insn->index].value.ptr;
+	return actual && actual[0] == insn->first &&
+	       strcmp(actual, insn->string) == 0;
+}
+
+static inline int eval_ipv4_eq(const filter_insn_t *insn, fieldset_t *fields)
+{
+	const field_t *f = &fields->fields[insn->index];
+	return f->type == FS_IPV4 && f->value.num == insn->value;
+}
+
+int evaluate_program(const filter_program_t *program, fieldset_t *fields)
+{
+	if (!program)
+		return 1;
+	const filter_insn_t *insns = program->insns;
+	const field_t *f = fields->fields;
+	int result = 1;
+	int pc = 0;
+	while (pc < program->len) {
+		const filter_insn_t *insn = &insns[pc++];
+		switch (insn->opcode) {
+		case FILTER_INT_EQ:
+			result = f[insn->index].value.num == insn->value;
+			break;
+		case FILTER_INT_NEQ:
+			result = f[insn->index].value.num != insn->value;
+			break;
+		case FILTER_INT_GT:
+			result = f[insn->index].value.num > insn->value;
+			break;
+		case FILTER_INT_LT:
+			result = f[insn->index].value.num < insn->value;
+			break;
+		case FILTER_INT_GT_EQ:
+			result = f[insn->index].value.num >= insn->value;
+			break;
+		case FILTER_INT_LT_EQ:
+			result = f[insn->index].value.num <= insn->value;
+			break;
+		case FILTER_STR_EQ:
+			result = eval_str_eq(insn, fields);
+			break;
+		case FILTER_STR_NEQ:
+			result = !eval_str_eq(insn, fields);
+			break;
+		case FILTER_IPV4_EQ:
+			result = eval_ipv4_eq(insn, fields);
+			break;
+		case FILTER_IPV4_NEQ:
+			result = !eval_ipv4_eq(insn, fields);
+			break;
+		case FILTER_JUMP_IF_FALSE:
+			if (!result)
+				pc = insn->index;
+			break;
+		case FILTER_JUMP_IF_TRUE:
+			if (result)
+				pc = insn->index;
+			break;
+		case FILTER_CONST:
+			result = (int)insn->value;
+			break;
+		}
+	}
+	return result;
+}
+
 void print_expression(node_t *root)
 {
 	if (!root)
@@ -162,6 +238,12 @@ void print_expression(node_t *root)
 	case INT:
 		printf(" %llu) ", (long long unsigned)root->value.int_literal);
 		break;
+	case IPV4: {
+		char buf[FS_IPV4_STRLEN];
+		fs_format_ipv4((uint32_t)root->value.int_literal, buf);
+		printf("%s) ", buf);
+		break;
+	}
 	default:
 		break;
 	}
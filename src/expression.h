@@ -28,7 +28,10 @@ enum operation { GT,
 enum node_type { OP,
 		 FIELD,
 		 STRING,
-		 INT };
+		 INT,
+		 // string literal compared against an "ip" field, converted to a
+		 // network order address (in int_literal) by validate_filter
+		 IPV4 };
 
 struct field_id {
 	int index;
@@ -49,6 +52,41 @@ typedef struct node_st {
 	union node_value value;
 } node_t;
 
+// A validated expression tree is compiled (see compile_filter) into a flat
+// program that evaluates into a single result register. Comparisons set the
+// register, and the jumps implement the short circuit of && and ||.
+enum filter_opcode { FILTER_INT_EQ,
+		     FILTER_INT_NEQ,
+		     FILTER_INT_GT,
+		     FILTER_INT_LT,
+		     FILTER_INT_GT_EQ,
+		     FILTER_INT_LT_EQ,
+		     FILTER_STR_EQ,
+		     FILTER_STR_NEQ,
+		     FILTER_IPV4_EQ,
+		     FILTER_IPV4_NEQ,
+		     FILTER_JUMP_IF_FALSE,
+		     FILTER_JUMP_IF_TRUE,
+		     FILTER_CONST };
+
+typedef struct filter_insn {
+	enum filter_opcode opcode;
+	// field index, or the target of a jump
+	int index;
+	// integer or address literal, or the result of FILTER_CONST
+	uint64_t value;
+	// string literal, and its first byte to reject most mismatches
+	// without a call to strcmp
+	const char *string;
+	char first;
+} filter_insn_t;
+
+typedef struct filter_program {
+	int len;
+	int capacity;
+	filter_insn_t *insns;
+} filter_program_t;
+
 node_t *make_op_node(enum operation op);
 
 node_t *make_field_node(char *fieldname);
@@ -59,6 +97,10 @@ node_t *make_int_node(int literal);
 
 int evaluate_expression(node_t *root, fieldset_t *fields);
 
+// Same result as evaluate_expression on the tree the program was compiled
+// from. A NULL program accepts everything.
+int evaluate_program(const filter_program_t *program, fieldset_t *fields);
+
 void print_expression(node_t *root);
 
 #endif /* ZMAP_TREE_H */
@@ -9,6 +9,7 @@
 #include "fieldset.h"
 
 #include <string.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -31,20 +32,135 @@ void gen_fielddef_set(fielddefset_t *fds, fielddef_t fs[], int len)
 	fds->len += len;
 }
 
+#define ARENA_ALIGN 16
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	__attribute__((aligned(ARENA_ALIGN))) char data[];
+};
+
+struct arena {
+	struct arena_chunk *first;
+	struct arena_chunk *cur;
+	size_t chunk_size;
+};
+
+static _Thread_local struct arena arena;
+
+static struct arena_chunk *arena_new_chunk(size_t size)
+{
+	struct arena_chunk *c = xmalloc(sizeof(struct arena_chunk) + size);
+	c->size = size;
+	return c;
+}
+
+void fs_arena_init(size_t chunk_size)
+{
+	assert(!arena.first);
+	arena.chunk_size = chunk_size;
+	arena.first = arena_new_chunk(chunk_size);
+	arena.cur = arena.first;
+}
+
+void fs_arena_reset(void)
+{
+	// only chunks up to cur have been handed out from
+	for (struct arena_chunk *c = arena.first; c; c = c->next) {
+		c->used = 0;
+		if (c == arena.cur) {
+			break;
+		}
+	}
+	arena.cur = arena.first;
+}
+
+void fs_arena_destroy(void)
+{
+	struct arena_chunk *c = arena.first;
+	while (c) {
+		struct arena_chunk *next = c->next;
+		free(c);
+		c = next;
+	}
+	memset(&arena, 0, sizeof(arena));
+}
+
+static void *arena_alloc(size_t len)
+{
+	len = (len + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	struct arena_chunk *c = arena.cur;
+	while (c->size - c->used < len) {
+		if (!c->next || c->next->size < len) {
+			// chunks after cur are unused since the last reset, so
+			// a new one can be slotted in here
+			size_t size = len > arena.chunk_size ? len : arena.chunk_size;
+			struct arena_chunk *n = arena_new_chunk(size);
+			n->next = c->next;
+			c->next = n;
+		}
+		c = c->next;
+		arena.cur = c;
+	}
+	void *p = c->data + c->used;
+	c->used += len;
+	return p;
+}
+
+void *fs_alloc(size_t len)
+{
+	if (!arena.first) {
+		return xcalloc(1, len);
+	}
+	void *p = arena_alloc(len);
+	memset(p, 0, len);
+	return p;
+}
+
+char *fs_strdup(const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *p = arena.first ? arena_alloc(len) : xmalloc(len);
+	memcpy(p, s, len);
+	return p;
+}
+
+void fs_release(void *ptr)
+{
+	// a thread with an arena allocates every value from it, so there is
+	// nothing to look up
+	if (ptr && !arena.first) {
+		free(ptr);
+	}
+}
+
+static fieldset_t *fs_new(int type)
+{
+	fieldset_t *f;
+	if (arena.first) {
+		// fields are written as they are added, only the header needs
+		// to be cleared
+		f = arena_alloc(sizeof(fieldset_t));
+		memset(f, 0, offsetof(fieldset_t, fields));
+		f->arena = 1;
+	} else {
+		f = xcalloc(1, sizeof(fieldset_t));
+	}
+	f->type = type;
+	return f;
+}
+
 fieldset_t *fs_new_fieldset(fielddefset_t *fds)
 {
-	fieldset_t *f = xcalloc(1, sizeof(fieldset_t));
-	f->len = 0;
-	f->type = FS_FIELDSET;
+	fieldset_t *f = fs_new(FS_FIELDSET);
 	f->fds = fds;
 	return f;
 }
 
 fieldset_t *fs_new_repeated_field(int type, int free_)
 {
-	fieldset_t *f = xcalloc(1, sizeof(fieldset_t));
-	f->len = 0;
-	f->type = FS_REPEATED;
+	fieldset_t *f = fs_new(FS_REPEATED);
 	f->inner_type = type;
 	f->free_ = free_;
 	return f;
@@ -109,7 +225,7 @@ static void fs_modify_word(fieldset_t *fs, const char *name, int type,
 	for (int i = 0; i < fs->len; i++) {
 		if (!strcmp(fs->fields[i].name, name)) {
 			if (fs->fields[i].free_) {
-				free(fs->fields[i].value.ptr);
+				fs_release(fs->fields[i].value.ptr);
 				fs->fields[i].value.ptr = NULL;
 			}
 			fs->fields[i].type = type;
@@ -146,7 +262,7 @@ static char *sanitize_utf8(const char *buf)
 	}
 
 	// i is the total number of errors. We need 2 extra bytes for each rune
-	char *safe_buf = xmalloc(strlen(buf) + i * 2 + 1);
+	char *safe_buf = fs_alloc(strlen(buf) + i * 2 + 1);
 	char *safe_ptr = NULL;
 	memcpy(safe_buf, buf, strlen(buf));
 
@@ -216,7 +332,7 @@ void fs_add_unsafe_string(fieldset_t *fs, const char *name, char *value,
 		char *safe_value = sanitize_utf8(value);
 
 		if (free_) {
-			free(value);
+			fs_release(value);
 		}
 
 		field_val_t val = {.ptr = safe_value};
@@ -261,6 +377,12 @@ void fs_add_bool(fieldset_t *fs, const char *name, int value)
 	fs_add_word(fs, name, FS_BOOL, 0, sizeof(int), val);
 }
 
+void fs_add_ipv4(fieldset_t *fs, const char *name, uint32_t addr)
+{
+	field_val_t val = {.num = addr};
+	fs_add_word(fs, name, FS_IPV4, 0, sizeof(uint32_t), val);
+}
+
 void fs_add_binary(fieldset_t *fs, const char *name, size_t len, void *value,
 		   int free_)
 {
@@ -311,6 +433,12 @@ void fs_modify_bool(fieldset_t *fs, const char *name, int value)
 	fs_modify_word(fs, name, FS_BOOL, 0, sizeof(int), val);
 }
 
+void fs_modify_ipv4(fieldset_t *fs, const char *name, uint32_t addr)
+{
+	field_val_t val = {.num = addr};
+	fs_modify_word(fs, name, FS_IPV4, 0, sizeof(uint32_t), val);
+}
+
 void fs_modify_binary(fieldset_t *fs, const char *name, size_t len, void *value,
 		      int free_)
 {
@@ -323,6 +451,25 @@ uint64_t fs_get_uint64_by_index(fieldset_t *fs, int index)
 	return (uint64_t)fs->fields[index].value.num;
 }
 
+size_t fs_format_ipv4(uint32_t addr, char *buf)
+{
+	const uint8_t *octets = (const uint8_t *)&addr;
+	char *p = buf;
+	for (int i = 0; i < 4; i++) {
+		uint8_t o = octets[i];
+		if (o >= 100) {
+			*p++ = (char)('0' + o / 100);
+			*p++ = (char)('0' + (o / 10) % 10);
+		} else if (o >= 10) {
+			*p++ = (char)('0' + o / 10);
+		}
+		*p++ = (char)('0' + o % 10);
+		*p++ = '.';
+	}
+	*--p = '\0';
+	return (size_t)(p - buf);
+}
+
 char *fs_get_string_by_index(fieldset_t *fs, int index)
 {
 	return (char *)fs->fields[index].value.ptr;
@@ -343,7 +490,7 @@ void field_free(field_t *f)
 	if (f->type == FS_FIELDSET || f->type == FS_REPEATED) {
 		fs_free((fieldset_t *)f->value.ptr);
 	} else if (f->free_) {
-		free(f->value.ptr);
+		fs_release(f->value.ptr);
 	}
 }
 
@@ -356,7 +503,88 @@ void fs_free(fieldset_t *fs)
 		field_t *f = &(fs->fields[i]);
 		field_free(f);
 	}
-	free(fs);
+	if (!fs->arena) {
+		free(fs);
+	}
+}
+
+static size_t detach_align(size_t len)
+{
+	return (len + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static size_t detached_size(fieldset_t *fs)
+{
+	size_t size =
+	    detach_align(offsetof(fieldset_t, fields) + fs->len * sizeof(field_t));
+	for (int i = 0; i < fs->len; i++) {
+		field_t *f = &fs->fields[i];
+		if (!f->value.ptr) {
+			continue;
+		}
+		if (f->type == FS_STRING) {
+			size += detach_align(strlen(f->value.ptr) + 1);
+		} else if (f->type == FS_BINARY) {
+			size += detach_align(f->len);
+		} else if (f->type == FS_FIELDSET || f->type == FS_REPEATED) {
+			size += detached_size(f->value.ptr);
+		}
+	}
+	return size;
+}
+
+// Copies fs to *buf and advances *buf past everything written.
+static fieldset_t *detach_into(fieldset_t *fs, char **buf)
+{
+	fieldset_t *d = (fieldset_t *)*buf;
+	size_t header = offsetof(fieldset_t, fields) + fs->len * sizeof(field_t);
+	memcpy(d, fs, header);
+	d->arena = 1;
+	d->free_ = 0;
+	*buf += detach_align(header);
+	for (int i = 0; i < fs->len; i++) {
+		field_t *f = &d->fields[i];
+		f->free_ = 0;
+		if (!f->value.ptr) {
+			continue;
+		}
+		if (f->type == FS_STRING) {
+			size_t len = strlen(f->value.ptr) + 1;
+			memcpy(*buf, f->value.ptr, len);
+			f->value.ptr = *buf;
+			*buf += detach_align(len);
+		} else if (f->type == FS_BINARY) {
+			memcpy(*buf, f->value.ptr, f->len);
+			f->value.ptr = *buf;
+			*buf += detach_align(f->len);
+		} else if (f->type == FS_FIELDSET || f->type == FS_REPEATED) {
+			f->value.ptr = detach_into(f->value.ptr, buf);
+		}
+	}
+	return d;
+}
+
+size_t fs_detached_size(fieldset_t *fs)
+{
+	return detached_size(fs);
+}
+
+fieldset_t *fs_detach_into(fieldset_t *fs, void *buf)
+{
+	char *p = buf;
+	return detach_into(fs, &p);
+}
+
+fieldset_t *fs_detach(fieldset_t *fs)
+{
+	char *buf = NULL;
+	if (posix_memalign((void **)&buf, ARENA_ALIGN, detached_size(fs))) {
+		log_fatal("fieldset", "unable to allocate detached fieldset");
+	}
+	fieldset_t *d = detach_into(fs, &buf);
+	// the outermost fieldset owns the whole allocation
+	d->arena = 0;
+	return d;
 }
 
 void fs_generate_fieldset_translation(translation_t *t, fielddefset_t *avail,
@@ -394,6 +622,19 @@ void fs_generate_full_fieldset_translation(translation_t *t,
 	}
 }
 
+field_t fs_get_field_by_index(fieldset_t *fs, int index)
+{
+	if (index < fs->len) {
+		return fs->fields[index];
+	}
+	// fields past len were never written, fs_new does not clear them
+	field_t f = {.type = FS_NULL};
+	if (fs->fds && index < fs->fds->len) {
+		f.name = fs->fds->fielddefs[index].name;
+	}
+	return f;
+}
+
 fieldset_t *translate_fieldset(fieldset_t *fs, translation_t *t)
 {
 	fieldset_t *retv = fs_new_fieldset(NULL);
@@ -402,8 +643,7 @@ fieldset_t *translate_fieldset(fieldset_t *fs, translation_t *t)
 			  "unable to allocate space for translated field set");
 	}
 	for (int i = 0; i < t->len; i++) {
-		int o = t->translation[i];
-		memcpy(&(retv->fields[i]), &(fs->fields[o]), sizeof(field_t));
+		retv->fields[i] = fs_get_field_by_index(fs, t->translation[i]);
 	}
 	retv->len = t->len;
 	return retv;
@@ -24,6 +24,8 @@
 #define FS_BINARY 3
 #define FS_NULL 4
 #define FS_BOOL 7
+// IPv4 address in network order, formatted by the output module
+#define FS_IPV4 8
 // recursive support
 #define FS_FIELDSET 5
 #define FS_REPEATED 6
@@ -61,12 +63,17 @@ typedef struct field {
 // to the output module
 typedef struct fieldset {
 	int len;
-	field_t fields[MAX_FIELDS];
 	fielddefset_t *fds;
 	// only used for repeated.
 	int inner_type; // type of repeated element. e.g., FS_STRING
 	int type;	// REPEATED or FIELDSET
 	int free_;	// should elements be freed
+	// the fieldset lives in an arena or inside a detached fieldset, and is
+	// not freed on its own
+	int arena;
+	// must stay last: detached fieldsets only allocate the first len
+	// fields
+	field_t fields[MAX_FIELDS];
 } fieldset_t;
 
 // we pass a different fieldset to an output module than
@@ -81,6 +88,30 @@ typedef struct translation {
 	int translation[MAX_FIELDS];
 } translation_t;
 
+// Per thread bump allocator for everything a received packet produces.
+// Once a thread has called fs_arena_init, fieldsets and the values made by
+// fs_alloc and fs_strdup come from its arena, and fs_arena_reset reclaims
+// them all at once. Such values are still added with free_ set; fs_release
+// (used by fs_free) does nothing on a thread with an arena, so any value
+// added with free_ set must come from fs_alloc or fs_strdup. Threads
+// without an arena get heap memory from the same functions.
+void fs_arena_init(size_t chunk_size);
+void fs_arena_reset(void);
+void fs_arena_destroy(void);
+// zeroed
+void *fs_alloc(size_t len);
+char *fs_strdup(const char *s);
+void fs_release(void *ptr);
+// Deep copies fs, including borrowed values, into a single heap allocation
+// that stays valid after the arena is reset or the packet buffer reused.
+// Released with fs_free.
+fieldset_t *fs_detach(fieldset_t *fs);
+// The same copy, into caller owned storage of fs_detached_size(fs) bytes
+// aligned to 16. The storage stays the caller's: fs_free on the copy does
+// nothing.
+size_t fs_detached_size(fieldset_t *fs);
+fieldset_t *fs_detach_into(fieldset_t *fs, void *buf);
+
 fieldset_t *fs_new_fieldset(fielddefset_t *);
 
 fieldset_t *fs_new_repeated_field(int type, int free_);
@@ -102,6 +133,8 @@ void fs_add_uint64(fieldset_t *fs, const char *name, uint64_t value);
 
 void fs_add_bool(fieldset_t *fs, const char *name, int value);
 
+void fs_add_ipv4(fieldset_t *fs, const char *name, uint32_t addr);
+
 void fs_add_string(fieldset_t *fs, const char *name, char *value, int free_);
 
 void fs_add_unsafe_string(fieldset_t *fs, const char *name, char *value,
@@ -127,6 +160,8 @@ void fs_modify_uint64(fieldset_t *fs, const char *name, uint64_t value);
 
 void fs_modify_bool(fieldset_t *fs, const char *name, int value);
 
+void fs_modify_ipv4(fieldset_t *fs, const char *name, uint32_t addr);
+
 void fs_modify_string(fieldset_t *fs, const char *name, char *value, int free_);
 
 void fs_modify_binary(fieldset_t *fs, const char *name, size_t len, void *value,
@@ -134,11 +169,21 @@ void fs_modify_binary(fieldset_t *fs, const char *name, size_t len, void *value,
 
 uint64_t fs_get_uint64_by_index(fieldset_t *fs, int index);
 
+// room for "255.255.255.255" and its terminator
+#define FS_IPV4_STRLEN 16
+// Writes addr (network order) in dotted-quad form and a terminating null
+// to buf, which must hold FS_IPV4_STRLEN bytes. Returns the length without
+// the null.
+size_t fs_format_ipv4(uint32_t addr, char *buf);
+
 void fs_free(fieldset_t *fs);
 
 void fs_generate_fieldset_translation(translation_t *t, fielddefset_t *avail,
 				      const char **req, int reqlen);
 
+// Field index of fs, or a null field if fs stops short of it, as when a
+// probe module does not add every field it defines.
+field_t fs_get_field_by_index(fieldset_t *fs, int index);
 fieldset_t *translate_fieldset(fieldset_t *fs, translation_t *t);
 
 void fs_generate_full_fieldset_translation(translation_t *t,
@@ -12,13 +12,31 @@
 #include "parser.h"
 #include "expression.h"
 #include "../lib/logger.h"
+#include "../lib/xalloc.h"
 
 #include <string.h>
+#include <arpa/inet.h>
 
 extern int yyparse(void);
 
 node_t *zfilter;
 
+// Addresses are stored as integers in the fieldset, so the literal is
+// parsed here once rather than for every response.
+static int convert_ipv4_literal(node_t *literal, fielddef_t *def)
+{
+	struct in_addr addr;
+	if (inet_pton(AF_INET, literal->value.string_literal, &addr) != 1) {
+		fprintf(stderr, "'%s' is not an IPv4 address (field '%s')\n",
+			literal->value.string_literal, def->name);
+		return 0;
+	}
+	free(literal->value.string_literal);
+	literal->type = IPV4;
+	literal->value.int_literal = addr.s_addr;
+	return 1;
+}
+
 static int validate_node(node_t *node, fielddefset_t *fields)
 {
 	int index, found = 0;
@@ -49,6 +67,10 @@ static int validate_node(node_t *node, fielddefset_t *fields)
 		// Fieldname is fine, match the type.
 		switch (node->right_child->type) {
 		case STRING:
+			if (strcmp(fields->fielddefs[index].type, "ip") == 0) {
+				return convert_ipv4_literal(node->right_child,
+							    &fields->fielddefs[index]);
+			}
 			if (strcmp(fields->fielddefs[index].type, "string") ==
 			    0) {
 				return 1;
@@ -113,3 +135,224 @@ int validate_filter(node_t *root, fielddefset_t *fields)
 	return (validate_filter(root->left_child, fields) &&
 		validate_filter(root->right_child, fields));
 }
+
+static void emit(filter_program_t *program, filter_insn_t insn)
+{
+	if (program->len == program->capacity) {
+		program->capacity = program->capacity ? 2 * program->capacity : 8;
+		program->insns = xrealloc(program->insns, program->capacity *
+							      sizeof(filter_insn_t));
+	}
+	program->insns[program->len++] = insn;
+}
+
+// Returns the result of an integer comparison when it does not depend on
+// the field's value, or -1 otherwise.
+static int fold_int_comparison(enum operation op, uint64_t value, int is_bool)
+{
+	switch (op) {
+	case LT:
+		if (value == 0)
+			return 0;
+		if (is_bool && value > 1)
+			return 1;
+		break;
+	case GT_EQ:
+		if (value == 0)
+			return 1;
+		if (is_bool && value > 1)
+			return 0;
+		break;
+	case GT:
+		if (value == UINT64_MAX || (is_bool && value >= 1))
+			return 0;
+		break;
+	case LT_EQ:
+		if (value == UINT64_MAX || (is_bool && value >= 1))
+			return 1;
+		break;
+	case EQ:
+		if (is_bool && value > 1)
+			return 0;
+		break;
+	case NEQ:
+		if (is_bool && value > 1)
+			return 1;
+		break;
+	default:
+		break;
+	}
+	return -1;
+}
+
+static int compile_comparison(filter_program_t *program, node_t *node,
+			      fielddefset_t *fields)
+{
+	enum operation op = node->value.op;
+	node_t *literal = node->right_child;
+	filter_insn_t insn = {.index = node->left_child->value.field.index};
+	switch (literal->type) {
+	case STRING:
+		insn.opcode = op == EQ ? FILTER_STR_EQ : FILTER_STR_NEQ;
+		insn.string = literal->value.string_literal;
+		insn.first = insn.string[0];
+		break;
+	case IPV4:
+		insn.opcode = op == EQ ? FILTER_IPV4_EQ : FILTER_IPV4_NEQ;
+		insn.value = literal->value.int_literal;
+		break;
+	case INT: {
+		int is_bool =
+		    strcmp(fields->fielddefs[insn.index].type, "bool") == 0;
+		int folded =
+		    fold_int_comparison(op, literal->value.int_literal, is_bool);
+		if (folded >= 0) {
+			return folded;
+		}
+		static const enum filter_opcode int_ops[] = {
+		    [GT] = FILTER_INT_GT,	  [LT] = FILTER_INT_LT,
+		    [EQ] = FILTER_INT_EQ,	  [NEQ] = FILTER_INT_NEQ,
+		    [LT_EQ] = FILTER_INT_LT_EQ, [GT_EQ] = FILTER_INT_GT_EQ};
+		insn.opcode = int_ops[op];
+		insn.value = literal->value.int_literal;
+		break;
+	}
+	default:
+		log_fatal("filter", "unexpected node type %d in filter",
+			  literal->type);
+	}
+	emit(program, insn);
+	return -1;
+}
+
+// Emits the code for node, which leaves its result in the register, and
+// returns -1. When the result is known at compile time, nothing is emitted
+// and the result is returned instead.
+static int compile_node(filter_program_t *program, node_t *node,
+			fielddefset_t *fields)
+{
+	enum operation op = node->value.op;
+	if (op != AND && op != OR) {
+		return compile_comparison(program, node, fields);
+	}
+	// the value of either side that decides the whole expression
+	int decisive = (op == OR);
+	int start = program->len;
+	int left = compile_node(program, node->left_child, fields);
+	if (left == decisive) {
+		return decisive;
+	} else if (left >= 0) {
+		return compile_node(program, node->right_child, fields);
+	}
+	int jump = program->len;
+	emit(program, (filter_insn_t){.opcode = op == AND ? FILTER_JUMP_IF_FALSE
+							 : FILTER_JUMP_IF_TRUE});
+	int right = compile_node(program, node->right_child, fields);
+	if (right == decisive) {
+		// comparisons have no side effects, so the left side need not
+		// run at all
+		program->len = start;
+		return decisive;
+	} else if (right >= 0) {
+		program->len = jump;
+		return -1;
+	}
+	program->insns[jump].index = program->len;
+	return -1;
+}
+
+filter_program_t *compile_filter(node_t *root, fielddefset_t *fields)
+{
+	if (!root) {
+		return NULL;
+	}
+	filter_program_t *program = xcalloc(1, sizeof(filter_program_t));
+	int result = compile_node(program, root, fields);
+	if (result >= 0) {
+		log_debug("filter", "output filter is always %s",
+			  result ? "true" : "false");
+		emit(program, (filter_insn_t){.opcode = FILTER_CONST,
+					      .value = (uint64_t)result});
+	}
+	log_debug("filter", "output filter compiled to %d instructions",
+		  program->len);
+	return program;
+}
+
+static const char *bpf_relations[] = {[GT] = ">",     [LT] = "<",
+				      [EQ] = "=",     [NEQ] = "!=",
+				      [LT_EQ] = "<=", [GT_EQ] = ">="};
+
+// Translates a single comparison. ICMP responses report addresses and
+// ports from the quoted probe, so they are always let through.
+static int comparison_to_bpf(node_t *node, int port_fields, char *buf,
+			     size_t len)
+{
+	const char *name = node->left_child->value.field.fieldname;
+	node_t *literal = node->right_child;
+	enum operation op = node->value.op;
+	const char *rel = bpf_relations[op];
+	uint64_t value = literal->value.int_literal;
+	int n;
+	if (literal->type == IPV4 &&
+	    (!strcmp(name, "saddr") || !strcmp(name, "daddr"))) {
+		char addr[FS_IPV4_STRLEN];
+		fs_format_ipv4((uint32_t)value, addr);
+		n = snprintf(buf, len, "icmp or %s%s host %s",
+			     op == NEQ ? "not " : "",
+			     name[0] == 's' ? "src" : "dst", addr);
+	} else if (literal->type != INT) {
+		return 0;
+	} else if (!strcmp(name, "ttl") && value <= UINT8_MAX) {
+		n = snprintf(buf, len, "ip[8] %s %u", rel, (unsigned)value);
+	} else if (!strcmp(name, "ipid") && value <= UINT16_MAX) {
+		n = snprintf(buf, len, "ip[4:2] %s %u", rel, (unsigned)value);
+	} else if (port_fields && value <= UINT16_MAX &&
+		   (!strcmp(name, "sport") || !strcmp(name, "dport"))) {
+		int off = name[0] == 's' ? 0 : 2;
+		n = snprintf(buf, len,
+			     "not (tcp or udp) or (tcp and tcp[%d:2] %s %u) or "
+			     "(udp and udp[%d:2] %s %u)",
+			     off, rel, (unsigned)value, off, rel,
+			     (unsigned)value);
+	} else {
+		return 0;
+	}
+	return n > 0 && (size_t)n < len;
+}
+
+// An && may drop a side it cannot translate and still accept a superset of
+// packets, whereas an || needs both.
+static int node_to_bpf(node_t *node, int port_fields, char *buf, size_t len)
+{
+	enum operation op = node->value.op;
+	if (op != AND && op != OR) {
+		return comparison_to_bpf(node, port_fields, buf, len);
+	}
+	char *left = xmalloc(len);
+	char *right = xmalloc(len);
+	int has_left = node_to_bpf(node->left_child, port_fields, left, len);
+	int has_right =
+	    node_to_bpf(node->right_child, port_fields, right, len);
+	int ret = 0;
+	if (has_left && has_right) {
+		int n = snprintf(buf, len, "(%s) %s (%s)", left,
+				 op == AND ? "and" : "or", right);
+		ret = n > 0 && (size_t)n < len;
+	}
+	if (!ret && op == AND && (has_left || has_right)) {
+		snprintf(buf, len, "%s", has_left ? left : right);
+		ret = 1;
+	}
+	free(left);
+	free(right);
+	return ret;
+}
+
+int filter_to_bpf(node_t *root, int port_fields, char *buf, size_t len)
+{
+	if (!root) {
+		return 0;
+	}
+	return node_to_bpf(root, port_fields, buf, len);
+}
@@ -14,10 +14,22 @@
 
 struct output_filter {
 	node_t *expression;
+	// what the receive path evaluates, see compile_filter
+	filter_program_t *program;
 };
 
 int parse_filter_string(char *filter);
 
 int validate_filter(node_t *root, fielddefset_t *fields);
 
+// Compiles a validated expression tree for evaluate_program. Returns NULL
+// for an empty filter.
+filter_program_t *compile_filter(node_t *root, fielddefset_t *fields);
+
+// Writes a pcap filter expression to buf that accepts at least every packet
+// the validated filter could accept, using only the conditions on IP header
+// fields, and on TCP/UDP ports when port_fields is set. Returns 0 when no
+// such condition exists or it does not fit in len.
+int filter_to_bpf(node_t *root, int port_fields, char *buf, size_t len);
+
 #endif /* ZMAP_FILTER_H */
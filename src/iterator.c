@@ -9,6 +9,7 @@
 #include <assert.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <string.h>
 #include <time.h>
 
 #include "../lib/includes.h"
@@ -20,11 +21,13 @@
 #include "iterator.h"
 
 #include "aesrand.h"
+#include "permutation.h"
 #include "shard.h"
 #include "state.h"
 
 struct iterator {
 	cycle_t cycle;
+	permutation_t perm;
 	uint8_t num_threads;
 	shard_t *thread_shards;
 	uint8_t *complete;
@@ -66,6 +69,15 @@ static uint64_t bits_needed(uint64_t n)
 	return r;
 }
 
+// Lets every thread steal chunks from the others once its own are done
+static void iterator_set_peers(iterator_t *it)
+{
+	for (uint8_t i = 0; i < it->num_threads; ++i) {
+		shard_set_peers(&it->thread_shards[i], it->thread_shards,
+				it->num_threads);
+	}
+}
+
 iterator_t *iterator_init(uint8_t num_threads, uint16_t shard,
 			  uint16_t num_shards, uint64_t num_addrs,
 			  uint32_t num_ports)
@@ -81,7 +93,6 @@ iterator_t *iterator_init(uint8_t num_threads, uint16_t shard,
 	log_debug("iterator", "minimum elements to iterate over: %llu",
 		  group_min_size);
 	iterator_t *it = xmalloc(sizeof(struct iterator));
-	const cyclic_group_t *group = get_group(group_min_size);
 	if (num_addrs > (1LL << 32)) {
 		zsend.max_ip_index = 0xFFFFFFFF;
 	} else {
@@ -94,47 +105,75 @@ iterator_t *iterator_init(uint8_t num_threads, uint16_t shard,
 	zsend.max_target_index = 1ULL << (32 + bits_for_port);
 	log_debug("iterator", "max target index %ull", zsend.max_target_index);
 
-	it->cycle = make_cycle(group, zconf.aes);
 	it->num_threads = num_threads;
 	it->curr_threads = num_threads;
-	it->thread_shards = xcalloc(num_threads, sizeof(shard_t));
+	it->thread_shards =
+	    xmalloc_aligned(CACHE_LINE_SIZE, num_threads * sizeof(shard_t));
 	it->complete = xcalloc(it->num_threads, sizeof(uint8_t));
 	pthread_mutex_init(&it->mutex, NULL);
 	log_debug("iterator", "max targets is %u", zsend.max_targets);
+	if (zconf.iterator_method == ITERATOR_METHOD_FEISTEL) {
+		// The permutation covers exactly the allowed (ip, port) pairs,
+		// so nothing is rejected and max_target_index is never hit.
+		uint64_t num_elts = num_addrs * num_ports;
+		log_debug("iterator", "permuting %llu elements", num_elts);
+		permutation_init(&it->perm, num_elts, zconf.aes);
+		for (uint8_t i = 0; i < num_threads; ++i) {
+			shard_init_permutation(&it->thread_shards[i], shard,
+					       num_shards, i, num_threads,
+					       zsend.max_targets, &it->perm,
+					       shard_complete, it);
+		}
+		iterator_set_peers(it);
+		zconf.generator = 0;
+		return it;
+	}
+	const cyclic_group_t *group = get_group(group_min_size);
+	it->cycle = make_cycle(group, zconf.aes);
 	for (uint8_t i = 0; i < num_threads; ++i) {
 		shard_init(&it->thread_shards[i], shard, num_shards, i,
 			   num_threads, zsend.max_targets, bits_for_port,
 			   &it->cycle, shard_complete, it);
 	}
+	iterator_set_peers(it);
 	zconf.generator = it->cycle.generator;
 	return it;
 }
 
-uint64_t iterator_get_sent(iterator_t *it)
+void iterator_get_stats(iterator_t *it, shard_stats_t *total)
 {
-	uint64_t sent = 0;
+	memset(total, 0, sizeof(shard_stats_t));
 	for (uint8_t i = 0; i < it->num_threads; ++i) {
-		sent += it->thread_shards[i].state.packets_sent;
+		shard_stats_t s;
+		shard_stats_snapshot(&it->thread_shards[i], &s);
+		total->packets_sent += s.packets_sent;
+		total->targets_scanned += s.targets_scanned;
+		total->packets_failed += s.packets_failed;
+		total->iterations += s.iterations;
+		total->pacing_late_ps += s.pacing_late_ps;
+		total->pacing_waits += s.pacing_waits;
 	}
-	return sent;
+}
+
+uint64_t iterator_get_sent(iterator_t *it)
+{
+	shard_stats_t total;
+	iterator_get_stats(it, &total);
+	return total.packets_sent;
 }
 
 uint64_t iterator_get_iterations(iterator_t *it)
 {
-	uint64_t iterations = 0;
-	for (uint8_t i = 0; i < it->num_threads; ++i) {
-		iterations += it->thread_shards[i].iterations;
-	}
-	return iterations;
+	shard_stats_t total;
+	iterator_get_stats(it, &total);
+	return total.iterations;
 }
 
 uint32_t iterator_get_fail(iterator_t *it)
 {
-	uint32_t fails = 0;
-	for (uint8_t i = 0; i < it->num_threads; ++i) {
-		fails += it->thread_shards[i].state.packets_failed;
-	}
-	return fails;
+	shard_stats_t total;
+	iterator_get_stats(it, &total);
+	return (uint32_t)total.packets_failed;
 }
 
 shard_t *get_shard(iterator_t *it, uint8_t thread_id)
@@ -143,6 +182,12 @@ shard_t *get_shard(iterator_t *it, uint8_t thread_id)
 	return &it->thread_shards[thread_id];
 }
 
+uint8_t iterator_get_num_threads(iterator_t *it)
+{
+	assert(it);
+	return it->num_threads;
+}
+
 uint32_t iterator_get_curr_send_threads(iterator_t *it)
 {
 	assert(it);
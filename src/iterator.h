@@ -23,10 +23,13 @@ iterator_t *iterator_init(uint8_t num_threads, uint16_t shard,
 			  uint16_t num_shards, uint64_t num_addrs,
 			  uint32_t num_ports);
 
+// Sums the counters most recently published by each send thread
+void iterator_get_stats(iterator_t *it, shard_stats_t *total);
 uint64_t iterator_get_sent(iterator_t *it);
 uint64_t iterator_get_iterations(iterator_t *it);
 uint32_t iterator_get_fail(iterator_t *it);
 
+uint8_t iterator_get_num_threads(iterator_t *it);
 uint32_t iterator_get_curr_send_threads(iterator_t *it);
 
 shard_t *get_shard(iterator_t *it, uint8_t thread_id);
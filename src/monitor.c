@@ -31,6 +31,7 @@
 
 #include "blocklist.h"
 #include "iterator.h"
+#include "output_stage.h"
 #include "recv.h"
 #include "state.h"
 
@@ -49,7 +50,14 @@ typedef struct internal_scan_status {
 	uint64_t last_recv_app_success;
 	uint64_t last_recv_total;
 	uint64_t last_pcap_drop;
+	uint64_t last_tx_ring_stalls;
+	uint64_t last_pacing_late_ps;
+	uint64_t last_pacing_waits;
+	uint64_t last_output_dropped;
+	uint64_t last_output_stall_ns;
 	double min_hitrate_start;
+	// counters of each send thread as of the last update
+	shard_stats_t *last_thread_stats;
 } int_status_t;
 
 // exportable status information that can be printed to screen
@@ -104,6 +112,22 @@ typedef struct export_scan_status {
 	double fail_last;
 	float seconds_under_min_hitrate;
 
+	uint64_t tx_ring_stall_total;
+	double tx_ring_stall_last;
+
+	// average lateness of paced sends in the last interval, microseconds
+	double pacing_error_last;
+	uint64_t pacing_late_ps;
+	uint64_t pacing_waits;
+
+	// results waiting for the output thread
+	uint64_t output_queue_depth;
+	uint64_t output_dropped_total;
+	double output_dropped_last;
+	// milliseconds per second that receive threads waited on the output
+	// queue in the last interval
+	double output_stall_last;
+
 } export_status_t;
 
 static FILE *status_fd = NULL;
@@ -121,43 +145,33 @@ static double min_d(double array[], int n)
 }
 
 // estimate time remaining time based on config and state
-double compute_remaining_time(double age, uint64_t packets_sent,
-			      uint64_t iterations)
+double compute_remaining_time(double age, uint64_t packets_sent)
 {
 	if (!zsend.complete) {
-		double remaining[] = {INFINITY, INFINITY, INFINITY, INFINITY,
-				      INFINITY};
-		if (zsend.list_of_ips_pbm) {
-			// Estimate progress using group iterations
-			double done =
-			    (double)iterations /
-			    ((uint64_t)0xFFFFFFFFU / zconf.total_shards);
-			remaining[0] =
-			    (1. - done) * (age / done) + zconf.cooldown_secs;
-		}
+		double remaining[] = {INFINITY, INFINITY, INFINITY, INFINITY};
 		if (zsend.max_targets) {
 			double done =
 			    (double)packets_sent /
 			    ((uint64_t)zsend.max_targets *
 			     zconf.packet_streams / zconf.total_shards);
-			remaining[1] =
+			remaining[0] =
 			    (1. - done) * (age / done) + zconf.cooldown_secs;
 		}
 		if (zconf.max_runtime) {
-			remaining[2] =
+			remaining[1] =
 			    (zconf.max_runtime - age) + zconf.cooldown_secs;
 		}
 		if (zconf.max_results) {
 			double done =
 			    (double)zrecv.filter_success / zconf.max_results;
-			remaining[3] = (1. - done) * (age / done);
+			remaining[2] = (1. - done) * (age / done);
 		}
 		if (zsend.max_ip_index) {
 			double done =
 			    (double)packets_sent /
 			    ((uint64_t)zsend.max_ip_index * zconf.ports->port_count * zconf.packet_streams /
 				 zconf.total_shards);
-			remaining[4] =
+			remaining[3] =
 			    (1. - done) * (age / done) + zconf.cooldown_secs;
 		}
 		double remaining_time = min_d(remaining, sizeof(remaining) / sizeof(double));
@@ -184,12 +198,41 @@ static void update_pcap_stats(pthread_mutex_t *recv_ready_mutex)
 	pthread_mutex_unlock(recv_ready_mutex);
 }
 
+static void log_thread_stats(int_status_t *intrnl, iterator_t *it,
+			     double delta)
+{
+	uint8_t num_threads = iterator_get_num_threads(it);
+	for (uint8_t i = 0; i < num_threads; ++i) {
+		shard_t *s = get_shard(it, i);
+		shard_stats_t cur;
+		shard_stats_snapshot(s, &cur);
+		shard_stats_t *last = &intrnl->last_thread_stats[i];
+		double pps = (cur.packets_sent - last->packets_sent) / delta;
+		double pacing_delay = 0;
+		if (cur.pacing_waits > last->pacing_waits) {
+			pacing_delay =
+			    (double)(cur.pacing_late_ps - last->pacing_late_ps) /
+			    (cur.pacing_waits - last->pacing_waits) / 1000000.0;
+		}
+		log_debug("monitor",
+			  "send thread %hhu: %.0f p/s, %" PRIu64 " targets, "
+			  "%" PRIu64 " failures, pacing delay %.1f us, "
+			  "%u of %u own chunks left, %u chunks stolen",
+			  i, pps, cur.targets_scanned, cur.packets_failed,
+			  pacing_delay, shard_chunks_left(s), s->num_chunks,
+			  __atomic_load_n(&s->chunks_stolen, __ATOMIC_RELAXED));
+		*last = cur;
+	}
+}
+
 static void export_stats(int_status_t *intrnl, export_status_t *exp,
 			 iterator_t *it)
 {
-	uint64_t total_sent = iterator_get_sent(it);
-	uint64_t total_iterations = iterator_get_iterations(it);
-	uint32_t total_fail = iterator_get_fail(it);
+	shard_stats_t total;
+	iterator_get_stats(it, &total);
+	uint64_t total_sent = total.packets_sent;
+	uint64_t total_iterations = total.iterations;
+	uint32_t total_fail = (uint32_t)total.packets_failed;
 	uint64_t total_recv = zrecv.pcap_recv;
 	uint64_t recv_success = zrecv.success_unique;
 	uint32_t app_success = zrecv.app_success_unique;
@@ -198,7 +241,7 @@ static void export_stats(int_status_t *intrnl, export_status_t *exp,
 	// time since the last time we updated
 	double delta = cur_time - intrnl->last_now;
 	double remaining_secs =
-	    compute_remaining_time(age, total_sent, total_iterations);
+	    compute_remaining_time(age, total_sent);
 
 	// export amount of time the scan has been running
 	if (age < WARMUP_PERIOD) {
@@ -299,8 +342,38 @@ static void export_stats(int_status_t *intrnl, export_status_t *exp,
 	exp->fail_last = (exp->fail_total - intrnl->last_send_failures) / delta;
 	exp->fail_avg = exp->fail_total / age;
 
+	exp->tx_ring_stall_total =
+	    __atomic_load_n(&zsend.tx_ring_stalls, __ATOMIC_RELAXED);
+	exp->tx_ring_stall_last =
+	    (exp->tx_ring_stall_total - intrnl->last_tx_ring_stalls) / delta;
+
+	exp->pacing_late_ps = total.pacing_late_ps;
+	exp->pacing_waits = total.pacing_waits;
+	exp->pacing_error_last = 0;
+	if (exp->pacing_waits > intrnl->last_pacing_waits) {
+		exp->pacing_error_last =
+		    (double)(exp->pacing_late_ps - intrnl->last_pacing_late_ps) /
+		    (exp->pacing_waits - intrnl->last_pacing_waits) / 1000000.0;
+	}
+
+	exp->output_queue_depth = output_stage_depth();
+	exp->output_dropped_total =
+	    __atomic_load_n(&zrecv.output_dropped, __ATOMIC_RELAXED);
+	exp->output_dropped_last =
+	    (exp->output_dropped_total - intrnl->last_output_dropped) / delta;
+	uint64_t output_stall_ns =
+	    __atomic_load_n(&zrecv.output_stall_ns, __ATOMIC_RELAXED);
+	exp->output_stall_last =
+	    (output_stall_ns - intrnl->last_output_stall_ns) / 1000000.0 / delta;
+	log_debug("monitor",
+		  "output queue: %" PRIu64 " queued, %.1f ms/s stalled, "
+		  "%.0f dropped/s",
+		  exp->output_queue_depth, exp->output_stall_last,
+		  exp->output_dropped_last);
+
 	// misc
 	exp->send_threads = iterator_get_curr_send_threads(it);
+	log_thread_stats(intrnl, it, delta);
 
 	// Update internal stats
 	intrnl->last_now = cur_time;
@@ -309,6 +382,11 @@ static void export_stats(int_status_t *intrnl, export_status_t *exp,
 	intrnl->last_recv_app_success = exp->app_recv_success_unique;
 	intrnl->last_pcap_drop = exp->pcap_drop_total;
 	intrnl->last_send_failures = exp->fail_total;
+	intrnl->last_tx_ring_stalls = exp->tx_ring_stall_total;
+	intrnl->last_pacing_late_ps = exp->pacing_late_ps;
+	intrnl->last_pacing_waits = exp->pacing_waits;
+	intrnl->last_output_dropped = exp->output_dropped_total;
+	intrnl->last_output_stall_ns = output_stall_ns;
 	intrnl->last_recv_total = exp->total_recv;
 }
 
@@ -326,6 +404,24 @@ static void log_drop_warnings(export_status_t *exp)
 			 "Failed to send %.0f packets/sec (%u total failures)",
 			 exp->fail_last, exp->fail_total);
 	}
+	if (exp->tx_ring_stall_last > 0) {
+		log_warn("monitor",
+			 "TX ring was full %.0f times in the last second "
+			 "(%" PRIu64 " total stalls)",
+			 exp->tx_ring_stall_last, exp->tx_ring_stall_total);
+	}
+	if (exp->output_dropped_last > 0) {
+		log_warn("monitor",
+			 "Output could not keep up, dropped %.0f results in the "
+			 "last second (%" PRIu64 " total)",
+			 exp->output_dropped_last, exp->output_dropped_total);
+	}
+	if (exp->output_stall_last > 100) {
+		log_warn("monitor",
+			 "Output could not keep up, receive threads waited "
+			 "%.0f ms in the last second",
+			 exp->output_stall_last);
+	}
 }
 
 static void onscreen_appsuccess(export_status_t *exp)
@@ -412,7 +508,11 @@ static FILE *init_status_update_file(char *path)
 	    "recv-success-total,recv-success-last-one-sec,recv-success-avg-per-sec,"
 	    "recv-total,recv-total-last-one-sec,recv-total-avg-per-sec,"
 	    "pcap-drop-total,drop-last-one-sec,drop-avg-per-sec,"
-	    "sendto-fail-total,sendto-fail-last-one-sec,sendto-fail-avg-per-sec\n");
+	    "sendto-fail-total,sendto-fail-last-one-sec,sendto-fail-avg-per-sec,"
+	    "tx-ring-stall-total,tx-ring-stall-last-one-sec,"
+	    "pacing-error-avg-us,"
+	    "output-queue-depth,output-stall-ms-last-one-sec,"
+	    "output-drop-total,output-drop-last-one-sec\n");
 	fflush(f);
 	return f;
 }
@@ -433,14 +533,22 @@ static void update_status_updates_file(export_status_t *exp, FILE *f)
 		"%" PRIu64 ",%.0f,%.0f,"
 		"%" PRIu64 ",%.0f,%.0f,"
 		"%" PRIu64 ",%.0f,%.0f,"
-		"%" PRIu64 ",,%.0f,%.0f\n",
+		"%" PRIu64 ",,%.0f,%.0f,"
+		"%" PRIu64 ",%.0f,"
+		"%.1f,"
+		"%" PRIu64 ",%.1f,"
+		"%" PRIu64 ",%.0f\n",
 		timestamp, exp->time_past, exp->time_remaining,
 		exp->percent_complete, exp->hitrate, exp->send_threads,
 		exp->total_sent, exp->send_rate, exp->send_rate_avg,
 		exp->recv_success_unique, exp->recv_rate, exp->recv_avg,
 		exp->total_recv, exp->recv_total_rate, exp->recv_total_avg,
 		exp->pcap_drop_total, exp->pcap_drop_last, exp->pcap_drop_avg,
-		exp->fail_total, exp->fail_last, exp->fail_avg);
+		exp->fail_total, exp->fail_last, exp->fail_avg,
+		exp->tx_ring_stall_total, exp->tx_ring_stall_last,
+		exp->pacing_error_last, exp->output_queue_depth,
+		exp->output_stall_last, exp->output_dropped_total,
+		exp->output_dropped_last);
 	fflush(f);
 }
 
@@ -495,6 +603,8 @@ void export_then_update(int_status_t *internal_status, iterator_t *it, export_st
 void monitor_run(iterator_t *it, pthread_mutex_t *lock)
 {
 	int_status_t *internal_status = xmalloc(sizeof(int_status_t));
+	internal_status->last_thread_stats =
+	    xcalloc(iterator_get_num_threads(it), sizeof(shard_stats_t));
 	export_status_t *export_status = xmalloc(sizeof(export_status_t));
 
 	// wait for the scanning process to finish
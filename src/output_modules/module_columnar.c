@@ -0,0 +1,551 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+// Column oriented binary output. Rows are collected into batches of
+// --output-args rows (default 65536) and each batch is written one column
+// after another. All integers are little endian.
+//
+// File header:
+//     char     magic[8]        "ZMAPCOL\0"
+//     uint32   version         1
+//     uint32   num_columns
+//     for each column:
+//         uint8    type        ZCOL_* below
+//         uint8    reserved    0
+//         uint16   name_len
+//         char     name[name_len]
+//
+// Batches, followed by a uint32 0 after the last one:
+//     uint32   num_rows
+//     for each column:
+//         uint8    encoding    ZCOL_ENC_* below
+//         uint8    valid[(num_rows + 7) / 8]
+//                  bit i (least significant first) is set when row i has
+//                  a value; rows without one still take up a slot below
+//         values, by type and encoding:
+//         UINT64   uint64 value[num_rows]
+//         BOOL     uint8 bits[(num_rows + 7) / 8], laid out like valid
+//         IPV4     uint8 addr[num_rows][4], in network order
+//         STRING, BINARY with ZCOL_ENC_PLAIN:
+//                  uint32 offsets[num_rows + 1], then offsets[num_rows]
+//                  bytes; value i is bytes offsets[i] to offsets[i + 1]
+//         STRING with ZCOL_ENC_DICT:
+//                  uint32 num_new, then num_new entries of uint32 len and
+//                  len bytes that are appended to the column's dictionary,
+//                  then uint32 index[num_rows] into the dictionary
+//
+// String columns start out dictionary encoded, which suits the many
+// columns with only a handful of values such as classification. Once a
+// column's dictionary would grow past ZCOL_DICT_MAX_ENTRIES or
+// ZCOL_DICT_MAX_BYTES, the column is written plain for the rest of the
+// file. scripts/columnar_to_csv.py converts the file back to CSV.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "../../lib/includes.h"
+#include "../../lib/logger.h"
+#include "../../lib/xalloc.h"
+#include "../fieldset.h"
+
+#include "output_modules.h"
+#include "output_buffer.h"
+
+#define ZCOL_MAGIC "ZMAPCOL"
+#define ZCOL_VERSION 1
+
+#define ZCOL_UINT64 1
+#define ZCOL_BOOL 2
+#define ZCOL_IPV4 3
+#define ZCOL_STRING 4
+#define ZCOL_BINARY 5
+
+#define ZCOL_ENC_PLAIN 0
+#define ZCOL_ENC_DICT 1
+
+#define ZCOL_DEFAULT_BATCH_ROWS 65536
+#define ZCOL_DICT_MAX_ENTRIES 1024
+#define ZCOL_DICT_MAX_BYTES (1 << 16)
+// open addressing slots, at most half full
+#define ZCOL_DICT_SLOTS (2 * ZCOL_DICT_MAX_ENTRIES)
+
+typedef struct zcol_column {
+	const char *name;
+	uint8_t type;
+	// field type that fills the column; anything else that
+	// column_accepts rejects is a missing value
+	int fs_type;
+	uint8_t *valid;
+	// UINT64, BOOL and IPV4 values
+	uint64_t *nums;
+	// STRING and BINARY values
+	uint32_t *offsets;
+	char *bytes;
+	size_t bytes_len;
+	size_t bytes_cap;
+	// dictionary, kept across batches. Entries past dict_written have not
+	// been written to the file yet.
+	int dictionary;
+	uint32_t dict_len;
+	uint32_t dict_written;
+	uint32_t *dict_offsets;
+	char *dict_bytes;
+	uint32_t *dict_slots; // entry + 1, 0 when empty
+	uint32_t *indices;
+} zcol_column_t;
+
+static FILE *file = NULL;
+static output_buffer_t out;
+static zcol_column_t *columns = NULL;
+static int num_columns = 0;
+static uint32_t batch_rows = ZCOL_DEFAULT_BATCH_ROWS;
+static uint32_t rows = 0;
+
+static void put_u8(uint8_t v) { obuf_putc(&out, (char)v); }
+
+static void put_u16(uint16_t v)
+{
+	uint8_t b[2] = {(uint8_t)v, (uint8_t)(v >> 8)};
+	obuf_append(&out, b, sizeof(b));
+}
+
+static void put_u32(uint32_t v)
+{
+	uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16),
+			(uint8_t)(v >> 24)};
+	obuf_append(&out, b, sizeof(b));
+}
+
+static void put_u32_array(const uint32_t *v, uint32_t n)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	obuf_append(&out, v, (size_t)n * sizeof(uint32_t));
+#else
+	for (uint32_t i = 0; i < n; i++) {
+		put_u32(v[i]);
+	}
+#endif
+}
+
+static void put_u64_array(const uint64_t *v, uint32_t n)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	obuf_append(&out, v, (size_t)n * sizeof(uint64_t));
+#else
+	for (uint32_t i = 0; i < n; i++) {
+		put_u32((uint32_t)v[i]);
+		put_u32((uint32_t)(v[i] >> 32));
+	}
+#endif
+}
+
+static uint32_t dict_hash(const char *s, size_t len)
+{
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (uint8_t)s[i]) * 16777619u;
+	}
+	return h;
+}
+
+// Returns the dictionary entry for a value, adding it if needed, or -1
+// when the dictionary is full.
+static int64_t dict_lookup(zcol_column_t *c, const char *s, size_t len)
+{
+	uint32_t slot = dict_hash(s, len) & (ZCOL_DICT_SLOTS - 1);
+	while (c->dict_slots[slot]) {
+		uint32_t e = c->dict_slots[slot] - 1;
+		uint32_t start = c->dict_offsets[e];
+		if (c->dict_offsets[e + 1] - start == len &&
+		    !memcmp(c->dict_bytes + start, s, len)) {
+			return e;
+		}
+		slot = (slot + 1) & (ZCOL_DICT_SLOTS - 1);
+	}
+	uint32_t used = c->dict_offsets[c->dict_len];
+	if (c->dict_len == ZCOL_DICT_MAX_ENTRIES ||
+	    len > ZCOL_DICT_MAX_BYTES - used) {
+		return -1;
+	}
+	memcpy(c->dict_bytes + used, s, len);
+	c->dict_offsets[c->dict_len + 1] = used + (uint32_t)len;
+	c->dict_slots[slot] = ++c->dict_len;
+	return c->dict_len - 1;
+}
+
+static void dict_free(zcol_column_t *c)
+{
+	c->dictionary = 0;
+	xfree(c->dict_offsets);
+	xfree(c->dict_bytes);
+	xfree(c->dict_slots);
+	xfree(c->indices);
+	c->dict_offsets = NULL;
+	c->dict_bytes = NULL;
+	c->dict_slots = NULL;
+	c->indices = NULL;
+}
+
+// Dictionary encodes the batch's values. Returns 0, and leaves the column
+// plain from then on, if they don't fit in the dictionary.
+static int dict_encode(zcol_column_t *c)
+{
+	for (uint32_t i = 0; i < rows; i++) {
+		if (!(c->valid[i / 8] & (1 << (i % 8)))) {
+			c->indices[i] = 0;
+			continue;
+		}
+		uint32_t start = c->offsets[i];
+		int64_t e = dict_lookup(c, c->bytes + start,
+					c->offsets[i + 1] - start);
+		if (e < 0) {
+			log_debug("columnar",
+				  "column %s has too many distinct values, "
+				  "writing it without a dictionary",
+				  c->name);
+			dict_free(c);
+			return 0;
+		}
+		c->indices[i] = (uint32_t)e;
+	}
+	return 1;
+}
+
+static void write_column(zcol_column_t *c)
+{
+	size_t bitmap_len = (rows + 7) / 8;
+	int dict = c->dictionary && dict_encode(c);
+	put_u8(dict ? ZCOL_ENC_DICT : ZCOL_ENC_PLAIN);
+	obuf_append(&out, c->valid, bitmap_len);
+	switch (c->type) {
+	case ZCOL_UINT64:
+		put_u64_array(c->nums, rows);
+		break;
+	case ZCOL_BOOL: {
+		uint8_t *bits = (uint8_t *)obuf_reserve(&out, bitmap_len);
+		memset(bits, 0, bitmap_len);
+		for (uint32_t i = 0; i < rows; i++) {
+			if (c->nums[i]) {
+				bits[i / 8] |= (uint8_t)(1 << (i % 8));
+			}
+		}
+		out.len += bitmap_len;
+		break;
+	}
+	case ZCOL_IPV4:
+		for (uint32_t i = 0; i < rows; i++) {
+			uint32_t addr = (uint32_t)c->nums[i];
+			obuf_append(&out, &addr, sizeof(addr));
+		}
+		break;
+	case ZCOL_STRING:
+	case ZCOL_BINARY:
+		if (dict) {
+			put_u32(c->dict_len - c->dict_written);
+			for (uint32_t e = c->dict_written; e < c->dict_len;
+			     e++) {
+				uint32_t start = c->dict_offsets[e];
+				uint32_t len = c->dict_offsets[e + 1] - start;
+				put_u32(len);
+				obuf_append(&out, c->dict_bytes + start, len);
+			}
+			c->dict_written = c->dict_len;
+			put_u32_array(c->indices, rows);
+		} else {
+			put_u32_array(c->offsets, rows + 1);
+			obuf_append(&out, c->bytes, c->bytes_len);
+		}
+		break;
+	}
+}
+
+static void write_batch(void)
+{
+	if (!rows) {
+		return;
+	}
+	put_u32(rows);
+	for (int i = 0; i < num_columns; i++) {
+		write_column(&columns[i]);
+	}
+	obuf_flush(&out);
+	for (int i = 0; i < num_columns; i++) {
+		zcol_column_t *c = &columns[i];
+		memset(c->valid, 0, (batch_rows + 7) / 8);
+		c->bytes_len = 0;
+	}
+	rows = 0;
+}
+
+// Maps a field definition's type to its column type. Returns 0 for the
+// types columnar output cannot store, such as fieldset and repeated.
+static int column_type(const char *type, uint8_t *ztype, int *fs_type)
+{
+	static const struct {
+		const char *name;
+		uint8_t ztype;
+		int fs_type;
+	} types[] = {{"int", ZCOL_UINT64, FS_UINT64},
+		     {"bool", ZCOL_BOOL, FS_BOOL},
+		     {"ip", ZCOL_IPV4, FS_IPV4},
+		     {"string", ZCOL_STRING, FS_STRING},
+		     {"binary", ZCOL_BINARY, FS_BINARY}};
+	for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+		if (!strcmp(type, types[i].name)) {
+			*ztype = types[i].ztype;
+			*fs_type = types[i].fs_type;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// def must have a type column_type accepts.
+static void column_init(zcol_column_t *c, const fielddef_t *def)
+{
+	memset(c, 0, sizeof(*c));
+	c->name = def->name;
+	int ok = column_type(def->type, &c->type, &c->fs_type);
+	assert(ok);
+	(void)ok;
+	c->valid = xcalloc((batch_rows + 7) / 8, 1);
+	if (c->type == ZCOL_STRING || c->type == ZCOL_BINARY) {
+		c->offsets = xcalloc(batch_rows + 1, sizeof(uint32_t));
+		c->bytes_cap = 4096;
+		c->bytes = xmalloc(c->bytes_cap);
+	} else {
+		c->nums = xcalloc(batch_rows, sizeof(uint64_t));
+	}
+	if (c->type == ZCOL_STRING) {
+		c->dictionary = 1;
+		c->dict_offsets =
+		    xcalloc(ZCOL_DICT_MAX_ENTRIES + 1, sizeof(uint32_t));
+		c->dict_bytes = xmalloc(ZCOL_DICT_MAX_BYTES);
+		c->dict_slots = xcalloc(ZCOL_DICT_SLOTS, sizeof(uint32_t));
+		c->indices = xcalloc(batch_rows, sizeof(uint32_t));
+	}
+}
+
+static void column_free(zcol_column_t *c)
+{
+	dict_free(c);
+	xfree(c->valid);
+	xfree(c->nums);
+	xfree(c->offsets);
+	xfree(c->bytes);
+}
+
+int columnar_init(struct state_conf *conf, UNUSED const char **fields,
+		  UNUSED int fieldlens)
+{
+	assert(conf);
+	fielddefset_t *defs = &conf->fsconf.outdefs;
+	// reject what cannot be written before creating the file
+	int unsupported = 0;
+	for (int i = 0; i < defs->len; i++) {
+		uint8_t ztype;
+		int fs_type;
+		if (!column_type(defs->fielddefs[i].type, &ztype, &fs_type)) {
+			log_error("columnar",
+				  "field %s has type %s, which columnar output "
+				  "does not support",
+				  defs->fielddefs[i].name,
+				  defs->fielddefs[i].type);
+			unsupported = 1;
+		}
+	}
+	if (unsupported) {
+		return EXIT_FAILURE;
+	}
+	if (conf->output_args) {
+		char *end;
+		errno = 0;
+		unsigned long n = strtoul(conf->output_args, &end, 10);
+		if (errno || *end || !n || n > UINT32_MAX / 8) {
+			log_error("columnar",
+				  "--output-args must be the number of rows "
+				  "per batch");
+			return EXIT_FAILURE;
+		}
+		batch_rows = (uint32_t)n;
+	}
+	if (!conf->output_filename || !strcmp(conf->output_filename, "-")) {
+		file = stdout;
+	} else if (!(file = fopen(conf->output_filename, "w"))) {
+		log_fatal("columnar",
+			  "could not open columnar output file (%s): %s",
+			  conf->output_filename, strerror(errno));
+	}
+	obuf_init(&out, file, "columnar");
+
+	num_columns = defs->len;
+	columns = xcalloc(num_columns, sizeof(zcol_column_t));
+	for (int i = 0; i < num_columns; i++) {
+		column_init(&columns[i], &defs->fielddefs[i]);
+	}
+	obuf_append(&out, ZCOL_MAGIC, sizeof(ZCOL_MAGIC));
+	put_u32(ZCOL_VERSION);
+	put_u32((uint32_t)num_columns);
+	for (int i = 0; i < num_columns; i++) {
+		size_t len = strlen(columns[i].name);
+		put_u8(columns[i].type);
+		put_u8(0);
+		put_u16((uint16_t)len);
+		obuf_append(&out, columns[i].name, len);
+	}
+	rows = 0;
+	return EXIT_SUCCESS;
+}
+
+// Whether a field of the given type fills the column. Probe modules fill
+// some bool fields, such as success, with fs_add_uint64, and CSV prints
+// both types as numbers, so int and bool columns take either. An int in a
+// bool column is stored as whether it is non-zero.
+static int column_accepts(const zcol_column_t *c, int type)
+{
+	if (type == c->fs_type) {
+		return 1;
+	}
+	return (c->fs_type == FS_UINT64 || c->fs_type == FS_BOOL) &&
+	       (type == FS_UINT64 || type == FS_BOOL);
+}
+
+// Stores f as row r of the current batch.
+static void column_add(zcol_column_t *c, field_t *f, uint32_t r)
+{
+	int valid = column_accepts(c, f->type);
+	if (valid) {
+		c->valid[r / 8] |= (uint8_t)(1 << (r % 8));
+	}
+	if (c->nums) {
+		c->nums[r] = valid ? f->value.num : 0;
+		return;
+	}
+	size_t len = 0;
+	if (valid) {
+		len = c->type == ZCOL_STRING ? strlen((char *)f->value.ptr)
+					     : f->len;
+	}
+	if (c->bytes_len + len > UINT32_MAX) {
+		log_fatal("columnar", "batch too large for column %s",
+			  c->name);
+	}
+	if (c->bytes_len + len > c->bytes_cap) {
+		while (c->bytes_len + len > c->bytes_cap) {
+			c->bytes_cap *= 2;
+		}
+		c->bytes = xrealloc(c->bytes, c->bytes_cap);
+	}
+	if (len) {
+		memcpy(c->bytes + c->bytes_len, f->value.ptr, len);
+	}
+	c->bytes_len += len;
+	c->offsets[r + 1] = (uint32_t)c->bytes_len;
+}
+
+int columnar_process(fieldset_t *fs)
+{
+	if (!file) {
+		return EXIT_SUCCESS;
+	}
+	assert(fs->len == num_columns);
+	for (int i = 0; i < num_columns; i++) {
+		column_add(&columns[i], &fs->fields[i], rows);
+	}
+	if (++rows == batch_rows || zconf.output_flush) {
+		write_batch();
+	}
+	return EXIT_SUCCESS;
+}
+
+// Copies the record batch into the current batch column by column, writing
+// the batch out whenever it fills up.
+static int columnar_process_batch(record_batch_t *batch)
+{
+	if (!file) {
+		return EXIT_SUCCESS;
+	}
+	assert(batch->num_columns == num_columns);
+	uint32_t done = 0;
+	while (done < (uint32_t)batch->len) {
+		uint32_t n = (uint32_t)batch->len - done;
+		if (n > batch_rows - rows) {
+			n = batch_rows - rows;
+		}
+		for (int i = 0; i < num_columns; i++) {
+			zcol_column_t *c = &columns[i];
+			field_t *f = &batch->columns[i][done];
+			for (uint32_t j = 0; j < n; j++) {
+				column_add(c, &f[j], rows + j);
+			}
+		}
+		rows += n;
+		done += n;
+		if (rows == batch_rows) {
+			write_batch();
+		}
+	}
+	if (zconf.output_flush) {
+		write_batch();
+	}
+	return EXIT_SUCCESS;
+}
+
+// Writes out the rows collected so far as a batch of their own, so that
+// they do not wait for a full batch while the scan is quiet.
+static int columnar_flush(void)
+{
+	if (file) {
+		write_batch();
+		obuf_flush(&out);
+	}
+	return EXIT_SUCCESS;
+}
+
+int columnar_close(UNUSED struct state_conf *c, UNUSED struct state_send *s,
+		   UNUSED struct state_recv *r)
+{
+	if (!file) {
+		return EXIT_SUCCESS;
+	}
+	write_batch();
+	put_u32(0);
+	obuf_close(&out);
+	fclose(file);
+	file = NULL;
+	for (int i = 0; i < num_columns; i++) {
+		column_free(&columns[i]);
+	}
+	xfree(columns);
+	columns = NULL;
+	num_columns = 0;
+	return EXIT_SUCCESS;
+}
+
+output_module_t module_columnar_file = {
+    .name = "columnar",
+    .init = &columnar_init,
+    .start = NULL,
+    .update = NULL,
+    .update_interval = 0,
+    .close = &columnar_close,
+    .process_ip = &columnar_process,
+    .process_batch = &columnar_process_batch,
+    .flush = &columnar_flush,
+    .supports_dynamic_output = NO_DYNAMIC_SUPPORT,
+    .helptext =
+	"Writes the output fields to a column oriented binary file, in batches "
+	"of rows. --output-args sets the number of rows per batch (default "
+	"65536); partial batches are written when the scan goes quiet or with "
+	"--output-flush. String columns with few distinct values are dictionary "
+	"encoded. The format is described in module_columnar.c, and "
+	"scripts/columnar_to_csv.py converts the file back to CSV."};
@@ -15,14 +15,139 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <assert.h>
-#include <inttypes.h>
 
+#include "../../lib/includes.h"
 #include "../../lib/logger.h"
+#include "../../lib/xalloc.h"
 #include "../fieldset.h"
 
 #include "output_modules.h"
+#include "output_buffer.h"
 
 static FILE *file = NULL;
+static output_buffer_t out;
+
+// Fields arrive translated into output order, so the formatter for each
+// column is picked once from the probe module's field definitions. A
+// field whose type doesn't match the plan (usually FS_NULL for a value
+// the probe module didn't set) goes through csv_write_field instead.
+typedef void (*csv_format_fn)(output_buffer_t *b, field_t *f);
+
+struct csv_column {
+	int type;
+	csv_format_fn format;
+};
+
+static struct csv_column *columns = NULL;
+static int num_columns = 0;
+
+// Strings containing a comma are wrapped in quotes, but not otherwise
+// escaped.
+static void csv_write_string(output_buffer_t *b, field_t *f)
+{
+	const char *str = (const char *)f->value.ptr;
+	size_t len = strlen(str);
+	if (memchr(str, ',', len)) {
+		char *p = obuf_reserve(b, len + 2);
+		p[0] = '"';
+		memcpy(p + 1, str, len);
+		p[len + 1] = '"';
+		b->len += len + 2;
+	} else {
+		obuf_append(b, str, len);
+	}
+}
+
+static void csv_write_ipv4(output_buffer_t *b, field_t *f)
+{
+	obuf_ipv4(b, (uint32_t)f->value.num);
+}
+
+static void csv_write_uint64(output_buffer_t *b, field_t *f)
+{
+	obuf_u64(b, f->value.num);
+}
+
+static void csv_write_bool(output_buffer_t *b, field_t *f)
+{
+	int v = (int)f->value.num;
+	if (v < 0) {
+		obuf_putc(b, '-');
+		obuf_u64(b, -(int64_t)v);
+	} else {
+		obuf_u64(b, (uint64_t)v);
+	}
+}
+
+static void csv_write_binary(output_buffer_t *b, field_t *f)
+{
+	obuf_hex(b, (const uint8_t *)f->value.ptr, f->len);
+}
+
+static void csv_write_null(UNUSED output_buffer_t *b, UNUSED field_t *f) {}
+
+static csv_format_fn csv_formatter(int type)
+{
+	switch (type) {
+	case FS_STRING:
+		return &csv_write_string;
+	case FS_IPV4:
+		return &csv_write_ipv4;
+	case FS_UINT64:
+		return &csv_write_uint64;
+	case FS_BOOL:
+		return &csv_write_bool;
+	case FS_BINARY:
+		return &csv_write_binary;
+	case FS_NULL:
+		return &csv_write_null;
+	default:
+		return NULL;
+	}
+}
+
+static void csv_write_field(output_buffer_t *b, field_t *f)
+{
+	csv_format_fn format = csv_formatter(f->type);
+	if (!format) {
+		log_fatal("csv", "received unknown output type");
+	}
+	format(b, f);
+}
+
+// Maps the type names used in field definitions to FS_* types, or FS_NULL
+// when the column has to be looked at row by row.
+static int fielddef_type(const char *type)
+{
+	if (!strcmp(type, "string")) {
+		return FS_STRING;
+	} else if (!strcmp(type, "ip")) {
+		return FS_IPV4;
+	} else if (!strcmp(type, "int")) {
+		return FS_UINT64;
+	} else if (!strcmp(type, "bool")) {
+		return FS_BOOL;
+	} else if (!strcmp(type, "binary")) {
+		return FS_BINARY;
+	}
+	return FS_NULL;
+}
+
+static void csv_build_plan(fielddefset_t *defs, const char **fields,
+			   int fieldlens)
+{
+	num_columns = fieldlens;
+	columns = xcalloc(fieldlens, sizeof(struct csv_column));
+	for (int i = 0; i < fieldlens; i++) {
+		int index = fds_get_index_by_name(defs, fields[i]);
+		int type = FS_NULL;
+		if (index >= 0) {
+			type = fielddef_type(defs->fielddefs[index].type);
+		}
+		columns[i].type = type;
+		columns[i].format = csv_formatter(type);
+	}
+}
 
 int csv_init(struct state_conf *conf, const char **fields, int fieldlens)
 {
@@ -42,17 +167,18 @@ int csv_init(struct state_conf *conf, const char **fields, int fieldlens)
 		file = stdout;
 		log_debug("csv", "no output file selected, will use stdout");
 	}
+	obuf_init(&out, file, "csv");
+	csv_build_plan(&conf->fsconf.defs, fields, fieldlens);
 	if (!conf->no_header_row) {
 		log_debug("csv", "more than one field, will add headers");
 		for (int i = 0; i < fieldlens; i++) {
 			if (i) {
-				fprintf(file, ",");
+				obuf_putc(&out, ',');
 			}
-			fprintf(file, "%s", fields[i]);
+			obuf_puts(&out, fields[i]);
 		}
-		fprintf(file, "\n");
+		obuf_putc(&out, '\n');
 	}
-	check_and_log_file_error(file, "csv");
 	return EXIT_SUCCESS;
 }
 
@@ -61,18 +187,25 @@ int csv_close(__attribute__((unused)) struct state_conf *c,
 	      __attribute__((unused)) struct state_recv *r)
 {
 	if (file) {
-		fflush(file);
+		obuf_close(&out);
 		fclose(file);
 	}
+	free(columns);
+	columns = NULL;
+	num_columns = 0;
 	return EXIT_SUCCESS;
 }
 
-static void hex_encode(FILE *f, unsigned char *readbuf, size_t len)
+static inline void csv_write_column(int i, field_t *f)
 {
-	for (size_t i = 0; i < len; i++) {
-		fprintf(f, "%02x", readbuf[i]);
+	if (i) {
+		obuf_putc(&out, ',');
+	}
+	if (i < num_columns && f->type == columns[i].type) {
+		columns[i].format(&out, f);
+	} else {
+		csv_write_field(&out, f);
 	}
-	check_and_log_file_error(f, "csv");
 }
 
 int csv_process(fieldset_t *fs)
@@ -81,31 +214,36 @@ int csv_process(fieldset_t *fs)
 		return EXIT_SUCCESS;
 	}
 	for (int i = 0; i < fs->len; i++) {
-		field_t *f = &(fs->fields[i]);
-		if (i) {
-			fprintf(file, ",");
+		csv_write_column(i, &(fs->fields[i]));
+	}
+	obuf_putc(&out, '\n');
+	obuf_end_record(&out);
+	return EXIT_SUCCESS;
+}
+
+int csv_process_batch(record_batch_t *batch)
+{
+	if (!file) {
+		return EXIT_SUCCESS;
+	}
+	for (int r = 0; r < batch->len; r++) {
+		for (int i = 0; i < batch->num_columns; i++) {
+			csv_write_column(i, &batch->columns[i][r]);
 		}
-		if (f->type == FS_STRING) {
-			if (strchr((char *)f->value.ptr, ',')) {
-				fprintf(file, "\"%s\"", (char *)f->value.ptr);
-			} else {
-				fprintf(file, "%s", (char *)f->value.ptr);
-			}
-		} else if (f->type == FS_UINT64) {
-			fprintf(file, "%" PRIu64, (uint64_t)f->value.num);
-		} else if (f->type == FS_BOOL) {
-			fprintf(file, "%" PRIi32, (int)f->value.num);
-		} else if (f->type == FS_BINARY) {
-			hex_encode(file, (unsigned char *)f->value.ptr, f->len);
-		} else if (f->type == FS_NULL) {
-			// do nothing
-		} else {
-			log_fatal("csv", "received unknown output type");
+		obuf_putc(&out, '\n');
+		if (zconf.output_flush) {
+			obuf_flush(&out);
 		}
 	}
-	fprintf(file, "\n");
-	fflush(file);
-	check_and_log_file_error(file, "csv");
+	obuf_end_record(&out);
+	return EXIT_SUCCESS;
+}
+
+static int csv_flush(void)
+{
+	if (file) {
+		obuf_flush(&out);
+	}
 	return EXIT_SUCCESS;
 }
 
@@ -117,6 +255,8 @@ output_module_t module_csv_file = {
     .update_interval = 0,
     .close = &csv_close,
     .process_ip = &csv_process,
+    .process_batch = &csv_process_batch,
+    .flush = &csv_flush,
     .supports_dynamic_output = NO_DYNAMIC_SUPPORT,
     .helptext =
 	"Outputs one or more output fields as a comma-delimited file. By default, the "
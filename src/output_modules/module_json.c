@@ -29,9 +29,11 @@
 #include "../../lib/logger.h"
 
 #include "output_modules.h"
+#include "output_buffer.h"
 #include "../probe_modules/probe_modules.h"
 
 static FILE *file = NULL;
+static output_buffer_t out;
 
 int json_output_file_init(struct state_conf *conf, UNUSED const char **fields,
 			  UNUSED int fieldlens)
@@ -49,19 +51,10 @@ int json_output_file_init(struct state_conf *conf, UNUSED const char **fields,
 		}
 	}
 	check_and_log_file_error(file, "json");
+	obuf_init(&out, file, "json");
 	return EXIT_SUCCESS;
 }
 
-char *hex_encode(unsigned char *packet, int buflen)
-{
-	char *buf = xmalloc(2 * buflen + 1);
-	for (int i = 0; i < buflen; i++) {
-		snprintf(buf + (i * 2), 3, "%.2x", packet[i]);
-	}
-	buf[buflen * 2] = 0;
-	return buf;
-}
-
 json_object *fs_to_jsonobj(fieldset_t *fs);
 json_object *repeated_to_jsonobj(fieldset_t *fs);
 
@@ -69,14 +62,20 @@ json_object *field_to_jsonobj(field_t *f)
 {
 	if (f->type == FS_STRING) {
 		return json_object_new_string((char *)f->value.ptr);
+	} else if (f->type == FS_IPV4) {
+		char buf[FS_IPV4_STRLEN];
+		size_t len = fs_format_ipv4((uint32_t)f->value.num, buf);
+		return json_object_new_string_len(buf, (int)len);
 	} else if (f->type == FS_UINT64) {
 		return json_object_new_int64(f->value.num);
 	} else if (f->type == FS_BOOL) {
 		return json_object_new_boolean(f->value.num);
 	} else if (f->type == FS_BINARY) {
-		char *encoded = hex_encode(f->value.ptr, f->len);
-		json_object *t = json_object_new_string(encoded);
-		free(encoded);
+		output_buffer_t hex = {.data = xmalloc(2 * f->len + 1),
+				       .cap = 2 * f->len + 1};
+		obuf_hex(&hex, f->value.ptr, f->len);
+		json_object *t = json_object_new_string_len(hex.data, (int)hex.len);
+		xfree(hex.data);
 		return t;
 	} else if (f->type == FS_NULL) {
 		return NULL;
@@ -112,17 +111,166 @@ json_object *fs_to_jsonobj(fieldset_t *fs)
 	return obj;
 }
 
+// Output records are written straight from the fieldset into the output
+// buffer. The result is byte for byte what json-c produces with
+// JSON_C_TO_STRING_PLAIN, without building an object tree per record.
+
+// How each byte is written inside a JSON string: 0 to copy it, a letter
+// for a two character escape, or 'u' for \u00XX. '/' is escaped because
+// json-c does.
+static const char json_escapes[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    'u', 'u', ['"'] = '"', ['/'] = '/', ['\\'] = '\\',
+};
+
+static void json_write_string(output_buffer_t *b, const char *str)
+{
+	static const char digits[] = "0123456789abcdef";
+	const unsigned char *s = (const unsigned char *)str;
+	obuf_putc(b, '"');
+	while (*s) {
+		// copy the longest run that needs no escaping in one go
+		const unsigned char *run = s;
+		while (*s && !json_escapes[*s]) {
+			s++;
+		}
+		obuf_append(b, run, (size_t)(s - run));
+		if (!*s) {
+			break;
+		}
+		char esc = json_escapes[*s];
+		if (esc == 'u') {
+			char u[6] = {'\\', 'u', '0', '0', digits[*s >> 4],
+				     digits[*s & 0x0f]};
+			obuf_append(b, u, sizeof(u));
+		} else {
+			char e[2] = {'\\', esc};
+			obuf_append(b, e, sizeof(e));
+		}
+		s++;
+	}
+	obuf_putc(b, '"');
+}
+
+static void json_write_fieldset(output_buffer_t *b, fieldset_t *fs);
+static void json_write_repeated(output_buffer_t *b, fieldset_t *fs);
+
+static void json_write_field(output_buffer_t *b, field_t *f)
+{
+	switch (f->type) {
+	case FS_STRING:
+		json_write_string(b, (const char *)f->value.ptr);
+		break;
+	case FS_IPV4:
+		obuf_putc(b, '"');
+		obuf_ipv4(b, (uint32_t)f->value.num);
+		obuf_putc(b, '"');
+		break;
+	case FS_UINT64:
+		// json-c holds integers as int64_t, so values from 2^63 up
+		// have always come out negative
+		if (f->value.num > INT64_MAX) {
+			obuf_putc(b, '-');
+			obuf_u64(b, -f->value.num);
+		} else {
+			obuf_u64(b, f->value.num);
+		}
+		break;
+	case FS_BOOL:
+		obuf_puts(b, f->value.num ? "true" : "false");
+		break;
+	case FS_BINARY:
+		obuf_putc(b, '"');
+		obuf_hex(b, f->value.ptr, f->len);
+		obuf_putc(b, '"');
+		break;
+	case FS_NULL:
+		obuf_puts(b, "null");
+		break;
+	case FS_FIELDSET:
+		json_write_fieldset(b, (fieldset_t *)f->value.ptr);
+		break;
+	case FS_REPEATED:
+		json_write_repeated(b, (fieldset_t *)f->value.ptr);
+		break;
+	default:
+		log_fatal("json", "received unknown output type: %i", f->type);
+	}
+}
+
+static void json_write_repeated(output_buffer_t *b, fieldset_t *fs)
+{
+	obuf_putc(b, '[');
+	for (int i = 0; i < fs->len; i++) {
+		if (i) {
+			obuf_putc(b, ',');
+		}
+		json_write_field(b, &fs->fields[i]);
+	}
+	obuf_putc(b, ']');
+}
+
+static void json_write_member(output_buffer_t *b, field_t *f, int *first)
+{
+	if (f->type == FS_NULL) {
+		return;
+	}
+	if (!*first) {
+		obuf_putc(b, ',');
+	}
+	*first = 0;
+	json_write_string(b, f->name);
+	obuf_putc(b, ':');
+	json_write_field(b, f);
+}
+
+static void json_write_fieldset(output_buffer_t *b, fieldset_t *fs)
+{
+	int first = 1;
+	obuf_putc(b, '{');
+	for (int i = 0; i < fs->len; i++) {
+		json_write_member(b, &(fs->fields[i]), &first);
+	}
+	obuf_putc(b, '}');
+}
+
 int json_output_to_file(fieldset_t *fs)
 {
 	if (!file) {
 		return EXIT_SUCCESS;
 	}
-	json_object *record = fs_to_jsonobj(fs);
-	fprintf(file, "%s\n",
-		json_object_to_json_string_ext(record, JSON_C_TO_STRING_PLAIN));
-	fflush(file);
-	check_and_log_file_error(file, "json");
-	json_object_put(record);
+	json_write_fieldset(&out, fs);
+	obuf_putc(&out, '\n');
+	obuf_end_record(&out);
+	return EXIT_SUCCESS;
+}
+
+static int json_output_batch(record_batch_t *batch)
+{
+	if (!file) {
+		return EXIT_SUCCESS;
+	}
+	for (int r = 0; r < batch->len; r++) {
+		int first = 1;
+		obuf_putc(&out, '{');
+		for (int i = 0; i < batch->num_columns; i++) {
+			json_write_member(&out, &batch->columns[i][r], &first);
+		}
+		obuf_puts(&out, "}\n");
+		if (zconf.output_flush) {
+			obuf_flush(&out);
+		}
+	}
+	obuf_end_record(&out);
+	return EXIT_SUCCESS;
+}
+
+static int json_output_flush(void)
+{
+	if (file) {
+		obuf_flush(&out);
+	}
 	return EXIT_SUCCESS;
 }
 
@@ -131,7 +279,7 @@ int json_output_file_close(UNUSED struct state_conf *c,
 			   UNUSED struct state_recv *r)
 {
 	if (file) {
-		fflush(file);
+		obuf_close(&out);
 		fclose(file);
 	}
 	return EXIT_SUCCESS;
@@ -153,6 +301,8 @@ output_module_t module_json_file = {
     .update_interval = 0,
     .close = &json_output_file_close,
     .process_ip = &json_output_to_file,
+    .process_batch = &json_output_batch,
+    .flush = &json_output_flush,
     .supports_dynamic_output = DYNAMIC_SUPPORT,
     .helptext =
 	"Outputs one or more output fields as a json valid file. By default, the \n"
@@ -14,6 +14,9 @@
  * limitations under the License.
  */
 
+#include <json.h>
+
 #include "fieldset.h"
 
+json_object *fs_to_jsonobj(fieldset_t *fs);
 int print_json_fieldset(fieldset_t *fs);
@@ -0,0 +1,199 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "output_buffer.h"
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../lib/logger.h"
+#include "../../lib/xalloc.h"
+#include "../fieldset.h"
+#include "../state.h"
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+void obuf_init(output_buffer_t *b, FILE *file, const char *name)
+{
+	b->file = file;
+	b->name = name;
+	b->cap = OUTPUT_BUFFER_SIZE;
+	b->data = xmalloc(b->cap);
+	b->len = 0;
+	b->pending_since = 0;
+	b->closed = 0;
+}
+
+// The reader of a pipe went away, as when output is piped into head. Like
+// a FILE whose reader is gone, the rest of the output is thrown away rather
+// than aborting the scan. Only reached when SIGPIPE is ignored, as it kills
+// the process otherwise.
+static void reader_gone(output_buffer_t *b)
+{
+	if (!b->closed) {
+		log_warn(b->name,
+			 "output was closed by its reader, discarding the "
+			 "remaining results");
+		b->closed = 1;
+	}
+	b->len = 0;
+	b->pending_since = 0;
+}
+
+// Output goes to the file descriptor directly in large chunks. Anything
+// written through the FILE beforehand is flushed first so it stays in
+// order. Interrupted and short writes are retried.
+void obuf_flush(output_buffer_t *b)
+{
+	if (!b->len) {
+		return;
+	}
+	if (b->closed) {
+		reader_gone(b);
+		return;
+	}
+	if (fflush(b->file) && errno == EPIPE) {
+		reader_gone(b);
+		return;
+	}
+	check_and_log_file_error(b->file, b->name);
+	int fd = fileno(b->file);
+	const char *p = b->data;
+	size_t left = b->len;
+	while (left) {
+		ssize_t n = write(fd, p, left);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EPIPE) {
+				reader_gone(b);
+				return;
+			}
+			log_fatal(b->name, "unable to write to file: %s",
+				  strerror(errno));
+		}
+		p += n;
+		left -= (size_t)n;
+	}
+	b->len = 0;
+	b->pending_since = 0;
+}
+
+void obuf_make_room(output_buffer_t *b, size_t n)
+{
+	obuf_flush(b);
+	if (n > b->cap) {
+		// a single record larger than the whole buffer
+		b->cap = n;
+		b->data = xrealloc(b->data, b->cap);
+	}
+}
+
+void obuf_end_record(output_buffer_t *b)
+{
+	if (zconf.output_flush) {
+		obuf_flush(b);
+		return;
+	}
+	uint64_t now = monotonic_ns();
+	if (!b->pending_since) {
+		b->pending_since = now;
+	} else if (now - b->pending_since > OUTPUT_BUFFER_FLUSH_NS) {
+		obuf_flush(b);
+	}
+}
+
+void obuf_close(output_buffer_t *b)
+{
+	obuf_flush(b);
+	xfree(b->data);
+	b->data = NULL;
+}
+
+static const char digit_pairs[201] = "00010203040506070809"
+				     "10111213141516171819"
+				     "20212223242526272829"
+				     "30313233343536373839"
+				     "40414243444546474849"
+				     "50515253545556575859"
+				     "60616263646566676869"
+				     "70717273747576777879"
+				     "80818283848586878889"
+				     "90919293949596979899";
+
+void obuf_u64(output_buffer_t *b, uint64_t v)
+{
+	// UINT64_MAX has 20 digits
+	char tmp[20];
+	char *p = tmp + sizeof(tmp);
+	while (v >= 100) {
+		uint64_t pair = v % 100;
+		v /= 100;
+		p -= 2;
+		memcpy(p, &digit_pairs[2 * pair], 2);
+	}
+	if (v >= 10) {
+		p -= 2;
+		memcpy(p, &digit_pairs[2 * v], 2);
+	} else {
+		*--p = (char)('0' + v);
+	}
+	obuf_append(b, p, (size_t)(tmp + sizeof(tmp) - p));
+}
+
+void obuf_ipv4(output_buffer_t *b, uint32_t addr)
+{
+	char *p = obuf_reserve(b, FS_IPV4_STRLEN);
+	b->len += fs_format_ipv4(addr, p);
+}
+
+void obuf_hex(output_buffer_t *b, const uint8_t *data, size_t len)
+{
+	static const char digits[] = "0123456789abcdef";
+	char *out = obuf_reserve(b, 2 * len);
+	size_t i = 0;
+#if defined(__x86_64__)
+	// 16 bytes at a time: split into nibbles, interleave them in output
+	// order, and turn each into '0'-'9' or 'a'-'f'
+	const __m128i low_mask = _mm_set1_epi8(0x0f);
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i zero = _mm_set1_epi8('0');
+	const __m128i letter_gap = _mm_set1_epi8('a' - '0' - 10);
+	for (; i + 16 <= len; i += 16) {
+		__m128i in = _mm_loadu_si128((const __m128i *)(data + i));
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(in, 4), low_mask);
+		__m128i lo = _mm_and_si128(in, low_mask);
+		__m128i first = _mm_unpacklo_epi8(hi, lo);
+		__m128i second = _mm_unpackhi_epi8(hi, lo);
+		first = _mm_add_epi8(
+		    _mm_add_epi8(first, zero),
+		    _mm_and_si128(_mm_cmpgt_epi8(first, nine), letter_gap));
+		second = _mm_add_epi8(
+		    _mm_add_epi8(second, zero),
+		    _mm_and_si128(_mm_cmpgt_epi8(second, nine), letter_gap));
+		_mm_storeu_si128((__m128i *)(out + 2 * i), first);
+		_mm_storeu_si128((__m128i *)(out + 2 * i + 16), second);
+	}
+#endif
+	for (; i < len; i++) {
+		out[2 * i] = digits[data[i] >> 4];
+		out[2 * i + 1] = digits[data[i] & 0x0f];
+	}
+	b->len += 2 * len;
+}
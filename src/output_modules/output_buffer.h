@@ -0,0 +1,79 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef ZMAP_OUTPUT_BUFFER_H
+#define ZMAP_OUTPUT_BUFFER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Large write buffer in front of an output file, for output modules that
+// format their records themselves. It is written out when full, when it
+// has held data for longer than OUTPUT_BUFFER_FLUSH_NS, when the output
+// thread is idle (see output_module_t.flush), or after every record with
+// --output-flush. Output modules only ever run on the output thread, so
+// there is no locking.
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define OUTPUT_BUFFER_FLUSH_NS 1000000000ULL
+
+typedef struct output_buffer {
+	FILE *file;
+	const char *name;
+	char *data;
+	size_t len;
+	size_t cap;
+	// when the oldest unwritten byte was added, 0 when empty
+	uint64_t pending_since;
+	// the reader of the pipe went away; output is discarded
+	int closed;
+} output_buffer_t;
+
+void obuf_init(output_buffer_t *b, FILE *file, const char *name);
+// Writes out everything buffered.
+void obuf_flush(output_buffer_t *b);
+// Called after each record or batch of records; flushes as configured.
+void obuf_end_record(output_buffer_t *b);
+// Flushes, and frees the buffer. Does not close the file.
+void obuf_close(output_buffer_t *b);
+
+// Makes room for n more bytes, writing out or growing the buffer.
+void obuf_make_room(output_buffer_t *b, size_t n);
+
+static inline char *obuf_reserve(output_buffer_t *b, size_t n)
+{
+	if (b->cap - b->len < n) {
+		obuf_make_room(b, n);
+	}
+	return b->data + b->len;
+}
+
+static inline void obuf_append(output_buffer_t *b, const void *data,
+			       size_t n)
+{
+	memcpy(obuf_reserve(b, n), data, n);
+	b->len += n;
+}
+
+static inline void obuf_putc(output_buffer_t *b, char c)
+{
+	*obuf_reserve(b, 1) = c;
+	b->len++;
+}
+
+static inline void obuf_puts(output_buffer_t *b, const char *s)
+{
+	obuf_append(b, s, strlen(s));
+}
+
+// Decimal integers, dotted-quad addresses and lowercase hex.
+void obuf_u64(output_buffer_t *b, uint64_t v);
+void obuf_ipv4(output_buffer_t *b, uint32_t addr);
+void obuf_hex(output_buffer_t *b, const uint8_t *data, size_t len);
+
+#endif /* ZMAP_OUTPUT_BUFFER_H */
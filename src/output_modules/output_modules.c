@@ -7,15 +7,20 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "../../lib/logger.h"
+#include "../../lib/xalloc.h"
+
 #include "output_modules.h"
 
 extern output_module_t module_csv_file;
 extern output_module_t module_json_file;
+extern output_module_t module_columnar_file;
 
 output_module_t *output_modules[] = {
-    &module_csv_file, &module_json_file,
+    &module_csv_file, &module_json_file, &module_columnar_file,
     // ADD YOUR MODULE HERE
 };
 
@@ -31,6 +36,174 @@ output_module_t *get_output_module_by_name(const char *name)
 	return NULL;
 }
 
+// values are mostly short strings, so this holds a batch of typical
+// records
+#define RECORD_BATCH_CHUNK_SIZE (64 * 1024)
+// what fs_detach_into expects
+#define RECORD_BATCH_ALIGN 16
+
+struct record_batch_chunk {
+	struct record_batch_chunk *next;
+	size_t size;
+	size_t used;
+	__attribute__((aligned(RECORD_BATCH_ALIGN))) char data[];
+};
+
+static struct record_batch_chunk *batch_new_chunk(size_t size)
+{
+	struct record_batch_chunk *c =
+	    xmalloc(sizeof(struct record_batch_chunk) + size);
+	c->next = NULL;
+	c->size = size;
+	c->used = 0;
+	return c;
+}
+
+// Bump allocates len bytes of value storage, in the same way as the
+// receive arena: chunks are only added, and reused after a clear.
+static void *batch_alloc(record_batch_t *batch, size_t len)
+{
+	len = (len + RECORD_BATCH_ALIGN - 1) &
+	      ~(size_t)(RECORD_BATCH_ALIGN - 1);
+	struct record_batch_chunk *c = batch->cur;
+	while (c->size - c->used < len) {
+		if (!c->next || c->next->size < len) {
+			size_t size = len > RECORD_BATCH_CHUNK_SIZE
+					  ? len
+					  : RECORD_BATCH_CHUNK_SIZE;
+			struct record_batch_chunk *n = batch_new_chunk(size);
+			n->next = c->next;
+			c->next = n;
+		}
+		c = c->next;
+		batch->cur = c;
+	}
+	void *p = c->data + c->used;
+	c->used += len;
+	return p;
+}
+
+void record_batch_init(record_batch_t *batch, fielddefset_t *schema)
+{
+	memset(batch, 0, sizeof(*batch));
+	batch->schema = schema;
+	batch->num_columns = schema->len;
+	for (int c = 0; c < batch->num_columns; c++) {
+		batch->columns[c] = xcalloc(RECORD_BATCH_SIZE, sizeof(field_t));
+	}
+	batch->chunks = batch_new_chunk(RECORD_BATCH_CHUNK_SIZE);
+	batch->cur = batch->chunks;
+	// not from fs_new_fieldset, as batches may be made on a receive
+	// thread, whose arena is reset after every packet
+	batch->row = xcalloc(1, sizeof(fieldset_t));
+	batch->row->type = FS_FIELDSET;
+	batch->row->fds = schema;
+}
+
+void record_batch_free(record_batch_t *batch)
+{
+	for (int c = 0; c < batch->num_columns; c++) {
+		xfree(batch->columns[c]);
+	}
+	struct record_batch_chunk *c = batch->chunks;
+	while (c) {
+		struct record_batch_chunk *next = c->next;
+		free(c);
+		c = next;
+	}
+	// the scratch row only ever borrows fields
+	xfree(batch->row);
+	memset(batch, 0, sizeof(*batch));
+}
+
+// Copies field f into the batch, taking a copy of whatever it points to.
+static void batch_copy_field(record_batch_t *batch, field_t *dst,
+			     const field_t *f)
+{
+	*dst = *f;
+	dst->free_ = 0;
+	if (!f->value.ptr) {
+		return;
+	}
+	if (f->type == FS_STRING) {
+		size_t len = strlen(f->value.ptr) + 1;
+		dst->value.ptr =
+		    memcpy(batch_alloc(batch, len), f->value.ptr, len);
+	} else if (f->type == FS_BINARY) {
+		dst->value.ptr =
+		    memcpy(batch_alloc(batch, f->len), f->value.ptr, f->len);
+	} else if (f->type == FS_FIELDSET || f->type == FS_REPEATED) {
+		fieldset_t *child = f->value.ptr;
+		dst->value.ptr = fs_detach_into(
+		    child, batch_alloc(batch, fs_detached_size(child)));
+	}
+}
+
+static int batch_next_row(record_batch_t *batch, int num_fields)
+{
+	if (batch->len >= RECORD_BATCH_SIZE) {
+		log_fatal("output", "record batch is already full (%d records)",
+			  RECORD_BATCH_SIZE);
+	}
+	if (num_fields != batch->num_columns) {
+		log_fatal("output",
+			  "record has %d fields, but the record batch has %d "
+			  "columns",
+			  num_fields, batch->num_columns);
+	}
+	return batch->len++;
+}
+
+void record_batch_add(record_batch_t *batch, fieldset_t *fs)
+{
+	int r = batch_next_row(batch, fs->len);
+	for (int c = 0; c < batch->num_columns; c++) {
+		batch_copy_field(batch, &batch->columns[c][r], &fs->fields[c]);
+	}
+}
+
+void record_batch_add_translated(record_batch_t *batch, fieldset_t *fs,
+				 translation_t *t)
+{
+	int r = batch_next_row(batch, t->len);
+	for (int c = 0; c < batch->num_columns; c++) {
+		field_t f = fs_get_field_by_index(fs, t->translation[c]);
+		batch_copy_field(batch, &batch->columns[c][r], &f);
+	}
+}
+
+void record_batch_clear(record_batch_t *batch)
+{
+	for (struct record_batch_chunk *c = batch->chunks; c; c = c->next) {
+		c->used = 0;
+		if (c == batch->cur) {
+			break;
+		}
+	}
+	batch->cur = batch->chunks;
+	batch->len = 0;
+}
+
+int output_process_batch(output_module_t *module, record_batch_t *batch)
+{
+	if (module->process_batch) {
+		return module->process_batch(batch);
+	}
+	if (!module->process_ip) {
+		return EXIT_SUCCESS;
+	}
+	fieldset_t *row = batch->row;
+	row->len = batch->num_columns;
+	for (int r = 0; r < batch->len; r++) {
+		for (int c = 0; c < batch->num_columns; c++) {
+			row->fields[c] = batch->columns[c][r];
+		}
+		module->process_ip(row);
+	}
+	row->len = 0;
+	return EXIT_SUCCESS;
+}
+
 void print_output_modules(void)
 {
 	int num_modules =
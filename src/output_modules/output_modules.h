@@ -15,6 +15,26 @@
 #define NO_DYNAMIC_SUPPORT 0
 #define DYNAMIC_SUPPORT 1
 
+// Up to RECORD_BATCH_SIZE results, stored column by column in the order
+// of schema (zconf.fsconf.outdefs): columns[c][r] is output field c of
+// record r. Strings, binaries and nested fieldsets are copied into storage
+// owned by the batch, so the fields are only valid until it is cleared.
+#define RECORD_BATCH_SIZE 256
+
+struct record_batch_chunk;
+
+typedef struct record_batch {
+	fielddefset_t *schema;
+	int num_columns;
+	int len;
+	field_t *columns[MAX_FIELDS];
+	// storage for the values the fields point to, kept across clears
+	struct record_batch_chunk *chunks;
+	struct record_batch_chunk *cur;
+	// scratch fieldset for handing single records to process_ip
+	fieldset_t *row;
+} record_batch_t;
+
 // called at scanner initialization
 typedef int (*output_init_cb)(struct state_conf *, const char **fields,
 			      int fieldslen);
@@ -22,10 +42,17 @@ typedef int (*output_init_cb)(struct state_conf *, const char **fields,
 // called on packet receipt
 typedef int (*output_packet_cb)(fieldset_t *fs);
 
+// called with batches of results, instead of process_ip for each
+typedef int (*output_batch_cb)(record_batch_t *batch);
+
 // called periodically during the scan
 typedef int (*output_update_cb)(struct state_conf *, struct state_send *,
 				struct state_recv *);
 
+// called when the output thread has nothing else to do, so that modules
+// that buffer output can write it out
+typedef int (*output_flush_cb)(void);
+
 typedef struct output_module {
 	const char *name;
 	int supports_dynamic_output;
@@ -35,11 +62,29 @@ typedef struct output_module {
 	output_update_cb update;
 	output_update_cb close;
 	output_packet_cb process_ip;
+	// optional, takes precedence over process_ip
+	output_batch_cb process_batch;
+	output_flush_cb flush;
 	const char *helptext;
 } output_module_t;
 
 output_module_t *get_output_module_by_name(const char *);
 
+void record_batch_init(record_batch_t *batch, fielddefset_t *schema);
+void record_batch_free(record_batch_t *batch);
+// Appends a copy of fs, whose fields are already in output order. fs is
+// left to the caller.
+void record_batch_add(record_batch_t *batch, fieldset_t *fs);
+// Appends a copy of the output fields of fs, picked out by t, so that a
+// fieldset from the probe module needs no translated copy of its own.
+void record_batch_add_translated(record_batch_t *batch, fieldset_t *fs,
+				 translation_t *t);
+// Empties the batch, keeping its storage for the next records.
+void record_batch_clear(record_batch_t *batch);
+// Passes the batch to the module's process_batch, or record by record to
+// its process_ip.
+int output_process_batch(output_module_t *module, record_batch_t *batch);
+
 void print_output_modules(void);
 
 #endif // HEADER_OUTPUT_MODULES_H
@@ -0,0 +1,240 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "output_stage.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#include "../lib/includes.h"
+#include "../lib/logger.h"
+#include "../lib/spsc.h"
+#include "../lib/xalloc.h"
+
+#include "recv.h"
+#include "state.h"
+#include "output_modules/output_modules.h"
+
+// how long an idle output thread, or a producer facing a full queue, sleeps
+// before looking again
+#define OUTPUT_STAGE_IDLE_NS 200000
+
+// Receive threads fill record batches of their own and queue them whole.
+// Written batches go back to the receive thread they came from, so every
+// queue is single producer, single consumer in both directions.
+struct producer {
+	// filled batches, towards the output thread
+	spsc_ring_t *full;
+	// written batches, back to the receive thread
+	spsc_ring_t *empty;
+	// batches allocated so far, at most max_batches
+	uint32_t num_batches;
+	// the batch the receive thread is filling, if any
+	record_batch_t *cur;
+};
+
+static struct producer producers[MAX_RECEIVERS];
+static uint8_t num_queues;
+static uint32_t max_batches;
+static pthread_t output_thread;
+static int stopping;
+// results in queued batches
+static uint64_t queued;
+// success_unique as of the last call to the output module's update
+static uint64_t last_update_unique;
+
+static void idle_sleep(void)
+{
+	struct timespec ts = {.tv_sec = 0, .tv_nsec = OUTPUT_STAGE_IDLE_NS};
+	nanosleep(&ts, NULL);
+}
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void write_batch(struct producer *p, record_batch_t *batch)
+{
+	uint64_t len = batch->len;
+	if (zconf.output_module) {
+		output_process_batch(zconf.output_module, batch);
+	}
+	record_batch_clear(batch);
+	// there is room, as a producer never has more batches than either
+	// ring holds
+	spsc_push(p->empty, batch);
+	__atomic_fetch_sub(&queued, len, __ATOMIC_RELAXED);
+}
+
+// Gives the output module its periodic update whenever success_unique has
+// crossed a multiple of its update_interval.
+static void maybe_update(void)
+{
+	if (!zconf.output_module || !zconf.output_module->update ||
+	    !zconf.output_module->update_interval) {
+		return;
+	}
+	uint64_t interval = zconf.output_module->update_interval;
+	uint64_t unique =
+	    __atomic_load_n(&zrecv.success_unique, __ATOMIC_RELAXED);
+	if (unique / interval != last_update_unique / interval) {
+		zconf.output_module->update(&zconf, &zsend, &zrecv);
+		last_update_unique = unique;
+	}
+}
+
+// Drains the queues round robin, taking at most one batch from each queue
+// per pass so that one busy receiver cannot starve the others, until a pass
+// finds every queue empty. Returns the number of results written.
+static uint64_t drain(void)
+{
+	uint64_t written = 0;
+	uint64_t popped;
+	do {
+		popped = 0;
+		for (uint8_t i = 0; i < num_queues; i++) {
+			record_batch_t *batch = spsc_pop(producers[i].full);
+			if (batch) {
+				popped += batch->len;
+				write_batch(&producers[i], batch);
+			}
+		}
+		written += popped;
+	} while (popped);
+	return written;
+}
+
+static void *output_stage_run(UNUSED void *arg)
+{
+	log_debug("output", "output thread started");
+	while (1) {
+		// read the flag before draining, so that nothing submitted
+		// before the stop request can be left behind
+		int stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+		uint64_t written = drain();
+		maybe_update();
+		if (stop) {
+			break;
+		}
+		if (!written) {
+			if (zconf.output_module && zconf.output_module->flush) {
+				zconf.output_module->flush();
+			}
+			idle_sleep();
+		}
+	}
+	log_debug("output", "output thread finished");
+	return NULL;
+}
+
+void output_stage_start(uint8_t num_producers)
+{
+	num_queues = num_producers;
+	max_batches = (zconf.output_queue_size + RECORD_BATCH_SIZE - 1) /
+		      RECORD_BATCH_SIZE;
+	// one being filled while another is written
+	if (max_batches < 2) {
+		max_batches = 2;
+	}
+	for (uint8_t i = 0; i < num_queues; i++) {
+		producers[i].full = spsc_init(max_batches);
+		producers[i].empty = spsc_init(max_batches);
+		producers[i].num_batches = 0;
+		producers[i].cur = NULL;
+	}
+	stopping = 0;
+	queued = 0;
+	last_update_unique = 0;
+	if (pthread_create(&output_thread, NULL, output_stage_run, NULL)) {
+		log_fatal("output", "unable to create output thread");
+	}
+}
+
+// Returns a batch for the producer to fill: a written one if there is one,
+// else a new one until the producer has max_batches, else NULL.
+static record_batch_t *take_batch(struct producer *p)
+{
+	record_batch_t *batch = spsc_pop(p->empty);
+	if (batch || p->num_batches == max_batches) {
+		return batch;
+	}
+	batch = xmalloc(sizeof(record_batch_t));
+	record_batch_init(batch, &zconf.fsconf.outdefs);
+	p->num_batches++;
+	return batch;
+}
+
+static void queue_batch(struct producer *p)
+{
+	__atomic_fetch_add(&queued, p->cur->len, __ATOMIC_RELAXED);
+	// there is room, see write_batch
+	spsc_push(p->full, p->cur);
+	p->cur = NULL;
+}
+
+void output_stage_submit(uint8_t producer, fieldset_t *fs)
+{
+	struct producer *p = &producers[producer];
+	if (!p->cur) {
+		p->cur = take_batch(p);
+	}
+	if (!p->cur) {
+		if (zconf.output_queue_policy == OUTPUT_QUEUE_POLICY_DROP) {
+			__atomic_fetch_add(&zrecv.output_dropped, 1,
+					   __ATOMIC_RELAXED);
+			return;
+		}
+		uint64_t start = monotonic_ns();
+		do {
+			idle_sleep();
+		} while (!(p->cur = spsc_pop(p->empty)));
+		__atomic_fetch_add(&zrecv.output_stall_ns,
+				   monotonic_ns() - start, __ATOMIC_RELAXED);
+	}
+	record_batch_add_translated(p->cur, fs, &zconf.fsconf.translation);
+	if (p->cur->len == RECORD_BATCH_SIZE) {
+		queue_batch(p);
+	}
+}
+
+void output_stage_flush(uint8_t producer)
+{
+	struct producer *p = &producers[producer];
+	if (p->cur && p->cur->len) {
+		queue_batch(p);
+	}
+}
+
+void output_stage_finish(void)
+{
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+	pthread_join(output_thread, NULL);
+	for (uint8_t i = 0; i < num_queues; i++) {
+		struct producer *p = &producers[i];
+		record_batch_t *batch;
+		if (p->cur) {
+			record_batch_free(p->cur);
+			free(p->cur);
+			p->cur = NULL;
+		}
+		while ((batch = spsc_pop(p->empty))) {
+			record_batch_free(batch);
+			free(batch);
+		}
+		spsc_free(p->full);
+		spsc_free(p->empty);
+	}
+}
+
+uint64_t output_stage_depth(void)
+{
+	return __atomic_load_n(&queued, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,37 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef ZMAP_OUTPUT_STAGE_H
+#define ZMAP_OUTPUT_STAGE_H
+
+#include <stdint.h>
+
+#include "fieldset.h"
+
+// The output stage runs the output module on its own thread, so that a
+// slow disk or a blocked stdout pipe stalls an in-memory queue rather than
+// packet capture. Every receive thread copies its results straight into
+// record batches of its own and hands them over whole, through a bounded
+// queue of about output_queue_size results.
+
+void output_stage_start(uint8_t num_producers);
+// Copies the output fields of fs, a fieldset from the probe module, into
+// the producer's current batch. fs is left to the caller. Each producer
+// index belongs to one receive thread.
+void output_stage_submit(uint8_t producer, fieldset_t *fs);
+// Hands the producer's partly filled batch to the output thread. Receive
+// threads call this whenever they run out of packets, so results never wait
+// for a batch to fill up.
+void output_stage_flush(uint8_t producer);
+// Waits for every queued result to be written and stops the stage. Every
+// producer must have flushed, and none may submit afterwards.
+void output_stage_finish(void);
+// Number of results currently queued across all receive threads.
+uint64_t output_stage_depth(void);
+
+#endif /* ZMAP_OUTPUT_STAGE_H */
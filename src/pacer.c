@@ -0,0 +1,170 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "pacer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "../lib/includes.h"
+#include "../lib/logger.h"
+
+#include "probe_modules/probe_modules.h"
+#include "state.h"
+
+#define PS_PER_NS 1000ULL
+#define PS_PER_SEC 1000000000000ULL
+
+// deadlines further away than this are slept for instead of spun on
+#define PACER_SLEEP_THRESHOLD (200 * 1000 * PS_PER_NS)
+// wake up this much before the deadline to absorb scheduler latency
+#define PACER_SPIN_MARGIN (50 * 1000 * PS_PER_NS)
+// upper bound on the send time of a slice, so that low rates are spread out
+// instead of being sent a batch at a time
+#define PACER_MAX_SLICE (2 * 1000 * 1000 * PS_PER_NS)
+
+// 7 byte MAC preamble, 1 byte start frame delimiter, 4 byte CRC and a 12
+// byte inter-frame gap are on the wire but not in the packet buffer
+#define ETH_WIRE_OVERHEAD 24
+// minimum size of an ethernet frame on the wire, including the overhead
+#define ETH_WIRE_MIN 84
+
+#ifdef CLOCK_MONOTONIC_RAW
+#define PACER_CLOCK CLOCK_MONOTONIC_RAW
+#else
+#define PACER_CLOCK CLOCK_MONOTONIC
+#endif
+
+static uint64_t clock_base_ns;
+// time at which the budget handed out so far runs out
+static uint64_t pool_end;
+
+static inline uint64_t clock_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(PACER_CLOCK, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t pacer_now(void)
+{
+	return (clock_ns() - clock_base_ns) * PS_PER_NS;
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__asm__ __volatile__("pause");
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+// Time a packet of len bytes takes out of the pool, 0 if unlimited.
+static uint64_t pacer_cost(size_t len)
+{
+	if (zconf.bandwidth > 0) {
+		uint64_t wire_len = len + ETH_WIRE_OVERHEAD;
+		if (wire_len < ETH_WIRE_MIN) {
+			wire_len = ETH_WIRE_MIN;
+		}
+		return wire_len * 8 * PS_PER_SEC / zconf.bandwidth;
+	}
+	if (zconf.rate > 0) {
+		return PS_PER_SEC / (uint64_t)zconf.rate;
+	}
+	return 0;
+}
+
+void pacer_global_init(void)
+{
+	clock_base_ns = clock_ns();
+	pool_end = 0;
+}
+
+void pacer_init(pacer_t *p)
+{
+	memset(p, 0, sizeof(pacer_t));
+	p->cost_estimate = pacer_cost(zconf.probe_module->max_packet_length);
+	p->enabled = p->cost_estimate > 0;
+}
+
+uint64_t pacer_reserve(pacer_t *p)
+{
+	// packets charged past the end of the last slice are carried over
+	uint64_t debt = p->next - p->slice_end;
+	uint64_t size = p->cost_estimate * zconf.batch;
+	if (size > PACER_MAX_SLICE) {
+		size = p->cost_estimate > PACER_MAX_SLICE ? p->cost_estimate
+							   : PACER_MAX_SLICE;
+	}
+	uint64_t now = pacer_now();
+	uint64_t end = __atomic_load_n(&pool_end, __ATOMIC_RELAXED);
+	uint64_t start;
+	do {
+		start = end > now ? end : now;
+	} while (!__atomic_compare_exchange_n(&pool_end, &end, start + size, 1,
+					      __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+	p->slice_end = start + size;
+	p->next = start + debt;
+	return start;
+}
+
+int pacer_slice_packets(const pacer_t *p, int max)
+{
+	if (!p->enabled || p->cost_estimate == 0) {
+		return max;
+	}
+	if (p->next >= p->slice_end) {
+		return 1;
+	}
+	uint64_t n = (p->slice_end - p->next + p->cost_estimate - 1) /
+		     p->cost_estimate;
+	return n < (uint64_t)max ? (int)n : max;
+}
+
+void pacer_wait(pacer_t *p, uint64_t deadline)
+{
+	uint64_t now = pacer_now();
+	if (deadline > now && deadline - now > PACER_SLEEP_THRESHOLD) {
+		uint64_t sleep_ns =
+		    (deadline - now - PACER_SPIN_MARGIN) / PS_PER_NS;
+		struct timespec ts = {
+		    .tv_sec = sleep_ns / 1000000000ULL,
+		    .tv_nsec = sleep_ns % 1000000000ULL,
+		};
+		// CLOCK_MONOTONIC_RAW can't be used with clock_nanosleep, so
+		// sleep relative and spin the rest against the raw clock
+		while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR) {
+		}
+		now = pacer_now();
+	}
+	while (now < deadline) {
+		cpu_relax();
+		now = pacer_now();
+	}
+	p->late += now - deadline;
+	p->waits++;
+}
+
+void pacer_charge(pacer_t *p, size_t len)
+{
+	if (!p->enabled) {
+		return;
+	}
+	// re-evaluated per packet so that SIGUSR1/SIGUSR2 rate changes apply
+	// immediately
+	uint64_t cost = pacer_cost(len);
+	if (cost == 0) {
+		return;
+	}
+	p->cost_estimate = cost;
+	p->next += cost;
+}
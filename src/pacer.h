@@ -0,0 +1,72 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef ZMAP_PACER_H
+#define ZMAP_PACER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Send rate limiting.
+//
+// All send threads draw send time from one shared token pool, kept as the
+// time at which the pool's budget runs out (the GCRA "theoretical arrival
+// time"). A thread reserves a slice worth one batch of packets at a time,
+// but never more than a couple of milliseconds of send time (and never
+// less than one packet), so low rates are not sent in bursts. It spends the
+// slice packet by packet without touching shared state, and waits for the
+// slice to start before it builds the packets of the next one. A thread that stalls
+// stops reserving, so its share is picked up by the others, and the pool
+// never starts in the past, so nobody bursts to catch up after a stall.
+//
+// Packets are charged by their actual length when --bandwidth is given and
+// as one packet each when --rate is given. All times are in picoseconds
+// since pacer_global_init().
+
+typedef struct pacer {
+	int enabled;
+	// scheduled send time of the next packet
+	uint64_t next;
+	// end of the slice reserved from the pool
+	uint64_t slice_end;
+	// cost of the last packet, used to size the next slice
+	uint64_t cost_estimate;
+	// total lateness of slice starts, and the number of slices
+	uint64_t late;
+	uint64_t waits;
+} pacer_t;
+
+// Initialize the shared token pool. Must be called once before any send
+// thread calls pacer_init.
+void pacer_global_init(void);
+
+// Initialize the per-thread pacer state.
+void pacer_init(pacer_t *p);
+
+// Returns whether the current slice is spent and a new one has to be
+// reserved with pacer_reserve before the next packet is sent.
+static inline int pacer_slice_done(const pacer_t *p)
+{
+	return p->enabled && p->next >= p->slice_end;
+}
+
+// Reserve the next slice from the shared pool and return its start time.
+uint64_t pacer_reserve(pacer_t *p);
+
+// Returns how many of the next *max* packets fit into the current slice,
+// at least 1.
+int pacer_slice_packets(const pacer_t *p, int max);
+
+// Wait until *deadline*. Sleeps with clock_nanosleep while the deadline is
+// far away and spins for the last few microseconds.
+void pacer_wait(pacer_t *p, uint64_t deadline);
+
+// Charge a packet of *len* bytes against the current slice.
+void pacer_charge(pacer_t *p, size_t len);
+
+#endif /* ZMAP_PACER_H */
@@ -0,0 +1,83 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "permutation.h"
+
+#include <assert.h>
+#include <math.h>
+
+// Round function. The permutation only has to look random, not resist an
+// attacker, so a keyed 64-bit mixer (the murmur3 finalizer) is enough.
+static inline uint64_t round_function(uint64_t x, uint64_t key)
+{
+	x ^= key;
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+// Maps a uniformly distributed 64-bit value onto [0, m) without a division.
+static inline uint64_t reduce(uint64_t x, uint64_t m)
+{
+	__extension__ typedef unsigned __int128 uint128_t;
+	return (uint64_t)(((uint128_t)x * m) >> 64);
+}
+
+void permutation_init(permutation_t *p, uint64_t size, aesrand_t *aes)
+{
+	assert(size > 0);
+	p->size = size;
+	// a = ceil(sqrt(size)), b = ceil(size / a) keeps a*b - size < a, so
+	// cycle walking is practically never needed
+	double root = sqrt((double)size);
+	uint64_t a = (uint64_t)root;
+	while (a * a < size) {
+		a++;
+	}
+	while (a > 1 && (a - 1) * (a - 1) >= size) {
+		a--;
+	}
+	p->a = a;
+	p->b = (size + a - 1) / a;
+	for (int i = 0; i < PERMUTATION_ROUNDS; i++) {
+		p->keys[i] = aesrand_getword(aes);
+	}
+}
+
+// One pass through the Feistel network over [0, a*b).
+static inline uint64_t permute(const permutation_t *p, uint64_t x)
+{
+	uint64_t left = x % p->a;
+	uint64_t right = x / p->a;
+	// left is in Z_a and right in Z_b on even rounds, and the other way
+	// around on odd rounds
+	for (int i = 0; i < PERMUTATION_ROUNDS; i++) {
+		uint64_t m = (i % 2 == 0) ? p->a : p->b;
+		uint64_t sum = left + reduce(round_function(right, p->keys[i]), m);
+		if (sum >= m) {
+			sum -= m;
+		}
+		left = right;
+		right = sum;
+	}
+	// PERMUTATION_ROUNDS is even, so left is back in Z_a
+	return left + p->a * right;
+}
+
+uint64_t permutation_get(const permutation_t *p, uint64_t index)
+{
+	assert(index < p->size);
+	uint64_t x = permute(p, index);
+	while (x >= p->size) {
+		x = permute(p, x);
+	}
+	return x;
+}
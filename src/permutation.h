@@ -0,0 +1,40 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef ZMAP_PERMUTATION_H
+#define ZMAP_PERMUTATION_H
+
+#include <stdint.h>
+
+#include "aesrand.h"
+
+// Keyed permutation of [0, size), used as an alternative to iterating over a
+// cyclic group.
+//
+// The domain is split as Z_a x Z_b with a*b >= size and a*b - size < a, and
+// permuted with an alternating Feistel network that adds the round function
+// modulo a and b in turn (Black and Rogaway's FE2). Outputs that fall into the
+// small gap [size, a*b) are walked through the permutation again until they
+// land in the domain. Any index can be mapped directly, so there is no state
+// to carry from one element to the next.
+
+#define PERMUTATION_ROUNDS 6
+
+typedef struct permutation {
+	uint64_t size;
+	uint64_t a;
+	uint64_t b;
+	uint64_t keys[PERMUTATION_ROUNDS];
+} permutation_t;
+
+void permutation_init(permutation_t *p, uint64_t size, aesrand_t *aes);
+
+// Returns the element at position index < size of the permutation.
+uint64_t permutation_get(const permutation_t *p, uint64_t index);
+
+#endif /* ZMAP_PERMUTATION_H */
@@ -80,6 +80,9 @@ int bacnet_prepare_packet(void *buf, macaddr_t *src, macaddr_t *gw, UNUSED void
 	bnp->apdu.server_choice = 0x0c;
 	memcpy(body, bacnet_body, BACNET_BODY_LEN);
 
+	// checksum of the template, updated incrementally in make_packet
+	ip_header->ip_sum = zmap_ip_checksum((unsigned short *)ip_header);
+
 	return EXIT_SUCCESS;
 }
 
@@ -93,11 +96,8 @@ int bacnet_make_packet(void *buf, size_t *buf_len, ipaddr_n_t src_ip,
 	struct udphdr *udp_header = (struct udphdr *)&ip_header[1];
 	struct bacnet_probe *bnp = (struct bacnet_probe *)&udp_header[1];
 
-	ip_header->ip_src.s_addr = src_ip;
-	ip_header->ip_dst.s_addr = dst_ip;
-	ip_header->ip_ttl = ttl;
-	ip_header->ip_sum = 0;
-	ip_header->ip_id = ip_id;
+	ip_set_addrs(ip_header, src_ip, dst_ip, NULL);
+	ip_set_ttl_id(ip_header, ttl, ip_id);
 
 	udp_header->uh_sport =
 	    htons(get_src_port(num_ports, probe_num, validation));
@@ -105,7 +105,6 @@ int bacnet_make_packet(void *buf, size_t *buf_len, ipaddr_n_t src_ip,
 
 	bnp->apdu.invoke_id = get_invoke_id(validation);
 
-	ip_header->ip_sum = zmap_ip_checksum((unsigned short *)ip_header);
 	*buf_len = ZMAP_BACNET_PACKET_LEN;
 
 	return EXIT_SUCCESS;
@@ -194,6 +193,7 @@ probe_module_t module_bacnet = {.name = "bacnet",
 				.pcap_filter = "udp || icmp",
 				.pcap_snaplen = 1500,
 				.port_args = 1,
+				.port_filter = PORT_FILTER_DST | PORT_FILTER_SRC | PORT_FILTER_FIELDS,
 				.global_initialize = &bacnet_global_initialize,
 				.thread_initialize = &bacnet_init_perthread,
 				.prepare_packet = &bacnet_prepare_packet,
@@ -364,11 +364,11 @@ static char *get_name(const char *data, uint16_t data_len, const char *payload,
 		      uint16_t payload_len, uint16_t *bytes_consumed)
 {
 	log_trace("dns", "call to get_name, data_len: %d", data_len);
-	char *name = xmalloc(MAX_NAME_LENGTH);
+	char *name = fs_alloc(MAX_NAME_LENGTH);
 	*bytes_consumed = get_name_helper(data, data_len, payload, payload_len,
 					  name, MAX_NAME_LENGTH - 1, 0);
 	if (*bytes_consumed == 0) {
-		free(name);
+		fs_release(name);
 		return NULL;
 	}
 	// Our memset ensured null byte.
@@ -397,7 +397,7 @@ static bool process_response_question(char **data, uint16_t *data_len,
 	}
 	assert(bytes_consumed > 0);
 	if ((bytes_consumed + sizeof(dns_question_tail)) > *data_len) {
-		free(question_name);
+		fs_release(question_name);
 		return true;
 	}
 	dns_question_tail *tail = (dns_question_tail *)(*data + bytes_consumed);
@@ -444,7 +444,7 @@ static bool process_response_answer(char **data, uint16_t *data_len,
 	}
 	assert(bytes_consumed > 0);
 	if ((bytes_consumed + sizeof(dns_answer_tail)) > *data_len) {
-		free(answer_name);
+		fs_release(answer_name);
 		return true;
 	}
 	dns_answer_tail *tail = (dns_answer_tail *)(*data + bytes_consumed);
@@ -455,7 +455,7 @@ static bool process_response_answer(char **data, uint16_t *data_len,
 	char *rdata = tail->rdata;
 
 	if ((rdlength + bytes_consumed + sizeof(dns_answer_tail)) > *data_len) {
-		free(answer_name);
+		fs_release(answer_name);
 		return true;
 	}
 	// Build our new question fieldset
@@ -502,13 +502,14 @@ static bool process_response_answer(char **data, uint16_t *data_len,
 			} else {
 				// (largest value 16bit) + " " + answer + null
 				char *rdata_with_pref =
-				    xmalloc(5 + 1 + strlen(rdata_name) + 1);
+				    fs_alloc(5 + 1 + strlen(rdata_name) + 1);
 
 				uint8_t num_printed =
 				    snprintf(rdata_with_pref, 6, "%hu ",
 					     ntohs(*(uint16_t *)rdata));
 				memcpy(rdata_with_pref + num_printed,
 				       rdata_name, strlen(rdata_name));
+				fs_release(rdata_name);
 				fs_add_uint64(afs, "rdata_is_parsed", 1);
 				fs_add_unsafe_string(afs, "rdata",
 						     rdata_with_pref, 1);
@@ -523,7 +524,7 @@ static bool process_response_answer(char **data, uint16_t *data_len,
 			fs_add_binary(afs, "rdata", rdlength, rdata, 0);
 		} else {
 			fs_add_uint64(afs, "rdata_is_parsed", 1);
-			char *txt = xmalloc(rdlength);
+			char *txt = fs_alloc(rdlength);
 			memcpy(txt, rdata + 1, rdlength - 1);
 			fs_add_unsafe_string(afs, "rdata", txt, 1);
 		}
@@ -538,7 +539,7 @@ static bool process_response_answer(char **data, uint16_t *data_len,
 		} else {
 			fs_add_uint64(afs, "rdata_is_parsed", 1);
 			char *addr =
-			    strdup(inet_ntoa(*(struct in_addr *)rdata));
+			    fs_strdup(inet_ntoa(*(struct in_addr *)rdata));
 			fs_add_unsafe_string(afs, "rdata", addr, 1);
 		}
 	} else if (type == DNS_QTYPE_AAAA) {
@@ -551,7 +552,7 @@ static bool process_response_answer(char **data, uint16_t *data_len,
 			fs_add_binary(afs, "rdata", rdlength, rdata, 0);
 		} else {
 			fs_add_uint64(afs, "rdata_is_parsed", 1);
-			char *ipv6_str = xmalloc(INET6_ADDRSTRLEN);
+			char *ipv6_str = fs_alloc(INET6_ADDRSTRLEN);
 
 			inet_ntop(AF_INET6, (struct sockaddr_in6 *)rdata,
 				  ipv6_str, INET6_ADDRSTRLEN);
@@ -763,6 +764,9 @@ int dns_prepare_packet(void *buf, macaddr_t *src, macaddr_t *gw,
 
 	memcpy(payload, dns_packets[0], dns_packet_lens[0]);
 
+	// checksum of the template, updated incrementally in make_packet
+	ip_header->ip_sum = zmap_ip_checksum((unsigned short *)ip_header);
+
 	return EXIT_SUCCESS;
 }
 
@@ -797,7 +801,7 @@ int dns_make_packet(void *buf, size_t *buf_len, ipaddr_n_t src_ip,
 		uint16_t encoded_len =
 		    htons(sizeof(struct ip) + sizeof(struct udphdr) +
 			  dns_packet_lens[dns_index]);
-		make_ip_header(ip_header, IPPROTO_UDP, encoded_len);
+		ip_set_len(ip_header, encoded_len);
 
 		encoded_len =
 		    sizeof(struct udphdr) + dns_packet_lens[dns_index];
@@ -813,10 +817,8 @@ int dns_make_packet(void *buf, size_t *buf_len, ipaddr_n_t src_ip,
 		       dns_packet_lens[dns_index]);
 	}
 
-	ip_header->ip_src.s_addr = src_ip;
-	ip_header->ip_dst.s_addr = dst_ip;
-	ip_header->ip_ttl = ttl;
-	ip_header->ip_id = ip_id;
+	ip_set_addrs(ip_header, src_ip, dst_ip, NULL);
+	ip_set_ttl_id(ip_header, ttl, ip_id);
 	// Above we wanted to look up the dns question index (so we could send 2 probes for the same DNS query)
 	// Here we want the port to be unique regardless of if this is the 2nd probe to the same DNS query so using
 	// probe_num itself to set the unique UDP source port.
@@ -828,12 +830,11 @@ int dns_make_packet(void *buf, size_t *buf_len, ipaddr_n_t src_ip,
 
 	dns_header_p->id = validation[2] & 0xFFFF;
 
-	ip_header->ip_sum = 0;
-	ip_header->ip_sum = zmap_ip_checksum((unsigned short *)ip_header);
-
 	return EXIT_SUCCESS;
 }
 
+PROBE_MAKE_PACKETS(dns_make_packets, dns_make_packet)
+
 void dns_print_packet(FILE *fp, void *packet)
 {
 	struct ether_header *ethh = (struct ether_header *)packet;
@@ -1116,9 +1117,11 @@ probe_module_t module_dns = {
     .pcap_filter = "udp || icmp",
     .pcap_snaplen = PCAP_SNAPLEN,
     .port_args = 1,
+    .port_filter = PORT_FILTER_DST | PORT_FILTER_SRC | PORT_FILTER_FIELDS,
     .global_initialize = &dns_global_initialize,
     .prepare_packet = &dns_prepare_packet,
     .make_packet = &dns_make_packet,
+    .make_packets = &dns_make_packets,
     .print_packet = &dns_print_packet,
     .validate_packet = &dns_validate_packet,
     .process_packet = &dns_process_packet,
@@ -160,6 +160,11 @@ static int icmp_echo_prepare_packet(void *buf, macaddr_t *src, macaddr_t *gw,
 
 	memcpy(payload, icmp_payload, icmp_payload_len);
 
+	// checksums of the template, updated incrementally in make_packet
+	icmp_header->icmp_cksum = icmp_checksum((unsigned short *)icmp_header,
+						ICMP_MINLEN + icmp_payload_len);
+	ip_header->ip_sum = zmap_ip_checksum((unsigned short *)ip_header);
+
 	return EXIT_SUCCESS;
 }
 
@@ -176,28 +181,22 @@ static int icmp_echo_make_packet(void *buf, size_t *buf_len, ipaddr_n_t src_ip,
 	uint16_t icmp_idnum = validation[1] & 0xFFFF;
 	uint16_t icmp_seqnum = validation[2] & 0xFFFF;
 
-	ip_header->ip_src.s_addr = src_ip;
-	ip_header->ip_dst.s_addr = dst_ip;
-	ip_header->ip_ttl = ttl;
+	ip_set_addrs(ip_header, src_ip, dst_ip, NULL);
+	ip_set_ttl_id(ip_header, ttl, ip_id);
 
-	icmp_header->icmp_id = icmp_idnum;
-	icmp_header->icmp_seq = icmp_seqnum;
+	csum_set16(&icmp_header->icmp_cksum, &icmp_header->icmp_id,
+		   icmp_idnum);
+	csum_set16(&icmp_header->icmp_cksum, &icmp_header->icmp_seq,
+		   icmp_seqnum);
 
-	icmp_header->icmp_cksum = 0;
-	icmp_header->icmp_cksum = icmp_checksum((unsigned short *)icmp_header,
-						ICMP_MINLEN + icmp_payload_len);
-
-	// Update the IP and UDP headers to match the new payload length
 	size_t ip_len = sizeof(struct ip) + ICMP_MINLEN + icmp_payload_len;
-	ip_header->ip_len = htons(ip_len);
-	ip_header->ip_id = ip_id;
-	ip_header->ip_sum = 0;
-	ip_header->ip_sum = zmap_ip_checksum((unsigned short *)ip_header);
 	*buf_len = ip_len + sizeof(struct ether_header);
 
 	return EXIT_SUCCESS;
 }
 
+PROBE_MAKE_PACKETS(icmp_echo_make_packets, icmp_echo_make_packet)
+
 static void icmp_echo_print_packet(FILE *fp, void *packet)
 {
 	struct ether_header *ethh = (struct ether_header *)packet;
@@ -312,6 +311,17 @@ static void icmp_echo_process_packet(const u_char *packet, uint32_t len,
 	}
 }
 
+static int icmp_echo_classify_packet(const u_char *packet,
+				     UNUSED uint32_t len,
+				     UNUSED uint32_t *validation)
+{
+	struct ip *ip_hdr = (struct ip *)&packet[sizeof(struct ether_header)];
+	struct icmp *icmp_hdr =
+	    (struct icmp *)((char *)ip_hdr + 4 * ip_hdr->ip_hl);
+	return icmp_hdr->icmp_type == ICMP_ECHOREPLY ? PROBE_CLASSIFY_SUCCESS
+						     : 0;
+}
+
 static fielddef_t fields[] = {
     {.name = "type", .type = "int", .desc = "icmp message type"},
     {.name = "code", .type = "int", .desc = "icmp message sub type code"},
@@ -335,8 +345,10 @@ probe_module_t module_icmp_echo = {
     .close = &icmp_global_cleanup,
     .prepare_packet = &icmp_echo_prepare_packet,
     .make_packet = &icmp_echo_make_packet,
+    .make_packets = &icmp_echo_make_packets,
     .print_packet = &icmp_echo_print_packet,
     .process_packet = &icmp_echo_process_packet,
+    .classify_packet = &icmp_echo_classify_packet,
     .validate_packet = &icmp_validate_packet,
     .helptext =
 	"Probe module that sends ICMP echo requests to hosts.\n"
@@ -262,14 +262,12 @@ void ipip_process_packet(const u_char *packet, UNUSED uint32_t len,
 		// ICMP unreach comes from another server (not the one we sent a
 		// probe to); But we will fix up saddr to be who we sent the
 		// probe to, in case you care.
-		fs_modify_string(fs, "saddr",
-				 make_ip_str(ip_inner->ip_dst.s_addr), 1);
+		fs_modify_ipv4(fs, "saddr", ip_inner->ip_dst.s_addr);
 		fs_add_string(fs, "classification", (char *)"icmp-unreach", 0);
 		fs_add_bool(fs, "success", 0);
 		fs_add_null(fs, "sport");
 		fs_add_null(fs, "dport");
-		fs_add_string(fs, "icmp_responder",
-			      make_ip_str(ip_hdr->ip_src.s_addr), 1);
+		fs_add_ipv4(fs, "icmp_responder", ip_hdr->ip_src.s_addr);
 		fs_add_uint64(fs, "icmp_type", icmp->icmp_type);
 		fs_add_uint64(fs, "icmp_code", icmp->icmp_code);
 		if (icmp->icmp_code <= ICMP_UNREACH_PRECEDENCE_CUTOFF) {
@@ -392,7 +390,7 @@ static fielddef_t fields[] = {
     {.name = "sport", .type = "int", .desc = "UDP source port"},
     {.name = "dport", .type = "int", .desc = "UDP destination port"},
     {.name = "icmp_responder",
-     .type = "string",
+     .type = "ip",
      .desc = "Source IP of ICMP_UNREACH message"},
     {.name = "icmp_type", .type = "int", .desc = "icmp message type"},
     {.name = "icmp_code", .type = "int", .desc = "icmp message sub type code"},
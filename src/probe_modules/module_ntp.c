@@ -113,14 +113,12 @@ void ntp_process_packet(const u_char *packet, UNUSED uint32_t len,
 		struct ip *ip_inner =
 		    (struct ip *)((char *)icmp + ICMP_UNREACH_HEADER_SIZE);
 
-		fs_modify_string(fs, "saddr",
-				 make_ip_str(ip_inner->ip_dst.s_addr), 1);
+		fs_modify_ipv4(fs, "saddr", ip_inner->ip_dst.s_addr);
 		fs_add_constchar(fs, "classification", "icmp");
 		fs_add_bool(fs, "success", 0);
 		fs_add_null(fs, "sport");
 		fs_add_null(fs, "dport");
-		fs_add_string(fs, "icmp_responder",
-			      make_ip_str(ip_hdr->ip_src.s_addr), 1);
+		fs_add_ipv4(fs, "icmp_responder", ip_hdr->ip_src.s_addr);
 		fs_add_uint64(fs, "icmp_type", icmp->icmp_type);
 		fs_add_uint64(fs, "icmp_code", icmp->icmp_code);
 		fs_add_null(fs, "icmp_unreach_str");
@@ -191,6 +189,9 @@ int ntp_prepare_packet(void *buf, macaddr_t *src, macaddr_t *gw, UNUSED void *ar
 			    sizeof(struct udphdr) + sizeof(struct ntphdr);
 	module_ntp.max_packet_length = header_len;
 
+	// checksum of the template, updated incrementally in make_packet
+	ip_header->ip_sum = zmap_ip_checksum((unsigned short *)ip_header);
+
 	return EXIT_SUCCESS;
 }
 
@@ -251,6 +252,7 @@ probe_module_t module_ntp = {.name = "ntp",
 			     .pcap_filter = "udp || icmp",
 			     .pcap_snaplen = 1500,
 			     .port_args = 1,
+			     .port_filter = PORT_FILTER_DST | PORT_FILTER_SRC | PORT_FILTER_FIELDS,
 			     .global_initialize = &ntp_global_initialize,
 			     .thread_initialize = &ntp_init_perthread,
 			     .prepare_packet = &ntp_prepare_packet,
@@ -55,6 +55,11 @@ static int synackscan_prepare_packet(void *buf, macaddr_t *src, macaddr_t *gw,
 	struct tcphdr *tcp_header = (struct tcphdr *)(&ip_header[1]);
 	make_tcp_header(tcp_header, TH_SYN | TH_ACK);
 	set_mss_option(tcp_header);
+	// checksums of the template, updated incrementally in make_packet
+	tcp_header->th_sum = tcp_checksum(ZMAP_TCP_SYNACKSCAN_TCP_HEADER_LEN,
+					  ip_header->ip_src.s_addr,
+					  ip_header->ip_dst.s_addr, tcp_header);
+	ip_header->ip_sum = zmap_ip_checksum((unsigned short *)ip_header);
 	return EXIT_SUCCESS;
 }
 
@@ -71,23 +76,14 @@ static int synackscan_make_packet(void *buf, UNUSED size_t *buf_len,
 	uint32_t tcp_ack =
 	    validation[2]; // get_src_port() below uses validation 1 internally.
 
-	ip_header->ip_src.s_addr = src_ip;
-	ip_header->ip_dst.s_addr = dst_ip;
-	ip_header->ip_ttl = ttl;
-	ip_header->ip_id = ip_id;
-
-	tcp_header->th_sport =
-	    htons(get_src_port(num_ports, probe_num, validation));
-	tcp_header->th_dport = dport;
-	tcp_header->th_seq = tcp_seq;
-	tcp_header->th_ack = tcp_ack;
-	tcp_header->th_sum = 0;
-	tcp_header->th_sum = tcp_checksum(ZMAP_TCP_SYNACKSCAN_TCP_HEADER_LEN,
-					  ip_header->ip_src.s_addr,
-					  ip_header->ip_dst.s_addr, tcp_header);
+	ip_set_addrs(ip_header, src_ip, dst_ip, &tcp_header->th_sum);
+	ip_set_ttl_id(ip_header, ttl, ip_id);
 
-	ip_header->ip_sum = 0;
-	ip_header->ip_sum = zmap_ip_checksum((unsigned short *)ip_header);
+	csum_set16(&tcp_header->th_sum, &tcp_header->th_sport,
+		   htons(get_src_port(num_ports, probe_num, validation)));
+	csum_set16(&tcp_header->th_sum, &tcp_header->th_dport, dport);
+	csum_set32(&tcp_header->th_sum, &tcp_header->th_seq, tcp_seq);
+	csum_set32(&tcp_header->th_sum, &tcp_header->th_ack, tcp_ack);
 	*buf_len = ZMAP_TCP_SYNACKSCAN_PACKET_LEN;
 
 	return EXIT_SUCCESS;
@@ -202,6 +198,13 @@ static void synackscan_process_packet(const u_char *packet, UNUSED uint32_t len,
 	}
 }
 
+static int synackscan_classify_packet(const u_char *packet, uint32_t len,
+				      UNUSED uint32_t *validation)
+{
+	struct ip *ip_hdr = get_ip_header(packet, len);
+	return ip_hdr->ip_p == IPPROTO_TCP ? PROBE_CLASSIFY_SUCCESS : 0;
+}
+
 static fielddef_t fields[] = {
     {.name = "sport", .type = "int", .desc = "TCP source port"},
     {.name = "dport", .type = "int", .desc = "TCP destination port"},
@@ -218,11 +221,13 @@ probe_module_t module_tcp_synackscan = {
     .pcap_filter = "(tcp && tcp[13] & 4 != 0 || tcp[13] == 18) || icmp",
     .pcap_snaplen = 96,
     .port_args = 1,
+    .port_filter = PORT_FILTER_DST | PORT_FILTER_SRC | PORT_FILTER_FIELDS,
     .global_initialize = &synackscan_global_initialize,
     .prepare_packet = &synackscan_prepare_packet,
     .make_packet = &synackscan_make_packet,
     .print_packet = &synscan_print_packet,
     .process_packet = &synackscan_process_packet,
+    .classify_packet = &synackscan_classify_packet,
     .validate_packet = &synackscan_validate_packet,
     .close = NULL,
     .helptext = "Probe module that sends a TCP SYNACK packet to a specific "
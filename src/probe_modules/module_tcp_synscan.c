@@ -95,6 +95,11 @@ static int synscan_prepare_packet(void *buf, macaddr_t *src, macaddr_t *gw,
 	struct tcphdr *tcp_header = (struct tcphdr *)(&ip_header[1]);
 	make_tcp_header(tcp_header, TH_SYN);
 	set_tcp_options(tcp_header, os_for_tcp_options);
+	// checksums of the template, updated incrementally in make_packet
+	tcp_header->th_sum = tcp_checksum(zmap_tcp_synscan_tcp_header_len,
+					  ip_header->ip_src.s_addr,
+					  ip_header->ip_dst.s_addr, tcp_header);
+	ip_header->ip_sum = zmap_ip_checksum((unsigned short *)ip_header);
 	return EXIT_SUCCESS;
 }
 
@@ -108,29 +113,20 @@ static int synscan_make_packet(void *buf, size_t *buf_len, ipaddr_n_t src_ip,
 	struct tcphdr *tcp_header = (struct tcphdr *)(&ip_header[1]);
 	uint32_t tcp_seq = validation[0];
 
-	ip_header->ip_src.s_addr = src_ip;
-	ip_header->ip_dst.s_addr = dst_ip;
-	ip_header->ip_ttl = ttl;
+	ip_set_addrs(ip_header, src_ip, dst_ip, &tcp_header->th_sum);
+	ip_set_ttl_id(ip_header, ttl, ip_id);
 
 	port_h_t sport = get_src_port(num_source_ports, probe_num, validation);
-	tcp_header->th_sport = htons(sport);
-	tcp_header->th_dport = dport;
-	tcp_header->th_seq = tcp_seq;
-	// checksum value must be zero when calculating packet's checksum
-	tcp_header->th_sum = 0;
-	tcp_header->th_sum = tcp_checksum(zmap_tcp_synscan_tcp_header_len,
-					  ip_header->ip_src.s_addr,
-					  ip_header->ip_dst.s_addr, tcp_header);
-
-	ip_header->ip_id = ip_id;
-	// checksum value must be zero when calculating packet's checksum
-	ip_header->ip_sum = 0;
-	ip_header->ip_sum = zmap_ip_checksum((unsigned short *)ip_header);
+	csum_set16(&tcp_header->th_sum, &tcp_header->th_sport, htons(sport));
+	csum_set16(&tcp_header->th_sum, &tcp_header->th_dport, dport);
+	csum_set32(&tcp_header->th_sum, &tcp_header->th_seq, tcp_seq);
 
 	*buf_len = zmap_tcp_synscan_packet_len;
 	return EXIT_SUCCESS;
 }
 
+PROBE_MAKE_PACKETS(synscan_make_packets, synscan_make_packet)
+
 // not static because used by synack scan
 void synscan_print_packet(FILE *fp, void *packet)
 {
@@ -354,6 +350,19 @@ static void synscan_process_packet(const u_char *packet, UNUSED uint32_t len,
 	}
 }
 
+static int synscan_classify_packet(const u_char *packet, uint32_t len,
+				   UNUSED uint32_t *validation)
+{
+	struct ip *ip_hdr = get_ip_header(packet, len);
+	assert(ip_hdr);
+	if (ip_hdr->ip_p == IPPROTO_TCP) {
+		struct tcphdr *tcp = get_tcp_header(ip_hdr, len);
+		assert(tcp);
+		return (tcp->th_flags & TH_RST) ? 0 : PROBE_CLASSIFY_SUCCESS;
+	}
+	return 0;
+}
+
 static fielddef_t fields[] = {
     {.name = "sport", .type = "int", .desc = "TCP source port"},
     {.name = "dport", .type = "int", .desc = "TCP destination port"},
@@ -374,11 +383,14 @@ probe_module_t module_tcp_synscan = {
     .pcap_filter = "(tcp && tcp[13] & 4 != 0 || tcp[13] == 18) || icmp",
     .pcap_snaplen = 96,
     .port_args = 1,
+    .port_filter = PORT_FILTER_DST | PORT_FILTER_SRC | PORT_FILTER_FIELDS,
     .global_initialize = &synscan_global_initialize,
     .prepare_packet = &synscan_prepare_packet,
     .make_packet = &synscan_make_packet,
+    .make_packets = &synscan_make_packets,
     .print_packet = &synscan_print_packet,
     .process_packet = &synscan_process_packet,
+    .classify_packet = &synscan_classify_packet,
     .validate_packet = &synscan_validate_packet,
     .close = NULL,
     .helptext =
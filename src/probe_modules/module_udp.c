@@ -216,6 +216,7 @@ int udp_global_initialize(struct state_conf *conf)
 		udp_template =
 		    udp_template_load(in, in_len, &udp_template_max_len);
 		module_udp.make_packet = udp_make_templated_packet;
+		module_udp.make_packets = NULL;
 	} else if (strncmp(args, "hex", arg_name_len) == 0) {
 		udp_fixed_payload_len = strlen(c) / 2;
 		udp_fixed_payload = xmalloc(udp_fixed_payload_len);
@@ -298,6 +299,9 @@ int udp_prepare_packet(void *buf, macaddr_t *src, macaddr_t *gw, UNUSED void *ar
 		memcpy(payload, udp_fixed_payload, udp_fixed_payload_len);
 	}
 
+	// checksum of the template, updated incrementally in make_packet
+	ip_header->ip_sum = zmap_ip_checksum((unsigned short *)ip_header);
+
 	return EXIT_SUCCESS;
 }
 
@@ -312,22 +316,19 @@ int udp_make_packet(void *buf, size_t *buf_len, ipaddr_n_t src_ip,
 	size_t headers_len = sizeof(struct ether_header) + sizeof(struct ip) +
 			     sizeof(struct udphdr);
 
-	ip_header->ip_src.s_addr = src_ip;
-	ip_header->ip_dst.s_addr = dst_ip;
-	ip_header->ip_ttl = ttl;
+	ip_set_addrs(ip_header, src_ip, dst_ip, NULL);
+	ip_set_ttl_id(ip_header, ttl, ip_id);
 	udp_header->uh_sport =
 	    htons(get_src_port(num_ports, probe_num, validation));
 	udp_header->uh_dport = dport;
 
-	ip_header->ip_id = ip_id;
-	ip_header->ip_sum = 0;
-	ip_header->ip_sum = zmap_ip_checksum((unsigned short *)ip_header);
-
 	// Output the total length of the packet
 	*buf_len = headers_len + udp_fixed_payload_len;
 	return EXIT_SUCCESS;
 }
 
+PROBE_MAKE_PACKETS(udp_make_packets, udp_make_packet)
+
 int udp_make_templated_packet(void *buf, size_t *buf_len, ipaddr_n_t src_ip,
 			      ipaddr_n_t dst_ip, port_n_t dport, uint8_t ttl,
 			      uint32_t *validation, int probe_num, uint16_t ip_id,
@@ -339,9 +340,8 @@ int udp_make_templated_packet(void *buf, size_t *buf_len, ipaddr_n_t src_ip,
 	size_t headers_len = sizeof(struct ether_header) + sizeof(struct ip) +
 			     sizeof(struct udphdr);
 
-	ip_header->ip_src.s_addr = src_ip;
-	ip_header->ip_dst.s_addr = dst_ip;
-	ip_header->ip_ttl = ttl;
+	ip_set_addrs(ip_header, src_ip, dst_ip, NULL);
+	ip_set_ttl_id(ip_header, ttl, ip_id);
 	udp_header->uh_sport =
 	    htons(get_src_port(num_ports, probe_num, validation));
 	udp_header->uh_dport = dport;
@@ -365,14 +365,10 @@ int udp_make_templated_packet(void *buf, size_t *buf_len, ipaddr_n_t src_ip,
 	}
 
 	// Update the IP and UDP headers to match the new payload length
-	ip_header->ip_len =
-	    htons(sizeof(struct ip) + sizeof(struct udphdr) + payload_len);
+	ip_set_len(ip_header, htons(sizeof(struct ip) + sizeof(struct udphdr) +
+				    payload_len));
 	udp_header->uh_ulen = ntohs(sizeof(struct udphdr) + payload_len);
 
-	ip_header->ip_sum = 0;
-	ip_header->ip_id = ip_id;
-	ip_header->ip_sum = zmap_ip_checksum((unsigned short *)ip_header);
-
 	// Recalculate the total length of the packet
 	*buf_len = headers_len + payload_len;
 	return EXIT_SUCCESS;
@@ -447,6 +443,13 @@ void udp_process_packet(const u_char *packet, UNUSED uint32_t len,
 	}
 }
 
+static int udp_classify_packet(const u_char *packet, UNUSED uint32_t len,
+			       UNUSED uint32_t *validation)
+{
+	struct ip *ip_hdr = (struct ip *)&packet[sizeof(struct ether_header)];
+	return ip_hdr->ip_p == IPPROTO_UDP ? PROBE_CLASSIFY_SUCCESS : 0;
+}
+
 int udp_validate_packet(const struct ip *ip_hdr, uint32_t len, uint32_t *src_ip,
 			uint32_t *validation, const struct port_conf *ports)
 {
@@ -950,14 +953,17 @@ probe_module_t module_udp = {
     .pcap_snaplen =
 	MAX_UDP_PAYLOAD_LEN + 20 + 24, // Ether Header, IP Header with Options
     .port_args = 1,
+    .port_filter = PORT_FILTER_DST | PORT_FILTER_FIELDS,
     .global_initialize = &udp_global_initialize,
     .thread_initialize = &udp_init_perthread,
     .prepare_packet = &udp_prepare_packet,
     .make_packet =
 	&udp_make_packet, // can be overridden to udp_make_templated_packet by udp_global_initalize
+    .make_packets = &udp_make_packets, // unset for templated payloads
     .print_packet = &udp_print_packet,
     .validate_packet = &udp_validate_packet,
     .process_packet = &udp_process_packet,
+    .classify_packet = &udp_classify_packet,
     .close = &udp_global_cleanup,
     .helptext = "Probe module that sends UDP packets to hosts. Packets can "
 		"optionally be templated based on destination host. Specify "
@@ -71,6 +71,9 @@ int upnp_prepare_packet(void *buf, macaddr_t *src, macaddr_t *gw,
 	       strlen(upnp_query));
 	strcpy(payload, upnp_query);
 
+	// checksum of the template, updated incrementally in make_packet
+	ip_header->ip_sum = zmap_ip_checksum((unsigned short *)ip_header);
+
 	return EXIT_SUCCESS;
 }
 
@@ -143,23 +146,23 @@ void upnp_process_packet(const u_char *packet, UNUSED uint32_t len,
 				value += (size_t)1;
 			}
 			if (!strcasecmp(key, "server")) {
-				server = strdup(value);
+				server = fs_strdup(value);
 			} else if (!strcasecmp(key, "location")) {
-				location = strdup(value);
+				location = fs_strdup(value);
 			} else if (!strcasecmp(key, "USN")) {
-				usn = strdup(value);
+				usn = fs_strdup(value);
 			} else if (!strcasecmp(key, "EXT")) {
-				ext = strdup(value);
+				ext = fs_strdup(value);
 			} else if (!strcasecmp(key, "ST")) {
-				st = strdup(value);
+				st = fs_strdup(value);
 			} else if (!strcasecmp(key, "Agent")) {
-				agent = strdup(value);
+				agent = fs_strdup(value);
 			} else if (!strcasecmp(key, "X-User-Agent")) {
-				xusragent = strdup(value);
+				xusragent = fs_strdup(value);
 			} else if (!strcasecmp(key, "date")) {
-				date = strdup(value);
+				date = fs_strdup(value);
 			} else if (!strcasecmp(key, "Cache-Control")) {
-				cachecontrol = strdup(value);
+				cachecontrol = fs_strdup(value);
 			} else {
 				// log_debug("upnp-module", "new key: %s", key);
 			}
@@ -260,6 +263,7 @@ probe_module_t module_upnp = {
     .pcap_filter = "udp || icmp",
     .pcap_snaplen = 2048,
     .port_args = 1,
+    .port_filter = PORT_FILTER_DST | PORT_FILTER_SRC | PORT_FILTER_FIELDS,
     .global_initialize = &upnp_global_initialize,
     .prepare_packet = &upnp_prepare_packet,
     .make_packet = &udp_make_packet,
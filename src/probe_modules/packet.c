@@ -272,6 +272,49 @@ void make_udp_header(struct udphdr *udp_header, uint16_t len)
 	udp_header->uh_sum = 0;
 }
 
+int packet_checksums_ok(const void *packetbuf, size_t len)
+{
+	const struct ether_header *ethh = (const struct ether_header *)packetbuf;
+	if (len < sizeof(struct ether_header) + sizeof(struct ip) ||
+	    ethh->ether_type != htons(ETHERTYPE_IP)) {
+		return 1;
+	}
+	struct ip iph;
+	memcpy(&iph, &ethh[1], sizeof(struct ip));
+	uint16_t ip_sum = iph.ip_sum;
+	iph.ip_sum = 0;
+	if (zmap_ip_checksum((unsigned short *)&iph) != ip_sum) {
+		return 0;
+	}
+	size_t ip_hl = 4 * iph.ip_hl;
+	size_t ip_len = ntohs(iph.ip_len);
+	if (ip_len < ip_hl ||
+	    sizeof(struct ether_header) + ip_len > len ||
+	    ip_len > MAX_PACKET_SIZE) {
+		return 1;
+	}
+	// work on a copy so that the checksum field can be cleared
+	uint32_t l4[(MAX_PACKET_SIZE + 3) / 4];
+	size_t l4_len = ip_len - ip_hl;
+	memcpy(l4, (const uint8_t *)&ethh[1] + ip_hl, l4_len);
+	if (iph.ip_p == IPPROTO_TCP && l4_len >= sizeof(struct tcphdr)) {
+		struct tcphdr *tcph = (struct tcphdr *)l4;
+		uint16_t th_sum = tcph->th_sum;
+		tcph->th_sum = 0;
+		return tcp_checksum(l4_len, iph.ip_src.s_addr,
+				    iph.ip_dst.s_addr, tcph) == th_sum;
+	}
+	if (iph.ip_p == IPPROTO_ICMP && l4_len >= ICMP_MINLEN) {
+		struct icmp *icmph = (struct icmp *)l4;
+		uint16_t icmp_cksum = icmph->icmp_cksum;
+		icmph->icmp_cksum = 0;
+		return icmp_checksum((unsigned short *)icmph, l4_len) ==
+		       icmp_cksum;
+	}
+	// UDP checksums are left at 0
+	return 1;
+}
+
 int icmp_helper_validate(const struct ip *ip_hdr, uint32_t len,
 			 size_t min_l4_len, struct ip **probe_pkt,
 			 size_t *probe_len)
@@ -347,9 +390,9 @@ void fs_populate_icmp_from_iphdr(struct ip *ip, size_t len, fieldset_t *fs)
 	// probe to); But we will fix up saddr to be who we sent the
 	// probe to, in case you care.
 	struct ip *ip_inner = get_inner_ip_header(icmp, len);
-	fs_modify_string(fs, "saddr", make_ip_str(ip_inner->ip_dst.s_addr), 1);
+	fs_modify_ipv4(fs, "saddr", ip_inner->ip_dst.s_addr);
 	// Add other ICMP fields from within the header
-	fs_add_string(fs, "icmp_responder", make_ip_str(ip->ip_src.s_addr), 1);
+	fs_add_ipv4(fs, "icmp_responder", ip->ip_src.s_addr);
 	fs_add_uint64(fs, "icmp_type", icmp->icmp_type);
 	fs_add_uint64(fs, "icmp_code", icmp->icmp_code);
 	if (icmp->icmp_code <= ICMP_UNREACH_PRECEDENCE_CUTOFF) {
@@ -360,15 +403,13 @@ void fs_populate_icmp_from_iphdr(struct ip *ip, size_t len, fieldset_t *fs)
 	}
 }
 
-// Note: caller must free return value
+// Note: caller must release return value (fs_release, or add it to a
+// fieldset with free_ set)
 char *make_ip_str(uint32_t ip)
 {
 	struct in_addr t;
 	t.s_addr = ip;
-	const char *temp = inet_ntoa(t);
-	char *retv = xmalloc(strlen(temp) + 1);
-	strcpy(retv, temp);
-	return retv;
+	return fs_strdup(inet_ntoa(t));
 }
 
 const char *icmp_unreach_strings[] = {
@@ -46,7 +46,7 @@
 
 #define ICMP_FIELDSET_FIELDS                                                                             \
 	{.name = "icmp_responder",                                                                       \
-	 .type = "string",                                                                               \
+	 .type = "ip",                                                                                   \
 	 .desc = "Source IP of ICMP_UNREACH messages"},                                                  \
 	    {.name = "icmp_type", .type = "int", .desc = "icmp message type"},                           \
 	    {.name = "icmp_code",                                                                        \
@@ -83,6 +83,7 @@ static inline unsigned short in_checksum(unsigned short *ip_pkt, int len)
 		sum += *((unsigned char *)ip_pkt);
 	}
 	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
 	return (unsigned short)(~sum);
 }
 
@@ -96,6 +97,7 @@ static inline unsigned short in_icmp_checksum(unsigned short *ip_pkt, int len)
 		sum += *((unsigned char *)ip_pkt);
 	}
 	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
 	return (unsigned short)(~sum);
 }
 
@@ -144,6 +146,114 @@ static inline uint16_t tcp_checksum(unsigned short len_tcp, uint32_t saddr,
 	return (unsigned short)(~sum);
 }
 
+// Incremental checksum updates (RFC 1624, eqn. 3)
+//
+// prepare_packet leaves a valid checksum over the packet template in each
+// header. make_packet then only rewrites the per-probe fields, using the
+// helpers below, which patch the checksum with a few adds instead of summing
+// the whole header again. Values are 16-bit words in memory order, as read by
+// in_checksum, so no byte swapping is needed.
+
+static inline uint16_t csum_fold(uint32_t sum)
+{
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	return (uint16_t)sum;
+}
+
+// HC' = ~(~HC + ~m + m')
+static inline uint16_t csum_replace16(uint16_t check, uint16_t old_val,
+				      uint16_t new_val)
+{
+	uint32_t sum = (uint16_t)~check;
+	sum += (uint16_t)~old_val;
+	sum += new_val;
+	return (uint16_t)~csum_fold(sum);
+}
+
+static inline uint16_t csum_replace32(uint16_t check, uint32_t old_val,
+				      uint32_t new_val)
+{
+	uint32_t sum = (uint16_t)~check;
+	sum += (uint16_t)~(old_val & 0xFFFF);
+	sum += (uint16_t)~(old_val >> 16);
+	sum += new_val & 0xFFFF;
+	sum += new_val >> 16;
+	return (uint16_t)~csum_fold(sum);
+}
+
+// Set a 16-bit field covered by *check
+static inline void csum_set16(uint16_t *check, uint16_t *field, uint16_t val)
+{
+	*check = csum_replace16(*check, *field, val);
+	*field = val;
+}
+
+// Set a 32-bit field covered by *check
+static inline void csum_set32(uint16_t *check, uint32_t *field, uint32_t val)
+{
+	*check = csum_replace32(*check, *field, val);
+	*field = val;
+}
+
+// Set the source and destination address of an IPv4 header. l4_check is the
+// checksum of the transport header if its pseudo header covers the addresses
+// (TCP), or NULL.
+static inline void ip_set_addrs(struct ip *iph, ipaddr_n_t src,
+				ipaddr_n_t dst, uint16_t *l4_check)
+{
+	if (l4_check) {
+		*l4_check = csum_replace32(*l4_check, iph->ip_src.s_addr, src);
+		*l4_check = csum_replace32(*l4_check, iph->ip_dst.s_addr, dst);
+	}
+	csum_set32(&iph->ip_sum, &iph->ip_src.s_addr, src);
+	csum_set32(&iph->ip_sum, &iph->ip_dst.s_addr, dst);
+}
+
+static inline void ip_set_ttl_id(struct ip *iph, uint8_t ttl, uint16_t ip_id)
+{
+	// the TTL shares a 16-bit word with the protocol
+	alias_unsigned_short *ttl_word = (alias_unsigned_short *)&iph->ip_ttl;
+	uint16_t old_word = *ttl_word;
+	iph->ip_ttl = ttl;
+	iph->ip_sum = csum_replace16(iph->ip_sum, old_word, *ttl_word);
+	csum_set16(&iph->ip_sum, &iph->ip_id, ip_id);
+}
+
+// len is in network order
+static inline void ip_set_len(struct ip *iph, uint16_t len)
+{
+	csum_set16(&iph->ip_sum, &iph->ip_len, len);
+}
+
+// Defines *name* as a make_packets callback that calls the module's
+// make_packet function *make* for each target. The call is direct, so it is
+// inlined into the loop. A packet that make_packet fails to build is left
+// with length 0 and the callback returns EXIT_FAILURE.
+#define PROBE_MAKE_PACKETS(name, make)                                         \
+	static int name(struct batch_packet *packets, probe_target_t *targets, \
+			int n, void *arg)                                      \
+	{                                                                      \
+		int rc = EXIT_SUCCESS;                                         \
+		for (int i = 0; i < n; i++) {                                  \
+			probe_target_t *t = &targets[i];                       \
+			size_t len = 0;                                        \
+			if (make(packets[i].buf, &len, t->src_ip, t->dst_ip,   \
+				 t->dst_port, t->ttl, t->validation,           \
+				 t->probe_num, t->ip_id,                       \
+				 arg) != EXIT_SUCCESS) {                       \
+				len = 0;                                       \
+				rc = EXIT_FAILURE;                             \
+			}                                                      \
+			packets[i].len = (uint32_t)len;                        \
+		}                                                              \
+		return rc;                                                     \
+	}
+
+// Verify the IPv4 and TCP/ICMP checksums of a packet against a full
+// recomputation. Returns 1 if they match, 0 otherwise.
+int packet_checksums_ok(const void *packetbuf, size_t len);
+
 // Returns 0 if dst_port is outside the expected valid range, non-zero otherwise
 static inline int check_dst_port(uint16_t port, int num_ports,
 				 uint32_t *validation)
@@ -227,7 +337,8 @@ static inline struct ip *get_inner_ip_header(const struct icmp *icmp,
 	return (struct ip *)((char *)icmp + ICMP_UNREACH_HEADER_SIZE);
 }
 
-// Note: caller must free return value
+// Note: caller must release return value (fs_release, or add it to a
+// fieldset with free_ set)
 char *make_ip_str(uint32_t ip);
 
 extern const char *icmp_unreach_strings[];
@@ -69,9 +69,9 @@ void fs_add_ip_fields(fieldset_t *fs, struct ip *ip)
 	// WARNING: you must update fs_ip_fields_len  as well
 	// as the definitions set (ip_fiels) if you
 	// change the fields added below:
-	fs_add_string(fs, "saddr", make_ip_str(ip->ip_src.s_addr), 1);
+	fs_add_ipv4(fs, "saddr", ip->ip_src.s_addr);
 	fs_add_uint64(fs, "saddr_raw", (uint64_t)ip->ip_src.s_addr);
-	fs_add_string(fs, "daddr", make_ip_str(ip->ip_dst.s_addr), 1);
+	fs_add_ipv4(fs, "daddr", ip->ip_dst.s_addr);
 	fs_add_uint64(fs, "daddr_raw", (uint64_t)ip->ip_dst.s_addr);
 	fs_add_uint64(fs, "ipid", ntohs(ip->ip_id));
 	fs_add_uint64(fs, "ttl", ip->ip_ttl);
@@ -84,12 +84,11 @@ void fs_add_system_fields(fieldset_t *fs, int is_repeat, int in_cooldown, const
 	fs_add_bool(fs, "repeat", is_repeat);
 	fs_add_bool(fs, "cooldown", in_cooldown);
 
-	char *timestr = xmalloc(TIMESTR_LEN + 1);
-	char *timestr_ms = xmalloc(TIMESTR_LEN + 1);
+	char timestr[TIMESTR_LEN + 1];
+	char *timestr_ms = fs_alloc(TIMESTR_LEN + 1);
 	struct tm *ptm = localtime(&ts.tv_sec);
 	strftime(timestr, TIMESTR_LEN, "%Y-%m-%dT%H:%M:%S.%%03d%z", ptm);
 	snprintf(timestr_ms, TIMESTR_LEN, timestr, ts.tv_nsec / 1000000);
-	free(timestr);
 	fs_add_string(fs, "timestamp_str", timestr_ms, 1);
 	fs_add_uint64(fs, "timestamp_ts", (uint64_t)ts.tv_sec);
 	fs_add_uint64(fs, "timestamp_us", (uint64_t)(ts.tv_nsec/1000));
@@ -98,13 +97,13 @@ void fs_add_system_fields(fieldset_t *fs, int is_repeat, int in_cooldown, const
 int ip_fields_len = 6;
 fielddef_t ip_fields[] = {
     {.name = "saddr",
-     .type = "string",
+     .type = "ip",
      .desc = "source IP address of response"},
     {.name = "saddr_raw",
      .type = "int",
      .desc = "network order integer form of source IP address"},
     {.name = "daddr",
-     .type = "string",
+     .type = "ip",
      .desc = "destination IP address of response"},
     {.name = "daddr_raw",
      .type = "int",
@@ -16,6 +16,7 @@
 
 #include "../state.h"
 #include "../fieldset.h"
+#include "../validate.h"
 
 #ifndef PROBE_MODULES_H
 #define PROBE_MODULES_H
@@ -73,6 +74,31 @@ typedef int (*probe_make_packet_cb)(void *packetbuf, size_t *buf_len,
 				    uint32_t *validation, int probe_num,
 				    uint16_t ip_id, void *arg);
 
+// Arguments of one make_packet call, see above.
+typedef struct probe_target {
+	ipaddr_n_t src_ip;
+	ipaddr_n_t dst_ip;
+	port_n_t dst_port;
+	uint8_t ttl;
+	uint16_t ip_id;
+	int probe_num;
+	uint32_t validation[VALIDATE_BYTES / sizeof(uint32_t)];
+} probe_target_t;
+
+struct batch_packet;
+
+// The optional make_packets callback builds n packets at once, packet i from
+// targets[i] into packets[i], with the same contract as make_packet. It must
+// set packets[i].len, to 0 for packets it could not build, in which case it
+// returns EXIT_FAILURE and those targets are skipped. Modules that provide
+// it avoid an indirect call per packet and keep their template in cache
+// across the whole batch; PROBE_MAKE_PACKETS in packet.h defines one from
+// make_packet. When not set, the framework calls make_packet for each
+// target instead.
+typedef int (*probe_make_packets_cb)(struct batch_packet *packets,
+				     probe_target_t *targets, int n,
+				     void *arg);
+
 typedef void (*probe_print_packet_cb)(FILE *, void *packetbuf);
 
 typedef int (*probe_close_cb)(struct state_conf *, struct state_send *,
@@ -86,6 +112,29 @@ typedef void (*probe_classify_packet_cb)(const u_char *packetbuf, uint32_t len,
 					 fieldset_t *, uint32_t *validation,
 					 const struct timespec ts);
 
+// Flags for probe_module_t.port_filter, which let the receive path check
+// ports of TCP and UDP responses in the kernel's packet filter.
+// Responses are always addressed to one of our source ports.
+#define PORT_FILTER_DST 1
+// Responses come from one of the scanned ports unless source port
+// validation was disabled with --validate-source-port.
+#define PORT_FILTER_SRC 2
+// Set when sport and dport fields are the response's TCP or UDP ports.
+#define PORT_FILTER_FIELDS 4
+
+// Flags returned by classify_packet.
+#define PROBE_CLASSIFY_SUCCESS 1
+#define PROBE_CLASSIFY_APP_SUCCESS 2
+
+// The optional classify_packet callback is passed the same buffer as
+// process_packet and returns PROBE_CLASSIFY_SUCCESS when process_packet would
+// set "success", plus PROBE_CLASSIFY_APP_SUCCESS when it would set
+// "app_success", without building any fields. It must agree with
+// process_packet. In default mode, the receive path uses it to decide whether
+// a response will be output at all before paying for process_packet.
+typedef int (*probe_classify_cb)(const u_char *packetbuf, uint32_t len,
+				 uint32_t *validation);
+
 typedef struct probe_module {
 	const char *name;
 
@@ -100,14 +149,18 @@ typedef struct probe_module {
 	// Should ZMap complain if the user hasn't specified valid
 	// source and target port numbers?
 	uint8_t port_args;
+	// PORT_FILTER_* flags, see above
+	uint8_t port_filter;
 
 	probe_global_init_cb global_initialize;
 	probe_thread_init_cb thread_initialize;
 	probe_prepare_packet_cb prepare_packet;
 	probe_make_packet_cb make_packet;
+	probe_make_packets_cb make_packets;
 	probe_print_packet_cb print_packet;
 	probe_validate_packet_cb validate_packet;
 	probe_classify_packet_cb process_packet;
+	probe_classify_cb classify_packet;
 	probe_close_cb close;
 	int output_type;
 	fielddef_t *fields;
@@ -9,12 +9,35 @@
 #ifndef ZMAP_RECV_INTERNAL_H
 #define ZMAP_RECV_INTERNAL_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <time.h>
+
+struct recv_packet {
+	const uint8_t *bytes;
+	uint32_t len;
+	struct timespec ts;
+};
 
 void handle_packet(uint32_t buflen, const uint8_t *bytes,
 		   const struct timespec ts);
-void recv_init(void);
-void recv_packets(void);
-void recv_cleanup(void);
+// Same as calling handle_packet for each packet, but generates the
+// validation of several packets at once.
+void handle_packets(const struct recv_packet *packets, uint32_t n);
+#define BPFLEN 1024
+// Writes the BPF filter expression that selects responses to the probe
+// module's packets (and excludes our own outgoing frames) into buf, which
+// must hold at least BPFLEN bytes.
+void recv_bpf_filter(char *buf, size_t len);
+#if defined(__linux__)
+// Joins a packet socket to this process's PACKET_FANOUT group, so that the
+// kernel spreads responses over the receive threads by flow hash.
+void recv_join_fanout_group(int fd);
+#endif
+// Capture backend. thread_id is in [0, zconf.receivers); backends that do
+// not support multiple receive threads are only called with thread_id 0.
+void recv_init(uint8_t thread_id);
+void recv_packets(uint8_t thread_id);
+void recv_cleanup(uint8_t thread_id);
 
 #endif /* ZMAP_RECV_INTERNAL_H */
@@ -247,7 +247,7 @@ wait_for_e2e_connectivity(void)
 			log_debug("recv-netmap", "Sent ICMP echo request");
 		}
 
-		recv_packets();
+		recv_packets(0);
 	}
 }
 
@@ -258,7 +258,7 @@ static if_stats_ctx_t *stats_ctx;
 static bool need_recv_counter;
 static uint64_t recv_counter;
 
-void recv_init(void)
+void recv_init(UNUSED uint8_t thread_id)
 {
 	fds.fd = zconf.nm.nm_fd;
 	fds.events = POLLIN;
@@ -289,7 +289,7 @@ void recv_init(void)
 	}
 }
 
-void recv_cleanup(void)
+void recv_cleanup(UNUSED uint8_t thread_id)
 {
 	if_stats_fini(stats_ctx);
 	stats_ctx = NULL;
@@ -298,7 +298,7 @@ void recv_cleanup(void)
 	nm_if = NULL;
 }
 
-void recv_packets(void)
+void recv_packets(UNUSED uint8_t thread_id)
 {
 	// On Linux, EINTR seems to happen here once at startup.
 	// Haven't seen any EINTR on FreeBSD.  Retry is not wrong
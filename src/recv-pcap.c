@@ -32,7 +32,8 @@
 #define PCAP_PROMISC 1
 #define PCAP_TIMEOUT 100
 
-static pcap_t *pc = NULL;
+// one capture handle per receive thread
+static pcap_t *pcs[MAX_RECEIVERS];
 
 void packet_cb(u_char __attribute__((__unused__)) * user,
 	       const struct pcap_pkthdr *p, const u_char *bytes)
@@ -55,14 +56,12 @@ void packet_cb(u_char __attribute__((__unused__)) * user,
 	handle_packet(buflen, bytes, ts);
 }
 
-#define BPFLEN 1024
-
-void recv_init(void)
+static pcap_t *open_capture(void)
 {
 	char bpftmp[BPFLEN];
 	char errbuf[PCAP_ERRBUF_SIZE];
 
-	pc = pcap_open_live(zconf.iface, zconf.probe_module->pcap_snaplen,
+	pcap_t *pc = pcap_open_live(zconf.iface, zconf.probe_module->pcap_snaplen,
 			    PCAP_PROMISC, PCAP_TIMEOUT, errbuf);
 	if (pc == NULL) {
 		log_fatal("recv", "could not open device %s: %s", zconf.iface,
@@ -93,26 +92,7 @@ void recv_init(void)
 	}
 
 	struct bpf_program bpf;
-
-	if (!zconf.send_ip_pkts) {
-		snprintf(bpftmp, sizeof(bpftmp) - 1,
-			 "not ether src %02x:%02x:%02x:%02x:%02x:%02x",
-			 zconf.hw_mac[0], zconf.hw_mac[1], zconf.hw_mac[2],
-			 zconf.hw_mac[3], zconf.hw_mac[4], zconf.hw_mac[5]);
-		assert(strlen(zconf.probe_module->pcap_filter) + 10 <
-		       (BPFLEN - strlen(bpftmp)));
-	} else {
-		bpftmp[0] = 0;
-	}
-	if (zconf.probe_module->pcap_filter) {
-		if (!zconf.send_ip_pkts) {
-			strcat(bpftmp, " and (");
-		} else {
-			strcat(bpftmp, "(");
-		}
-		strcat(bpftmp, zconf.probe_module->pcap_filter);
-		strcat(bpftmp, ")");
-	}
+	recv_bpf_filter(bpftmp, sizeof(bpftmp));
 	if (strcmp(bpftmp, "")) {
 		if (pcap_compile(pc, &bpf, bpftmp, 1, 0) < 0) {
 			log_fatal("recv", "couldn't compile filter");
@@ -127,11 +107,25 @@ void recv_init(void)
 	if (pcap_setnonblock(pc, 1, errbuf) == -1) {
 		log_fatal("recv", "pcap_setnonblock error:%s", errbuf);
 	}
+	return pc;
+}
+
+void recv_init(uint8_t thread_id)
+{
+	assert(thread_id < MAX_RECEIVERS);
+	pcs[thread_id] = open_capture();
+	if (zconf.receivers > 1) {
+#if defined __linux__ && __linux__
+		recv_join_fanout_group(pcap_fileno(pcs[thread_id]));
+#else
+		log_fatal("recv", "multiple receive threads require Linux");
+#endif
+	}
 }
 
-void recv_packets(void)
+void recv_packets(uint8_t thread_id)
 {
-	int ret = pcap_dispatch(pc, -1, packet_cb, NULL);
+	int ret = pcap_dispatch(pcs[thread_id], -1, packet_cb, NULL);
 	if (ret == -1) {
 		log_fatal("recv", "pcap_dispatch error");
 	} else if (ret == 0) {
@@ -139,26 +133,34 @@ void recv_packets(void)
 	}
 }
 
-void recv_cleanup(void)
+void recv_cleanup(uint8_t thread_id)
 {
-	pcap_close(pc);
-	pc = NULL;
+	pcap_close(pcs[thread_id]);
+	pcs[thread_id] = NULL;
 }
 
 int recv_update_stats(void)
 {
-	if (!pc) {
+	if (!pcs[0]) {
 		return EXIT_FAILURE;
 	}
-	struct pcap_stat pcst;
-	if (pcap_stats(pc, &pcst)) {
-		log_error("recv", "unable to retrieve pcap statistics: %s",
-			  pcap_geterr(pc));
-		return EXIT_FAILURE;
-	} else {
-		zrecv.pcap_recv = pcst.ps_recv;
-		zrecv.pcap_drop = pcst.ps_drop;
-		zrecv.pcap_ifdrop = pcst.ps_ifdrop;
+	uint64_t recv = 0, drop = 0, ifdrop = 0;
+	for (int i = 0; i < zconf.receivers; i++) {
+		struct pcap_stat pcst;
+		if (!pcs[i]) {
+			continue;
+		}
+		if (pcap_stats(pcs[i], &pcst)) {
+			log_error("recv", "unable to retrieve pcap statistics: %s",
+				  pcap_geterr(pcs[i]));
+			return EXIT_FAILURE;
+		}
+		recv += pcst.ps_recv;
+		drop += pcst.ps_drop;
+		ifdrop += pcst.ps_ifdrop;
 	}
+	zrecv.pcap_recv = recv;
+	zrecv.pcap_drop = drop;
+	zrecv.pcap_ifdrop = ifdrop;
 	return EXIT_SUCCESS;
 }
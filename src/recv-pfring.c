@@ -22,7 +22,7 @@
 static pfring_zc_pkt_buff *pf_buffer;
 static pfring_zc_queue *pf_recv;
 
-void recv_init()
+void recv_init(UNUSED uint8_t thread_id)
 {
 	// Get the socket and packet handle
 	pf_recv = zconf.pf.recv;
@@ -34,7 +34,7 @@ void recv_init()
 	zconf.data_link_size = sizeof(struct ether_header);
 }
 
-void recv_cleanup()
+void recv_cleanup(UNUSED uint8_t thread_id)
 {
 	if (!pf_recv) {
 		return;
@@ -42,7 +42,7 @@ void recv_cleanup()
 	pfring_zc_sync_queue(pf_recv, rx_only);
 }
 
-void recv_packets()
+void recv_packets(UNUSED uint8_t thread_id)
 {
 	int ret = pfring_zc_recv_pkt(pf_recv, &pf_buffer, 0);
 	// Empty queue, return to let outer loop check for termination
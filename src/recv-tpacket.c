@@ -0,0 +1,308 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#if !defined(__linux__)
+#error "TPACKET requires Linux"
+#endif
+
+#include "recv.h"
+#include "recv-internal.h"
+#include "state.h"
+
+#include "../lib/includes.h"
+#include "../lib/logger.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include <pcap/pcap.h>
+
+#include "probe_modules/probe_modules.h"
+
+// Frames in a TPACKET_V3 block are variable length, so the frame size only
+// matters for the kernel's bookkeeping. It has to divide the block size.
+#define RX_RING_FRAME_SIZE 2048
+// how long the kernel may hold a partially filled block before handing it
+// to us anyway, which bounds the added latency when responses are sparse
+#define RX_RING_RETIRE_TIMEOUT_MS 10
+// same as the libpcap read timeout the pcap backend uses
+#define RX_RING_POLL_TIMEOUT_MS 100
+// packets handed to handle_packets at once
+#define RX_RING_BATCH 64
+
+struct rx_ring {
+	int fd;
+	uint8_t *map;
+	size_t map_len;
+	uint32_t block_size;
+	uint32_t block_nr;
+	// next block we expect the kernel to hand us
+	uint32_t cur;
+};
+
+static struct rx_ring rings[MAX_RECEIVERS];
+
+// PACKET_STATISTICS resets the kernel's counters on every read, so they
+// are accumulated here across calls to recv_update_stats.
+static uint64_t total_packets;
+static uint64_t total_drops;
+
+static int datalink_type(int fd)
+{
+	struct ifreq ifr;
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, zconf.iface, IFNAMSIZ - 1);
+	if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+		log_fatal("recv", "unable to get link type of %s: %s",
+			  zconf.iface, strerror(errno));
+	}
+	switch (ifr.ifr_hwaddr.sa_family) {
+	case ARPHRD_ETHER:
+	case ARPHRD_LOOPBACK:
+		log_debug("recv", "Data link layer Ethernet");
+		zconf.data_link_size = sizeof(struct ether_header);
+		return DLT_EN10MB;
+	case ARPHRD_NONE:
+	case ARPHRD_PPP:
+#ifdef ARPHRD_RAWIP
+	case ARPHRD_RAWIP:
+#endif
+		log_info("recv", "Data link RAW");
+		zconf.data_link_size = 0;
+		return DLT_RAW;
+	default:
+		log_error("recv", "unknown data link layer: %u",
+			  ifr.ifr_hwaddr.sa_family);
+		return DLT_EN10MB;
+	}
+}
+
+// Compiles the probe module's filter with libpcap and attaches the result
+// to the socket in the kernel.
+static void attach_filter(int fd, int linktype)
+{
+	char bpftmp[BPFLEN];
+	recv_bpf_filter(bpftmp, sizeof(bpftmp));
+	if (!strcmp(bpftmp, "")) {
+		return;
+	}
+	pcap_t *dead =
+	    pcap_open_dead(linktype, zconf.probe_module->pcap_snaplen);
+	if (!dead) {
+		log_fatal("recv", "unable to create pcap handle for filter");
+	}
+	struct bpf_program bpf;
+	if (pcap_compile(dead, &bpf, bpftmp, 1, PCAP_NETMASK_UNKNOWN) < 0) {
+		log_fatal("recv", "couldn't compile filter: %s",
+			  pcap_geterr(dead));
+	}
+	struct sock_fprog prog = {
+	    .len = (unsigned short)bpf.bf_len,
+	    .filter = (struct sock_filter *)bpf.bf_insns,
+	};
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+		       sizeof(prog)) < 0) {
+		log_fatal("recv", "couldn't install filter: %s",
+			  strerror(errno));
+	}
+	pcap_freecode(&bpf);
+	pcap_close(dead);
+}
+
+void recv_init(uint8_t thread_id)
+{
+	assert(thread_id < MAX_RECEIVERS);
+	struct rx_ring *r = &rings[thread_id];
+	memset(r, 0, sizeof(*r));
+	// the socket is created for no protocol, so that nothing is queued on
+	// it before the filter is attached and the ring is set up
+	r->fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (r->fd < 0) {
+		log_fatal("recv", "unable to open packet socket: %s",
+			  strerror(errno));
+	}
+	attach_filter(r->fd, datalink_type(r->fd));
+#ifdef PACKET_IGNORE_OUTGOING
+	// our own probes never need to be looked at; older kernels lack this
+	// and rely on the filter instead
+	int one = 1;
+	setsockopt(r->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one,
+		   sizeof(one));
+#endif
+
+	int version = TPACKET_V3;
+	if (setsockopt(r->fd, SOL_PACKET, PACKET_VERSION, &version,
+		       sizeof(version)) < 0) {
+		log_fatal("recv", "unable to set TPACKET_V3: %s",
+			  strerror(errno));
+	}
+	struct tpacket_req3 req;
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = zconf.rx_ring_block_size;
+	req.tp_block_nr = zconf.rx_ring_blocks;
+	req.tp_frame_size = RX_RING_FRAME_SIZE;
+	req.tp_frame_nr =
+	    (req.tp_block_size / RX_RING_FRAME_SIZE) * req.tp_block_nr;
+	req.tp_retire_blk_tov = RX_RING_RETIRE_TIMEOUT_MS;
+	if (setsockopt(r->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) <
+	    0) {
+		log_fatal("recv", "unable to create PACKET_RX_RING: %s",
+			  strerror(errno));
+	}
+	r->block_size = req.tp_block_size;
+	r->block_nr = req.tp_block_nr;
+	r->map_len = (size_t)r->block_size * r->block_nr;
+	r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_LOCKED, r->fd, 0);
+	if (r->map == MAP_FAILED) {
+		// locking the ring is only an optimization
+		r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE,
+			      MAP_SHARED, r->fd, 0);
+	}
+	if (r->map == MAP_FAILED) {
+		log_fatal("recv", "unable to mmap PACKET_RX_RING: %s",
+			  strerror(errno));
+	}
+
+	struct sockaddr_ll sll;
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = if_nametoindex(zconf.iface);
+	if (!sll.sll_ifindex) {
+		log_fatal("recv", "could not open device %s: %s", zconf.iface,
+			  strerror(errno));
+	}
+	if (bind(r->fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		log_fatal("recv", "unable to bind packet socket to %s: %s",
+			  zconf.iface, strerror(errno));
+	}
+	if (zconf.receivers > 1) {
+		recv_join_fanout_group(r->fd);
+	}
+	log_debug("recv", "RX ring %u set up with %u blocks of %u bytes",
+		  thread_id, r->block_nr, r->block_size);
+}
+
+void recv_cleanup(uint8_t thread_id)
+{
+	struct rx_ring *r = &rings[thread_id];
+	if (r->map) {
+		munmap(r->map, r->map_len);
+		r->map = NULL;
+		close(r->fd);
+	}
+}
+
+static inline struct tpacket_block_desc *rx_ring_block(struct rx_ring *r,
+						       uint32_t idx)
+{
+	return (struct tpacket_block_desc *)(r->map +
+					     (size_t)idx * r->block_size);
+}
+
+static inline int block_ready(struct tpacket_block_desc *b)
+{
+	return __atomic_load_n(&b->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+	       TP_STATUS_USER;
+}
+
+// Hands every packet in a retired block to handle_packets, in batches.
+static void recv_block(struct tpacket_block_desc *b)
+{
+	struct recv_packet packets[RX_RING_BATCH];
+	uint32_t n = 0;
+	uint32_t num_pkts = b->hdr.bh1.num_pkts;
+	struct tpacket3_hdr *hdr =
+	    (struct tpacket3_hdr *)((uint8_t *)b +
+				    b->hdr.bh1.offset_to_first_pkt);
+	for (uint32_t i = 0; i < num_pkts; i++) {
+		packets[n].bytes = (uint8_t *)hdr + hdr->tp_mac;
+		packets[n].len = hdr->tp_snaplen;
+		packets[n].ts.tv_sec = hdr->tp_sec;
+		packets[n].ts.tv_nsec = hdr->tp_nsec;
+		if (++n == RX_RING_BATCH) {
+			handle_packets(packets, n);
+			n = 0;
+		}
+		hdr = (struct tpacket3_hdr *)((uint8_t *)hdr +
+					      hdr->tp_next_offset);
+	}
+	if (n) {
+		handle_packets(packets, n);
+	}
+}
+
+void recv_packets(uint8_t thread_id)
+{
+	struct rx_ring *r = &rings[thread_id];
+	struct tpacket_block_desc *b = rx_ring_block(r, r->cur);
+	if (!block_ready(b)) {
+		struct pollfd pfd = {
+		    .fd = r->fd, .events = POLLIN | POLLERR, .revents = 0};
+		int ret = poll(&pfd, 1, RX_RING_POLL_TIMEOUT_MS);
+		if (ret < 0 && errno != EINTR) {
+			log_error("recv", "poll(POLLIN) failed: %d: %s", errno,
+				  strerror(errno));
+		}
+		if (!block_ready(b)) {
+			return;
+		}
+	}
+	// drain everything that is ready, but give the caller a chance to
+	// flush counters and check for completion at least once per lap
+	for (uint32_t i = 0; i < r->block_nr && block_ready(b); i++) {
+		recv_block(b);
+		__atomic_store_n(&b->hdr.bh1.block_status, TP_STATUS_KERNEL,
+				 __ATOMIC_RELEASE);
+		r->cur = (r->cur + 1) % r->block_nr;
+		b = rx_ring_block(r, r->cur);
+	}
+}
+
+int recv_update_stats(void)
+{
+	if (!rings[0].map) {
+		return EXIT_FAILURE;
+	}
+	for (int i = 0; i < zconf.receivers; i++) {
+		struct tpacket_stats_v3 st;
+		socklen_t len = sizeof(st);
+		if (!rings[i].map) {
+			continue;
+		}
+		if (getsockopt(rings[i].fd, SOL_PACKET, PACKET_STATISTICS, &st,
+			       &len) < 0) {
+			log_error("recv", "unable to retrieve ring statistics: %s",
+				  strerror(errno));
+			return EXIT_FAILURE;
+		}
+		__atomic_fetch_add(&total_packets, st.tp_packets,
+				   __ATOMIC_RELAXED);
+		__atomic_fetch_add(&total_drops, st.tp_drops, __ATOMIC_RELAXED);
+	}
+	zrecv.pcap_recv = __atomic_load_n(&total_packets, __ATOMIC_RELAXED);
+	// packets the kernel had to drop because every block of the ring was
+	// still waiting to be processed
+	zrecv.pcap_drop = __atomic_load_n(&total_drops, __ATOMIC_RELAXED);
+	zrecv.pcap_ifdrop = 0;
+	return EXIT_SUCCESS;
+}
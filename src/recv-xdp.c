@@ -0,0 +1,152 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#if !defined(__linux__)
+#error "XDP requires Linux"
+#endif
+
+#include "recv.h"
+#include "recv-internal.h"
+#include "socket-xdp.h"
+#include "state.h"
+
+#include "../lib/includes.h"
+#include "../lib/logger.h"
+#include "../lib/xalloc.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <linux/if_xdp.h>
+
+// maximum number of descriptors consumed from one RX ring per poll
+#define XDP_RX_BATCH 64
+
+static struct pollfd *fds;
+static uint32_t num_fds;
+static uint64_t recv_counter;
+
+void recv_init(UNUSED uint8_t thread_id)
+{
+	zconf.data_link_size = sizeof(struct ether_header);
+	num_fds = zconf.xdp.num_queues;
+	fds = xcalloc(num_fds ? num_fds : 1, sizeof(struct pollfd));
+	for (uint32_t i = 0; i < num_fds; i++) {
+		fds[i].fd = xsk_socket__fd(zconf.xdp.queues[i]->xsk);
+		fds[i].events = POLLIN;
+	}
+	recv_counter = 0;
+}
+
+void recv_cleanup(UNUSED uint8_t thread_id)
+{
+	free(fds);
+	fds = NULL;
+	num_fds = 0;
+}
+
+// Hands every received frame on the queue's RX ring straight to
+// handle_packets and returns the frames to the kernel through the fill ring.
+static void recv_queue(struct xdp_queue *q, struct timespec ts)
+{
+	uint32_t idx_rx;
+	uint32_t n = xsk_ring_cons__peek(&q->rx, XDP_RX_BATCH, &idx_rx);
+	if (n == 0) {
+		return;
+	}
+	struct recv_packet packets[XDP_RX_BATCH];
+	for (uint32_t i = 0; i < n; i++) {
+		const struct xdp_desc *desc =
+		    xsk_ring_cons__rx_desc(&q->rx, idx_rx + i);
+		packets[i].bytes = xsk_umem__get_data(q->umem_area, desc->addr);
+		packets[i].len = desc->len;
+		packets[i].ts = ts;
+	}
+	handle_packets(packets, n);
+	recv_counter += n;
+
+	// all RX frames are either on the fill ring or in our hands, and the
+	// fill ring is as large as the RX part of the UMEM, so this succeeds
+	uint32_t idx_fill;
+	if (xsk_ring_prod__reserve(&q->fill, n, &idx_fill) != n) {
+		log_fatal("recv-xdp", "fill ring of queue %u overflowed",
+			  q->queue_id);
+	}
+	for (uint32_t i = 0; i < n; i++) {
+		const struct xdp_desc *desc =
+		    xsk_ring_cons__rx_desc(&q->rx, idx_rx + i);
+		*xsk_ring_prod__fill_addr(&q->fill, idx_fill + i) =
+		    xsk_umem__extract_addr(desc->addr);
+	}
+	xsk_ring_prod__submit(&q->fill, n);
+	xsk_ring_cons__release(&q->rx, n);
+	if (xsk_ring_prod__needs_wakeup(&q->fill)) {
+		recvfrom(xsk_socket__fd(q->xsk), NULL, 0, MSG_DONTWAIT, NULL,
+			 NULL);
+	}
+}
+
+void recv_packets(UNUSED uint8_t thread_id)
+{
+	if (num_fds == 0) {
+		// dryrun, no queue pairs are bound
+		usleep(1000);
+		return;
+	}
+	int ret = poll(fds, num_fds, 100 /* ms */);
+	if (ret == 0) {
+		return;
+	} else if (ret < 0) {
+		if (errno != EINTR) {
+			log_error("recv-xdp", "poll(POLLIN) failed: %d: %s",
+				  errno, strerror(errno));
+		}
+		return;
+	}
+	// AF_XDP descriptors carry no timestamp
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	for (uint32_t i = 0; i < num_fds; i++) {
+		if (fds[i].revents & POLLIN) {
+			recv_queue(zconf.xdp.queues[i], ts);
+		}
+	}
+}
+
+int recv_update_stats(void)
+{
+	if (!fds) {
+		return EXIT_FAILURE;
+	}
+	uint64_t drop = 0;
+	uint64_t ifdrop = 0;
+	for (uint32_t i = 0; i < num_fds; i++) {
+		struct xdp_statistics stats;
+		socklen_t optlen = sizeof(stats);
+		memset(&stats, 0, sizeof(stats));
+		if (getsockopt(fds[i].fd, SOL_XDP, XDP_STATISTICS, &stats,
+			       &optlen)) {
+			log_error("recv-xdp",
+				  "unable to retrieve XDP statistics: %s",
+				  strerror(errno));
+			return EXIT_FAILURE;
+		}
+		// dropped because the RX ring was full or the frame invalid
+		drop += stats.rx_dropped + stats.rx_ring_full;
+		// dropped by the driver because we were out of fill frames
+		ifdrop += stats.rx_fill_ring_empty_descs;
+	}
+	zrecv.pcap_recv = recv_counter;
+	zrecv.pcap_drop = drop;
+	zrecv.pcap_ifdrop = ifdrop;
+	return EXIT_SUCCESS;
+}
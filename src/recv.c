@@ -11,13 +11,20 @@
 #include <assert.h>
 
 #include "../lib/includes.h"
-#include "cachehash.h"
+#include "../lib/dedup_window.h"
+#include "../lib/rbm.h"
 #include "../lib/util.h"
 #include "../lib/logger.h"
 #include "../lib/pbm.h"
+#include "../lib/xalloc.h"
 
+#include <errno.h>
 #include <pthread.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#endif
 
 #include "recv-internal.h"
 #include "state.h"
@@ -25,75 +32,237 @@
 #include "fieldset.h"
 #include "shard.h"
 #include "expression.h"
+#include "filter.h"
 #include "probe_modules/packet.h"
 #include "probe_modules/probe_modules.h"
 #include "output_modules/output_modules.h"
+#include "output_stage.h"
 
-static u_char fake_eth_hdr[65535];
-// bitmap of observed IP addresses
+static _Thread_local u_char fake_eth_hdr[65535];
+
+// size of the chunks of each receive thread's fieldset arena, enough for a
+// few fieldsets and their strings
+#define RECV_ARENA_CHUNK_SIZE (64 * 1024)
+
+// Response counters are accumulated per receive thread and folded into
+// zrecv after each capture batch, so that threads do not bounce the
+// shared counters between cores on every packet.
+struct recv_counters {
+	uint64_t success_total;
+	uint64_t success_unique;
+	uint64_t app_success_total;
+	uint64_t app_success_unique;
+	uint64_t cooldown_total;
+	uint64_t cooldown_unique;
+	uint64_t failure_total;
+	uint64_t validation_passed;
+	uint64_t validation_failed;
+	uint32_t ip_fragments;
+};
+static _Thread_local struct recv_counters counters;
+
+// Duplicate suppression state is split into shards selected by a hash of
+// the source address. With a single receive thread there is one shard.
+#define DEDUP_SHARDS 64
+struct dedup_shard {
+	pthread_mutex_t lock;
+	// recently seen (ip, port) pairs, for DEDUP_METHOD_WINDOW
+	dedup_window_t *window;
+	// every (ip, port) pair that responded successfully, for
+	// DEDUP_METHOD_FULL when more than one port is scanned
+	rbm_t *responders;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+static struct dedup_shard *dedup_shards = NULL;
+static uint32_t num_dedup_shards = 0;
+// bitmap of observed IP addresses, for DEDUP_METHOD_FULL. Each /16 page
+// is only ever touched under the lock of the shard its prefix maps to.
 static uint8_t **seen = NULL;
-static cachehash *ch = NULL;
 
-void handle_packet(uint32_t buflen, const u_char *bytes,
-		   const struct timespec ts)
+// index of the calling receive thread, and of its queue into the output
+// stage
+static _Thread_local uint8_t recv_thread_id;
+
+static void dedup_init(void)
+{
+	num_dedup_shards = zconf.receivers > 1 ? DEDUP_SHARDS : 1;
+	dedup_shards = xmalloc_aligned(
+	    CACHE_LINE_SIZE, num_dedup_shards * sizeof(struct dedup_shard));
+	for (uint32_t i = 0; i < num_dedup_shards; i++) {
+		pthread_mutex_init(&dedup_shards[i].lock, NULL);
+		dedup_shards[i].window = NULL;
+		dedup_shards[i].responders = NULL;
+		if (zconf.dedup_method == DEDUP_METHOD_FULL &&
+		    zconf.ports->port_count > 1) {
+			dedup_shards[i].responders = rbm_init();
+		}
+		if (zconf.dedup_method == DEDUP_METHOD_WINDOW) {
+			dedup_shards[i].window = dedup_window_init(
+			    zconf.dedup_window_memory / num_dedup_shards);
+		}
+	}
+	if (zconf.dedup_file) {
+		seen = pbm_map_file(zconf.dedup_file);
+	} else if (zconf.dedup_method == DEDUP_METHOD_FULL &&
+		   zconf.ports->port_count == 1) {
+		seen = pbm_init();
+	}
+}
+
+static struct dedup_shard *dedup_shard_for(uint32_t key)
+{
+	uint32_t h = key * 2654435761u;
+	return &dedup_shards[((uint64_t)h * num_dedup_shards) >> 32];
+}
+
+// Returns whether src_ip (and, in window mode or with several ports,
+// src_port) has been seen before. In full mode a target is only recorded
+// once it has produced a successful response; in window mode every
+// validated response is.
+static int dedup_check(uint32_t src_ip, uint16_t src_port, int is_success)
+{
+	int is_repeat = 0;
+	if (zconf.dedup_method == DEDUP_METHOD_FULL && !seen) {
+		uint32_t ip = ntohl(src_ip);
+		uint16_t port = ntohs(src_port);
+		// same key as the containers in the set, so that each of
+		// them is only ever touched under one lock
+		struct dedup_shard *d =
+		    dedup_shard_for(((uint32_t)port << 16) | (ip >> 16));
+		pthread_mutex_lock(&d->lock);
+		is_repeat = rbm_check(d->responders, ip, port);
+		if (is_success && !is_repeat) {
+			rbm_set(d->responders, ip, port);
+		}
+		pthread_mutex_unlock(&d->lock);
+	} else if (zconf.dedup_file) {
+		// shared with other processes, so bits are set atomically
+		// rather than under a shard lock
+		uint32_t ip = ntohl(src_ip);
+		if (is_success) {
+			is_repeat = pbm_test_and_set(seen, ip);
+		} else {
+			is_repeat = pbm_check(seen, ip);
+		}
+	} else if (zconf.dedup_method == DEDUP_METHOD_FULL) {
+		uint32_t ip = ntohl(src_ip);
+		struct dedup_shard *d = dedup_shard_for(ip >> 16);
+		pthread_mutex_lock(&d->lock);
+		is_repeat = pbm_check(seen, ip);
+		if (is_success && !is_repeat) {
+			pbm_set(seen, ip);
+		}
+		pthread_mutex_unlock(&d->lock);
+	} else if (zconf.dedup_method == DEDUP_METHOD_WINDOW) {
+		struct dedup_shard *d = dedup_shard_for(src_ip);
+		pthread_mutex_lock(&d->lock);
+		is_repeat = dedup_window_check(d->window, src_ip, src_port);
+		pthread_mutex_unlock(&d->lock);
+	}
+	return is_repeat;
+}
+
+// Reserves one of the --max-results slots. Returns 0 once they are gone.
+static int claim_result(void)
+{
+	uint64_t cur = __atomic_load_n(&zrecv.filter_success, __ATOMIC_RELAXED);
+	do {
+		if (cur >= zconf.max_results) {
+			return 0;
+		}
+	} while (!__atomic_compare_exchange_n(&zrecv.filter_success, &cur,
+					      cur + 1, 1, __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+	return 1;
+}
+
+#define FLUSH_COUNTER(name)                                                    \
+	do {                                                                   \
+		if (counters.name) {                                           \
+			__atomic_fetch_add(&zrecv.name, counters.name,         \
+					   __ATOMIC_RELAXED);                  \
+			counters.name = 0;                                     \
+		}                                                              \
+	} while (0)
+
+// Folds this thread's counters into zrecv.
+static void flush_counters(void)
+{
+	FLUSH_COUNTER(success_unique);
+	FLUSH_COUNTER(success_total);
+	FLUSH_COUNTER(app_success_total);
+	FLUSH_COUNTER(app_success_unique);
+	FLUSH_COUNTER(cooldown_total);
+	FLUSH_COUNTER(cooldown_unique);
+	FLUSH_COUNTER(failure_total);
+	FLUSH_COUNTER(validation_passed);
+	FLUSH_COUNTER(validation_failed);
+	FLUSH_COUNTER(ip_fragments);
+}
+
+// Locates the IP header and the source port of a response. Returns 0 if
+// the buffer is too short to hold an IP header.
+static int parse_response(uint32_t buflen, const u_char *bytes,
+			  struct ip **ip_hdr, uint32_t *len_ip_and_payload,
+			  uint16_t *src_port)
 {
 	if ((sizeof(struct ip) + zconf.data_link_size) > buflen) {
 		// buffer not large enough to contain ethernet
 		// and ip headers. further action would overrun buf
-		return;
+		return 0;
 	}
-	struct ip *ip_hdr = (struct ip *)&bytes[zconf.data_link_size];
-	uint32_t src_ip = ip_hdr->ip_src.s_addr;
-	uint16_t src_port = 0;
+	*ip_hdr = (struct ip *)&bytes[zconf.data_link_size];
+	*src_port = 0;
 
-	uint32_t len_ip_and_payload =
+	*len_ip_and_payload =
 	    buflen - (zconf.send_ip_pkts ? 0 : sizeof(struct ether_header));
 	// extract port if TCP or UDP packet to both generate validation data and to
 	// check if the response is a duplicate
-	if (ip_hdr->ip_p == IPPROTO_TCP) {
-		struct tcphdr *tcp = get_tcp_header(ip_hdr, len_ip_and_payload);
+	if ((*ip_hdr)->ip_p == IPPROTO_TCP) {
+		struct tcphdr *tcp = get_tcp_header(*ip_hdr, *len_ip_and_payload);
 		if (tcp) {
-			src_port = tcp->th_sport;
+			*src_port = tcp->th_sport;
 		}
-	} else if (ip_hdr->ip_p == IPPROTO_UDP) {
-		struct udphdr *udp = get_udp_header(ip_hdr, len_ip_and_payload);
+	} else if ((*ip_hdr)->ip_p == IPPROTO_UDP) {
+		struct udphdr *udp = get_udp_header(*ip_hdr, *len_ip_and_payload);
 		if (udp) {
-			src_port = udp->uh_sport;
+			*src_port = udp->uh_sport;
 		}
 	}
+	return 1;
+}
 
-	uint32_t validation[VALIDATE_BYTES / sizeof(uint32_t)];
-	// TODO: for TTL exceeded messages, ip_hdr->saddr is going to be
-	// different and we must calculate off potential payload message instead
-	validate_gen(ip_hdr->ip_dst.s_addr, ip_hdr->ip_src.s_addr, src_port,
-		     (uint8_t *)validation);
+// Runs the probe module's process_packet on a new fieldset in this thread's
+// arena.
+static fieldset_t *build_fieldset(const u_char *bytes, uint32_t buflen,
+				  struct ip *ip_hdr, uint32_t *validation,
+				  const struct timespec ts)
+{
+	fieldset_t *fs = fs_new_fieldset(&zconf.fsconf.defs);
+	fs_add_ip_fields(fs, ip_hdr);
+	zconf.probe_module->process_packet(bytes, buflen, fs, validation, ts);
+	assert(zconf.fsconf.success_index < fs->len);
+	return fs;
+}
 
+static void handle_response(uint32_t buflen, const u_char *bytes,
+			    const struct timespec ts, struct ip *ip_hdr,
+			    uint32_t len_ip_and_payload, uint16_t src_port,
+			    uint32_t *validation)
+{
+	uint32_t src_ip = ip_hdr->ip_src.s_addr;
 	if (!zconf.probe_module->validate_packet(
 		ip_hdr, len_ip_and_payload, &src_ip, validation, zconf.ports)) {
-		zrecv.validation_failed++;
+		counters.validation_failed++;
 		return;
 	} else {
-		zrecv.validation_passed++;
+		counters.validation_passed++;
 	}
 	// woo! We've validated that the packet is a response to our scan
-	int is_repeat = 0;
-	if (zconf.dedup_method == DEDUP_METHOD_FULL) {
-		is_repeat = pbm_check(seen, ntohl(src_ip));
-	} else if (zconf.dedup_method == DEDUP_METHOD_WINDOW) {
-		target_t t = {.ip = src_ip, .port = src_port, .status = 0};
-		if (cachehash_get(ch, &t, sizeof(target_t))) {
-			is_repeat = 1;
-		} else {
-			cachehash_put(ch, &t, sizeof(target_t), (void *)1);
-		}
-	}
 	// track whether this is the first packet in an IP fragment.
 	if (ip_hdr->ip_off & IP_MF) {
-		zrecv.ip_fragments++;
+		counters.ip_fragments++;
 	}
 
-	fieldset_t *fs = fs_new_fieldset(&zconf.fsconf.defs);
-	fs_add_ip_fields(fs, ip_hdr);
 	// HACK:
 	// probe modules expect the full ethernet frame
 	// in process_packet. For VPN, we only get back an IP frame.
@@ -111,86 +280,320 @@ void handle_packet(uint32_t buflen, const u_char *bytes,
 		bytes = fake_eth_hdr;
 		buflen += sizeof(struct ether_header);
 	}
-	zconf.probe_module->process_packet(bytes, buflen, fs, validation, ts);
-	fs_add_system_fields(fs, is_repeat, zsend.complete, ts);
-	int success_index = zconf.fsconf.success_index;
-	assert(success_index < fs->len);
-	int is_success = fs_get_uint64_by_index(fs, success_index);
+	fieldset_t *fs = NULL;
+	int is_success, is_app_success = 0;
+	if (zconf.default_mode && zconf.probe_module->classify_packet) {
+		// default mode only outputs unique successes, so there is no
+		// point in building fields before we know this is one
+		int classification = zconf.probe_module->classify_packet(
+		    bytes, buflen, validation);
+		is_success = !!(classification & PROBE_CLASSIFY_SUCCESS);
+		if (zconf.fsconf.app_success_index >= 0) {
+			is_app_success =
+			    !!(classification & PROBE_CLASSIFY_APP_SUCCESS);
+		}
+	} else {
+		fs = build_fieldset(bytes, buflen, ip_hdr, validation, ts);
+		is_success = fs_get_uint64_by_index(fs,
+						    zconf.fsconf.success_index);
+		// probe module includes app_success field
+		if (zconf.fsconf.app_success_index >= 0) {
+			is_app_success = fs_get_uint64_by_index(
+			    fs, zconf.fsconf.app_success_index);
+		}
+	}
+	// the repeat check and the update of the seen set have to be a single
+	// step, as other receive threads may see the same source concurrently
+	int is_repeat = dedup_check(src_ip, src_port, is_success);
 
 	if (is_success) {
-		zrecv.success_total++;
+		counters.success_total++;
 		if (!is_repeat) {
-			zrecv.success_unique++;
-			if (zconf.dedup_method == DEDUP_METHOD_FULL) {
-				pbm_set(seen, ntohl(src_ip));
-			} else if (zconf.dedup_method == DEDUP_METHOD_WINDOW) {
-			}
+			counters.success_unique++;
 		}
 		if (zsend.complete) {
-			zrecv.cooldown_total++;
+			counters.cooldown_total++;
 			if (!is_repeat) {
-				zrecv.cooldown_unique++;
+				counters.cooldown_unique++;
 			}
 		}
 	} else {
-		zrecv.failure_total++;
-	}
-	// probe module includes app_success field
-	if (zconf.fsconf.app_success_index >= 0) {
-		int is_app_success =
-		    fs_get_uint64_by_index(fs, zconf.fsconf.app_success_index);
-		if (is_app_success) {
-			zrecv.app_success_total++;
-			if (!is_repeat) {
-				zrecv.app_success_unique++;
-			}
+		counters.failure_total++;
+	}
+	if (is_app_success) {
+		counters.app_success_total++;
+		if (!is_repeat) {
+			counters.app_success_unique++;
 		}
 	}
 
-	fieldset_t *o = NULL;
-	// we need to translate the data provided by the probe module
-	// into a fieldset that can be used by the output module
 	if (!is_success && zconf.default_mode) {
 		goto cleanup;
 	}
 	if (is_repeat && zconf.default_mode) {
 		goto cleanup;
 	}
-	if (!evaluate_expression(zconf.filter.expression, fs)) {
+	if (!fs) {
+		fs = build_fieldset(bytes, buflen, ip_hdr, validation, ts);
+	}
+	fs_add_system_fields(fs, is_repeat, zsend.complete, ts);
+	if (!evaluate_program(zconf.filter.program, fs)) {
 		goto cleanup;
 	}
-	zrecv.filter_success++;
-	o = translate_fieldset(fs, &zconf.fsconf.translation);
-	if (zconf.output_module && zconf.output_module->process_ip) {
-		zconf.output_module->process_ip(o);
+	if (!claim_result()) {
+		goto cleanup;
 	}
+	// the fieldset lives in this thread's arena and may borrow from the
+	// capture buffer, so the output stage copies the output fields into
+	// its own batch before the arena is reset
+	output_stage_submit(recv_thread_id, fs);
 cleanup:
-	fs_free(fs);
-	free(o);
-	if (zconf.output_module && zconf.output_module->update &&
-	    !(zrecv.success_unique % zconf.output_module->update_interval)) {
-		zconf.output_module->update(&zconf, &zsend, &zrecv);
+	if (fs) {
+		fs_free(fs);
+		fs_arena_reset();
 	}
 }
 
-int recv_run(pthread_mutex_t *recv_ready_mutex)
+void handle_packet(uint32_t buflen, const u_char *bytes,
+		   const struct timespec ts)
 {
-	log_trace("recv", "recv thread started");
-	log_debug("recv", "capturing responses on %s", zconf.iface);
-	if (!zconf.dryrun) {
-		recv_init();
+	struct ip *ip_hdr;
+	uint32_t len_ip_and_payload;
+	uint16_t src_port;
+	if (!parse_response(buflen, bytes, &ip_hdr, &len_ip_and_payload,
+			    &src_port)) {
+		return;
+	}
+	uint32_t validation[VALIDATE_BYTES / sizeof(uint32_t)];
+	// TODO: for TTL exceeded messages, ip_hdr->saddr is going to be
+	// different and we must calculate off potential payload message instead
+	validate_gen(ip_hdr->ip_dst.s_addr, ip_hdr->ip_src.s_addr, src_port,
+		     (uint8_t *)validation);
+	handle_response(buflen, bytes, ts, ip_hdr, len_ip_and_payload,
+			src_port, validation);
+}
+
+void handle_packets(const struct recv_packet *packets, uint32_t n)
+{
+	for (uint32_t done = 0; done < n; done += VALIDATE_BATCH) {
+		uint32_t len = n - done < VALIDATE_BATCH ? n - done : VALIDATE_BATCH;
+		const struct recv_packet *p = &packets[done];
+		struct ip *ip_hdr[VALIDATE_BATCH];
+		uint32_t len_ip_and_payload[VALIDATE_BATCH];
+		uint16_t src_port[VALIDATE_BATCH];
+		uint32_t dst[VALIDATE_BATCH], src[VALIDATE_BATCH];
+		uint32_t idx[VALIDATE_BATCH];
+		uint32_t valid = 0;
+		for (uint32_t i = 0; i < len; i++) {
+			if (!parse_response(p[i].len, p[i].bytes,
+					    &ip_hdr[valid],
+					    &len_ip_and_payload[valid],
+					    &src_port[valid])) {
+				continue;
+			}
+			// validation is generated from the probe's point of
+			// view, so the response's addresses are swapped
+			src[valid] = ip_hdr[valid]->ip_dst.s_addr;
+			dst[valid] = ip_hdr[valid]->ip_src.s_addr;
+			idx[valid] = i;
+			valid++;
+		}
+		uint32_t validation[VALIDATE_BATCH]
+				   [VALIDATE_BYTES / sizeof(uint32_t)];
+		validate_gen_batch(src, dst, src_port, valid,
+				   (uint8_t(*)[VALIDATE_BYTES])validation);
+		for (uint32_t i = 0; i < valid; i++) {
+			handle_response(p[idx[i]].len, p[idx[i]].bytes,
+					p[idx[i]].ts,
+					ip_hdr[i], len_ip_and_payload[i],
+					src_port[i], validation[i]);
+		}
+	}
+}
+
+// Appends "and (clause)" to the filter in buf, unless the result would not
+// fit. Returns whether it was appended.
+static int append_bpf_clause(char *buf, size_t len, const char *clause)
+{
+	size_t used = strlen(buf);
+	int n = snprintf(buf + used, len - used, "%s(%s)", used ? " and " : "",
+			 clause);
+	if (n < 0 || (size_t)n >= len - used) {
+		buf[used] = '\0';
+		return 0;
+	}
+	return 1;
+}
+
+// Appends "port N" or "portrange N-M" for each run of ports set in bm,
+// joined by "or", to buf. Returns 0 if it does not fit.
+static int bpf_port_list(char *buf, size_t len, const char *dir, uint8_t *bm)
+{
+	size_t used = strlen(buf);
+	int first = 1;
+	for (uint32_t port = 0; port <= 0xFFFF; port++) {
+		if (!bm_check(bm, (uint16_t)port)) {
+			continue;
+		}
+		uint32_t last = port;
+		while (last < 0xFFFF && bm_check(bm, (uint16_t)(last + 1))) {
+			last++;
+		}
+		int n;
+		if (last == port) {
+			n = snprintf(buf + used, len - used, "%s%s port %u",
+				     first ? "" : " or ", dir, port);
+		} else {
+			n = snprintf(buf + used, len - used,
+				     "%s%s portrange %u-%u", first ? "" : " or ",
+				     dir, port, last);
+		}
+		if (n < 0 || (size_t)n >= len - used) {
+			return 0;
+		}
+		used += n;
+		first = 0;
+		port = last;
+	}
+	return !first;
+}
+
+// TCP and UDP responses that validation would reject because of their
+// ports are dropped in the kernel, before they are copied to us. ICMP
+// responses carry the ports in the quoted probe and are left alone.
+static void port_bpf_filter(char *buf, size_t len)
+{
+	buf[0] = '\0';
+	uint8_t flags = zconf.probe_module->port_filter;
+	if (!(flags & PORT_FILTER_DST)) {
+		return;
+	}
+	int src = zconf.validate_source_port_override ==
+		      VALIDATE_SRC_PORT_ENABLE_OVERRIDE ||
+		  ((flags & PORT_FILTER_SRC) &&
+		   zconf.validate_source_port_override !=
+		       VALIDATE_SRC_PORT_DISABLE_OVERRIDE);
+	char ports[BPFLEN] = "";
+	if (src && !bpf_port_list(ports, sizeof(ports), "src",
+				  zconf.ports->port_bitmap)) {
+		log_debug("recv", "too many target port ranges for the "
+				  "kernel filter, checking them in ZMap only");
+		ports[0] = '\0';
+	}
+	snprintf(buf, len,
+		 "not (tcp or udp) or (dst portrange %u-%u%s%s%s)",
+		 zconf.source_port_first, zconf.source_port_last,
+		 ports[0] ? " and (" : "", ports, ports[0] ? ")" : "");
+}
+
+// Narrows the filter in buf with the scan's ports and the output filter.
+// This only narrows the filter further, so any of it may be left out when
+// it does not fit.
+static void narrow_bpf_filter(char *buf, size_t len)
+{
+	char clause[BPFLEN];
+	port_bpf_filter(clause, sizeof(clause));
+	if (clause[0] && !append_bpf_clause(buf, len, clause)) {
+		log_debug("recv", "port filter does not fit the kernel filter");
+	}
+	if (filter_to_bpf(zconf.filter.expression,
+			  zconf.probe_module->port_filter & PORT_FILTER_FIELDS,
+			  clause, sizeof(clause)) &&
+	    !append_bpf_clause(buf, len, clause)) {
+		log_debug("recv",
+			  "output filter does not fit the kernel filter");
 	}
+}
+
+void recv_bpf_filter(char *buf, size_t len)
+{
+	assert(len >= BPFLEN);
+	char clause[BPFLEN];
+	buf[0] = '\0';
+	if (!zconf.send_ip_pkts) {
+		snprintf(clause, sizeof(clause),
+			 "not ether src %02x:%02x:%02x:%02x:%02x:%02x",
+			 zconf.hw_mac[0], zconf.hw_mac[1], zconf.hw_mac[2],
+			 zconf.hw_mac[3], zconf.hw_mac[4], zconf.hw_mac[5]);
+		append_bpf_clause(buf, len, clause);
+	}
+	if (zconf.probe_module->pcap_filter) {
+		if (!append_bpf_clause(buf, len,
+				       zconf.probe_module->pcap_filter)) {
+			log_fatal("recv",
+				  "probe module pcap filter does not fit the "
+				  "kernel filter: %s",
+				  zconf.probe_module->pcap_filter);
+		}
+	}
+	// Responses the narrowed filter drops are never seen, so they would
+	// no longer count towards the hit rate, the success and failure
+	// totals or validation failures, and non-first IP fragments, which
+	// carry no ports, would be dropped too. Hence opt-in.
+	if (zconf.kernel_filter) {
+		narrow_bpf_filter(buf, len);
+	}
+	log_debug("recv", "kernel packet filter: %s", buf);
+}
+
+#if defined(__linux__)
+void recv_join_fanout_group(int fd)
+{
+	int group = getpid() & 0xFFFF;
+	int arg = group | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG)
+			   << 16);
+	if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0) {
+		log_fatal("recv", "unable to join PACKET_FANOUT group: %s",
+			  strerror(errno));
+	}
+}
+#endif
+
+static int recv_should_stop(void)
+{
+	if (zconf.max_results &&
+	    zrecv.filter_success >= zconf.max_results) {
+		return 1;
+	}
+	return zsend.complete && (now() - zsend.finish > zconf.cooldown_secs);
+}
+
+static void recv_loop(uint8_t thread_id)
+{
+	recv_thread_id = thread_id;
+	fs_arena_init(RECV_ARENA_CHUNK_SIZE);
 	if (zconf.send_ip_pkts) {
 		struct ether_header *eth = (struct ether_header *)fake_eth_hdr;
-		memset(fake_eth_hdr, 0, sizeof(fake_eth_hdr));
 		eth->ether_type = htons(ETHERTYPE_IP);
 	}
-	// initialize paged bitmap
-	if (zconf.dedup_method == DEDUP_METHOD_FULL) {
-		seen = pbm_init();
-	} else if (zconf.dedup_method == DEDUP_METHOD_WINDOW) {
-		ch = cachehash_init(zconf.dedup_window_size, NULL);
+	do {
+		recv_packets(thread_id);
+		output_stage_flush(thread_id);
+		flush_counters();
+	} while (!recv_should_stop());
+	fs_arena_destroy();
+}
+
+static void *recv_worker(void *arg)
+{
+	uint8_t thread_id = (uint8_t)(uintptr_t)arg;
+	log_debug("recv", "receive thread %u started", thread_id);
+	recv_loop(thread_id);
+	log_debug("recv", "receive thread %u finished", thread_id);
+	return NULL;
+}
+
+int recv_run(pthread_mutex_t *recv_ready_mutex)
+{
+	log_trace("recv", "recv thread started");
+	log_debug("recv", "capturing responses on %s with %u thread(s)",
+		  zconf.iface, zconf.receivers);
+	if (!zconf.dryrun) {
+		for (uint8_t i = 0; i < zconf.receivers; i++) {
+			recv_init(i);
+		}
 	}
+	dedup_init();
 	if (zconf.default_mode) {
 		log_info("recv",
 			 "duplicate responses will be excluded from output");
@@ -212,24 +615,35 @@ int recv_run(pthread_mutex_t *recv_ready_mutex)
 		zconf.max_results = -1;
 	}
 
-	do {
-		if (zconf.dryrun) {
+	output_stage_start(zconf.receivers);
+	if (zconf.dryrun) {
+		do {
 			sleep(1);
-		} else {
-			recv_packets();
-			if (zconf.max_results &&
-			    zrecv.filter_success >= zconf.max_results) {
-				break;
+		} while (!recv_should_stop());
+	} else {
+		pthread_t workers[MAX_RECEIVERS];
+		for (uint8_t i = 1; i < zconf.receivers; i++) {
+			int r = pthread_create(&workers[i], NULL, recv_worker,
+					       (void *)(uintptr_t)i);
+			if (r != 0) {
+				log_fatal("recv",
+					  "unable to create receive thread");
 			}
 		}
-	} while (
-	    !(zsend.complete && (now() - zsend.finish > zconf.cooldown_secs)));
+		recv_loop(0);
+		for (uint8_t i = 1; i < zconf.receivers; i++) {
+			pthread_join(workers[i], NULL);
+		}
+	}
+	output_stage_finish();
 	zrecv.finish = now();
 	// get final pcap statistics before closing
 	recv_update_stats();
 	if (!zconf.dryrun) {
 		pthread_mutex_lock(recv_ready_mutex);
-		recv_cleanup();
+		for (uint8_t i = 0; i < zconf.receivers; i++) {
+			recv_cleanup(i);
+		}
 		pthread_mutex_unlock(recv_ready_mutex);
 	}
 	zrecv.complete = 1;
@@ -11,6 +11,8 @@
 
 #include <pthread.h>
 
+#define MAX_RECEIVERS 64
+
 int recv_update_stats(void);
 int recv_run(pthread_mutex_t *recv_ready_mutex);
 
@@ -19,6 +19,8 @@ int send_batch(sock_t sock, batch_t *batch, int retries);
 #elif defined(NETMAP)
 void submit_batch_internal(batch_t *batch);
 int send_batch_internal(sock_t sock, batch_t *batch);
+#elif defined(XDP)
+#include "socket-xdp.h"
 #elif defined(__linux__)
 #include "send-linux.h"
 #endif
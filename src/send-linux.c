@@ -25,13 +25,15 @@
 #include <sys/time.h>
 #include <sys/types.h>
 
-#include <netpacket/packet.h>
+#include <linux/if_packet.h>
+#include <poll.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <linux/netlink.h>
 
 #include "../lib/includes.h"
 #include "../lib/logger.h"
+#include "../lib/xalloc.h"
 #include "./send.h"
 #include "./send-linux.h"
 #include "state.h"
@@ -39,6 +41,95 @@
 // Dummy sockaddr for sendto
 static struct sockaddr_ll sockaddr;
 
+// TX ring geometry. Frames are one page each so that any packet up to
+// MAX_PACKET_SIZE fits behind the tpacket3_hdr, and blocks hold 16 frames.
+#define TX_RING_FRAME_SIZE 4096
+#define TX_RING_BLOCK_SIZE (16 * TX_RING_FRAME_SIZE)
+#define TX_RING_MIN_FRAMES 4096
+// how long to wait for the kernel to free a frame when the ring is full
+#define TX_RING_POLL_TIMEOUT_MS 100
+// packet data starts right after the header when PACKET_TX_HAS_OFF is unset
+#define TX_RING_DATA_OFFSET TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+
+static int send_batch_tx_ring(sock_t sock, batch_t *batch, int retries);
+
+struct tx_ring *tx_ring_init(int sock)
+{
+	int version = TPACKET_V3;
+	if (setsockopt(sock, SOL_PACKET, PACKET_VERSION, &version,
+		       sizeof(version)) < 0) {
+		log_fatal("send", "unable to set TPACKET_V3 on socket: %s",
+			  strerror(errno));
+	}
+	// bypass the qdisc layer and hand frames directly to the driver
+	int one = 1;
+	if (setsockopt(sock, SOL_PACKET, PACKET_QDISC_BYPASS, &one,
+		       sizeof(one)) < 0) {
+		log_warn("send", "unable to enable PACKET_QDISC_BYPASS: %s",
+			 strerror(errno));
+	}
+
+	// keep a few batches in flight so that building the next batch
+	// overlaps with the kernel draining the previous ones
+	uint32_t frames = 4 * (uint32_t)zconf.batch;
+	if (frames < TX_RING_MIN_FRAMES) {
+		frames = TX_RING_MIN_FRAMES;
+	}
+	uint32_t frames_per_block = TX_RING_BLOCK_SIZE / TX_RING_FRAME_SIZE;
+	struct tpacket_req3 req;
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = TX_RING_BLOCK_SIZE;
+	req.tp_block_nr = (frames + frames_per_block - 1) / frames_per_block;
+	req.tp_frame_size = TX_RING_FRAME_SIZE;
+	req.tp_frame_nr = req.tp_block_nr * frames_per_block;
+	if (setsockopt(sock, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) <
+	    0) {
+		log_fatal("send",
+			  "unable to create PACKET_TX_RING (TPACKET_V3 TX rings "
+			  "require Linux 4.11 or newer): %s",
+			  strerror(errno));
+	}
+
+	struct tx_ring *ring = xcalloc(1, sizeof(struct tx_ring));
+	ring->frame_size = req.tp_frame_size;
+	ring->frame_nr = req.tp_frame_nr;
+	ring->map_len = (size_t)req.tp_block_size * req.tp_block_nr;
+	ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_LOCKED | MAP_POPULATE, sock, 0);
+	if (ring->map == MAP_FAILED) {
+		// locking the ring is only an optimization, and the default
+		// RLIMIT_MEMLOCK is far smaller than a ring per send thread
+		log_warn("send",
+			 "unable to lock the PACKET_TX_RING in memory (see "
+			 "RLIMIT_MEMLOCK), continuing without");
+		ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, sock, 0);
+	}
+	if (ring->map == MAP_FAILED) {
+		log_fatal("send", "unable to mmap PACKET_TX_RING: %s",
+			  strerror(errno));
+	}
+
+	// bind to the scan interface with protocol 0 so that the kernel
+	// doesn't also queue a copy of every received frame on this socket
+	struct sockaddr_ll sll;
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = 0;
+	sll.sll_ifindex = if_nametoindex(zconf.iface);
+	if (sll.sll_ifindex == 0) {
+		log_fatal("send", "unable to find index of interface %s: %s",
+			  zconf.iface, strerror(errno));
+	}
+	if (bind(sock, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		log_fatal("send", "unable to bind TX ring socket to %s: %s",
+			  zconf.iface, strerror(errno));
+	}
+	log_debug("send", "TX ring set up with %u frames of %u bytes",
+		  ring->frame_nr, ring->frame_size);
+	return ring;
+}
+
 int send_run_init(sock_t s)
 {
 	// Get the actual socket
@@ -75,6 +166,9 @@ int send_batch(sock_t sock, batch_t *batch, int retries)
 		// nothing to send
 		return EXIT_SUCCESS;
 	}
+	if (sock.tx_ring) {
+		return send_batch_tx_ring(sock, batch, retries);
+	}
 	struct mmsghdr msgvec[batch->capacity]; // Array of multiple msg header structures
 	struct msghdr msgs[batch->capacity];
 	struct iovec iovs[batch->capacity];
@@ -128,3 +222,100 @@ int send_batch(sock_t sock, batch_t *batch, int retries)
 	}
 	return total_packets_sent;
 }
+
+static inline struct tpacket3_hdr *tx_ring_frame(struct tx_ring *ring,
+						uint32_t idx)
+{
+	// frame_size evenly divides the block size, so frames are contiguous
+	return (struct tpacket3_hdr *)(ring->map +
+				       (size_t)idx * ring->frame_size);
+}
+
+// Whether the kernel is done with a frame. PACKET_LOSS is left unset, so
+// a frame the driver rejects is marked TP_STATUS_WRONG_FORMAT rather than
+// silently dropped, and the kernel stops at it until the frame is filled
+// and requested again.
+static inline int tx_ring_frame_done(struct tpacket3_hdr *hdr)
+{
+	uint32_t status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+	return status == TP_STATUS_AVAILABLE ||
+	       status == TP_STATUS_WRONG_FORMAT;
+}
+
+// Waits until the frame at the head of the ring has been released by the
+// kernel. Returns 0 once the frame is done, -1 if it is still in use after
+// the given number of attempts. It always waits at least once, even with
+// --retries=0, since a full ring is normal at high rates.
+static int tx_ring_wait(sock_t sock, struct tpacket3_hdr *hdr, int retries)
+{
+	__atomic_fetch_add(&zsend.tx_ring_stalls, 1, __ATOMIC_RELAXED);
+	struct pollfd pfd;
+	pfd.fd = sock.sock;
+	pfd.events = POLLOUT;
+	int attempts = retries > 0 ? retries : 1;
+	for (int i = 0; i < attempts; i++) {
+		// make sure everything already queued is handed to the driver
+		if (send(sock.sock, NULL, 0, MSG_DONTWAIT) < 0 &&
+		    errno != EAGAIN && errno != ENOBUFS) {
+			log_error("batch send", "error kicking TX ring: %s",
+				  strerror(errno));
+		}
+		if (tx_ring_frame_done(hdr)) {
+			return 0;
+		}
+		poll(&pfd, 1, TX_RING_POLL_TIMEOUT_MS);
+		if (tx_ring_frame_done(hdr)) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+// Copies the batch into free ring frames, marks them for sending, and then
+// kicks the kernel once for the whole batch. Returns the number of packets
+// that were queued on the ring, less the number of earlier packets found
+// rejected by the driver in the frames that were reused.
+static int send_batch_tx_ring(sock_t sock, batch_t *batch, int retries)
+{
+	struct tx_ring *ring = sock.tx_ring;
+	int queued = 0;
+	int rejected = 0;
+	for (int i = 0; i < batch->len; ++i) {
+		struct tpacket3_hdr *hdr = tx_ring_frame(ring, ring->cur);
+		if (!tx_ring_frame_done(hdr) &&
+		    tx_ring_wait(sock, hdr, retries)) {
+			log_warn("batch send",
+				 "TX ring still full, only queued %d packets "
+				 "out of a batch of %d packets",
+				 queued, batch->len);
+			break;
+		}
+		if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) ==
+		    TP_STATUS_WRONG_FORMAT) {
+			// reusing the frame also lets the kernel move past it
+			rejected++;
+		}
+		memcpy((uint8_t *)hdr + TX_RING_DATA_OFFSET,
+		       batch->packets[i].buf, batch->packets[i].len);
+		hdr->tp_len = batch->packets[i].len;
+		hdr->tp_next_offset = 0;
+		__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST,
+				 __ATOMIC_RELEASE);
+		ring->cur = (ring->cur + 1) % ring->frame_nr;
+		queued++;
+	}
+	// frames that can't be handed to the driver right now stay on the
+	// ring and go out with the next kick
+	if (send(sock.sock, NULL, 0, MSG_DONTWAIT) < 0 && errno != EAGAIN &&
+	    errno != ENOBUFS) {
+		log_error("batch send", "error kicking TX ring: %s",
+			  strerror(errno));
+		if (queued == 0) {
+			return -1;
+		}
+	}
+	if (rejected) {
+		log_debug("batch send", "driver rejected %d packets", rejected);
+	}
+	return queued - rejected;
+}
@@ -13,11 +13,23 @@
 #include <string.h>
 
 #include <netinet/ip.h>
-#include <netpacket/packet.h>
+#include <linux/if_packet.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 
 #include "../lib/includes.h"
 
+// state of a memory-mapped PACKET_TX_RING (TPACKET_V3) owned by one sender
+struct tx_ring {
+	uint8_t *map;
+	size_t map_len;
+	uint32_t frame_size;
+	uint32_t frame_nr;
+	// index of the next frame to fill
+	uint32_t cur;
+};
+
+struct tx_ring *tx_ring_init(int sock);
+
 #endif /* ZMAP_SEND_LINUX_H */
@@ -0,0 +1,109 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#if !defined(__linux__)
+#error "XDP requires Linux"
+#endif
+
+#include "send.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "../lib/includes.h"
+#include "../lib/logger.h"
+
+#include "socket.h"
+#include "socket-xdp.h"
+#include "state.h"
+
+// how long to wait for the NIC to complete frames when none are free
+#define XDP_TX_POLL_TIMEOUT_MS 1
+
+int send_run_init(UNUSED sock_t sock)
+{
+	// queue pairs are bound in xdp_init before the send threads start
+	return EXIT_SUCCESS;
+}
+
+// Move frames the kernel is done sending back onto the free stack.
+static void xdp_reclaim_tx(struct xdp_queue *q)
+{
+	uint32_t idx;
+	uint32_t n = xsk_ring_cons__peek(&q->comp, XDP_NUM_TX_FRAMES, &idx);
+	for (uint32_t i = 0; i < n; i++) {
+		q->tx_free[q->tx_free_len++] =
+		    *xsk_ring_cons__comp_addr(&q->comp, idx++);
+	}
+	if (n) {
+		xsk_ring_cons__release(&q->comp, n);
+	}
+}
+
+static void xdp_kick_tx(struct xdp_queue *q)
+{
+	if (sendto(xsk_socket__fd(q->xsk), NULL, 0, MSG_DONTWAIT, NULL, 0) <
+		0 &&
+	    errno != EAGAIN && errno != EBUSY && errno != ENOBUFS) {
+		log_error("send-xdp", "sendto on queue %u failed: %d: %s",
+			  q->queue_id, errno, strerror(errno));
+	}
+}
+
+// Copies the batch into free UMEM frames and posts them on the TX ring of
+// the sender's queue pair, waking the kernel at most once per batch. As with
+// netmap, probes are built in the batch and copied, since send_run owns the
+// packet buffers. Returns the number of packets posted.
+int send_batch(sock_t sock, batch_t *batch, int attempts)
+{
+	if (batch->len == 0) {
+		return 0;
+	}
+	struct xdp_queue *q = sock.xdp.queue;
+	xdp_reclaim_tx(q);
+	for (int i = 0; q->tx_free_len < batch->len && i < attempts; i++) {
+		// copy mode only transmits from within the syscall, so
+		// always kick here, not just when the kernel asks for it
+		xdp_kick_tx(q);
+		struct pollfd fds = {
+		    .fd = xsk_socket__fd(q->xsk),
+		    .events = POLLOUT,
+		};
+		poll(&fds, 1, XDP_TX_POLL_TIMEOUT_MS);
+		xdp_reclaim_tx(q);
+	}
+	uint32_t n = batch->len;
+	if (n > q->tx_free_len) {
+		log_warn("send-xdp",
+			 "no free TX frames on queue %u, only sending %u "
+			 "packets out of a batch of %u packets",
+			 q->queue_id, q->tx_free_len, n);
+		n = q->tx_free_len;
+	}
+	uint32_t idx;
+	// the TX ring has as many slots as there are TX frames, so this
+	// cannot fail while we hold n free frames
+	if (n == 0 || xsk_ring_prod__reserve(&q->tx, n, &idx) != n) {
+		return 0;
+	}
+	for (uint32_t i = 0; i < n; i++) {
+		uint64_t addr = q->tx_free[--q->tx_free_len];
+		memcpy(xsk_umem__get_data(q->umem_area, addr),
+		       batch->packets[i].buf, batch->packets[i].len);
+		struct xdp_desc *desc = xsk_ring_prod__tx_desc(&q->tx, idx++);
+		desc->addr = addr;
+		desc->len = batch->packets[i].len;
+	}
+	xsk_ring_prod__submit(&q->tx, n);
+	if (xsk_ring_prod__needs_wakeup(&q->tx)) {
+		xdp_kick_tx(q);
+	}
+	return (int)n;
+}
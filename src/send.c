@@ -18,6 +18,7 @@
 #include <errno.h>
 #include <assert.h>
 #include <signal.h>
+#include <inttypes.h>
 
 #include "../lib/includes.h"
 #include "../lib/util.h"
@@ -25,13 +26,13 @@
 #include "../lib/random.h"
 #include "../lib/blocklist.h"
 #include "../lib/lockfd.h"
-#include "../lib/pbm.h"
 #include "../lib/xalloc.h"
 
 #include "send-internal.h"
 #include "aesrand.h"
 #include "get_gateway.h"
 #include "iterator.h"
+#include "pacer.h"
 #include "probe_modules/packet.h"
 #include "probe_modules/probe_modules.h"
 #include "shard.h"
@@ -48,6 +49,14 @@ static uint16_t num_src_ports;
 
 void sig_handler_increase_speed(UNUSED int signal)
 {
+	if (zconf.bandwidth > 0) {
+		uint64_t old_bandwidth = zconf.bandwidth;
+		zconf.bandwidth += (zconf.bandwidth / 20);
+		log_info("send", "send bandwidth increased from %" PRIu64
+				 " to %" PRIu64 " bit/s.",
+			 old_bandwidth, zconf.bandwidth);
+		return;
+	}
 	int old_rate = zconf.rate;
 	zconf.rate += (zconf.rate * 0.05);
 	log_info("send", "send rate increased from %i to %i pps.", old_rate,
@@ -56,6 +65,14 @@ void sig_handler_increase_speed(UNUSED int signal)
 
 void sig_handler_decrease_speed(UNUSED int signal)
 {
+	if (zconf.bandwidth > 0) {
+		uint64_t old_bandwidth = zconf.bandwidth;
+		zconf.bandwidth -= (zconf.bandwidth / 20);
+		log_info("send", "send bandwidth decreased from %" PRIu64
+				 " to %" PRIu64 " bit/s.",
+			 old_bandwidth, zconf.bandwidth);
+		return;
+	}
 	int old_rate = zconf.rate;
 	zconf.rate -= (zconf.rate * 0.05);
 	log_info("send", "send rate decreased from %i to %i pps.", old_rate,
@@ -68,13 +85,14 @@ iterator_t *send_init(void)
 	// generate a new primitive root and starting position
 	iterator_t *it;
 	uint32_t num_subshards = (uint32_t)zconf.senders * (uint32_t)zconf.total_shards;
-	if (num_subshards > (blocklist_count_allowed() * zconf.ports->port_count)) {
+	uint64_t num_addrs = zsend.list_of_ips ? zsend.list_of_ips_len
+					       : blocklist_count_allowed();
+	if (num_subshards > (num_addrs * zconf.ports->port_count)) {
 		log_fatal("send", "senders * shards > allowed probes");
 	}
 	if (zsend.max_targets && (num_subshards > zsend.max_targets)) {
 		log_fatal("send", "senders * shards > max targets");
 	}
-	uint64_t num_addrs = blocklist_count_allowed();
 	it = iterator_init(zconf.senders, zconf.shard_num, zconf.total_shards,
 			   num_addrs, zconf.ports->port_count);
 	// determine the source address offset from which we'll send packets
@@ -105,7 +123,8 @@ iterator_t *send_init(void)
 		    "must specify rate or bandwidth, or neither, not both.");
 	}
 	// Convert specified bandwidth to packet rate. This is an estimate using the
-	// max packet size a probe module will generate.
+	// max packet size a probe module will generate and is only used for
+	// reporting, the pacer charges each packet by its actual length.
 	if (zconf.bandwidth > 0) {
 		size_t pkt_len = zconf.probe_module->max_packet_length;
 		pkt_len *= 8;
@@ -182,6 +201,7 @@ iterator_t *send_init(void)
 	// setup signal handlers for changing scan speed
 	signal(SIGUSR1, sig_handler_increase_speed);
 	signal(SIGUSR2, sig_handler_decrease_speed);
+	pacer_global_init();
 	zsend.start = now();
 	return it;
 }
@@ -195,6 +215,172 @@ static inline ipaddr_n_t get_src_ip(ipaddr_n_t dst, int local_offset)
 					 zconf.number_source_ips];
 }
 
+// Sends (or in dryrun mode prints) the packets in the batch and empties it.
+static void flush_batch(sock_t st, batch_t *batch, shard_t *s, int attempts)
+{
+	if (batch->len == 0) {
+		return;
+	}
+	if (zconf.dryrun) {
+		if (zconf.verify_checksums) {
+			for (int i = 0; i < batch->len; i++) {
+				if (!packet_checksums_ok(batch->packets[i].buf,
+							 batch->packets[i].len)) {
+					log_fatal("send",
+						  "probe module %s produced a packet with a bad checksum",
+						  zconf.probe_module->name);
+				}
+			}
+		}
+		lock_file(stdout);
+		for (int i = 0; i < batch->len; i++) {
+			zconf.probe_module->print_packet(stdout,
+							 batch->packets[i].buf);
+		}
+		unlock_file(stdout);
+	} else {
+		int rc = send_batch(st, batch, attempts);
+		// whether batch succeeds or fails, this was the only attempt. Any re-tries are handled within batch
+		if (rc < 0) {
+			log_error("send_batch", "could not send any batch packets: %s", strerror(errno));
+			// rc is the last error code if all packets couldn't be sent
+			s->state.packets_failed += batch->len;
+		} else {
+			// rc is number of packets sent successfully, if > 0
+			s->state.packets_failed += batch->len - rc;
+		}
+	}
+	// reset batch length for next batch
+	batch->len = 0;
+}
+
+static inline int same_probe_tuple(const probe_target_t *a,
+				   const probe_target_t *b)
+{
+	return a->src_ip == b->src_ip && a->dst_ip == b->dst_ip &&
+	       a->dst_port == b->dst_port;
+}
+
+static void validate_batch(probe_target_t *targets, const int *idx, int len)
+{
+	uint32_t src[VALIDATE_BATCH], dst[VALIDATE_BATCH];
+	uint16_t dst_port[VALIDATE_BATCH];
+	uint8_t validation[VALIDATE_BATCH][VALIDATE_BYTES];
+	for (int i = 0; i < len; i++) {
+		src[i] = targets[idx[i]].src_ip;
+		dst[i] = targets[idx[i]].dst_ip;
+		dst_port[i] = targets[idx[i]].dst_port;
+	}
+	validate_gen_batch(src, dst, dst_port, len, validation);
+	for (int i = 0; i < len; i++) {
+		memcpy(targets[idx[i]].validation, validation[i],
+		       VALIDATE_BYTES);
+	}
+}
+
+// Fills in the validation and IP ID of the queued targets.
+static void validate_targets(probe_target_t *targets, int num_targets)
+{
+	// The validation only depends on the (src_ip, dst_ip, dst_port)
+	// tuple. Consecutive streams of a target share it whenever they get
+	// the same source IP, which is always the case with a single source
+	// IP, so only the first of them is encrypted.
+	int idx[VALIDATE_BATCH];
+	int len = 0;
+	for (int i = 0; i < num_targets; i++) {
+		if (i > 0 && same_probe_tuple(&targets[i], &targets[i - 1])) {
+			continue;
+		}
+		idx[len++] = i;
+		if (len == VALIDATE_BATCH) {
+			validate_batch(targets, idx, len);
+			len = 0;
+		}
+	}
+	validate_batch(targets, idx, len);
+	for (int i = 0; i < num_targets; i++) {
+		probe_target_t *t = &targets[i];
+		if (i > 0 && same_probe_tuple(t, &targets[i - 1])) {
+			memcpy(t->validation, targets[i - 1].validation,
+			       VALIDATE_BYTES);
+		}
+		// Grab last 2 bytes of validation for ip_id
+		t->ip_id = (uint16_t)(t->validation[VALIDATE_BYTES / sizeof(uint32_t) - 1] &
+				      0xFFFF);
+	}
+}
+
+// Builds packets for the queued targets into the empty batch, waits until
+// the pacer allows them to be sent and sends them. At low rates the pacer
+// hands out less than a batch at a time, so they are sent in several parts.
+static void send_targets(sock_t st, batch_t *batch, probe_target_t *targets,
+			 int num_targets, pacer_t *pacer, void *probe_data,
+			 shard_t *s, int attempts)
+{
+	if (num_targets == 0) {
+		return;
+	}
+	assert(batch->len == 0 && num_targets <= batch->capacity);
+	validate_targets(targets, num_targets);
+	int n;
+	for (int off = 0; off < num_targets; off += n) {
+		if (pacer_slice_done(pacer)) {
+			pacer_wait(pacer, pacer_reserve(pacer));
+		}
+		n = pacer_slice_packets(pacer, num_targets - off);
+		probe_target_t *part = &targets[off];
+		int failed = 0;
+		if (zconf.probe_module->make_packets) {
+			for (int i = 0; i < n; i++) {
+				batch->packets[i].len = 0;
+			}
+			failed = zconf.probe_module->make_packets(
+				     batch->packets, part, n, probe_data) !=
+				 EXIT_SUCCESS;
+		} else {
+			for (int i = 0; i < n; i++) {
+				probe_target_t *t = &part[i];
+				size_t length = 0;
+				if (zconf.probe_module->make_packet(
+					batch->packets[i].buf, &length,
+					t->src_ip, t->dst_ip, t->dst_port,
+					t->ttl, t->validation, t->probe_num,
+					t->ip_id, probe_data) != EXIT_SUCCESS) {
+					length = 0;
+					failed = 1;
+				}
+				batch->packets[i].len = (uint32_t)length;
+			}
+		}
+		int len = 0;
+		for (int i = 0; i < n; i++) {
+			struct batch_packet *pkt = &batch->packets[i];
+			if (pkt->len > MAX_PACKET_SIZE) {
+				log_fatal(
+				    "send",
+				    "send thread %hhu set length (%u) larger than MAX (%zu)",
+				    s->thread_id, pkt->len, MAX_PACKET_SIZE);
+			}
+			if (failed && pkt->len == 0) {
+				// the probe module could not build a packet
+				// for this target, skip it
+				s->state.packets_failed++;
+				continue;
+			}
+			if (len != i) {
+				struct batch_packet *dst = &batch->packets[len];
+				memcpy(dst->buf, pkt->buf, pkt->len);
+				dst->len = pkt->len;
+			}
+			len++;
+			pacer_charge(pacer, pkt->len);
+		}
+		batch->len = len;
+		flush_batch(st, batch, s, attempts);
+	}
+	shard_stats_publish(s, pacer->late, pacer->waits);
+}
+
 // one sender thread
 int send_run(sock_t st, shard_t *s)
 {
@@ -243,119 +429,20 @@ int send_run(sock_t st, shard_t *s)
 		}
 	}
 
-	// adaptive timing to hit target rate
-	uint64_t count = 0;
-	uint64_t last_count = count;
-	double last_time = steady_now();
-	uint32_t delay = 0;
-	uint interval = 0;
-	volatile uint vi;
-	struct timespec ts, rem;
-	double send_rate =
-	    (double)zconf.rate /
-	    ((double)zconf.senders * zconf.packet_streams);
-	const double slow_rate = 1000; // packets per seconds per thread
-	// at which it uses the slow methods
-	long nsec_per_sec = 1000 * 1000 * 1000;
-	long long sleep_time = nsec_per_sec;
-	if (zconf.rate > 0) {
-		delay = 10000;
-		if (send_rate < slow_rate) {
-			// set the initial time difference
-			sleep_time = nsec_per_sec / send_rate;
-			last_time = steady_now() - (1.0 / send_rate);
-		} else {
-			// estimate initial rate
-			for (vi = delay; vi--;)
-				;
-			delay *= 1 / (steady_now() - last_time) /
-				 ((double)zconf.rate /
-				  (double)zconf.senders);
-			interval = ((double)zconf.rate /
-				    (double)zconf.senders) /
-				   20;
-			last_time = steady_now();
-			assert(interval > 0);
-			if (delay == 0) {
-				// at extremely high bandwidths, the delay could be set to zero.
-				// this breaks the multiplier logic below, so we'll hard-set it to 1 in this case.
-				delay = 1;
-			}
-		}
-	}
+	// targets are queued until there are enough for a full batch, so that
+	// the probe module can build them all at once
+	probe_target_t *targets =
+	    xcalloc(batch->capacity, sizeof(probe_target_t));
+	int num_targets = 0;
+	pacer_t pacer;
+	pacer_init(&pacer);
 	int attempts = zconf.retries + 1;
 	// Get the initial IP to scan.
 	target_t current = shard_get_cur_target(s);
 	uint32_t current_ip = current.ip;
 	uint16_t current_port = current.port;
 
-	// If provided a list of IPs to scan, then the first generated address
-	// might not be on that list. Iterate until the current IP is one the
-	// list, then start the true scanning process.
-	if (zconf.list_of_ips_filename) {
-		while (!pbm_check(zsend.list_of_ips_pbm, current_ip)) {
-			current = shard_get_next_target(s);
-			current_ip = current.ip;
-			current_port = current.port;
-			if (current.status == ZMAP_SHARD_DONE) {
-				log_debug(
-				    "send",
-				    "never made it to send loop in send thread %i",
-				    s->thread_id);
-				goto cleanup;
-			}
-		}
-	}
 	while (1) {
-		// Adaptive timing delay
-		if (count && delay > 0) {
-			if (send_rate < slow_rate) {
-				double t = steady_now();
-				double last_rate = (1.0 / (t - last_time));
-
-				sleep_time *= ((last_rate / send_rate) + 1) / 2;
-				ts.tv_sec = sleep_time / nsec_per_sec;
-				ts.tv_nsec = sleep_time % nsec_per_sec;
-				log_debug("sleep",
-					  "sleep for %d sec, %ld nanoseconds",
-					  ts.tv_sec, ts.tv_nsec);
-				while (nanosleep(&ts, &rem) == -1) {
-				}
-				last_time = t;
-			} else {
-				for (vi = delay; vi--;)
-					;
-				if (!interval || (count % interval == 0)) {
-					double t = steady_now();
-					assert(count > last_count);
-					assert(t > last_time);
-					double multiplier =
-					    (double)(count - last_count) /
-					    (t - last_time) /
-					    (zconf.rate / zconf.senders);
-					uint32_t old_delay = delay;
-					delay *= multiplier;
-					if (delay == old_delay) {
-						if (multiplier > 1.0) {
-							delay *= 2;
-						} else if (multiplier < 1.0) {
-							delay *= 0.5;
-						}
-					}
-					if (delay == 0) {
-						// delay could become zero if the actual send rate stays below the target rate for long enough
-						// this could be due to things like VM cpu contention, or the NIC being saturated.
-						// However, we never want delay to become 0, as this would remove any rate limiting for the rest
-						// of the ZMap invocation (since 0 * multiplier = 0 for any multiplier). To prevent the removal
-						// of rate-limiting we'll set delay to one here.
-						delay = 1;
-					}
-					last_count = count;
-					last_time = t;
-				}
-			}
-		}
-
 		// Check if the program has otherwise completed and break out of the send loop.
 		if (zrecv.complete) {
 			goto cleanup;
@@ -391,60 +478,17 @@ int send_run(sock_t st, shard_t *s)
 			goto cleanup;
 		}
 		for (int i = 0; i < zconf.packet_streams; i++) {
-			count++;
-			uint32_t src_ip = get_src_ip(current_ip, i);
-			uint8_t size_of_validation = VALIDATE_BYTES / sizeof(uint32_t);
-			uint32_t validation[size_of_validation];
-			validate_gen(src_ip, current_ip,
-				     htons(current_port),
-				     (uint8_t *)validation);
-			uint8_t ttl = zconf.probe_ttl;
-
-			size_t length = 0;
-			zconf.probe_module->make_packet(
-			    batch->packets[batch->len].buf, &length,
-			    src_ip, current_ip, htons(current_port), ttl, validation, i,
-			    // Grab last 2 bytes of validation for ip_id
-			    (uint16_t)(validation[size_of_validation - 1] & 0xFFFF),
-			    probe_data);
-			if (length > MAX_PACKET_SIZE) {
-				log_fatal(
-				    "send",
-				    "send thread %hhu set length (%zu) larger than MAX (%zu)",
-				    s->thread_id, length,
-				    MAX_PACKET_SIZE);
-			}
-			batch->packets[batch->len].len = (uint32_t)length;
-
-			if (zconf.dryrun) {
-				batch->len++;
-				if (batch->len == batch->capacity) {
-					lock_file(stdout);
-					for (int i = 0; i < batch->len; i++) {
-						zconf.probe_module->print_packet(stdout,
-														 batch->packets[i].buf);
-					}
-					unlock_file(stdout);
-					// reset batch length for next batch
-					batch->len = 0;
-				}
-			} else {
-				batch->len++;
-				if (batch->len == batch->capacity) {
-					// batch is full, sending
-					int rc = send_batch(st, batch, attempts);
-					// whether batch succeeds or fails, this was the only attempt. Any re-tries are handled within batch
-					if (rc < 0) {
-						log_error("send_batch", "could not send any batch packets: %s", strerror(errno));
-						// rc is the last error code if all packets couldn't be sent
-						s->state.packets_failed += batch->len;
-					} else {
-						// rc is number of packets sent successfully, if > 0
-						s->state.packets_failed += batch->len - rc;
-					}
-					// reset batch length for next batch
-					batch->len = 0;
-				}
+			probe_target_t *t = &targets[num_targets];
+			t->src_ip = get_src_ip(current_ip, i);
+			t->dst_ip = current_ip;
+			t->dst_port = htons(current_port);
+			t->ttl = zconf.probe_ttl;
+			t->probe_num = i;
+			num_targets++;
+			if (num_targets == batch->capacity) {
+				send_targets(st, batch, targets, num_targets,
+					     &pacer, probe_data, s, attempts);
+				num_targets = 0;
 			}
 			s->state.packets_sent++;
 		}
@@ -455,37 +499,12 @@ int send_run(sock_t st, shard_t *s)
 		current = shard_get_next_target(s);
 		current_ip = current.ip;
 		current_port = current.port;
-		if (zconf.list_of_ips_filename &&
-		    current.status != ZMAP_SHARD_DONE) {
-			// If we have a list of IPs bitmap, ensure the next IP
-			// to scan is on the list.
-			while (!pbm_check(zsend.list_of_ips_pbm,
-					  current_ip)) {
-				current = shard_get_next_target(s);
-				current_ip = current.ip;
-				if (current.status == ZMAP_SHARD_DONE) {
-					log_debug(
-					    "send",
-					    "send thread %hhu shard finished in get_next_ip_loop depleted",
-					    s->thread_id);
-					goto cleanup;
-				}
-			}
-		}
 	}
 cleanup:
-	if (!zconf.dryrun && send_batch(st, batch, attempts) < 0) {
-		log_error("send_batch cleanup", "could not send remaining batch packets: %s", strerror(errno));
-	} else if (zconf.dryrun) {
-		lock_file(stdout);
-		for (int i = 0; i < batch->len; i++) {
-			zconf.probe_module->print_packet(stdout,
-											 batch->packets[i].buf);
-		}
-		unlock_file(stdout);
-		// reset batch length for next batch
-		batch->len = 0;
-	}
+	send_targets(st, batch, targets, num_targets, &pacer, probe_data, s,
+		     attempts);
+	shard_stats_publish(s, pacer.late, pacer.waits);
+	free(targets);
 	free_packet_batch(batch);
 	s->cb(s->thread_id, s->arg);
 	if (zconf.dryrun) {
@@ -14,6 +14,7 @@
 #include "../lib/includes.h"
 #include "../lib/logger.h"
 #include "../lib/blocklist.h"
+#include "../lib/xalloc.h"
 #include "shard.h"
 #include "state.h"
 
@@ -28,14 +29,135 @@ static inline uint32_t extract_ip(uint64_t v, uint8_t bits)
 	return (uint32_t)(v >> bits);
 }
 
-static void shard_roll_to_valid(shard_t *s)
+// Maps an ip index onto an address, from the list of IPs if one was given
+static inline uint32_t shard_lookup_ip(uint32_t ip_index)
 {
-	uint64_t current_ip_index = (s->current - 1) >> s->bits_for_port;
-	uint16_t candidate_port = extract_port(s->current - 1, s->bits_for_port);
-	if (current_ip_index < zsend.max_ip_index && candidate_port < zconf.ports->port_count) {
-		return;
+	if (zsend.list_of_ips) {
+		return zsend.list_of_ips[ip_index];
 	}
-	shard_get_next_target(s);
+	return blocklist_lookup_index(ip_index);
+}
+
+// Whether a group element maps onto an allowed (ip, port) pair
+static inline int shard_cyclic_valid(const shard_t *s, uint64_t elem)
+{
+	if (elem >= zsend.max_target_index) {
+		// We choose primes/moduli that are larger than the number of
+		// allowed targets, so some elements are out of bounds.
+		return 0;
+	}
+	uint64_t current_ip_index = (elem - 1) >> s->bits_for_port;
+	uint16_t candidate_port = extract_port(elem - 1, s->bits_for_port);
+	return current_ip_index < zsend.max_ip_index &&
+	       candidate_port < zconf.ports->port_count;
+}
+
+static inline target_t shard_cyclic_target(const shard_t *s, uint64_t elem)
+{
+	uint32_t ip = extract_ip(elem - 1, s->bits_for_port);
+	uint16_t port = extract_port(elem - 1, s->bits_for_port);
+	return (target_t){.ip = shard_lookup_ip(ip),
+			  .port = (uint16_t)zconf.ports->ports[port],
+			  .status = ZMAP_SHARD_OK};
+}
+
+static inline target_t shard_permutation_target(const shard_t *s)
+{
+	uint64_t v = permutation_get(s->perm, s->current - 1);
+	// Mixed-radix decoding of v into (ip index, port index)
+	uint32_t port_count = zconf.ports->port_count;
+	uint32_t ip = (uint32_t)(v / port_count);
+	uint16_t port = (uint16_t)(v % port_count);
+	return (target_t){.ip = shard_lookup_ip(ip),
+			  .port = zconf.ports->ports[port],
+			  .status = ZMAP_SHARD_OK};
+}
+
+// Claims the chunk at the head (owner) or tail (thief) of a shard's queue.
+static const shard_chunk_t *shard_claim_chunk(shard_t *s, int from_tail)
+{
+	uint64_t range = __atomic_load_n(&s->chunk_range, __ATOMIC_ACQUIRE);
+	while (1) {
+		uint32_t head = (uint32_t)(range >> 32);
+		uint32_t tail = (uint32_t)range;
+		if (head >= tail) {
+			return NULL;
+		}
+		uint32_t idx = from_tail ? tail - 1 : head;
+		uint64_t next = from_tail ? range - 1 : range + (1ULL << 32);
+		if (__atomic_compare_exchange_n(&s->chunk_range, &range, next,
+						1, __ATOMIC_ACQ_REL,
+						__ATOMIC_ACQUIRE)) {
+			return &s->chunks[idx];
+		}
+	}
+}
+
+// Moves the shard onto its next chunk, stealing one from a peer once its own
+// are gone. Returns 0 and marks the shard done if there is no work left.
+static int shard_take_chunk(shard_t *s)
+{
+	const shard_chunk_t *c = shard_claim_chunk(s, 0);
+	// Chunks are never added back, so once every queue has been seen
+	// empty there is nothing left to steal.
+	for (uint8_t i = 1; !c && i < s->num_peers; i++) {
+		shard_t *victim = &s->peers[(s->thread_id + i) % s->num_peers];
+		c = shard_claim_chunk(victim, 1);
+		if (c) {
+			// only written here, read by the monitor
+			__atomic_store_n(&s->chunks_stolen,
+					 s->chunks_stolen + 1,
+					 __ATOMIC_RELAXED);
+		}
+	}
+	if (!c) {
+		s->current = ZMAP_SHARD_DONE;
+		return 0;
+	}
+	s->params.first = c->first;
+	s->params.last = c->last;
+	// Permutation shards keep the position plus one in current, so that
+	// ZMAP_SHARD_DONE (0) never collides with a position. Group elements
+	// are never 0.
+	s->current = s->perm ? c->first + 1 : c->first;
+	return 1;
+}
+
+static void shard_set_common(shard_t *shard, uint32_t sub_idx,
+			     uint32_t num_subshards, uint8_t thread_idx,
+			     uint64_t max_total_targets, shard_complete_cb cb,
+			     void *arg)
+{
+	// Set the (thread) id
+	shard->thread_id = thread_idx;
+
+	// Set max_targets if applicable. Stealing moves work between threads,
+	// but each thread still stops at its own share, so the total remains
+	// exact.
+	if (max_total_targets > 0) {
+		uint64_t max_targets_this_shard =
+		    max_total_targets / num_subshards;
+		if (sub_idx < (max_total_targets % num_subshards)) {
+			++max_targets_this_shard;
+		}
+		shard->state.max_targets = max_targets_this_shard;
+	}
+
+	// Set the callbacks
+	shard->cb = cb;
+	shard->arg = arg;
+
+	// Until shard_set_peers() is called, only our own chunks are used
+	shard->peers = NULL;
+	shard->num_peers = 0;
+	shard->chunks_stolen = 0;
+	shard->chunk_range = shard->num_chunks;
+	shard->current = ZMAP_SHARD_DONE;
+}
+
+static uint32_t shard_num_chunks(uint64_t len)
+{
+	return len < SHARD_MAX_CHUNKS ? (uint32_t)len : SHARD_MAX_CHUNKS;
 }
 
 void shard_init(shard_t *shard, uint16_t shard_idx, uint16_t num_shards,
@@ -74,84 +196,159 @@ void shard_init(shard_t *shard, uint16_t shard_idx, uint16_t num_shards,
 	// Let e_b = floor(Q / S) * i
 	uint64_t exponent_begin = (num_elts / num_subshards) * sub_idx;
 
-	// The stopping exponent is the first element of the next shard.
+	// The stopping exponent is the first element of the next shard. The
+	// last subshard runs up to Q, which wraps around to the first element
+	// of subshard 0.
 	//
-	//     e_e = floor(Q / S) * ((i + 1) % S)
-	uint64_t exponent_end =
-	    (num_elts / num_subshards) * ((sub_idx + 1) % num_subshards);
+	//     e_e = floor(Q / S) * (i + 1)
+	uint64_t exponent_end = (sub_idx + 1 == num_subshards)
+				    ? num_elts
+				    : (num_elts / num_subshards) * (sub_idx + 1);
 
-	// We actually offset the begin and end of each cycle. Given an offset
-	// k, shift each exponent by k modulo Q.
-	exponent_begin = (exponent_begin + cycle->offset) % num_elts;
-	exponent_end = (exponent_end + cycle->offset) % num_elts;
+	// The subshard is split into chunks of consecutive exponents, which
+	// are the unit of work that threads steal from each other.
+	uint64_t len = exponent_end - exponent_begin;
+	shard->num_chunks = shard_num_chunks(len);
+	shard->chunks = xcalloc(shard->num_chunks, sizeof(shard_chunk_t));
 
 	// Multiprecision variants of everything above
-	mpz_t generator_m, exponent_begin_m, exponent_end_m, prime_m;
+	mpz_t generator_m, exponent_m, prime_m, elem_m;
 	mpz_init_set_ui(generator_m, cycle->generator);
-	mpz_init_set_ui(exponent_begin_m, exponent_begin);
-	mpz_init_set_ui(exponent_end_m, exponent_end);
+	mpz_init(exponent_m);
 	mpz_init_set_ui(prime_m, cycle->group->prime);
+	mpz_init(elem_m);
+
+	// Calculate the boundaries of each chunk as powers of g modulo p. We
+	// actually offset the begin and end of each cycle. Given an offset k,
+	// shift each exponent by k modulo Q.
+	for (uint32_t i = 0; i <= shard->num_chunks; i++) {
+		uint64_t exponent =
+		    exponent_begin + len * i / shard->num_chunks;
+		mpz_set_ui(exponent_m, (exponent + cycle->offset) % num_elts);
+		mpz_powm(elem_m, generator_m, exponent_m, prime_m);
+		uint64_t elem = (uint64_t)mpz_get_ui(elem_m);
+		if (i < shard->num_chunks) {
+			shard->chunks[i].first = elem;
+		}
+		if (i > 0) {
+			shard->chunks[i - 1].last = elem;
+		}
+	}
 
-	// Calculate the first and last points of the shard as powers of g
-	// modulo p.
-	mpz_t start_m, stop_m;
-	mpz_init(start_m);
-	mpz_init(stop_m);
-	mpz_powm(start_m, generator_m, exponent_begin_m, prime_m);
-	mpz_powm(stop_m, generator_m, exponent_end_m, prime_m);
-
-	// Pull the result out as a uint64_t
-	shard->params.first = (uint64_t)mpz_get_ui(start_m);
-	shard->params.last = (uint64_t)mpz_get_ui(stop_m);
 	shard->params.factor = cycle->generator;
 	shard->params.modulus = cycle->group->prime;
 	shard->bits_for_port = bits_for_port;
+	shard->perm = NULL;
 
-	// Set the shard at the beginning.
-	shard->current = shard->params.first;
-
-	// Set the (thread) id
-	shard->thread_id = thread_idx;
+	shard_set_common(shard, sub_idx, num_subshards, thread_idx,
+			 max_total_targets, cb, arg);
 
-	// Set max_targets if applicable
-	if (max_total_targets > 0) {
-		uint64_t max_targets_this_shard =
-		    max_total_targets / num_subshards;
-		if (sub_idx < (max_total_targets % num_subshards)) {
-			++max_targets_this_shard;
-		}
-		shard->state.max_targets = max_targets_this_shard;
+	// Set the shard at the beginning of its first chunk. If that isn't
+	// pointing to a valid index in the blocklist, find the first element
+	// that is.
+	if (shard_take_chunk(shard) &&
+	    !shard_cyclic_valid(shard, shard->current)) {
+		shard_get_next_target(shard);
 	}
 
-	// Set the callbacks
-	shard->cb = cb;
-	shard->arg = arg;
-
-	// If the beginning of a shard isn't pointing to a valid index in the
-	// blocklist, find the first element that is.
-	shard_roll_to_valid(shard);
-
 	// Clear everything
 	mpz_clear(generator_m);
-	mpz_clear(exponent_begin_m);
-	mpz_clear(exponent_end_m);
+	mpz_clear(exponent_m);
 	mpz_clear(prime_m);
-	mpz_clear(start_m);
-	mpz_clear(stop_m);
+	mpz_clear(elem_m);
+}
+
+void shard_init_permutation(shard_t *shard, uint16_t shard_idx,
+			    uint16_t num_shards, uint8_t thread_idx,
+			    uint8_t num_threads, uint64_t max_total_targets,
+			    const permutation_t *perm, shard_complete_cb cb,
+			    void *arg)
+{
+	assert(num_shards > 0);
+	assert(num_threads > 0);
+	assert(shard_idx < num_shards);
+	assert(thread_idx < num_threads);
+	uint32_t num_subshards = (uint32_t)num_shards * (uint32_t)num_threads;
+	uint64_t num_elts = perm->size;
+	assert(!max_total_targets || (num_subshards <= max_total_targets));
+	uint32_t sub_idx = shard_idx * num_threads + thread_idx;
+
+	// Every position of the permutation is a valid target, so subshards
+	// are plain contiguous ranges of positions. The first N % S subshards
+	// take one extra position each.
+	uint64_t per_subshard = num_elts / num_subshards;
+	uint64_t extra = num_elts % num_subshards;
+	uint64_t begin = per_subshard * sub_idx +
+			 (sub_idx < extra ? sub_idx : extra);
+	uint64_t len = per_subshard + (sub_idx < extra ? 1 : 0);
+
+	shard->num_chunks = shard_num_chunks(len);
+	shard->chunks = xcalloc(shard->num_chunks, sizeof(shard_chunk_t));
+	for (uint32_t i = 0; i < shard->num_chunks; i++) {
+		shard->chunks[i].first = begin + len * i / shard->num_chunks;
+		shard->chunks[i].last =
+		    begin + len * (i + 1) / shard->num_chunks;
+	}
+
+	shard->params.factor = 0;
+	shard->params.modulus = num_elts;
+	shard->bits_for_port = 0;
+	shard->perm = perm;
+
+	shard_set_common(shard, sub_idx, num_subshards, thread_idx,
+			 max_total_targets, cb, arg);
+	shard_take_chunk(shard);
+}
+
+void shard_set_peers(shard_t *shard, shard_t *peers, uint8_t num_peers)
+{
+	shard->peers = peers;
+	shard->num_peers = num_peers;
+}
+
+uint32_t shard_chunks_left(shard_t *shard)
+{
+	uint64_t range = __atomic_load_n(&shard->chunk_range, __ATOMIC_RELAXED);
+	uint32_t head = (uint32_t)(range >> 32);
+	uint32_t tail = (uint32_t)range;
+	return head < tail ? tail - head : 0;
+}
+
+void shard_stats_snapshot(shard_t *s, shard_stats_t *out)
+{
+	shard_stats_t *st = &s->stats;
+	uint32_t seq;
+	do {
+		seq = __atomic_load_n(&st->seq, __ATOMIC_ACQUIRE);
+		out->packets_sent =
+		    __atomic_load_n(&st->packets_sent, __ATOMIC_RELAXED);
+		out->targets_scanned =
+		    __atomic_load_n(&st->targets_scanned, __ATOMIC_RELAXED);
+		out->packets_failed =
+		    __atomic_load_n(&st->packets_failed, __ATOMIC_RELAXED);
+		out->iterations =
+		    __atomic_load_n(&st->iterations, __ATOMIC_RELAXED);
+		out->pacing_late_ps =
+		    __atomic_load_n(&st->pacing_late_ps, __ATOMIC_RELAXED);
+		out->pacing_waits =
+		    __atomic_load_n(&st->pacing_waits, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) ||
+		 seq != __atomic_load_n(&st->seq, __ATOMIC_RELAXED));
+	out->seq = seq;
 }
 
 target_t shard_get_cur_target(shard_t *shard)
 {
 	if (shard->current == ZMAP_SHARD_DONE) {
-		// shard_roll_to_valid() has rolled to the very end.
+		// shard_get_next_target() has rolled to the very end.
 		return (target_t){
 		    .ip = 0, .port = 0, .status = ZMAP_SHARD_DONE};
 	}
-	uint32_t ip = extract_ip(shard->current - 1, shard->bits_for_port);
-	uint16_t port = extract_port(shard->current - 1, shard->bits_for_port);
-	return (target_t){.ip = (uint32_t)blocklist_lookup_index(ip),
-			  .port = (uint16_t)zconf.ports->ports[port],
-			  .status = ZMAP_SHARD_OK};
+	if (shard->perm) {
+		return shard_permutation_target(shard);
+	}
+	return shard_cyclic_target(shard, shard->current);
 }
 
 static inline uint64_t shard_get_next_elem(shard_t *shard)
@@ -168,30 +365,33 @@ target_t shard_get_next_target(shard_t *shard)
 		    .ip = 0, .port = 0, .status = ZMAP_SHARD_DONE};
 	}
 	while (1) {
-		uint64_t candidate = shard_get_next_elem(shard);
-		if (candidate == shard->params.last) {
-			shard->current = ZMAP_SHARD_DONE;
-			shard->iterations++;
+		if (shard->perm) {
+			if (shard->current < shard->params.last) {
+				shard->current++;
+				shard->iterations++;
+				return shard_permutation_target(shard);
+			}
+		} else {
+			uint64_t candidate = shard_get_next_elem(shard);
+			if (candidate != shard->params.last) {
+				if (!shard_cyclic_valid(shard, candidate)) {
+					// re-roll
+					continue;
+				}
+				// Good candidate, proceed with it.
+				shard->iterations++;
+				return shard_cyclic_target(shard, candidate);
+			}
+		}
+		// This chunk is finished, move on to the next one. Its first
+		// element is a candidate as well.
+		shard->iterations++;
+		if (!shard_take_chunk(shard)) {
 			return (target_t){
 			    .ip = 0, .port = 0, .status = ZMAP_SHARD_DONE};
 		}
-		if (candidate >= zsend.max_target_index) {
-			// If the candidate is out of bounds, re-roll. This will happen since we choose primes/moduli that are
-			// larger than the number of allowed targets. The IP is bounded below by checking against zsend.max_ip_index.
-			continue;
-		}
-		// Good candidate, proceed with it.
-		uint32_t candidate_ip =
-		    extract_ip(candidate - 1, shard->bits_for_port);
-		uint16_t candidate_port =
-		    extract_port(candidate - 1, shard->bits_for_port);
-		if (candidate_ip < zsend.max_ip_index &&
-		    candidate_port < zconf.ports->port_count) {
-			shard->iterations++;
-			return (target_t){
-			    .ip = blocklist_lookup_index(candidate_ip),
-			    .port = zconf.ports->ports[candidate_port],
-			    .status = ZMAP_SHARD_OK};
+		if (shard->perm || shard_cyclic_valid(shard, shard->current)) {
+			return shard_get_cur_target(shard);
 		}
 	}
 }
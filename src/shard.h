@@ -11,14 +11,44 @@
 
 #include <stdint.h>
 
+#include "../lib/includes.h"
+
 #include "cyclic.h"
+#include "permutation.h"
 
 #define ZMAP_SHARD_DONE 0
 #define ZMAP_SHARD_OK 1
 
+// Upper bound on the number of chunks each subshard is split into. Threads
+// that run out of chunks steal from the others, so this bounds how unevenly
+// work can end up being distributed at the end of a scan.
+#define SHARD_MAX_CHUNKS 1024
+
 typedef void (*shard_complete_cb)(uint8_t id, void *arg);
 
-typedef struct shard {
+typedef struct shard_chunk {
+	uint64_t first;
+	uint64_t last;
+} shard_chunk_t;
+
+// Counters of a send thread as last published by it, see
+// shard_stats_publish() and shard_stats_snapshot().
+typedef struct shard_stats {
+	uint32_t seq;
+	uint64_t packets_sent;
+	uint64_t targets_scanned;
+	uint64_t packets_failed;
+	uint64_t iterations;
+	// total lateness of paced batches, and the number of them
+	uint64_t pacing_late_ps;
+	uint64_t pacing_waits;
+} shard_stats_t;
+
+// Shards are cache line aligned, and so are their chunk queue and published
+// stats, so that send threads never write to a line that another thread
+// writes to or that the monitor reads.
+typedef struct __attribute__((aligned(CACHE_LINE_SIZE))) shard {
+	// owned by the send thread
 	struct shard_state {
 		uint64_t packets_sent;
 		uint64_t targets_scanned;
@@ -27,6 +57,7 @@ typedef struct shard {
 		uint32_t packets_failed;
 		uint64_t first_scanned;
 	} state;
+	// bounds of the chunk currently being iterated
 	struct shard_params {
 		uint64_t first;
 		uint64_t last;
@@ -37,8 +68,26 @@ typedef struct shard {
 	uint64_t iterations;
 	uint8_t thread_id;
 	uint8_t bits_for_port;
+	// set when iterating over a permutation instead of a cyclic group;
+	// chunks then bound ranges of positions
+	const permutation_t *perm;
+	// chunks taken from peers, read by the monitor
+	uint32_t chunks_stolen;
+	// all subshards of this process, indexed by thread id
+	struct shard *peers;
+	uint8_t num_peers;
 	shard_complete_cb cb;
 	void *arg;
+	// chunks that have not been claimed yet. The owner takes them from the
+	// head and other threads steal from the tail; both ends are packed into
+	// chunk_range (head in the upper, tail in the lower 32 bits) so that a
+	// single compare-and-swap claims a chunk. It has a cache line of its
+	// own, shared only with the read-only chunk list, so that thieves do
+	// not contend with the owner's updates of its iteration state.
+	uint64_t chunk_range __attribute__((aligned(CACHE_LINE_SIZE)));
+	shard_chunk_t *chunks;
+	uint32_t num_chunks;
+	shard_stats_t stats __attribute__((aligned(CACHE_LINE_SIZE)));
 } shard_t;
 
 void shard_init(shard_t *shard, uint16_t shard_idx, uint16_t num_shards,
@@ -46,6 +95,43 @@ void shard_init(shard_t *shard, uint16_t shard_idx, uint16_t num_shards,
 		uint64_t max_total_targets, uint8_t bits_for_port,
 		const cycle_t *cycle, shard_complete_cb cb, void *arg);
 
+void shard_init_permutation(shard_t *shard, uint16_t shard_idx,
+			    uint16_t num_shards, uint8_t thread_idx,
+			    uint8_t num_threads, uint64_t max_total_targets,
+			    const permutation_t *perm, shard_complete_cb cb,
+			    void *arg);
+
+// Lets the shard steal chunks from peers once its own are depleted.
+void shard_set_peers(shard_t *shard, shard_t *peers, uint8_t num_peers);
+
+uint32_t shard_chunks_left(shard_t *shard);
+
+// Publishes the shard's counters for other threads. Must only be called by
+// the send thread that owns the shard, typically once per batch.
+static inline void shard_stats_publish(shard_t *s, uint64_t pacing_late_ps,
+				       uint64_t pacing_waits)
+{
+	shard_stats_t *st = &s->stats;
+	// seqlock: the sequence is odd while an update is in progress
+	uint32_t seq = st->seq;
+	__atomic_store_n(&st->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&st->packets_sent, s->state.packets_sent,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&st->targets_scanned, s->state.targets_scanned,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&st->packets_failed, s->state.packets_failed,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&st->iterations, s->iterations, __ATOMIC_RELAXED);
+	__atomic_store_n(&st->pacing_late_ps, pacing_late_ps,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&st->pacing_waits, pacing_waits, __ATOMIC_RELAXED);
+	__atomic_store_n(&st->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// Takes a consistent copy of the counters last published for the shard.
+void shard_stats_snapshot(shard_t *s, shard_stats_t *out);
+
 typedef struct target {
 	uint32_t ip;
 	uint16_t port;
@@ -14,6 +14,7 @@
 #include "../lib/includes.h"
 #include "../lib/logger.h"
 
+#include "send-linux.h"
 #include "state.h"
 
 sock_t get_socket(UNUSED uint32_t id)
@@ -31,6 +32,10 @@ sock_t get_socket(UNUSED uint32_t id)
 			  strerror(errno));
 	}
 	sock_t s;
+	memset(&s, 0, sizeof(s));
 	s.sock = sock;
+	if (zconf.send_method == SEND_METHOD_TX_RING) {
+		s.tx_ring = tx_ring_init(sock);
+	}
 	return s;
 }
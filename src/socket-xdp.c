@@ -0,0 +1,487 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#if !defined(__linux__)
+#error "XDP requires Linux"
+#endif
+
+#include "socket.h"
+#include "socket-xdp.h"
+
+#include "../lib/includes.h"
+#include "../lib/logger.h"
+#include "../lib/xalloc.h"
+#include "state.h"
+#include "probe_modules/probe_modules.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <linux/bpf.h>
+#include <linux/ethtool.h>
+#include <linux/if_xdp.h>
+#include <linux/sockios.h>
+
+#include <bpf/bpf.h>
+#include <xdp/xsk.h>
+
+const char *const XDP_MODE_NAMES[] = {"auto", "copy", "zerocopy"};
+
+#define XDP_INSN(c, d, s, o, i)                                          \
+	((struct bpf_insn){.code = (c),                                  \
+			   .dst_reg = (d),                               \
+			   .src_reg = (s),                               \
+			   .off = (o),                                   \
+			   .imm = (i)})
+
+// Which frames the XDP program hands to ZMap. Everything that does not
+// match is passed on to the kernel, so the host's own traffic keeps working
+// while ZMap is attached to the interface.
+struct xdp_match {
+	// IP protocols the probe module sends
+	int tcp;
+	int udp;
+	// the probe module only speaks ICMP, so all ICMP but the requests the
+	// kernel answers belongs to us
+	int icmp_only;
+	// TCP/UDP destination ports of responses, our source ports
+	int check_dst;
+	uint16_t dst_first;
+	uint16_t dst_last;
+	// TCP/UDP source ports of responses, the scanned ports
+	int check_src;
+	uint16_t src_first;
+	uint16_t src_last;
+};
+
+// Derive the match from the probe module the same way recv_bpf_filter
+// builds the kernel filter of the other backends. Both are supersets of what
+// the probe module accepts; validate_packet has the final word.
+static void xdp_match_init(struct xdp_match *m)
+{
+	memset(m, 0, sizeof(*m));
+	const char *filter = zconf.probe_module->pcap_filter;
+	m->tcp = filter && strstr(filter, "tcp") != NULL;
+	m->udp = filter && strstr(filter, "udp") != NULL;
+	m->icmp_only = !m->tcp && !m->udp;
+
+	uint8_t flags = zconf.probe_module->port_filter;
+	if (!(flags & PORT_FILTER_DST)) {
+		return;
+	}
+	m->check_dst = 1;
+	m->dst_first = zconf.source_port_first;
+	m->dst_last = zconf.source_port_last;
+	int src = zconf.validate_source_port_override ==
+		      VALIDATE_SRC_PORT_ENABLE_OVERRIDE ||
+		  ((flags & PORT_FILTER_SRC) &&
+		   zconf.validate_source_port_override !=
+		       VALIDATE_SRC_PORT_DISABLE_OVERRIDE);
+	if (src && zconf.ports->port_count > 0) {
+		m->check_src = 1;
+		m->src_first = 0xFFFF;
+		m->src_last = 0;
+		for (uint i = 0; i < zconf.ports->port_count; i++) {
+			uint16_t port = zconf.ports->ports[i];
+			if (port < m->src_first) {
+				m->src_first = port;
+			}
+			if (port > m->src_last) {
+				m->src_last = port;
+			}
+		}
+	}
+}
+
+#define XDP_PROG_MAX_INSNS 96
+
+enum xdp_label {
+	XDP_LABEL_PORTS,
+	XDP_LABEL_ICMP,
+	XDP_LABEL_REDIRECT,
+	XDP_LABEL_PASS,
+	XDP_NUM_LABELS
+};
+
+// A straight-line BPF program under construction. Jumps name a label and
+// are patched with the relative offset once every label is placed.
+struct xdp_prog {
+	struct bpf_insn insns[XDP_PROG_MAX_INSNS];
+	int len;
+	int labels[XDP_NUM_LABELS];
+	int fixups[XDP_PROG_MAX_INSNS];
+};
+
+static void xdp_emit(struct xdp_prog *p, struct bpf_insn insn)
+{
+	assert(p->len < XDP_PROG_MAX_INSNS);
+	p->fixups[p->len] = -1;
+	p->insns[p->len++] = insn;
+}
+
+// Emit the conditional jump *op* comparing *dst* against *imm*, or against
+// register *src* when it is not 0, to *target*.
+static void xdp_emit_jmp(struct xdp_prog *p, uint8_t op, uint8_t dst,
+			 uint8_t src, int32_t imm, enum xdp_label target)
+{
+	uint8_t code = BPF_JMP | op | (src ? BPF_X : BPF_K);
+	xdp_emit(p, XDP_INSN(code, dst, src, 0, imm));
+	p->fixups[p->len - 1] = target;
+}
+
+// Jump to *target* when *reg*, a port in host byte order, is outside
+// [first, last].
+static void xdp_emit_range(struct xdp_prog *p, uint8_t reg, uint16_t first,
+			   uint16_t last, enum xdp_label target)
+{
+	xdp_emit_jmp(p, BPF_JLT, reg, 0, first, target);
+	xdp_emit_jmp(p, BPF_JGT, reg, 0, last, target);
+}
+
+static void xdp_place(struct xdp_prog *p, enum xdp_label label)
+{
+	p->labels[label] = p->len;
+}
+
+// Advance *reg* from an IPv4 header to the header that follows it and make
+// sure the first *need* bytes there are inside the frame. Clobbers r4, r5.
+static void xdp_emit_skip_ip(struct xdp_prog *p, uint8_t reg, int need)
+{
+	xdp_emit(p, XDP_INSN(BPF_LDX | BPF_MEM | BPF_B, BPF_REG_5, reg, 0, 0));
+	xdp_emit(p, XDP_INSN(BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_5, 0, 0, 0xF));
+	xdp_emit(p, XDP_INSN(BPF_ALU64 | BPF_LSH | BPF_K, BPF_REG_5, 0, 0, 2));
+	xdp_emit_jmp(p, BPF_JLT, BPF_REG_5, 0, sizeof(struct ip), XDP_LABEL_PASS);
+	xdp_emit(p, XDP_INSN(BPF_ALU64 | BPF_ADD | BPF_X, reg, BPF_REG_5, 0, 0));
+	xdp_emit(p, XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, reg, 0, 0));
+	xdp_emit(p, XDP_INSN(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, need));
+	xdp_emit_jmp(p, BPF_JGT, BPF_REG_4, BPF_REG_3, 0, XDP_LABEL_PASS);
+}
+
+// Load the 16-bit port at *off* from *reg* into r4 in host byte order.
+static void xdp_emit_load_port(struct xdp_prog *p, uint8_t reg, int16_t off)
+{
+	xdp_emit(p, XDP_INSN(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_4, reg, off, 0));
+	xdp_emit(p, XDP_INSN(BPF_ALU | BPF_END | BPF_TO_BE, BPF_REG_4, 0, 0, 16));
+}
+
+// Load the XDP program that hands the probe module's responses received on
+// a queue to the queue's AF_XDP socket, and passes everything else (ARP,
+// IPv6, the host's own connections) on to the kernel. It is assembled from
+// raw instructions so that building ZMap does not require a BPF toolchain:
+//
+//	if (frame is not IPv4 or too short) goto pass
+//	r2 = start of the L4 header
+//	if (proto == TCP or UDP, if the probe sends it) goto ports
+//	if (proto == ICMP) goto icmp
+//	goto pass
+// ports:
+//	if (dport or sport outside the probe's ranges) goto pass
+//	goto redirect
+// icmp:
+//	ICMP-only probes: if (echo or timestamp request) goto pass
+//	otherwise: if (not an error, or the quoted probe's sport is outside
+//	           our source ports) goto pass
+// redirect:
+//	return bpf_redirect_map(xsks_map, ctx->rx_queue_index, XDP_PASS)
+// pass:
+//	return XDP_PASS
+static int xdp_load_prog(int map_fd, const struct xdp_match *m)
+{
+	struct xdp_prog p;
+	memset(&p, 0, sizeof(p));
+
+	// r6 = ctx, r2 = data, r3 = data_end
+	xdp_emit(&p, XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1,
+			      0, 0));
+	xdp_emit(&p, XDP_INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1,
+			      offsetof(struct xdp_md, data), 0));
+	xdp_emit(&p, XDP_INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_1,
+			      offsetof(struct xdp_md, data_end), 0));
+	xdp_emit(&p, XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2,
+			      0, 0));
+	xdp_emit(&p, XDP_INSN(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0,
+			      sizeof(struct ether_header) + sizeof(struct ip)));
+	xdp_emit_jmp(&p, BPF_JGT, BPF_REG_4, BPF_REG_3, 0, XDP_LABEL_PASS);
+	xdp_emit(&p, XDP_INSN(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_4, BPF_REG_2,
+			      offsetof(struct ether_header, ether_type), 0));
+	xdp_emit_jmp(&p, BPF_JNE, BPF_REG_4, 0, htons(ETHERTYPE_IP), XDP_LABEL_PASS);
+	// r7 = protocol, r2 = L4 header with at least 8 bytes
+	xdp_emit(&p, XDP_INSN(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0,
+			      sizeof(struct ether_header)));
+	xdp_emit(&p, XDP_INSN(BPF_LDX | BPF_MEM | BPF_B, BPF_REG_7, BPF_REG_2,
+			      offsetof(struct ip, ip_p), 0));
+	xdp_emit_skip_ip(&p, BPF_REG_2, 8);
+	if (m->tcp) {
+		xdp_emit_jmp(&p, BPF_JEQ, BPF_REG_7, 0, IPPROTO_TCP, XDP_LABEL_PORTS);
+	}
+	if (m->udp) {
+		xdp_emit_jmp(&p, BPF_JEQ, BPF_REG_7, 0, IPPROTO_UDP, XDP_LABEL_PORTS);
+	}
+	xdp_emit_jmp(&p, BPF_JEQ, BPF_REG_7, 0, IPPROTO_ICMP, XDP_LABEL_ICMP);
+	xdp_emit_jmp(&p, BPF_JA, 0, 0, 0, XDP_LABEL_PASS);
+
+	// TCP and UDP share the layout of the port fields
+	if (m->tcp || m->udp) {
+		xdp_place(&p, XDP_LABEL_PORTS);
+		if (m->check_dst) {
+			xdp_emit_load_port(&p, BPF_REG_2, 2);
+			xdp_emit_range(&p, BPF_REG_4, m->dst_first,
+				       m->dst_last, XDP_LABEL_PASS);
+		}
+		if (m->check_src) {
+			xdp_emit_load_port(&p, BPF_REG_2, 0);
+			xdp_emit_range(&p, BPF_REG_4, m->src_first,
+				       m->src_last, XDP_LABEL_PASS);
+		}
+		xdp_emit_jmp(&p, BPF_JA, 0, 0, 0, XDP_LABEL_REDIRECT);
+	}
+
+	xdp_place(&p, XDP_LABEL_ICMP);
+	xdp_emit(&p, XDP_INSN(BPF_LDX | BPF_MEM | BPF_B, BPF_REG_4, BPF_REG_2,
+			      0, 0));
+	if (m->icmp_only) {
+		// leave the requests the kernel answers to the kernel
+		xdp_emit_jmp(&p, BPF_JEQ, BPF_REG_4, 0, ICMP_ECHO, XDP_LABEL_PASS);
+		xdp_emit_jmp(&p, BPF_JEQ, BPF_REG_4, 0, ICMP_TIMESTAMP, XDP_LABEL_PASS);
+		xdp_emit_jmp(&p, BPF_JA, 0, 0, 0, XDP_LABEL_REDIRECT);
+	} else {
+		// only errors quote one of our probes
+		static const int32_t errors[] = {
+		    ICMP_UNREACH, ICMP_SOURCEQUENCH, ICMP_REDIRECT,
+		    ICMP_TIMXCEED, ICMP_PARAMPROB};
+		int n = sizeof(errors) / sizeof(errors[0]);
+		for (int i = 0; i < n; i++) {
+			// jump over the remaining checks and the goto pass
+			xdp_emit(&p, XDP_INSN(BPF_JMP | BPF_JEQ | BPF_K,
+					      BPF_REG_4, 0, n - i, errors[i]));
+		}
+		xdp_emit_jmp(&p, BPF_JA, 0, 0, 0, XDP_LABEL_PASS);
+		if (m->check_dst) {
+			// the quoted IP header and the ports after it
+			xdp_emit(&p, XDP_INSN(BPF_ALU64 | BPF_ADD | BPF_K,
+					      BPF_REG_2, 0, 0,
+					      ICMP_MINLEN));
+			xdp_emit(&p, XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_X,
+					      BPF_REG_4, BPF_REG_2, 0, 0));
+			xdp_emit(&p, XDP_INSN(BPF_ALU64 | BPF_ADD | BPF_K,
+					      BPF_REG_4, 0, 0,
+					      sizeof(struct ip)));
+			xdp_emit_jmp(&p, BPF_JGT, BPF_REG_4, BPF_REG_3, 0, XDP_LABEL_PASS);
+			xdp_emit_skip_ip(&p, BPF_REG_2, 4);
+			xdp_emit_load_port(&p, BPF_REG_2, 0);
+			xdp_emit_range(&p, BPF_REG_4, m->dst_first,
+				       m->dst_last, XDP_LABEL_PASS);
+		}
+	}
+
+	xdp_place(&p, XDP_LABEL_REDIRECT);
+	xdp_emit(&p, XDP_INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6,
+			      offsetof(struct xdp_md, rx_queue_index), 0));
+	xdp_emit(&p, XDP_INSN(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1,
+			      BPF_PSEUDO_MAP_FD, 0, map_fd));
+	xdp_emit(&p, XDP_INSN(0, 0, 0, 0, 0));
+	xdp_emit(&p, XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0,
+			      XDP_PASS));
+	xdp_emit(&p, XDP_INSN(BPF_JMP | BPF_CALL, 0, 0, 0,
+			      BPF_FUNC_redirect_map));
+	xdp_emit(&p, XDP_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+
+	xdp_place(&p, XDP_LABEL_PASS);
+	xdp_emit(&p, XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0,
+			      XDP_PASS));
+	xdp_emit(&p, XDP_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+
+	for (int i = 0; i < p.len; i++) {
+		if (p.fixups[i] >= 0) {
+			p.insns[i].off = p.labels[p.fixups[i]] - i - 1;
+		}
+	}
+	int fd = bpf_prog_load(BPF_PROG_TYPE_XDP, "zmap_xdp", "GPL", p.insns,
+			       p.len, NULL);
+	if (fd < 0) {
+		log_fatal("socket-xdp", "unable to load XDP program: %s",
+			  strerror(errno));
+	}
+	return fd;
+}
+
+uint32_t xdp_get_num_queues(char const *ifname)
+{
+	struct ethtool_channels channels;
+	memset(&channels, 0, sizeof(channels));
+	channels.cmd = ETHTOOL_GCHANNELS;
+	struct ifreq ifr;
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	ifr.ifr_data = (void *)&channels;
+
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		log_fatal("socket-xdp", "unable to create socket: %s",
+			  strerror(errno));
+	}
+	int rc = ioctl(fd, SIOCETHTOOL, &ifr);
+	close(fd);
+	if (rc < 0) {
+		// drivers without channel support have a single queue
+		log_debug("socket-xdp",
+			  "ETHTOOL_GCHANNELS failed on %s (%s), assuming one "
+			  "queue",
+			  ifname, strerror(errno));
+		return 1;
+	}
+	uint32_t num_queues = channels.combined_count;
+	if (num_queues == 0) {
+		num_queues = channels.rx_count < channels.tx_count
+				 ? channels.rx_count
+				 : channels.tx_count;
+	}
+	return num_queues ? num_queues : 1;
+}
+
+static int xdp_queue_bind(struct xdp_queue *q, uint16_t bind_flags)
+{
+	struct xsk_socket_config cfg;
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.rx_size = XDP_NUM_RX_FRAMES;
+	cfg.tx_size = XDP_NUM_TX_FRAMES;
+	// we attach our own program, see xdp_load_prog
+	cfg.libxdp_flags = XSK_LIBXDP_FLAGS__INHIBIT_PROG_LOAD;
+	cfg.bind_flags = bind_flags | XDP_USE_NEED_WAKEUP;
+	return xsk_socket__create(&q->xsk, zconf.iface, q->queue_id, q->umem,
+				  &q->rx, &q->tx, &cfg);
+}
+
+static struct xdp_queue *xdp_queue_create(uint32_t queue_id, int map_fd)
+{
+	struct xdp_queue *q = xcalloc(1, sizeof(struct xdp_queue));
+	q->queue_id = queue_id;
+	q->umem_len = (size_t)XDP_NUM_FRAMES * XDP_FRAME_SIZE;
+	q->umem_area = mmap(NULL, q->umem_len, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (q->umem_area == MAP_FAILED) {
+		log_fatal("socket-xdp", "unable to allocate UMEM: %s",
+			  strerror(errno));
+	}
+	struct xsk_umem_config umem_cfg = {
+	    .fill_size = XDP_NUM_RX_FRAMES,
+	    .comp_size = XDP_NUM_TX_FRAMES,
+	    .frame_size = XDP_FRAME_SIZE,
+	    .frame_headroom = XSK_UMEM__DEFAULT_FRAME_HEADROOM,
+	    .flags = XSK_UMEM__DEFAULT_FLAGS,
+	};
+	int rc = xsk_umem__create(&q->umem, q->umem_area, q->umem_len,
+				  &q->fill, &q->comp, &umem_cfg);
+	if (rc) {
+		log_fatal("socket-xdp", "unable to create UMEM for queue %u: %s",
+			  queue_id, strerror(-rc));
+	}
+
+	switch (zconf.xdp.mode) {
+	case XDP_MODE_ZEROCOPY:
+		rc = xdp_queue_bind(q, XDP_ZEROCOPY);
+		break;
+	case XDP_MODE_COPY:
+		rc = xdp_queue_bind(q, XDP_COPY);
+		break;
+	default:
+		// fall back to copy mode on drivers without zero-copy support
+		rc = xdp_queue_bind(q, XDP_ZEROCOPY);
+		if (rc) {
+			log_debug("socket-xdp",
+				  "zero-copy bind of queue %u failed (%s), "
+				  "retrying in copy mode",
+				  queue_id, strerror(-rc));
+			zconf.xdp.mode = XDP_MODE_COPY;
+			rc = xdp_queue_bind(q, XDP_COPY);
+		} else {
+			zconf.xdp.mode = XDP_MODE_ZEROCOPY;
+		}
+		break;
+	}
+	if (rc) {
+		log_fatal("socket-xdp",
+			  "unable to bind AF_XDP socket to %s queue %u: %s",
+			  zconf.iface, queue_id, strerror(-rc));
+	}
+	rc = xsk_socket__update_xskmap(q->xsk, map_fd);
+	if (rc) {
+		log_fatal("socket-xdp", "unable to add queue %u to xsks map: %s",
+			  queue_id, strerror(-rc));
+	}
+
+	// lend the RX part of the UMEM to the kernel
+	uint32_t idx;
+	if (xsk_ring_prod__reserve(&q->fill, XDP_NUM_RX_FRAMES, &idx) !=
+	    XDP_NUM_RX_FRAMES) {
+		log_fatal("socket-xdp", "unable to populate fill ring of queue %u",
+			  queue_id);
+	}
+	for (uint64_t i = 0; i < XDP_NUM_RX_FRAMES; i++) {
+		*xsk_ring_prod__fill_addr(&q->fill, idx++) = i * XDP_FRAME_SIZE;
+	}
+	xsk_ring_prod__submit(&q->fill, XDP_NUM_RX_FRAMES);
+
+	// and keep the TX part for the send thread
+	q->tx_free = xcalloc(XDP_NUM_TX_FRAMES, sizeof(uint64_t));
+	for (uint64_t i = 0; i < XDP_NUM_TX_FRAMES; i++) {
+		q->tx_free[i] = (XDP_NUM_RX_FRAMES + i) * XDP_FRAME_SIZE;
+	}
+	q->tx_free_len = XDP_NUM_TX_FRAMES;
+	return q;
+}
+
+void xdp_init(uint32_t num_queues)
+{
+	int ifindex = if_nametoindex(zconf.iface);
+	if (ifindex == 0) {
+		log_fatal("socket-xdp", "unable to find index of interface %s: %s",
+			  zconf.iface, strerror(errno));
+	}
+	zconf.xdp.map_fd = bpf_map_create(BPF_MAP_TYPE_XSKMAP, "zmap_xsks",
+					  sizeof(int), sizeof(int), num_queues,
+					  NULL);
+	if (zconf.xdp.map_fd < 0) {
+		log_fatal("socket-xdp", "unable to create xsks map: %s",
+			  strerror(errno));
+	}
+	struct xdp_match match;
+	xdp_match_init(&match);
+	zconf.xdp.prog_fd = xdp_load_prog(zconf.xdp.map_fd, &match);
+
+	zconf.xdp.queues = xcalloc(num_queues, sizeof(struct xdp_queue *));
+	for (uint32_t i = 0; i < num_queues; i++) {
+		zconf.xdp.queues[i] = xdp_queue_create(i, zconf.xdp.map_fd);
+	}
+	zconf.xdp.num_queues = num_queues;
+
+	// A bpf_link detaches the program automatically when ZMap exits,
+	// including when it is killed, so the host is never left with a
+	// program that redirects traffic to sockets that no longer exist.
+	zconf.xdp.link_fd =
+	    bpf_link_create(zconf.xdp.prog_fd, ifindex, BPF_XDP, NULL);
+	if (zconf.xdp.link_fd < 0) {
+		log_fatal("socket-xdp", "unable to attach XDP program to %s: %s",
+			  zconf.iface, strerror(errno));
+	}
+	log_info("socket-xdp", "AF_XDP bound to %s with %u queue pairs in %s mode",
+		 zconf.iface, num_queues, XDP_MODE_NAMES[zconf.xdp.mode]);
+}
+
+sock_t get_socket(uint32_t id)
+{
+	assert(id < zconf.xdp.num_queues);
+	sock_t sock;
+	sock.xdp.queue = zconf.xdp.queues[id];
+	return sock;
+}
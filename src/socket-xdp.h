@@ -0,0 +1,66 @@
+/*
+ * ZMap Copyright 2013 Regents of the University of Michigan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef ZMAP_SOCKET_XDP_H
+#define ZMAP_SOCKET_XDP_H
+
+// AF_XDP queue pairs shared by the XDP send and recv backends.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <xdp/xsk.h>
+
+#define XDP_MODE_AUTO 0
+#define XDP_MODE_COPY 1
+#define XDP_MODE_ZEROCOPY 2
+
+extern const char *const XDP_MODE_NAMES[];
+
+// UMEM geometry of a queue pair. The first XDP_NUM_RX_FRAMES frames are
+// lent to the kernel through the fill ring, the rest are owned by the send
+// thread and recycled through the completion ring.
+#define XDP_FRAME_SIZE 2048
+#define XDP_NUM_RX_FRAMES 2048
+#define XDP_NUM_TX_FRAMES 2048
+#define XDP_NUM_FRAMES (XDP_NUM_RX_FRAMES + XDP_NUM_TX_FRAMES)
+
+// One AF_XDP socket bound to a single NIC queue, with its own UMEM shared
+// between the RX and TX rings. The fill and RX rings are only touched by the
+// recv thread, the TX and completion rings only by the send thread bound to
+// the queue, if there is one, so no locking is required.
+struct xdp_queue {
+	uint32_t queue_id;
+	struct xsk_umem *umem;
+	struct xsk_socket *xsk;
+	void *umem_area;
+	size_t umem_len;
+	// recv side
+	struct xsk_ring_prod fill;
+	struct xsk_ring_cons rx;
+	// send side
+	struct xsk_ring_prod tx;
+	struct xsk_ring_cons comp;
+	uint64_t *tx_free;
+	uint32_t tx_free_len;
+};
+
+// Get the number of queues of an interface that can carry an AF_XDP socket
+// for both sending and receiving.
+//
+// *ifname* is the name of the interface.
+uint32_t xdp_get_num_queues(char const *ifname);
+
+// Load the XDP program, which redirects the probe module's responses and
+// passes all other traffic to the kernel, on zconf.iface and bind one queue
+// pair to each of the first *num_queues* NIC queues, honoring
+// zconf.xdp.mode. Responses on queues without a socket never reach ZMap, so
+// *num_queues* should be xdp_get_num_queues(zconf.iface). Exits on failure.
+void xdp_init(uint32_t num_queues);
+
+#endif /* ZMAP_SOCKET_XDP_H */
@@ -17,10 +17,17 @@
 #error "PFRING and NETMAP are mutually exclusive, only define one of them"
 #endif
 
+#if defined(XDP) && (defined(PFRING) || defined(NETMAP))
+#error "XDP is mutually exclusive with PFRING and NETMAP, only define one of them"
+#endif
+
 #ifdef PFRING
 #include <pfring_zc.h>
 #endif
 
+struct tx_ring;
+struct xdp_queue;
+
 typedef union {
 #ifdef PFRING
 	struct {
@@ -33,6 +40,16 @@ typedef union {
 		uint32_t tx_ring_idx;
 		int tx_ring_fd;
 	} nm;
+#elif defined(XDP)
+	struct {
+		struct xdp_queue *queue;
+	} xdp;
+#elif defined(__linux__)
+	struct {
+		int sock;
+		// mmap'd PACKET_TX_RING, NULL when sending with sendmmsg
+		struct tx_ring *tx_ring;
+	};
 #else
 	int sock;
 #endif
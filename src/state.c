@@ -10,6 +10,9 @@
 #include "../lib/logger.h"
 
 const char *const DEDUP_METHOD_NAMES[] = {"default", "none", "full", "window"};
+const char *const SEND_METHOD_NAMES[] = {"sendmmsg", "tx-ring"};
+const char *const ITERATOR_METHOD_NAMES[] = {"cyclic", "feistel"};
+const char *const OUTPUT_QUEUE_POLICY_NAMES[] = {"block", "drop"};
 
 // global configuration and defaults
 struct state_conf zconf = {
@@ -23,9 +26,13 @@ struct state_conf zconf = {
     .default_mode = 0,
     .dedup_method = 0,
     .dedup_window_size = 0,
+    .dedup_file = NULL,
+    .dedup_window_memory = 0,
     .dryrun = 0,
     .fast_dryrun = 0,
+    .verify_checksums = 0,
     .hw_mac = {0},
+    .iterator_method = ITERATOR_METHOD_CYCLIC,
     .hw_mac_set = 0,
     .gw_ip = 0,
     .gw_mac = {0},
@@ -33,6 +40,7 @@ struct state_conf zconf = {
     .iface = NULL,
     .list_of_ips_count = 0,
     .list_of_ips_filename = NULL,
+    .list_of_ips_format = 0,
     .log_directory = NULL,
     .log_file = NULL,
     .log_level = LOG_INFO,
@@ -51,7 +59,10 @@ struct state_conf zconf = {
     .output_fields_len = 0,
     .output_filename = NULL,
     .output_filter_str = NULL,
+    .output_flush = 0,
     .output_module = NULL,
+    .output_queue_size = 65536,
+    .output_queue_policy = OUTPUT_QUEUE_POLICY_BLOCK,
     .packet_streams = 1,
     .ports = NULL,
     .probe_args = NULL,
@@ -65,7 +76,11 @@ struct state_conf zconf = {
     .seed = 0,
     .seed_provided = 0,
     .senders = 1,
+    .receivers = 1,
     .send_ip_pkts = 0,
+    .send_method = SEND_METHOD_SENDMMSG,
+    .rx_ring_block_size = 1 << 20,
+    .rx_ring_blocks = 32,
     .source_port_first = 32768, // (these are the default
     .source_port_last = 61000,	//   ephemeral range on Linux),
     .status_updates_file = NULL,
@@ -85,8 +100,10 @@ struct state_send zsend = {
     .warmup = 1,
     .complete = 0,
     .sendto_failures = 0,
+    .tx_ring_stalls = 0,
     .max_targets = 0,
-    .list_of_ips_pbm = NULL,
+    .list_of_ips = NULL,
+    .list_of_ips_len = 0,
 };
 
 // global receiver stats and defaults
@@ -32,8 +32,24 @@
 
 extern const char *const DEDUP_METHOD_NAMES[];
 
+#define SEND_METHOD_SENDMMSG 0
+#define SEND_METHOD_TX_RING 1
+
+extern const char *const SEND_METHOD_NAMES[];
+
+#define ITERATOR_METHOD_CYCLIC 0
+#define ITERATOR_METHOD_FEISTEL 1
+
+extern const char *const ITERATOR_METHOD_NAMES[];
+
+#define OUTPUT_QUEUE_POLICY_BLOCK 0
+#define OUTPUT_QUEUE_POLICY_DROP 1
+
+extern const char *const OUTPUT_QUEUE_POLICY_NAMES[];
+
 struct probe_module;
 struct output_module;
+struct xdp_queue;
 
 struct fieldset_conf {
 	fielddefset_t defs;
@@ -73,6 +89,8 @@ struct state_conf {
 	int cooldown_secs;
 	// number of sending threads
 	uint8_t senders;
+	// number of receiving threads
+	uint8_t receivers;
 	uint16_t batch;
 	uint32_t pin_cores_len;
 	uint32_t *pin_cores;
@@ -81,6 +99,8 @@ struct state_conf {
 	int seed_provided;
 	uint64_t seed;
 	aesrand_t *aes;
+	// how the (ip, port) space is permuted, see ITERATOR_METHOD_*
+	int iterator_method;
 	// generator of the cyclic multiplicative group that is utilized for
 	// address generation
 	uint32_t generator;
@@ -91,6 +111,12 @@ struct state_conf {
 	struct probe_module *probe_module;
 	char *output_module_name;
 	struct output_module *output_module;
+	// per receive thread queue into the output stage, and what to do
+	// when it is full (OUTPUT_QUEUE_POLICY_*)
+	uint32_t output_queue_size;
+	int output_queue_policy;
+	// flush output after every result rather than buffering
+	int output_flush;
 	char *probe_args;
 	uint8_t probe_ttl;
 	char *output_args;
@@ -102,10 +128,19 @@ struct state_conf {
 	in_addr_t source_ip_addresses[256];
 	uint32_t number_source_ips;
 	int send_ip_pkts;
+	// how the Linux raw socket backend hands packets to the kernel
+	int send_method;
+	// geometry of the TPACKET_V3 receive ring of each receive thread
+	uint32_t rx_ring_block_size;
+	uint32_t rx_ring_blocks;
+	// also drop responses that fail port validation or the output filter
+	// in the kernel packet filter
+	int kernel_filter;
 	char *output_filename;
 	char *blocklist_filename;
 	char *allowlist_filename;
 	char *list_of_ips_filename;
+	int list_of_ips_format;
 	uint32_t list_of_ips_count;
 	char *metadata_filename;
 	FILE *metadata_file;
@@ -124,6 +159,7 @@ struct state_conf {
 	char *status_updates_file;
 	int dryrun;
 	int fast_dryrun;
+	int verify_checksums;
 	int quiet;
 	int ignore_invalid_hosts;
 	int syslog;
@@ -137,7 +173,13 @@ struct state_conf {
 	int default_mode;
 	int no_header_row;
 	int dedup_method;
+	// bitmap file shared by every scan that uses it, for full
+	// deduplication across processes and runs
+	char *dedup_file;
 	int dedup_window_size;
+	// bytes of memory for the window, which takes precedence over its
+	// size in entries
+	uint64_t dedup_window_memory;
 #ifdef PFRING
 	struct {
 		pfring_zc_cluster *cluster;
@@ -156,6 +198,16 @@ struct state_conf {
 		uint32_t wait_ping_dstip;
 	} nm;
 #endif
+#ifdef XDP
+	struct {
+		int mode;
+		int map_fd;
+		int prog_fd;
+		int link_fd;
+		uint32_t num_queues;
+		struct xdp_queue **queues;
+	} xdp;
+#endif
 };
 extern struct state_conf zconf;
 
@@ -172,9 +224,15 @@ struct state_send {
 	uint32_t first_scanned;
 	uint64_t max_targets;
 	uint32_t sendto_failures;
+	// number of times a sender found its TX ring full
+	uint64_t tx_ring_stalls;
 	uint32_t max_ip_index;
 	uint64_t max_target_index;
-	uint8_t **list_of_ips_pbm;
+	// sorted, deduplicated and allowed addresses from
+	// --list-of-ips-file (network order), indexed by the iterator in
+	// place of the blocklist
+	uint32_t *list_of_ips;
+	uint32_t list_of_ips_len;
 };
 extern struct state_send zsend;
 
@@ -215,6 +273,10 @@ struct state_recv {
 	uint64_t pcap_drop;
 	// number of packets dropped by the network interface or its driver.
 	uint64_t pcap_ifdrop;
+	// results discarded because the output stage could not keep up
+	uint64_t output_dropped;
+	// time receive threads spent waiting for room in the output queue
+	uint64_t output_stall_ns;
 };
 extern struct state_recv zrecv;
 
@@ -99,9 +99,14 @@ void json_metadata(FILE *file)
 			       json_object_new_int(zconf.cooldown_secs));
 	json_object_object_add(obj, "senders",
 			       json_object_new_int(zconf.senders));
+	json_object_object_add(obj, "receivers",
+			       json_object_new_int(zconf.receivers));
 	json_object_object_add(obj, "seed", json_object_new_int64(zconf.seed));
 	json_object_object_add(obj, "seed_provided",
 			       json_object_new_int64(zconf.seed_provided));
+	json_object_object_add(
+	    obj, "iterator",
+	    json_object_new_string(ITERATOR_METHOD_NAMES[zconf.iterator_method]));
 	json_object_object_add(obj, "generator",
 			       json_object_new_int64(zconf.generator));
 	json_object_object_add(obj, "hitrate", json_object_new_double(hitrate));
@@ -125,6 +130,15 @@ void json_metadata(FILE *file)
 			       json_object_new_int64(zrecv.pcap_drop));
 	json_object_object_add(obj, "pcap_ifdrop",
 			       json_object_new_int64(zrecv.pcap_ifdrop));
+	json_object_object_add(
+	    obj, "output_queue_policy",
+	    json_object_new_string(
+		OUTPUT_QUEUE_POLICY_NAMES[zconf.output_queue_policy]));
+	json_object_object_add(obj, "output_dropped",
+			       json_object_new_int64(zrecv.output_dropped));
+	json_object_object_add(obj, "output_stall_ms",
+			       json_object_new_int64(zrecv.output_stall_ns /
+						     1000000));
 
 	json_object_object_add(obj, "ip_fragments",
 			       json_object_new_int64(zrecv.ip_fragments));
@@ -304,10 +318,17 @@ void json_metadata(FILE *file)
 	json_object_object_add(
 	    obj, "deduplication_method",
 	    json_object_new_string(DEDUP_METHOD_NAMES[zconf.dedup_method]));
+	if (zconf.dedup_file) {
+		json_object_object_add(obj, "deduplication_file",
+				       json_object_new_string(zconf.dedup_file));
+	}
 	if (zconf.dedup_method == DEDUP_METHOD_WINDOW) {
 		json_object_object_add(
 		    obj, "deduplication_window_size",
 		    json_object_new_int(zconf.dedup_window_size));
+		json_object_object_add(
+		    obj, "deduplication_window_memory",
+		    json_object_new_int64(zconf.dedup_window_memory));
 	}
 
 	// parse out JSON metadata that was supplied on the command-line
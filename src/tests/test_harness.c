@@ -25,8 +25,11 @@
 
 #include "../lib/includes.h"
 #include "../lib/blocklist.h"
+#include "../lib/cachehash.h"
+#include "../lib/dedup_window.h"
 #include "../lib/logger.h"
 #include "../lib/random.h"
+#include "../lib/rbm.h"
 #include "../lib/util.h"
 #include "../lib/xalloc.h"
 
@@ -38,9 +41,12 @@
 #include "get_gateway.h"
 #include "filter.h"
 #include "summary.h"
+#include "ports.h"
+#include "validate.h"
 
 #include "output_modules/output_modules.h"
 #include "probe_modules/probe_modules.h"
+#include "probe_modules/packet.h"
 #include "output_modules/module_json.h"
 #include "ztopt.h"
 
@@ -67,6 +73,1183 @@ int test_recursive_fieldsets(void)
 	return EXIT_SUCCESS;
 }
 
+static const char *benchmark_filters[] = {
+    "success = 1 && repl_code != 0 && (sport = 80 || sport = 443)",
+    "classification = synack || classification = rst",
+    "(sport > 1024 && sport <= 2048) || repl_code = 3 || success = 1",
+    "saddr = 10.0.0.1 || saddr != 192.168.0.1 && success = 1",
+};
+
+#define BENCH_FIELDSETS 1024
+#define BENCH_ROUNDS 2000
+
+static double elapsed_ns(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e9 +
+	       (end->tv_nsec - start->tv_nsec);
+}
+
+int benchmark_filters_eval(void)
+{
+	static fielddefset_t defs = {
+	    .fielddefs = {{.name = "saddr", .type = "ip"},
+			  {.name = "success", .type = "bool"},
+			  {.name = "repl_code", .type = "int"},
+			  {.name = "sport", .type = "int"},
+			  {.name = "classification", .type = "string"}},
+	    .len = 5};
+	static const char *classifications[] = {"synack", "rst", "icmp"};
+	static const uint16_t ports[] = {80, 443, 22, 1500, 8080};
+	fieldset_t *fs[BENCH_FIELDSETS];
+	int mismatches = 0;
+	for (int i = 0; i < BENCH_FIELDSETS; i++) {
+		fs[i] = fs_new_fieldset(&defs);
+		fs_add_ipv4(fs[i], "saddr", htonl(0x0a000000 + i % 7));
+		fs_add_bool(fs[i], "success", i % 3 != 0);
+		fs_add_uint64(fs[i], "repl_code", i % 4);
+		fs_add_uint64(fs[i], "sport", ports[i % 5]);
+		fs_add_constchar(fs[i], "classification",
+				 classifications[i % 3]);
+	}
+	for (size_t f = 0;
+	     f < sizeof(benchmark_filters) / sizeof(benchmark_filters[0]);
+	     f++) {
+		char *filter = strdup(benchmark_filters[f]);
+		if (!parse_filter_string(filter) ||
+		    !validate_filter(zconf.filter.expression, &defs)) {
+			log_fatal("ztests", "invalid filter %s", filter);
+		}
+		node_t *tree = zconf.filter.expression;
+		filter_program_t *program = compile_filter(tree, &defs);
+		for (int i = 0; i < BENCH_FIELDSETS; i++) {
+			int expected = evaluate_expression(tree, fs[i]);
+			int actual = evaluate_program(program, fs[i]);
+			if (expected != actual) {
+				log_error("ztests",
+					  "%s: program returned %d on fieldset "
+					  "%d, tree returned %d",
+					  benchmark_filters[f], actual, i,
+					  expected);
+				mismatches++;
+			}
+		}
+		struct timespec start, mid, end;
+		volatile int sink = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int r = 0; r < BENCH_ROUNDS; r++) {
+			for (int i = 0; i < BENCH_FIELDSETS; i++) {
+				sink += evaluate_expression(tree, fs[i]);
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &mid);
+		for (int r = 0; r < BENCH_ROUNDS; r++) {
+			for (int i = 0; i < BENCH_FIELDSETS; i++) {
+				sink += evaluate_program(program, fs[i]);
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double n = (double)BENCH_ROUNDS * BENCH_FIELDSETS;
+		printf("%s\n\ttree: %.2f ns/eval, program (%d insns): %.2f "
+		       "ns/eval\n",
+		       benchmark_filters[f], elapsed_ns(&start, &mid) / n,
+		       program->len, elapsed_ns(&mid, &end) / n);
+		free(filter);
+	}
+	for (int i = 0; i < BENCH_FIELDSETS; i++) {
+		fs_free(fs[i]);
+	}
+	if (mismatches) {
+		log_error("ztests",
+			  "%d filter program results differ from the tree",
+			  mismatches);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+// Each response key arrives twice, the second time after at most a quarter
+// of the window, so an exact window would flag every second arrival.
+static void benchmark_dedup_size(uint64_t entries)
+{
+	uint64_t ops = 2 * entries;
+	uint64_t hit_window = 0, hit_cachehash = 0;
+	struct timespec start, mid, end;
+
+	dedup_window_t *w = dedup_window_init(entries * sizeof(uint64_t));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (uint64_t j = 0; j < ops; j++) {
+		uint64_t i = j / 2;
+		if (j & 1) {
+			i -= (i * 2654435761u) % (entries / 4 + 1) % (i + 1);
+		}
+		uint64_t k = i * 0x9e3779b97f4a7c15ULL;
+		hit_window += dedup_window_check(w, (uint32_t)(k >> 32),
+						 (uint16_t)k);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &mid);
+	dedup_window_free(w);
+
+	cachehash *ch = cachehash_init(entries, NULL);
+	struct timespec ch_start;
+	clock_gettime(CLOCK_MONOTONIC, &ch_start);
+	for (uint64_t j = 0; j < ops; j++) {
+		uint64_t i = j / 2;
+		if (j & 1) {
+			i -= (i * 2654435761u) % (entries / 4 + 1) % (i + 1);
+		}
+		uint64_t k = i * 0x9e3779b97f4a7c15ULL;
+		target_t t = {.ip = (uint32_t)(k >> 32),
+			      .port = (uint16_t)k,
+			      .status = 0};
+		if (cachehash_get(ch, &t, sizeof(target_t))) {
+			hit_cachehash++;
+		} else {
+			cachehash_put(ch, &t, sizeof(target_t), (void *)1);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	cachehash_free(ch, NULL);
+
+	printf("%llu entries\n"
+	       "\twindow: %.1f ns/op, %.2f%% of repeats found, %llu MB\n"
+	       "\tcachehash: %.1f ns/op, %.2f%% of repeats found\n",
+	       (unsigned long long)entries, elapsed_ns(&start, &mid) / ops,
+	       100.0 * hit_window / entries,
+	       (unsigned long long)(entries * sizeof(uint64_t)) >> 20,
+	       elapsed_ns(&ch_start, &end) / ops,
+	       100.0 * hit_cachehash / entries);
+}
+
+int benchmark_dedup(void)
+{
+	static const uint64_t sizes[] = {1000000, 10000000, 100000000};
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		benchmark_dedup_size(sizes[i]);
+	}
+	return EXIT_SUCCESS;
+}
+
+// Fills a single-bucket window and checks which entries CLOCK evicts, then
+// checks that a large window holds every key inserted into it at low load.
+int test_dedup_window(void)
+{
+	int failures = 0;
+	dedup_window_t *w = dedup_window_init(0);
+	if (dedup_window_capacity(w) != DEDUP_WINDOW_BUCKET_SLOTS) {
+		log_error("ztests", "window of 0 bytes holds %zu entries",
+			  dedup_window_capacity(w));
+		failures++;
+	}
+	// 0.0.0.0:0 is a valid key, and keys differing only by port differ
+	for (uint16_t k = 0; k < DEDUP_WINDOW_BUCKET_SLOTS; k++) {
+		failures += dedup_window_check(w, 0, k) != 0;
+	}
+	for (uint16_t k = 0; k < DEDUP_WINDOW_BUCKET_SLOTS; k++) {
+		failures += dedup_window_check(w, 0, k) != 1;
+	}
+	// Every entry is referenced, so inserting 8 clears them all in one
+	// lap and evicts 0. Seeing 2 again gives it a second chance: 9 then
+	// evicts 1, and 10 passes over 2 to evict 3.
+	failures += dedup_window_check(w, 0, 8) != 0;
+	failures += dedup_window_check(w, 0, 2) != 1;
+	failures += dedup_window_check(w, 0, 9) != 0;
+	failures += dedup_window_check(w, 0, 10) != 0;
+	static const uint16_t kept[] = {2, 4, 5, 6, 7, 8, 9, 10};
+	for (size_t i = 0; i < sizeof(kept) / sizeof(kept[0]); i++) {
+		if (dedup_window_check(w, 0, kept[i]) != 1) {
+			log_error("ztests", "CLOCK evicted %u", kept[i]);
+			failures++;
+		}
+	}
+	// checked last, since each miss inserts and evicts again
+	static const uint16_t evicted[] = {0, 1, 3};
+	for (size_t i = 0; i < sizeof(evicted) / sizeof(evicted[0]); i++) {
+		if (dedup_window_check(w, 0, evicted[i]) != 0) {
+			log_error("ztests", "CLOCK kept %u", evicted[i]);
+			failures++;
+		}
+	}
+	dedup_window_free(w);
+
+	w = dedup_window_init(1 << 20);
+	uint64_t n = dedup_window_capacity(w) / DEDUP_WINDOW_BUCKET_SLOTS;
+	for (uint64_t i = 0; i < n; i++) {
+		uint64_t k = i * 0x9e3779b97f4a7c15ULL;
+		if (dedup_window_check(w, (uint32_t)(k >> 32), (uint16_t)k)) {
+			log_error("ztests", "key %llu found before insert",
+				  (unsigned long long)i);
+			failures++;
+		}
+	}
+	uint64_t missing = 0;
+	for (uint64_t i = 0; i < n; i++) {
+		uint64_t k = i * 0x9e3779b97f4a7c15ULL;
+		missing += !dedup_window_check(w, (uint32_t)(k >> 32),
+					       (uint16_t)k);
+	}
+	if (missing) {
+		log_error("ztests", "%llu of %llu keys missing from the window",
+			  (unsigned long long)missing, (unsigned long long)n);
+		failures++;
+	}
+	dedup_window_free(w);
+
+	if (failures) {
+		log_error("ztests", "%d dedup window failures", failures);
+		return EXIT_FAILURE;
+	}
+	printf("dedup window: ok\n");
+	return EXIT_SUCCESS;
+}
+
+#define RBM_TEST_VALUES 6000
+
+// Fills one container past the 4096 values at which it turns from a sorted
+// array into a bitmap, checking the whole set after every insert around
+// the switch, then spreads pairs over enough containers to grow the table.
+int test_rbm(void)
+{
+	int failures = 0;
+	rbm_t *b = rbm_init();
+	uint32_t base = 0x0a000000;
+	for (uint32_t i = 0; i < RBM_TEST_VALUES; i++) {
+		// even values in scrambled order, so inserts land mid-array
+		uint32_t v = ((i * 40503) & 0x7FFF) * 2;
+		if (rbm_check(b, base + v, 80)) {
+			log_error("ztests", "value %u found before insert", v);
+			failures++;
+		}
+		rbm_set(b, base + v, 80);
+		rbm_set(b, base + v, 80);
+		if (rbm_count(b) != i + 1) {
+			log_error("ztests", "%llu values after %u inserts",
+				  (unsigned long long)rbm_count(b), i + 1);
+			failures++;
+		}
+		if (i < 4090 || i > 4100) {
+			continue;
+		}
+		for (uint32_t j = 0; j < RBM_TEST_VALUES; j++) {
+			uint32_t u = ((j * 40503) & 0x7FFF) * 2;
+			if (rbm_check(b, base + u, 80) != (j <= i)) {
+				log_error("ztests",
+					  "value %u wrong after %u inserts", u,
+					  i + 1);
+				failures++;
+			}
+		}
+	}
+	// odd values, the same /16 under another port, and the next /16
+	for (uint32_t v = 1; v < 0x10000; v += 2) {
+		failures += rbm_check(b, base + v, 80);
+	}
+	for (uint32_t i = 0; i < RBM_TEST_VALUES; i++) {
+		uint32_t v = ((i * 40503) & 0x7FFF) * 2;
+		failures += rbm_check(b, base + v, 81);
+		failures += rbm_check(b, base + 0x10000 + v, 80);
+	}
+	rbm_free(b);
+
+	b = rbm_init();
+	for (uint32_t i = 0; i < 5000; i++) {
+		rbm_set(b, i << 16 | (i & 0xFFFF), (uint16_t)(i % 7));
+	}
+	for (uint32_t i = 0; i < 5000; i++) {
+		failures += !rbm_check(b, i << 16 | (i & 0xFFFF),
+				       (uint16_t)(i % 7));
+		failures += rbm_check(b, i << 16 | ((i + 1) & 0xFFFF),
+				      (uint16_t)(i % 7));
+	}
+	if (rbm_count(b) != 5000) {
+		log_error("ztests", "%llu pairs in 5000 containers",
+			  (unsigned long long)rbm_count(b));
+		failures++;
+	}
+	rbm_free(b);
+
+	if (failures) {
+		log_error("ztests", "%d rbm failures", failures);
+		return EXIT_FAILURE;
+	}
+	printf("rbm: ok\n");
+	return EXIT_SUCCESS;
+}
+
+// The CSV writer as it was before rows were buffered, kept as the
+// reference that the csv output module must match byte for byte.
+static void csv_reference_row(FILE *file, fieldset_t *fs)
+{
+	for (int i = 0; i < fs->len; i++) {
+		field_t *f = &(fs->fields[i]);
+		if (i) {
+			fprintf(file, ",");
+		}
+		if (f->type == FS_STRING) {
+			if (strchr((char *)f->value.ptr, ',')) {
+				fprintf(file, "\"%s\"", (char *)f->value.ptr);
+			} else {
+				fprintf(file, "%s", (char *)f->value.ptr);
+			}
+		} else if (f->type == FS_IPV4) {
+			char buf[FS_IPV4_STRLEN];
+			fs_format_ipv4((uint32_t)f->value.num, buf);
+			fputs(buf, file);
+		} else if (f->type == FS_UINT64) {
+			fprintf(file, "%llu", (unsigned long long)f->value.num);
+		} else if (f->type == FS_BOOL) {
+			fprintf(file, "%i", (int)f->value.num);
+		} else if (f->type == FS_BINARY) {
+			for (size_t j = 0; j < f->len; j++) {
+				fprintf(file, "%02x",
+					((unsigned char *)f->value.ptr)[j]);
+			}
+		}
+	}
+	fprintf(file, "\n");
+}
+
+static char *read_file(const char *path, size_t *len)
+{
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		log_fatal("ztests", "unable to open %s: %s", path,
+			  strerror(errno));
+	}
+	fseek(f, 0, SEEK_END);
+	*len = (size_t)ftell(f);
+	rewind(f);
+	char *buf = xmalloc(*len + 1);
+	if (fread(buf, 1, *len, f) != *len) {
+		log_fatal("ztests", "unable to read %s", path);
+	}
+	fclose(f);
+	return buf;
+}
+
+// Shared fixture for the output module tests: the schema the module is
+// initialized with, temporary files, and the same record batches the
+// output stage hands over.
+
+static void output_test_schema(const char **fields, const char **types,
+			       int num_fields)
+{
+	memset(&zconf.fsconf.defs, 0, sizeof(zconf.fsconf.defs));
+	fielddefset_t *defs = &zconf.fsconf.defs;
+	for (int i = 0; i < num_fields; i++) {
+		defs->fielddefs[i] =
+		    (fielddef_t){.name = fields[i], .type = types[i]};
+	}
+	defs->len = num_fields;
+	zconf.fsconf.outdefs = *defs;
+}
+
+// path is a mkstemp template, which is replaced with the file's name.
+static void output_test_tempfile(char *path)
+{
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		log_fatal("ztests", "unable to create temporary file: %s",
+			  strerror(errno));
+	}
+	close(fd);
+}
+
+// Returns row i for output_test_run, which frees it.
+typedef fieldset_t *(*output_test_row_cb)(int i, void *arg);
+
+// Writes num_rows rows from make_row to path through the named output
+// module, from init to close.
+static void output_test_run(const char *name, char *path, const char **fields,
+			    int num_fields, int num_rows,
+			    output_test_row_cb make_row, void *arg)
+{
+	output_module_t *module = get_output_module_by_name(name);
+	zconf.output_filename = path;
+	module->init(&zconf, fields, num_fields);
+	record_batch_t batch;
+	record_batch_init(&batch, &zconf.fsconf.outdefs);
+	for (int i = 0; i < num_rows; i++) {
+		fieldset_t *fs = make_row(i, arg);
+		record_batch_add(&batch, fs);
+		fs_free(fs);
+		if (batch.len == RECORD_BATCH_SIZE || i == num_rows - 1) {
+			output_process_batch(module, &batch);
+			record_batch_clear(&batch);
+		}
+	}
+	record_batch_free(&batch);
+	module->close(&zconf, &zsend, &zrecv);
+}
+
+// Compares the module's output with the expected file. Both are removed
+// if they match and kept for inspection otherwise. Returns the length of
+// the output, or -1 if they differ.
+static ssize_t output_test_compare(const char *what, const char *actual_path,
+				   const char *expected_path)
+{
+	size_t expected_len, actual_len;
+	char *expected_buf = read_file(expected_path, &expected_len);
+	char *actual_buf = read_file(actual_path, &actual_len);
+	ssize_t ret = (ssize_t)actual_len;
+	if (expected_len != actual_len ||
+	    memcmp(expected_buf, actual_buf, expected_len)) {
+		size_t i = 0;
+		while (i < expected_len && i < actual_len &&
+		       expected_buf[i] == actual_buf[i]) {
+			i++;
+		}
+		log_error("ztests",
+			  "%s differs at byte %zu (%zu vs %zu bytes), see %s "
+			  "and %s",
+			  what, i, actual_len, expected_len, actual_path,
+			  expected_path);
+		ret = -1;
+	} else {
+		unlink(expected_path);
+		unlink(actual_path);
+	}
+	free(expected_buf);
+	free(actual_buf);
+	return ret;
+}
+
+#define CSV_GOLDEN_ROWS 100000
+
+// Writes the same rows through the csv output module and the reference
+// writer and compares the files.
+static fieldset_t *csv_golden_row(int i, void *arg)
+{
+	return ((fieldset_t **)arg)[i];
+}
+
+int test_csv_golden(void)
+{
+	static const char *strings[] = {
+	    "", "synack", "a,b", ",", "\"quoted\"", "has space",
+	    "tab\there", "line\nbreak", "\xc3\xa9t\xc3\xa9,", "trailing,"};
+	static const char *fields[] = {"saddr", "classification", "success",
+				       "sport", "data", "missing", "mixed"};
+	static const char *types[] = {"ip",	"string", "bool", "int",
+				      "binary", "string", "int"};
+	int num_fields = sizeof(fields) / sizeof(fields[0]);
+	output_test_schema(fields, types, num_fields);
+
+	fieldset_t **rows = xcalloc(CSV_GOLDEN_ROWS, sizeof(fieldset_t *));
+	uint8_t data[64];
+	for (int i = 0; i < CSV_GOLDEN_ROWS; i++) {
+		fieldset_t *fs = fs_new_fieldset(NULL);
+		fs_add_ipv4(fs, "saddr", (uint32_t)i * 2654435761u);
+		fs_add_constchar(fs, "classification",
+				 strings[i % (sizeof(strings) /
+					      sizeof(strings[0]))]);
+		fs_add_bool(fs, "success", i % 3 == 0);
+		fs_add_uint64(fs, "sport",
+			      (uint64_t)i * 0x9e3779b97f4a7c15ULL >> (i % 64));
+		for (size_t j = 0; j < sizeof(data); j++) {
+			data[j] = (uint8_t)(i * 31 + j * 7);
+		}
+		fs_add_binary(fs, "data", (size_t)(i % 65), data, 0);
+		fs_add_null(fs, "missing");
+		// a column whose values don't match its definition
+		if (i % 2) {
+			fs_add_uint64(fs, "mixed", (uint64_t)i);
+		} else {
+			fs_add_constchar(fs, "mixed", "not,an,int");
+		}
+		rows[i] = fs;
+	}
+
+	char expected_path[] = "/tmp/ztests-csv-expected-XXXXXX";
+	char actual_path[] = "/tmp/ztests-csv-actual-XXXXXX";
+	output_test_tempfile(expected_path);
+	output_test_tempfile(actual_path);
+
+	struct timespec start, mid, end;
+	FILE *expected = fopen(expected_path, "w");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < num_fields; i++) {
+		fprintf(expected, i ? ",%s" : "%s", fields[i]);
+	}
+	fprintf(expected, "\n");
+	for (int i = 0; i < CSV_GOLDEN_ROWS; i++) {
+		csv_reference_row(expected, rows[i]);
+		fflush(expected);
+	}
+	fclose(expected);
+	clock_gettime(CLOCK_MONOTONIC, &mid);
+
+	zconf.no_header_row = 0;
+	output_test_run("csv", actual_path, fields, num_fields,
+			CSV_GOLDEN_ROWS, csv_golden_row, rows);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	free(rows);
+
+	ssize_t len =
+	    output_test_compare("csv output", actual_path, expected_path);
+	if (len < 0) {
+		return EXIT_FAILURE;
+	}
+	printf("csv output matches reference (%zd bytes)\n"
+	       "\treference: %.1f ns/row, csv module: %.1f ns/row\n",
+	       len, elapsed_ns(&start, &mid) / CSV_GOLDEN_ROWS,
+	       elapsed_ns(&mid, &end) / CSV_GOLDEN_ROWS);
+	return EXIT_SUCCESS;
+}
+
+#define JSON_GOLDEN_ROWS 10000
+
+// A row with every field type, nested and repeated fields, strings that
+// need escaping and integers on both sides of 2^63.
+static fieldset_t *json_golden_row(int i)
+{
+	static const char *strings[] = {
+	    "", "synack", "\"quoted\"", "back\\slash", "a/b",
+	    "\b\f\n\r\t", "\x01\x1f\x7f", "\xc3\xa9t\xc3\xa9",
+	    "</script>"};
+	static const uint64_t numbers[] = {0,
+					   1,
+					   INT64_MAX,
+					   (uint64_t)INT64_MAX + 1,
+					   UINT64_MAX - 1,
+					   UINT64_MAX};
+	size_t num_strings = sizeof(strings) / sizeof(strings[0]);
+	size_t num_numbers = sizeof(numbers) / sizeof(numbers[0]);
+	fieldset_t *fs = fs_new_fieldset(NULL);
+	fs_add_ipv4(fs, "saddr", (uint32_t)i * 2654435761u);
+	fs_add_constchar(fs, "name", strings[i % num_strings]);
+	fs_add_bool(fs, "success", i % 3 == 0);
+	fs_add_uint64(fs, "sport",
+		      i % 2 ? numbers[i / 2 % num_numbers]
+			    : (uint64_t)i * 0x9e3779b97f4a7c15ULL);
+	size_t len = (size_t)(i % 65);
+	uint8_t *data = xmalloc(len + 1);
+	for (size_t j = 0; j < len; j++) {
+		data[j] = (uint8_t)(i * 31 + j * 7);
+	}
+	fs_add_binary(fs, "data", len, data, 1);
+	fs_add_null(fs, "missing");
+
+	fieldset_t *inner = fs_new_fieldset(NULL);
+	fs_add_constchar(inner, "name", strings[(i + 1) % num_strings]);
+	fs_add_null(inner, "missing");
+	fs_add_uint64(inner, "ttl", numbers[i % num_numbers]);
+	fieldset_t *answer = fs_new_fieldset(NULL);
+	fs_add_fieldset(answer, "inner", inner);
+	fs_add_fieldset(fs, "answer", answer);
+
+	fieldset_t *answers = fs_new_repeated_fieldset();
+	for (int j = 0; j < i % 4; j++) {
+		fieldset_t *a = fs_new_fieldset(NULL);
+		fs_add_constchar(a, "name", strings[(i + j) % num_strings]);
+		fs_add_bool(a, "valid", j % 2);
+		fs_add_fieldset(answers, NULL, a);
+	}
+	fs_add_repeated(fs, "answers", answers);
+	fieldset_t *ports = fs_new_repeated_uint64();
+	for (int j = 0; j < i % 5; j++) {
+		fs_add_uint64(ports, NULL, numbers[(i + j) % num_numbers]);
+	}
+	fs_add_repeated(fs, "ports", ports);
+	fieldset_t *names = fs_new_repeated_string(0);
+	for (int j = 0; j < i % 3; j++) {
+		fs_add_constchar(names, NULL, strings[(i * j) % num_strings]);
+	}
+	fs_add_repeated(fs, "names", names);
+	return fs;
+}
+
+// Also writes the row's json-c rendering to the expected file.
+static fieldset_t *json_golden_expected_row(int i, void *arg)
+{
+	fieldset_t *fs = json_golden_row(i);
+	json_object *obj = fs_to_jsonobj(fs);
+	fprintf((FILE *)arg, "%s\n",
+		json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN));
+	json_object_put(obj);
+	return fs;
+}
+
+// Writes the same rows through the json output module and json-c and
+// compares the files.
+int test_json_golden(void)
+{
+	static const char *fields[] = {"saddr",	 "name",   "success",
+				       "sport",	 "data",   "missing",
+				       "answer", "answers", "ports",
+				       "names"};
+	static const char *types[] = {"ip",	    "string",	"bool",
+				      "int",	    "binary",	"string",
+				      "fieldset", "repeated", "repeated",
+				      "repeated"};
+	int num_fields = sizeof(fields) / sizeof(fields[0]);
+	output_test_schema(fields, types, num_fields);
+
+	char expected_path[] = "/tmp/ztests-json-expected-XXXXXX";
+	char actual_path[] = "/tmp/ztests-json-actual-XXXXXX";
+	output_test_tempfile(expected_path);
+	output_test_tempfile(actual_path);
+
+	FILE *expected = fopen(expected_path, "w");
+	output_test_run("json", actual_path, fields, num_fields,
+			JSON_GOLDEN_ROWS, json_golden_expected_row, expected);
+	fclose(expected);
+
+	ssize_t len =
+	    output_test_compare("json output", actual_path, expected_path);
+	if (len < 0) {
+		return EXIT_FAILURE;
+	}
+	printf("json output matches json-c (%zd bytes)\n", len);
+	return EXIT_SUCCESS;
+}
+
+#define COLUMNAR_ROWS 5555
+#define COLUMNAR_BATCH_ROWS "1000"
+
+// Column types and encodings of the format described in
+// module_columnar.c.
+enum { ZCOL_UINT64 = 1, ZCOL_BOOL, ZCOL_IPV4, ZCOL_STRING, ZCOL_BINARY };
+enum { ZCOL_ENC_PLAIN, ZCOL_ENC_DICT };
+
+// A row whose fields don't always have the type of their column: success
+// is filled with bools, ints and nulls as probe modules do, sport gets
+// bools, and classification gets an int, which columnar output drops.
+static fieldset_t *columnar_row(int i)
+{
+	static const char *classifications[] = {"synack", "rst", "",
+						"a,b"};
+	fieldset_t *fs = fs_new_fieldset(NULL);
+	fs_add_ipv4(fs, "saddr", (uint32_t)i * 2654435761u);
+	if (i % 3 == 0) {
+		fs_add_bool(fs, "success", i % 2);
+	} else if (i % 3 == 1) {
+		fs_add_uint64(fs, "success", (uint64_t)(i % 4));
+	} else {
+		fs_add_null(fs, "success");
+	}
+	if (i % 7 == 0) {
+		fs_add_null(fs, "sport");
+	} else if (i % 4 == 0) {
+		fs_add_bool(fs, "sport", i % 8 == 0);
+	} else {
+		fs_add_uint64(fs, "sport", (uint64_t)i * 0x9e3779b97f4a7c15ULL);
+	}
+	if (i % 5 == 0) {
+		fs_add_uint64(fs, "classification", (uint64_t)i);
+	} else {
+		fs_add_constchar(fs, "classification",
+				 classifications[i % 4]);
+	}
+	// enough distinct values that the column drops its dictionary
+	char *banner = xmalloc(32);
+	snprintf(banner, 32, "banner %d", i);
+	fs_add_string(fs, "banner", banner, 1);
+	size_t len = (size_t)(i % 17);
+	uint8_t *data = xmalloc(len + 1);
+	for (size_t j = 0; j < len; j++) {
+		data[j] = (uint8_t)(i * 13 + j);
+	}
+	fs_add_binary(fs, "data", len, data, 1);
+	return fs;
+}
+
+// Also flushes now and then, as the output thread does when it is idle,
+// so that the file has partial batches too.
+static fieldset_t *columnar_test_row(int i, UNUSED void *arg)
+{
+	if (i % 2000 == 1999) {
+		get_output_module_by_name("columnar")->flush();
+	}
+	return columnar_row(i);
+}
+
+static const uint8_t *columnar_take(const uint8_t **p, const uint8_t *end,
+				    size_t n)
+{
+	if ((size_t)(end - *p) < n) {
+		log_fatal("ztests", "columnar file is truncated");
+	}
+	const uint8_t *data = *p;
+	*p += n;
+	return data;
+}
+
+static uint64_t columnar_le(const uint8_t *b, int n)
+{
+	uint64_t v = 0;
+	for (int i = n - 1; i >= 0; i--) {
+		v = v << 8 | b[i];
+	}
+	return v;
+}
+
+static uint32_t columnar_u32(const uint8_t **p, const uint8_t *end)
+{
+	return (uint32_t)columnar_le(columnar_take(p, end, 4), 4);
+}
+
+// A string column's dictionary, as read so far.
+typedef struct columnar_dict {
+	const uint8_t **values;
+	uint32_t *lens;
+	uint32_t len;
+} columnar_dict_t;
+
+// Decodes one column of a batch and checks it against the rows it was
+// written from. Returns the number of mismatches.
+static int columnar_check_column(const uint8_t **p, const uint8_t *end,
+				 int type, int col, columnar_dict_t *dict,
+				 fieldset_t **rows, int first,
+				 uint32_t num_rows)
+{
+	int enc = *columnar_take(p, end, 1);
+	const uint8_t *valid = columnar_take(p, end, (num_rows + 7) / 8);
+	const uint8_t *values = NULL, *bytes = NULL;
+	const uint8_t *offsets = NULL, *indices = NULL;
+	switch (type) {
+	case ZCOL_UINT64:
+		values = columnar_take(p, end, 8 * (size_t)num_rows);
+		break;
+	case ZCOL_BOOL:
+		values = columnar_take(p, end, (num_rows + 7) / 8);
+		break;
+	case ZCOL_IPV4:
+		values = columnar_take(p, end, 4 * (size_t)num_rows);
+		break;
+	case ZCOL_STRING:
+	case ZCOL_BINARY:
+		if (enc == ZCOL_ENC_DICT) {
+			uint32_t num_new = columnar_u32(p, end);
+			dict->values = xrealloc(
+			    dict->values,
+			    (dict->len + num_new) * sizeof(*dict->values));
+			dict->lens = xrealloc(
+			    dict->lens,
+			    (dict->len + num_new) * sizeof(*dict->lens));
+			for (uint32_t e = 0; e < num_new; e++) {
+				uint32_t len = columnar_u32(p, end);
+				dict->lens[dict->len] = len;
+				dict->values[dict->len++] =
+				    columnar_take(p, end, len);
+			}
+			indices = columnar_take(p, end, 4 * (size_t)num_rows);
+		} else {
+			offsets =
+			    columnar_take(p, end, 4 * ((size_t)num_rows + 1));
+			bytes = columnar_take(
+			    p, end, columnar_le(&offsets[4 * num_rows], 4));
+		}
+		break;
+	default:
+		log_fatal("ztests", "unknown columnar column type %d", type);
+	}
+	static const int fs_types[] = {
+	    [ZCOL_UINT64] = FS_UINT64, [ZCOL_BOOL] = FS_BOOL,
+	    [ZCOL_IPV4] = FS_IPV4,     [ZCOL_STRING] = FS_STRING,
+	    [ZCOL_BINARY] = FS_BINARY};
+	int numeric = type == ZCOL_UINT64 || type == ZCOL_BOOL;
+	int mismatches = 0;
+	for (uint32_t r = 0; r < num_rows; r++) {
+		field_t *f = &rows[r]->fields[col];
+		int expected = f->type == fs_types[type] ||
+			       (numeric && (f->type == FS_UINT64 ||
+					    f->type == FS_BOOL));
+		int ok = ((valid[r / 8] >> (r % 8)) & 1) == expected;
+		if (ok && expected) {
+			const uint8_t *v = NULL;
+			size_t len = 0;
+			uint32_t addr = (uint32_t)f->value.num;
+			switch (type) {
+			case ZCOL_UINT64:
+				ok = columnar_le(&values[8 * r], 8) ==
+				     f->value.num;
+				break;
+			case ZCOL_BOOL:
+				ok = ((values[r / 8] >> (r % 8)) & 1) ==
+				     !!f->value.num;
+				break;
+			case ZCOL_IPV4:
+				ok = !memcmp(&values[4 * r], &addr, 4);
+				break;
+			default:
+				if (indices) {
+					uint32_t e = (uint32_t)columnar_le(
+					    &indices[4 * r], 4);
+					ok = e < dict->len;
+					v = ok ? dict->values[e] : NULL;
+					len = ok ? dict->lens[e] : 0;
+				} else {
+					uint32_t start = (uint32_t)columnar_le(
+					    &offsets[4 * r], 4);
+					v = bytes + start;
+					len = columnar_le(&offsets[4 * r + 4],
+							  4) -
+					      start;
+				}
+				size_t expected_len =
+				    type == ZCOL_STRING
+					? strlen((char *)f->value.ptr)
+					: f->len;
+				ok = ok && len == expected_len &&
+				     !memcmp(v, f->value.ptr, len);
+			}
+		}
+		if (!ok) {
+			if (mismatches < 10) {
+				log_error("ztests",
+					  "columnar field %s differs in row %d",
+					  f->name, first + (int)r);
+			}
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+// Writes rows with mixed field types through the columnar output module,
+// reads the file back and compares every value with the rows.
+int test_columnar(void)
+{
+	static const char *fields[] = {"saddr",	       "success", "sport",
+				       "classification", "banner",  "data"};
+	static const char *types[] = {"ip",     "bool",   "int",
+				      "string", "string", "binary"};
+	int num_fields = sizeof(fields) / sizeof(fields[0]);
+	output_test_schema(fields, types, num_fields);
+
+	char path[] = "/tmp/ztests-columnar-XXXXXX";
+	output_test_tempfile(path);
+	static char batch_rows[] = COLUMNAR_BATCH_ROWS;
+	zconf.output_args = batch_rows;
+	output_test_run("columnar", path, fields, num_fields, COLUMNAR_ROWS,
+			columnar_test_row, NULL);
+	zconf.output_args = NULL;
+
+	size_t len;
+	char *buf = read_file(path, &len);
+	const uint8_t *p = (const uint8_t *)buf, *end = p + len;
+	if (memcmp(columnar_take(&p, end, 8), "ZMAPCOL", 8) ||
+	    columnar_u32(&p, end) != 1 ||
+	    columnar_u32(&p, end) != (uint32_t)num_fields) {
+		log_fatal("ztests", "bad columnar file header in %s", path);
+	}
+	int col_types[MAX_FIELDS];
+	for (int i = 0; i < num_fields; i++) {
+		const uint8_t *h = columnar_take(&p, end, 4);
+		col_types[i] = h[0];
+		size_t name_len = columnar_le(&h[2], 2);
+		if (name_len != strlen(fields[i]) ||
+		    memcmp(columnar_take(&p, end, name_len), fields[i],
+			   name_len)) {
+			log_fatal("ztests", "bad name for column %d in %s", i,
+				  path);
+		}
+	}
+	columnar_dict_t dicts[MAX_FIELDS];
+	memset(dicts, 0, sizeof(dicts));
+	fieldset_t **rows = xcalloc(COLUMNAR_ROWS, sizeof(fieldset_t *));
+	int mismatches = 0;
+	int seen = 0;
+	uint32_t num_rows;
+	while ((num_rows = columnar_u32(&p, end))) {
+		if (seen + num_rows > COLUMNAR_ROWS) {
+			log_fatal("ztests", "too many rows in %s", path);
+		}
+		for (uint32_t r = 0; r < num_rows; r++) {
+			rows[seen + r] = columnar_row(seen + (int)r);
+		}
+		for (int i = 0; i < num_fields; i++) {
+			mismatches += columnar_check_column(
+			    &p, end, col_types[i], i, &dicts[i], &rows[seen],
+			    seen, num_rows);
+		}
+		seen += num_rows;
+	}
+	if (seen != COLUMNAR_ROWS || p != end) {
+		log_error("ztests", "read %d of %d rows from %s", seen,
+			  COLUMNAR_ROWS, path);
+		mismatches++;
+	}
+	for (int i = 0; i < seen; i++) {
+		fs_free(rows[i]);
+	}
+	for (int i = 0; i < num_fields; i++) {
+		xfree(dicts[i].values);
+		xfree(dicts[i].lens);
+	}
+	free(rows);
+	free(buf);
+	if (mismatches) {
+		log_error("ztests", "%d columnar values differ, see %s",
+			  mismatches, path);
+		return EXIT_FAILURE;
+	}
+	printf("columnar output round trips %d rows\n", seen);
+	unlink(path);
+	return EXIT_SUCCESS;
+}
+
+// Responses built from a module's own probes. Replies must pass
+// validate_packet and invalid or foreign responses must not; ICMP errors
+// pass or not depending on the module.
+enum classify_case {
+	CLASSIFY_REPLY,
+	CLASSIFY_RST,
+	CLASSIFY_ERROR,
+	CLASSIFY_INVALID,
+	CLASSIFY_FOREIGN_PROTO,
+	CLASSIFY_FOREIGN_ICMP,
+	CLASSIFY_NUM_CASES
+};
+
+static const char *classify_case_names[] = {
+    "reply", "rst", "icmp error", "invalid", "foreign protocol",
+    "foreign icmp"};
+
+#define CLASSIFY_PROBES 1000
+
+// Turns the probe frame into a response of the given kind and returns its
+// length.
+static uint32_t classify_make_response(uint8_t *out, const uint8_t *probe,
+				       size_t probe_len, int kind)
+{
+	memcpy(out, probe, sizeof(struct ether_header));
+	const struct ip *probe_ip =
+	    (const struct ip *)(probe + sizeof(struct ether_header));
+	struct ip *ip = (struct ip *)(out + sizeof(struct ether_header));
+	size_t ip_len = probe_len - sizeof(struct ether_header);
+	if (kind == CLASSIFY_ERROR) {
+		// port unreachable from the target, quoting the probe
+		size_t quoted = 4 * probe_ip->ip_hl + 8;
+		memcpy(ip, probe_ip, sizeof(struct ip));
+		ip->ip_hl = 5;
+		ip->ip_p = IPPROTO_ICMP;
+		ip->ip_src = probe_ip->ip_dst;
+		ip->ip_dst = probe_ip->ip_src;
+		struct icmp *icmp = (struct icmp *)&ip[1];
+		memset(icmp, 0, ICMP_HEADER_SIZE);
+		icmp->icmp_type = ICMP_UNREACH;
+		icmp->icmp_code = ICMP_UNREACH_PORT;
+		memcpy((uint8_t *)icmp + ICMP_HEADER_SIZE, probe_ip, quoted);
+		ip_len = sizeof(struct ip) + ICMP_HEADER_SIZE + quoted;
+		ip->ip_len = htons((uint16_t)ip_len);
+		return (uint32_t)(sizeof(struct ether_header) + ip_len);
+	}
+	memcpy(ip, probe_ip, ip_len);
+	ip->ip_src = probe_ip->ip_dst;
+	ip->ip_dst = probe_ip->ip_src;
+	uint8_t *l4 = (uint8_t *)ip + 4 * ip->ip_hl;
+	if (ip->ip_p == IPPROTO_TCP) {
+		struct tcphdr *tcp = (struct tcphdr *)l4;
+		uint16_t port = tcp->th_sport;
+		tcp->th_sport = tcp->th_dport;
+		tcp->th_dport = port;
+		uint32_t ack = ntohl(tcp->th_seq) + 1;
+		if (kind == CLASSIFY_INVALID) {
+			ack += 7;
+		}
+		tcp->th_ack = htonl(ack);
+		tcp->th_seq = htonl(0x5a5a5a5a);
+		tcp->th_flags =
+		    kind == CLASSIFY_RST ? TH_RST | TH_ACK : TH_SYN | TH_ACK;
+	} else if (ip->ip_p == IPPROTO_UDP) {
+		struct udphdr *udp = (struct udphdr *)l4;
+		uint16_t port = udp->uh_sport;
+		udp->uh_sport = udp->uh_dport;
+		udp->uh_dport = port;
+		if (kind == CLASSIFY_INVALID) {
+			udp->uh_dport = htons(zconf.source_port_last + 1);
+		}
+	} else if (ip->ip_p == IPPROTO_ICMP) {
+		struct icmp *icmp = (struct icmp *)l4;
+		icmp->icmp_type = ICMP_ECHOREPLY;
+		if (kind == CLASSIFY_INVALID) {
+			icmp->icmp_seq ^= 0xFFFF;
+		}
+	}
+	if (kind == CLASSIFY_FOREIGN_PROTO) {
+		// the same bytes under a protocol the module doesn't send
+		ip->ip_p = ip->ip_p == IPPROTO_TCP ? IPPROTO_UDP : IPPROTO_TCP;
+	} else if (kind == CLASSIFY_FOREIGN_ICMP) {
+		// an echo request, as sent to the scanner by anyone
+		ip->ip_p = IPPROTO_ICMP;
+		memset(l4, 0, ICMP_HEADER_SIZE);
+		((struct icmp *)l4)->icmp_type = ICMP_ECHO;
+	}
+	return (uint32_t)probe_len;
+}
+
+// Returns the success (or app_success) field set by process_packet, -1 if
+// there is none.
+static int classify_field(fieldset_t *fs, const char *name)
+{
+	for (int i = 0; i < fs->len; i++) {
+		if (!strcmp(fs->fields[i].name, name)) {
+			return fs->fields[i].type == FS_NULL
+				   ? -1
+				   : !!fs->fields[i].value.num;
+		}
+	}
+	return -1;
+}
+
+// Checks one probe module's classify_packet against process_packet.
+// Returns the number of mismatches.
+static int test_classify_module(const char *name, const char *probe_args)
+{
+	probe_module_t *module = get_probe_module_by_name(name);
+	if (!module || !module->classify_packet) {
+		log_fatal("ztests", "no classify_packet in probe module %s",
+			  name);
+	}
+	zconf.probe_module = module;
+	zconf.probe_args = probe_args ? strdup(probe_args) : NULL;
+	if (module->global_initialize &&
+	    module->global_initialize(&zconf) != EXIT_SUCCESS) {
+		log_fatal("ztests", "unable to initialize probe module %s",
+			  name);
+	}
+	void *probe_data = NULL;
+	if (module->thread_initialize) {
+		module->thread_initialize(&probe_data);
+	}
+	static uint8_t probe[MAX_PACKET_SIZE];
+	module->prepare_packet(probe, zconf.hw_mac, zconf.gw_mac, probe_data);
+
+	int passed[CLASSIFY_NUM_CASES] = {0};
+	int seen[CLASSIFY_NUM_CASES] = {0};
+	int mismatches = 0;
+	struct timespec ts = {0, 0};
+	for (int i = 0; i < CLASSIFY_PROBES; i++) {
+		uint32_t src_ip = htonl(0x0a000001);
+		uint32_t dst_ip = htonl(0x0b000000 + (uint32_t)i * 7919);
+		// zmap scans port 0 for modules that take no target ports
+		uint16_t dst_port =
+		    module->port_args
+			? htons(zconf.ports->ports[i % zconf.ports->port_count])
+			: 0;
+		uint32_t validation[VALIDATE_BYTES / sizeof(uint32_t)];
+		validate_gen(src_ip, dst_ip, dst_port, (uint8_t *)validation);
+		size_t probe_len = 0;
+		module->make_packet(probe, &probe_len, src_ip, dst_ip, dst_port,
+				    64, validation, 0, (uint16_t)i, probe_data);
+		for (int kind = 0; kind < CLASSIFY_NUM_CASES; kind++) {
+			uint8_t bytes[MAX_PACKET_SIZE];
+			uint32_t len = classify_make_response(bytes, probe,
+							      probe_len, kind);
+			// validation as generated by the receive path
+			struct ip *ip =
+			    (struct ip *)(bytes + sizeof(struct ether_header));
+			uint32_t ip_len = len - sizeof(struct ether_header);
+			uint16_t sport = 0;
+			if (ip->ip_p == IPPROTO_TCP) {
+				struct tcphdr *tcp = get_tcp_header(ip, ip_len);
+				if (tcp) {
+					sport = tcp->th_sport;
+				}
+			} else if (ip->ip_p == IPPROTO_UDP) {
+				struct udphdr *udp = get_udp_header(ip, ip_len);
+				if (udp) {
+					sport = udp->uh_sport;
+				}
+			}
+			uint32_t resp_validation[VALIDATE_BYTES /
+						 sizeof(uint32_t)];
+			validate_gen(ip->ip_dst.s_addr, ip->ip_src.s_addr,
+				     sport, (uint8_t *)resp_validation);
+			uint32_t resp_src = ip->ip_src.s_addr;
+			seen[kind]++;
+			if (!module->validate_packet(ip, ip_len, &resp_src,
+						     resp_validation,
+						     zconf.ports)) {
+				continue;
+			}
+			passed[kind]++;
+			int classification = module->classify_packet(
+			    bytes, len, resp_validation);
+			fieldset_t *fs = fs_new_fieldset(NULL);
+			fs_add_ip_fields(fs, ip);
+			module->process_packet(bytes, len, fs, resp_validation,
+					       ts);
+			int success = classify_field(fs, "success");
+			int app_success = classify_field(fs, "app_success");
+			fs_free(fs);
+			if (success != !!(classification &
+					  PROBE_CLASSIFY_SUCCESS) ||
+			    (app_success >= 0 &&
+			     app_success != !!(classification &
+					       PROBE_CLASSIFY_APP_SUCCESS))) {
+				log_error("ztests",
+					  "%s: classify_packet returned %d for "
+					  "a %s response, process_packet set "
+					  "success=%d app_success=%d",
+					  name, classification,
+					  classify_case_names[kind], success,
+					  app_success);
+				mismatches++;
+			}
+		}
+	}
+	for (int kind = 0; kind < CLASSIFY_NUM_CASES; kind++) {
+		int expected = 0;
+		if (kind == CLASSIFY_REPLY || kind == CLASSIFY_RST) {
+			expected = seen[kind];
+		} else if (kind == CLASSIFY_ERROR) {
+			expected = passed[kind];
+		}
+		if (passed[kind] != expected) {
+			log_error("ztests",
+				  "%s: %d of %d %s responses passed "
+				  "validate_packet, expected %d",
+				  name, passed[kind], seen[kind],
+				  classify_case_names[kind], expected);
+			mismatches++;
+		}
+	}
+	printf("%s: classify_packet matches process_packet on %d responses "
+	       "(%d icmp errors)\n",
+	       name,
+	       passed[CLASSIFY_REPLY] + passed[CLASSIFY_RST] +
+		   passed[CLASSIFY_ERROR],
+	       passed[CLASSIFY_ERROR]);
+	if (module->close) {
+		module->close(&zconf, &zsend, &zrecv);
+	}
+	return mismatches;
+}
+
+// Feeds valid, invalid and foreign responses to every probe module with a
+// classify_packet callback and checks that it agrees with process_packet
+// on the responses validate_packet lets through.
+int test_classify(void)
+{
+	static char ports[] = "80,443,8080";
+	zconf.ports = xcalloc(1, sizeof(struct port_conf));
+	zconf.ports->port_bitmap = bm_init();
+	parse_ports(ports, zconf.ports);
+	zconf.source_port_first = 40000;
+	zconf.source_port_last = 40015;
+	zconf.packet_streams = 1;
+	zconf.validate_source_port_override = VALIDATE_SRC_PORT_UNSET_OVERRIDE;
+	if (blocklist_init(NULL, NULL, NULL, 0, NULL, 0, 0)) {
+		log_fatal("ztests", "unable to initialize blocklist");
+	}
+	validate_init();
+	zconf.aes = aesrand_init_from_seed(0x5eed);
+
+	int mismatches = 0;
+	mismatches += test_classify_module("tcp_synscan", NULL);
+	mismatches += test_classify_module("tcp_synackscan", NULL);
+	mismatches += test_classify_module("icmp_echoscan", NULL);
+	mismatches += test_classify_module("udp", "text:hello");
+	if (mismatches) {
+		log_error("ztests", "%d classify_packet mismatches",
+			  mismatches);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
 int main(UNUSED int argc, UNUSED char **argv)
 {
 	struct gengetopt_args_info args;
@@ -91,6 +1274,31 @@ int main(UNUSED int argc, UNUSED char **argv)
 		exit(EXIT_SUCCESS);
 	}
 
+	if (args.filter_benchmark_given) {
+		return benchmark_filters_eval();
+	}
+	if (args.dedup_benchmark_given) {
+		return benchmark_dedup();
+	}
+	if (args.dedup_window_given) {
+		return test_dedup_window();
+	}
+	if (args.rbm_given) {
+		return test_rbm();
+	}
+	if (args.csv_golden_given) {
+		return test_csv_golden();
+	}
+	if (args.json_golden_given) {
+		return test_json_golden();
+	}
+	if (args.columnar_given) {
+		return test_columnar();
+	}
+	if (args.classify_given) {
+		return test_classify();
+	}
+
 	for (int i = 0; i < 100000000; i++)
 		test_recursive_fieldsets();
 	return EXIT_SUCCESS;
@@ -37,6 +37,26 @@ void validate_gen(const uint32_t src, const uint32_t dst,
 	validate_gen_ex(src, dst, (uint32_t)dst_port, 0, output);
 }
 
+void validate_gen_batch(const uint32_t *src, const uint32_t *dst,
+			const uint16_t *dst_port, size_t n,
+			uint8_t output[][VALIDATE_BYTES])
+{
+	assert(aes128);
+
+	uint32_t aes_input[VALIDATE_BATCH][AES128_BLOCK_BYTES / sizeof(uint32_t)];
+	for (size_t done = 0; done < n; done += VALIDATE_BATCH) {
+		size_t len = n - done < VALIDATE_BATCH ? n - done : VALIDATE_BATCH;
+		for (size_t i = 0; i < len; i++) {
+			aes_input[i][0] = src[done + i];
+			aes_input[i][1] = dst[done + i];
+			aes_input[i][2] = (uint32_t)dst_port[done + i];
+			aes_input[i][3] = 0;
+		}
+		aes128_encrypt_blocks(aes128, (uint8_t *)aes_input,
+				      output[done], len);
+	}
+}
+
 void validate_gen_ex(const uint32_t input0, const uint32_t input1,
 		     const uint32_t input2, const uint32_t input3,
 		     uint8_t output[VALIDATE_BYTES])
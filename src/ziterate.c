@@ -210,6 +210,15 @@ int main(int argc, char **argv)
 		}
 	}
 	zconf.aes = aesrand_init_from_seed(conf.seed);
+	if (!strcmp(args.iterator_arg, "cyclic")) {
+		zconf.iterator_method = ITERATOR_METHOD_CYCLIC;
+	} else if (!strcmp(args.iterator_arg, "feistel")) {
+		zconf.iterator_method = ITERATOR_METHOD_FEISTEL;
+	} else {
+		log_fatal(
+		    "ziterate",
+		    "Invalid iterator provided. Legal options are: cyclic, feistel.");
+	}
 
 	zconf.ports = xmalloc(sizeof(struct port_conf));
 	if (args.target_ports_given) {
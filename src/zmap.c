@@ -72,6 +72,10 @@ static int64_t distrib_func(pfring_zc_pkt_buff *pkt, pfring_zc_queue *in_queue,
 #include <fcntl.h>
 #endif
 
+#ifdef XDP
+#include "socket-xdp.h"
+#endif
+
 pthread_mutex_t recv_ready_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 int get_num_cores(void)
@@ -192,6 +196,43 @@ static void network_config_init(void)
 		  zconf.gw_mac[3], zconf.gw_mac[4], zconf.gw_mac[5]);
 }
 
+static int compare_ips(const void *a, const void *b)
+{
+	uint32_t x = ntohl(*(const uint32_t *)a);
+	uint32_t y = ntohl(*(const uint32_t *)b);
+	return (x > y) - (x < y);
+}
+
+// Loads --list-of-ips-file into a sorted array of the unique addresses that
+// the blocklist allows. Sorting makes the array, and therefore the scan
+// order for a given seed, independent of the order of the file, so that
+// every shard sees the same list. Scanning the list costs the same however
+// small it is compared to the address space, unlike the bitmap filter this
+// replaced, so short lists need no warning.
+static void load_list_of_ips(void)
+{
+	uint32_t count;
+	uint32_t *ips = pbm_parse_file(zconf.list_of_ips_filename,
+				       zconf.list_of_ips_format, &count);
+	zconf.list_of_ips_count = count;
+	qsort(ips, count, sizeof(uint32_t), compare_ips);
+	uint32_t len = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		if (len && ips[len - 1] == ips[i]) {
+			continue;
+		}
+		if (!blocklist_is_allowed(ips[i])) {
+			continue;
+		}
+		ips[len++] = ips[i];
+	}
+	log_debug("zmap",
+		  "%u addresses in list of IPs, %u unique and allowed", count,
+		  len);
+	zsend.list_of_ips = ips;
+	zsend.list_of_ips_len = len;
+}
+
 static void start_zmap(void)
 {
 	// Initialization
@@ -571,15 +612,30 @@ int main(int argc, char *argv[])
 	zconf.ignore_invalid_hosts = args.ignore_blocklist_errors_given;
 	SET_BOOL(zconf.dryrun, dryrun);
 	SET_BOOL(zconf.fast_dryrun, fast_dryrun);
+	SET_BOOL(zconf.verify_checksums, verify_checksums);
+	if (zconf.verify_checksums && !zconf.dryrun && !zconf.fast_dryrun) {
+		log_fatal("zmap", "--verify-checksums requires --dryrun");
+	}
 	SET_BOOL(zconf.quiet, quiet);
 	SET_BOOL(zconf.no_header_row, no_header_row);
 	zconf.cooldown_secs = args.cooldown_time_arg;
 	SET_IF_GIVEN(zconf.output_filename, output_file);
 	SET_IF_GIVEN(zconf.blocklist_filename, blocklist_file);
 	SET_IF_GIVEN(zconf.list_of_ips_filename, list_of_ips_file);
+	if (!strcmp(args.list_of_ips_format_arg, "text")) {
+		zconf.list_of_ips_format = PBM_FORMAT_TEXT;
+	} else if (!strcmp(args.list_of_ips_format_arg, "binary")) {
+		zconf.list_of_ips_format = PBM_FORMAT_BINARY;
+	} else {
+		log_fatal(
+		    "zmap",
+		    "Invalid list of IPs format provided. Legal options are: text, binary.");
+	}
 	SET_IF_GIVEN(zconf.probe_args, probe_args);
 	SET_IF_GIVEN(zconf.probe_ttl, probe_ttl);
 	SET_IF_GIVEN(zconf.output_args, output_args);
+	zconf.output_flush = args.output_flush_given;
+	zconf.kernel_filter = args.kernel_filter_given;
 	SET_IF_GIVEN(zconf.iface, interface);
 	SET_IF_GIVEN(zconf.max_runtime, max_runtime);
 	SET_IF_GIVEN(zconf.max_results, max_results);
@@ -757,11 +813,15 @@ int main(int argc, char *argv[])
 			zconf.dedup_method = DEDUP_METHOD_FULL;
 		}
 	}
-	if (zconf.dedup_method == DEDUP_METHOD_FULL &&
-	    zconf.ports->port_count > 1) {
-		log_fatal(
-		    "dedup",
-		    "full response de-duplication is not supported for multiple ports");
+	if (args.dedup_file_given) {
+		if (zconf.dedup_method != DEDUP_METHOD_FULL ||
+		    zconf.ports->port_count > 1) {
+			log_fatal("dedup", "--dedup-file requires full "
+					   "deduplication of a single port");
+		}
+		zconf.dedup_file = args.dedup_file_arg;
+		log_info("dedup", "Responders are recorded in %s",
+			 zconf.dedup_file);
 	}
 	if (zconf.dedup_method == DEDUP_METHOD_WINDOW) {
 		if (args.dedup_window_size_given) {
@@ -769,10 +829,47 @@ int main(int argc, char *argv[])
 		} else {
 			zconf.dedup_window_size = 1000000;
 		}
+		if (args.dedup_window_memory_given) {
+			// Supported: G,g=*2^30; M,m=*2^20; K,k=*2^10 bytes
+			char *suffix = args.dedup_window_memory_arg;
+			zconf.dedup_window_memory = strtoull(suffix, &suffix, 10);
+			switch (*suffix) {
+			case '\0':
+				break;
+			case 'G':
+			case 'g':
+				zconf.dedup_window_memory <<= 30;
+				break;
+			case 'M':
+			case 'm':
+				zconf.dedup_window_memory <<= 20;
+				break;
+			case 'K':
+			case 'k':
+				zconf.dedup_window_memory <<= 10;
+				break;
+			default:
+				log_fatal("dedup",
+					  "unknown --dedup-window-memory suffix "
+					  "'%s' (supported suffixes are G, M and "
+					  "K)",
+					  suffix);
+			}
+			if (!zconf.dedup_window_memory) {
+				log_fatal("dedup",
+					  "--dedup-window-memory must be "
+					  "positive");
+			}
+		} else {
+			// each entry takes 8 bytes
+			zconf.dedup_window_memory =
+			    (uint64_t)zconf.dedup_window_size * sizeof(uint64_t);
+		}
 		log_info("dedup",
-			 "Response deduplication method is %s with size %u",
+			 "Response deduplication method is %s with %llu "
+			 "bytes of memory",
 			 DEDUP_METHOD_NAMES[zconf.dedup_method],
-			 zconf.dedup_window_size);
+			 (unsigned long long)zconf.dedup_window_memory);
 	} else {
 		log_info("dedup", "Response deduplication method is %s",
 			 DEDUP_METHOD_NAMES[zconf.dedup_method]);
@@ -813,6 +910,27 @@ int main(int argc, char *argv[])
 		    &zconf.fsconf.translation, &zconf.fsconf.defs,
 		    zconf.output_fields, zconf.output_fields_len);
 	}
+	// definitions of the fields the output module receives, in order
+	zconf.fsconf.outdefs.len = zconf.fsconf.translation.len;
+	for (int i = 0; i < zconf.fsconf.translation.len; i++) {
+		zconf.fsconf.outdefs.fielddefs[i] =
+		    zconf.fsconf.defs
+			.fielddefs[zconf.fsconf.translation.translation[i]];
+	}
+
+	if (args.output_queue_size_arg < 1) {
+		log_fatal("zmap", "--output-queue-size must be at least 1");
+	}
+	zconf.output_queue_size = args.output_queue_size_arg;
+	if (!strcmp(args.output_queue_policy_arg, "block")) {
+		zconf.output_queue_policy = OUTPUT_QUEUE_POLICY_BLOCK;
+	} else if (!strcmp(args.output_queue_policy_arg, "drop")) {
+		zconf.output_queue_policy = OUTPUT_QUEUE_POLICY_DROP;
+	} else {
+		log_fatal(
+		    "zmap",
+		    "Invalid output queue policy provided. Legal options are: block, drop.");
+	}
 
 	// default filtering behavior is to drop unsuccessful and duplicates
 	if (zconf.default_mode) {
@@ -830,6 +948,8 @@ int main(int argc, char *argv[])
 				     &zconf.fsconf.defs)) {
 			log_fatal("zmap", "Invalid filter");
 		}
+		zconf.filter.program = compile_filter(zconf.filter.expression,
+						      &zconf.fsconf.defs);
 		zconf.output_filter_str = args.output_filter_arg;
 		log_debug("filter", "will use output filter %s",
 			  args.output_filter_arg);
@@ -886,6 +1006,15 @@ int main(int argc, char *argv[])
 		zconf.seed_provided = 0;
 	}
 	zconf.aes = aesrand_init_from_seed(zconf.seed);
+	if (!strcmp(args.iterator_arg, "cyclic")) {
+		zconf.iterator_method = ITERATOR_METHOD_CYCLIC;
+	} else if (!strcmp(args.iterator_arg, "feistel")) {
+		zconf.iterator_method = ITERATOR_METHOD_FEISTEL;
+	} else {
+		log_fatal(
+		    "zmap",
+		    "Invalid iterator provided. Legal options are: cyclic, feistel.");
+	}
 
 	// Set up sharding
 	zconf.shard_num = 0;
@@ -946,12 +1075,56 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (args.rx_ring_block_size_given || args.rx_ring_blocks_given) {
+#ifndef TPACKET
+		log_fatal("recv", "the receive ring options are only available "
+				  "with the Linux raw socket backend");
+#endif
+	}
+	long page_size = sysconf(_SC_PAGESIZE);
+	if (args.rx_ring_block_size_arg < page_size ||
+	    args.rx_ring_block_size_arg % page_size ||
+	    (args.rx_ring_block_size_arg & (args.rx_ring_block_size_arg - 1))) {
+		log_fatal("recv", "--rx-ring-block-size must be a power of two "
+				  "and a multiple of the page size (%ld)",
+			  page_size);
+	}
+	if (args.rx_ring_blocks_arg < 1) {
+		log_fatal("recv", "--rx-ring-blocks must be at least 1");
+	}
+	zconf.rx_ring_block_size = args.rx_ring_block_size_arg;
+	zconf.rx_ring_blocks = args.rx_ring_blocks_arg;
+
 	if (args.batch_given && args.batch_arg >= 1 && args.batch_arg <= UINT16_MAX) {
 		zconf.batch = args.batch_arg;
 	} else if (args.batch_given) {
 		log_fatal("zmap", "batch size must be > 0 and <= 65535");
 	}
 
+	if (args.send_method_given) {
+		if (!strcmp(args.send_method_arg, "sendmmsg")) {
+			zconf.send_method = SEND_METHOD_SENDMMSG;
+		} else if (!strcmp(args.send_method_arg, "tx-ring")) {
+			zconf.send_method = SEND_METHOD_TX_RING;
+		} else {
+			log_fatal(
+			    "send",
+			    "Invalid send method provided. Legal options are: sendmmsg, tx-ring.");
+		}
+	}
+	if (zconf.send_method == SEND_METHOD_TX_RING) {
+#if defined(PFRING) || defined(NETMAP) || defined(XDP) || !defined(__linux__)
+		log_fatal("send", "the tx-ring send method is only available "
+				  "with the Linux raw socket backend");
+#endif
+		if (zconf.send_ip_pkts) {
+			log_fatal("send", "the tx-ring send method does not "
+					  "support IP layer mode (--iplayer/-X)");
+		}
+	}
+	log_debug("send", "send method is %s",
+		  SEND_METHOD_NAMES[zconf.send_method]);
+
 	if (args.max_targets_given) {
 		zconf.max_targets = parse_max_targets(args.max_targets_arg, zconf.ports->port_count);
 	}
@@ -962,12 +1135,10 @@ int main(int argc, char *argv[])
 			   NULL, 0, zconf.ignore_invalid_hosts)) {
 		log_fatal("zmap", "unable to initialize blocklist / allowlist");
 	}
-	// if there's a list of ips to scan, then initialize PBM and populate
-	// it based on the provided file
+	// if there's a list of ips to scan, the iterator walks over the
+	// addresses in that list instead of over the whole allowlist
 	if (zconf.list_of_ips_filename) {
-		zsend.list_of_ips_pbm = pbm_init();
-		zconf.list_of_ips_count = pbm_load_from_file(
-		    zsend.list_of_ips_pbm, zconf.list_of_ips_filename);
+		load_list_of_ips();
 	}
 
 	// compute number of targets
@@ -975,15 +1146,10 @@ int main(int argc, char *argv[])
 	zconf.total_allowed = allowed;
 	zconf.total_disallowed = blocklist_count_not_allowed();
 	assert(allowed <= (1LL << 32));
-	if (!zconf.total_allowed) {
+	if (!zconf.total_allowed ||
+	    (zconf.list_of_ips_filename && !zsend.list_of_ips_len)) {
 		log_fatal("zmap", "zero eligible addresses to scan");
 	}
-	if (zconf.list_of_ips_count > 0 &&
-	    0xFFFFFFFFU / zconf.list_of_ips_count > 100000) {
-		log_warn(
-		    "zmap",
-		    "list of IPs is small compared to address space. Performance will suffer, consider using an allowlist instead");
-	}
 	if (zconf.max_targets) {
 		zsend.max_targets = zconf.max_targets;
 	}
@@ -1065,6 +1231,23 @@ int main(int argc, char *argv[])
 	}
 #endif
 
+#ifdef XDP
+	if (zconf.send_ip_pkts) {
+		log_fatal("zmap", "AF_XDP does not support IP layer mode (--iplayer/-X)");
+	}
+	if (args.xdp_mode_given) {
+		if (!strcmp(args.xdp_mode_arg, "auto")) {
+			zconf.xdp.mode = XDP_MODE_AUTO;
+		} else if (!strcmp(args.xdp_mode_arg, "copy")) {
+			zconf.xdp.mode = XDP_MODE_COPY;
+		} else if (!strcmp(args.xdp_mode_arg, "zerocopy")) {
+			zconf.xdp.mode = XDP_MODE_ZEROCOPY;
+		} else {
+			log_fatal("zmap", "Invalid XDP mode provided. Legal options are: auto, copy, zerocopy.");
+		}
+	}
+#endif
+
 #ifndef PFRING
 	// Set the correct number of threads, default to min(4, number of cores on host - 1, as available)
 	if (args.sender_threads_given) {
@@ -1090,6 +1273,13 @@ int main(int argc, char *argv[])
 		zconf.senders = (int)zconf.nm.nm_if->ni_tx_rings;
 		log_debug("zmap", "capping to %i sender threads based on number of TX rings", zconf.senders);
 	}
+#endif
+#ifdef XDP
+	uint32_t xdp_queues = xdp_get_num_queues(zconf.iface);
+	if (zconf.senders > (int)xdp_queues) {
+		zconf.senders = (int)xdp_queues;
+		log_debug("zmap", "capping to %i sender threads based on number of NIC queues", zconf.senders);
+	}
 #endif
 	if (2 * zconf.senders >= zsend.max_targets) {
 		log_warn(
@@ -1116,6 +1306,29 @@ int main(int argc, char *argv[])
 	zconf.senders = args.sender_threads_arg;
 #endif
 
+	if (args.receiver_threads_arg < 1 ||
+	    args.receiver_threads_arg > MAX_RECEIVERS) {
+		log_fatal("zmap", "--receiver-threads must be between 1 and %d",
+			  MAX_RECEIVERS);
+	}
+	zconf.receivers = args.receiver_threads_arg;
+#if defined(PFRING) || defined(NETMAP) || defined(XDP) || !defined(__linux__)
+	if (zconf.receivers > 1) {
+		log_fatal("zmap", "multiple receive threads are only available "
+				  "with the Linux raw socket backend");
+	}
+#endif
+
+#ifdef XDP
+	// Bind one AF_XDP queue pair to every NIC queue, since RSS may steer
+	// responses to any of them; senders use the first zconf.senders. The
+	// recv thread polls the RX rings of all of them, so they have to exist
+	// before it starts.
+	if (!zconf.dryrun) {
+		xdp_init(xdp_get_num_queues(zconf.iface));
+	}
+#endif
+
 	// Figure out what cores to bind to
 	if (args.cores_given) {
 		const char **core_list = NULL;
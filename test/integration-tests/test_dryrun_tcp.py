@@ -3,6 +3,7 @@ import math
 import os
 import random
 import re
+import tempfile
 import time
 
 import zmap_wrapper
@@ -136,6 +137,24 @@ def test_full_coverage_of_subnet_with_shards():
         assert_subnet_scanned_correctly(ip_list, subnet, subnet_size)
 
 
+def test_full_coverage_of_subnet_with_shards_feistel():
+    """
+    the Feistel iterator splits the target space into exact ranges, so shards and threads together must cover every
+    (IP, port) pair exactly once
+    """
+    subnet = "174.189.0.0/22"
+    ports = ["80", "443"]
+    seed = 123
+    for shard_ct, threads in [(1, 1), (3, 1), (2, 4)]:
+        packet_list = []
+        for shard in range(shard_ct):
+            packet_list.extend(zmap_wrapper.Wrapper(subnet=subnet, port=",".join(ports), shard=shard, shards=shard_ct,
+                                                    threads=threads, seed=seed, iterator="feistel").run())
+        targets = [(packet["ip"]["daddr"], packet["tcp"]["dest"]) for packet in packet_list]
+        assert len(targets) == len(set(targets)), "scanned a target multiple times"
+        assert len(targets) == 1024 * len(ports), "did not scan every target"
+
+
 def assert_subnet_scanned_correctly(ip_list, subnet, subnet_size):
     """
     Asserts that the scanned IPs are unique, cover the subnet, and are not outside the subnet
@@ -437,6 +456,26 @@ def test_list_of_ips_option():
     os.remove("ips.txt")
 
 
+def test_list_of_ips_binary_format():
+    """
+    scan using a binary list of IPs, with duplicates, across threads and shards and ensure each IP is scanned once
+    """
+    ips = utils.write_ips_to_file(1000, "ips.txt")
+    os.remove("ips.txt")
+    with open("ips.bin", "wb") as f:
+        for ip in ips + ips[:100]:
+            f.write(ipaddress.IPv4Address(ip).packed)
+    actual_packet_ips = []
+    for shard in range(3):
+        packets = zmap_wrapper.Wrapper(threads=2, shards=3, shard=shard, seed=123, list_of_ips_file="ips.bin",
+                                       list_of_ips_format="binary").run()
+        actual_packet_ips.extend(packet["ip"]["daddr"] for packet in packets)
+    assert sorted(actual_packet_ips) == sorted(ips), "scanned IPs not in the list of IPs"
+
+    # cleanup
+    os.remove("ips.bin")
+
+
 """
 ---allowlist-file
 """
@@ -592,3 +631,41 @@ def test_max_targets_option():
         packets = zmap_wrapper.Wrapper(threads=1, max_targets=max_targets, port=ports).run()
         assert len(
             packets) == expected_num_ips, "incorrect number of packets sent for test with max_targets = " + max_targets + " and ports = " + ports
+
+
+## --verify-checksums
+def test_incremental_checksums_match_full_checksums():
+    """
+    zmap aborts with --verify-checksums if an incrementally updated checksum differs from a full recomputation, so all
+    packets are only printed if every checksum was correct
+    """
+    for threads in [1, 4]:
+        packets = zmap_wrapper.Wrapper(port="22,80,443", num_of_ips=1000, threads=threads, probes="2",
+                                       verify_checksums=True).run()
+        assert len(packets) == 2000
+
+
+def test_incremental_checksums_match_full_checksums_per_module():
+    """
+    same as above for every other probe module that updates its checksums incrementally. UDP checksums are left at 0,
+    so for the UDP based modules this checks the IP header, including the length of variable sized payloads
+    """
+    with tempfile.NamedTemporaryFile(mode="w", suffix=".pkt") as template:
+        template.write("${DADDR} ${SPORT} ${RAND_ALPHA=3}")
+        template.flush()
+        modules = [
+            ("tcp_synackscan", ""),
+            ("icmp_echoscan", ""),
+            ("icmp_echoscan", "text:odd"),
+            ("udp", "text:hello"),
+            ("udp", "template:" + template.name),
+            ("dns", "A,example.com"),
+            ("ntp", ""),
+            ("bacnet", ""),
+            ("upnp", ""),
+        ]
+        for probe_module, probe_args in modules:
+            packets = zmap_wrapper.Wrapper(port="53,123", num_of_ips=500, threads=2, probes="2",
+                                           verify_checksums=True, probe_module=probe_module,
+                                           probe_args=probe_args).run()
+            assert len(packets) == 1000, "checksum mismatch or missing packets with " + probe_module
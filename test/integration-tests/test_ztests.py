@@ -0,0 +1,21 @@
+import subprocess
+
+import pytest
+
+ZTESTS_PATH = "../../src/ztests"
+
+
+@pytest.mark.parametrize("check", [
+    "dedup-window",
+    "rbm",
+    "csv-golden",
+    "json-golden",
+    "columnar",
+    "classify",
+])
+def test_ztests(check):
+    """
+    run one of the ztests checks, which exits non-zero on failure
+    """
+    result = subprocess.run([ZTESTS_PATH, "--" + check], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    assert result.returncode == 0, result.stderr.decode("utf-8")
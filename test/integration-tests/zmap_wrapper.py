@@ -8,7 +8,8 @@ PACKET_SEP = "-" * 54
 class Wrapper:
     def __init__(self, port="80", subnet="", num_of_ips=-1, threads=-1, shards=-1, shard=-1, seed=-1, iplayer=False,
                  dryrun=True, output_file="", max_runtime=-1, max_cooldown=-1, blocklist_file="", allowlist_file="",
-                 list_of_ips_file="", probes="", source_ip="", source_port="", source_mac="", rate=-1, max_targets=""):
+                 list_of_ips_file="", probes="", source_ip="", source_port="", source_mac="", rate=-1, max_targets="",
+                 verify_checksums=False, iterator="", list_of_ips_format="", probe_module="", probe_args=""):
         self.port = port
         self.subnet = subnet
         self.num_of_ips = num_of_ips
@@ -30,6 +31,11 @@ class Wrapper:
         self.source_mac = source_mac
         self.rate = rate
         self.max_targets = max_targets
+        self.verify_checksums = verify_checksums
+        self.iterator = iterator
+        self.list_of_ips_format = list_of_ips_format
+        self.probe_module = probe_module
+        self.probe_args = probe_args
 
 
     def run(self):
@@ -63,6 +69,8 @@ class Wrapper:
             args.extend(["--allowlist-file=" + self.allowlist_file])
         if self.list_of_ips_file:
             args.extend(["--list-of-ips-file=" + self.list_of_ips_file])
+        if self.list_of_ips_format:
+            args.extend(["--list-of-ips-format=" + self.list_of_ips_format])
         if self.probes:
             args.extend(["--probes=" + self.probes])
         if self.source_ip:
@@ -75,6 +83,14 @@ class Wrapper:
             args.extend(["--rate=" + str(self.rate)])
         if self.max_targets != "":
             args.extend(["--max-targets=" + str(self.max_targets)])
+        if self.verify_checksums:
+            args.extend(["--verify-checksums"])
+        if self.iterator:
+            args.extend(["--iterator=" + self.iterator])
+        if self.probe_module:
+            args.extend(["--probe-module=" + self.probe_module])
+        if self.probe_args:
+            args.extend(["--probe-args=" + self.probe_args])
 
         test_output = subprocess.run(args, stdout=subprocess.PIPE).stdout.decode('utf-8')
         packets = parse_output_into_obj_list(test_output)